@@ -14,6 +14,7 @@ TEST_DIR := $(PROJECT_DIR)/test
 LIB_DIR := $(BUILD_DIR)/lib
 BIN_DIR := $(BUILD_DIR)/bin
 INCLUDE_DIR := $(BUILD_DIR)/include
+BENCH_DIR := $(BUILD_DIR)/bench
 
 LD_LIBRARY_PATH := $(LIB_DIR):/usr/local/lib
 
@@ -36,6 +37,10 @@ DEFINES += -DRSB2_BUILD_DATE=\"$(BUILD_DATE)\"
 SOURCES ?= $(wildcard *.c)
 HEADERS ?= $(wildcard *.h)
 TEST_SOURCES ?= $(wildcard test/*.c)
+TEST_CXX_SOURCES ?= $(wildcard test/*.cpp)
+BENCH_COMMON ?= $(wildcard bench/rsb2_bench.c)
+BENCH_SOURCES ?= $(filter-out $(BENCH_COMMON),$(wildcard bench/*.c))
+BENCH_RESULTS ?= $(BENCH_DIR)/results.jsonl
 INCLUDES += \
 	-I $(SRC_DIR)/rsb2/rsb2_libdemo \
 	-I $(SRC_DIR)/rsb2/rsb2_libzmq \
@@ -55,8 +60,13 @@ endif
 ifdef NDEBUG
 CFLAGS += -DNDEBUG
 endif
+ifdef TRACE_GROUPS
+CFLAGS += -DRSB2_TRACE_GROUPS=$(TRACE_GROUPS)
+endif
 CFLAGS += -fPIC -g $(DEFINES)
 CC ?= gcc
+CXXFLAGS += $(filter-out -std=%,$(CFLAGS)) -std=c++20
+CXX ?= g++
 
 #=== Paths. ===
 vpath %.so $(LIB_DIR)
@@ -66,14 +76,21 @@ vpath bin/%.bin $(BUILD_DIR)
 vpath test/%.bin $(PROJECT_DIR)
 
 #=== Targets. ===
-.PHONY: all dist test run clean
+.PHONY: all dist test run bench clean
 all: dist
 dist: $(TARGET)
-test: test/$(TEST_NAME).bin $(TEST_TARGET)
+test: test/$(TEST_NAME).bin $(TEST_CXX_SOURCES:%.cpp=%.bin) $(TEST_TARGET)
 run: tmp/$(TEST_NAME).run
+bench: $(BENCH_SOURCES:bench/%.c=$(BENCH_DIR)/%.bin)
+	@echo "$(BENCH_RESULTS): running benchmarks..."
+	$(RM) $(BENCH_RESULTS)
+	for prog in $^; do \
+		LD_LIBRARY_PATH=$(LD_LIBRARY_PATH) $$prog $(BENCH_ARGS) >> $(BENCH_RESULTS) || exit 1; \
+	done
 clean:
 	$(RM) $(BUILD_DIR)/$(TARGET)
 	$(RM) $(TEST_DIR)/$(TEST_NAME).bin
+	$(RM) $(TEST_CXX_SOURCES:test/%.cpp=$(TEST_DIR)/%.bin)
 	$(RM) $(TMP_DIR)/$(TEST_NAME)*
 
 #=== Rule for building a shared library. ===
@@ -90,12 +107,26 @@ bin/%.bin: $(SOURCES) $(HEADERS) $(DEPENDS)
 	@echo "$@: building program..."
 	$(CC) $(CFLAGS) -Wl,-rpath,'$${ORIGIN}'/../lib -o $(DIST_DIR)/$@ $(SOURCES) $(INCLUDES) $(LIBS)
 
+#=== Rule for building a C++ test program, one per source. ===
+test/%.bin: test/%.cpp $(HEADERS) $(DEPENDS)
+	@test -d $(TEST_DIR) || $(MKDIR) $(TEST_DIR)
+	@echo "$@: building test program..."
+	$(CXX) $(CXXFLAGS) -Wl,-rpath,'$${ORIGIN}'/../build/lib -o $(PROJECT_DIR)/$@ $< -I . $(INCLUDES) \
+		$(LIBS) -L$(LIB_DIR) $(TEST_LIBS)
+
 #=== Rule for building a test program. ===
 test/%.bin: $(TEST_SOURCES) $(HEADERS) $(DEPENDS)
 	@test -d $(TEST_DIR) || $(MKDIR) $(TEST_DIR)
 	@echo "$@: building test program..."
-	$(CC) $(CFLAGS) -Wl,-rpath,'$${ORIGIN}'/../dist/lib -o $(PROJECT_DIR)/$@ $(TEST_SOURCES) $(INCLUDES) $(LIBS) \
-		-L$(LIB_DIR) $(TEST_LIBS)
+	$(CC) $(CFLAGS) -Wl,-rpath,'$${ORIGIN}'/../build/lib -o $(PROJECT_DIR)/$@ $(TEST_SOURCES) -I . $(INCLUDES) \
+		$(LIBS) -L$(LIB_DIR) $(TEST_LIBS)
+
+#=== Rule for building a benchmark program. ===
+$(BENCH_DIR)/%.bin: bench/%.c $(BENCH_COMMON) $(HEADERS) $(TARGET)
+	@test -d $(BENCH_DIR) || $(MKDIR) $(BENCH_DIR)
+	@echo "$@: building benchmark program..."
+	$(CC) $(CFLAGS) -Wl,-rpath,'$${ORIGIN}'/../lib -o $@ $< $(BENCH_COMMON) -I . $(INCLUDES) \
+		-L$(LIB_DIR) $(BENCH_LIBS)
 
 #=== Rule for running a test program. ===
 tmp/%.run: test/%.bin
@@ -0,0 +1,219 @@
+/** Benchmark support - Implementation.
+ * @file bench/rsb2_bench.c
+ * @author jp.tranvouez@navilab.com
+ */
+#include "rsb2_bench.h"
+#include "rsb2_eventmgr.h"
+#include "rsb2_frame.h"
+#include "rsb2_module.h"
+#include "rsb2_socket.h"
+
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#ifndef RSB2_BUILD_VERSION
+#define RSB2_BUILD_VERSION ""
+#endif
+#ifndef RSB2_BUILD_CHECKSUM
+#define RSB2_BUILD_CHECKSUM ""
+#endif
+#ifndef RSB2_BUILD_HOST
+#define RSB2_BUILD_HOST ""
+#endif
+#ifndef RSB2_BUILD_DATE
+#define RSB2_BUILD_DATE ""
+#endif
+
+static double g_scale = 1.0;			/* Operation count scale. */
+static const char *g_kindNames[RSB2_BENCH_KINDS] = {
+	"seqserve",
+	"epoll",
+	"pool",
+	"uring",
+};
+
+uint64_t rsb2_bench_received = 0;
+
+static void rsb2_bench_nullTracer(const char *func, const char *file, int line,
+		int ref, rsb2_TraceGroup group, const char *descr)
+{
+}
+
+static void rsb2_bench_nullHandler(const char *func, const char *file,
+		int line, const char *name, const char *descr)
+{
+}
+
+void rsb2_bench_init(int argc, char **argv)
+{
+	rsb2_module_setTracer(rsb2_bench_nullTracer);
+	rsb2_module_setTraceMask(-1, 0);
+	rsb2_eventmgr_setHandler(rsb2_bench_nullHandler);
+	if (argc > 1) {
+		g_scale = atof(argv[1]);
+		g_scale = g_scale > 0.0? g_scale: 1.0;
+	}
+}
+
+uint64_t rsb2_bench_ops(uint64_t ops)
+{
+	uint64_t scaled = ops * g_scale;
+	return scaled? scaled: 1;
+}
+
+const char *rsb2_bench_kindName(rsb2_Bench_kind kind)
+{
+	return g_kindNames[kind];
+}
+
+static void *rsb2_bench_server(void *arg)
+{
+	rsb2_Bench_server *server = arg;
+	rsb2_Unixsock_opts opts = { .framed = server->framed };
+	int err = 0;
+	if (server->kind == RSB2_BENCH_SEQSERVE) {
+		err = rsb2_unixsock_seqserve(server->path, server->fRecv, 0, 0);
+	} else {
+		/* one reactor thread per online CPU, at least two */
+		long ncpus = sysconf(_SC_NPROCESSORS_ONLN);
+		opts.nthreads = server->kind != RSB2_BENCH_POOL? 0:
+				ncpus > 2? ncpus: 2;
+		err = rsb2_unixsock_serve(server->path, server->fRecv, &opts);
+	}
+	if (err) {
+		fprintf(stderr, "%s: server failed\n", server->path);
+	}
+	return NULL;
+}
+
+int rsb2_bench_start(rsb2_Bench_server *server, const char *name)
+{
+	int err = -1;
+	snprintf(server->path, sizeof(server->path), "/tmp/rsb2_bench_%s.%d",
+			name, (int)getpid());
+	if (rsb2_unixsock_setEngine(server->kind == RSB2_BENCH_URING?
+			RSB2_UNIXSOCK_URING: RSB2_UNIXSOCK_EPOLL)) {
+		/* io_uring not supported, skip */
+	} else if (pthread_create(&server->thread, NULL, rsb2_bench_server,
+			server)) {
+		fprintf(stderr, "%s: pthread_create failed\n", server->path);
+	} else {
+		/* probe until listening, the probe connection is closed at once */
+		for (int i = 0; err && i < 200; i++) {
+			int sock = rsb2_unixsock_connect(server->path);
+			if (sock >= 0) {
+				rsb2_socket_close(sock);
+				err = 0;
+			} else {
+				usleep(5000);
+			}
+		}
+		if (err) {
+			fprintf(stderr, "%s: server not listening\n", server->path);
+			pthread_cancel(server->thread);
+			pthread_join(server->thread, NULL);
+		}
+	}
+	return err;
+}
+
+void rsb2_bench_stop(rsb2_Bench_server *server)
+{
+	int sock = rsb2_unixsock_connect(server->path);
+	if (sock >= 0 && server->framed) {
+		rsb2_frame_send(sock, "stop", 4);
+		rsb2_socket_close(sock);
+	} else if (sock >= 0) {
+		rsb2_socket_send(sock, "stop", 4);
+		rsb2_socket_close(sock);
+	}
+	pthread_join(server->thread, NULL);
+	rsb2_unixsock_closePools();
+	rsb2_unixsock_unlink(server->path);
+	rsb2_unixsock_setEngine(RSB2_UNIXSOCK_EPOLL);
+}
+
+static int rsb2_bench_isStop(const char *msg, int msglen)
+{
+	return msglen == 4 && !memcmp(msg, "stop", 4);
+}
+
+int rsb2_bench_echo(int sock, const char *msg, int msglen)
+{
+	int ret = 0;
+	if (rsb2_bench_isStop(msg, msglen)) {
+		ret = 2;
+	} else if (rsb2_socket_send(sock, msg, msglen) != msglen) {
+		ret = 1;
+	}
+	return ret;
+}
+
+int rsb2_bench_echoFramed(int sock, const char *msg, int msglen)
+{
+	int ret = 0;
+	if (rsb2_bench_isStop(msg, msglen)) {
+		ret = 2;
+	} else if (rsb2_frame_send(sock, msg, msglen)) {
+		ret = 1;
+	}
+	return ret;
+}
+
+int rsb2_bench_echoClose(int sock, const char *msg, int msglen)
+{
+	int ret = rsb2_bench_echo(sock, msg, msglen);
+	return ret? ret: 1;
+}
+
+int rsb2_bench_sink(int sock, const char *msg, int msglen)
+{
+	int ret = 0;
+	if (rsb2_bench_isStop(msg, msglen)) {
+		ret = 2;
+	} else {
+		__atomic_add_fetch(&rsb2_bench_received, msglen, __ATOMIC_RELEASE);
+	}
+	return ret;
+}
+
+int rsb2_bench_waitReceived(uint64_t bytes, int maxms)
+{
+	uint64_t deadline = rsb2_histo_now() + maxms * 1000000ull;
+	while (__atomic_load_n(&rsb2_bench_received, __ATOMIC_ACQUIRE) < bytes &&
+			rsb2_histo_now() < deadline) {
+		sched_yield();
+	}
+	return __atomic_load_n(&rsb2_bench_received, __ATOMIC_ACQUIRE) < bytes?
+			-1: 0;
+}
+
+void rsb2_bench_report(const char *bench, const char *params, uint64_t ops,
+		uint64_t bytes, uint64_t ns, const rsb2_Histo *lat)
+{
+	double secs = ns / 1e9;
+	secs = secs > 0.0? secs: 1e-9;
+	printf("{\"bench\":\"%s\",%s,\"ops\":%llu,\"bytes\":%llu,\"ns\":%llu,"
+			"\"ops_per_sec\":%.1f,\"mib_per_sec\":%.2f",
+			bench, params, (unsigned long long)ops,
+			(unsigned long long)bytes, (unsigned long long)ns,
+			ops / secs, bytes / secs / (1024.0 * 1024.0));
+	if (lat) {
+		rsb2_Histo_snap snap;
+		rsb2_histo_snapshot(lat, &snap);
+		printf(",\"mean_ns\":%llu,\"p50_ns\":%llu,\"p90_ns\":%llu,"
+				"\"p99_ns\":%llu,\"p999_ns\":%llu,\"max_ns\":%llu",
+				(unsigned long long)snap.mean, (unsigned long long)snap.p50,
+				(unsigned long long)snap.p90, (unsigned long long)snap.p99,
+				(unsigned long long)snap.p999, (unsigned long long)snap.max);
+	}
+	printf(",\"version\":\"%s\",\"checksum\":\"%s\",\"host\":\"%s\","
+			"\"date\":\"%s\"}\n", RSB2_BUILD_VERSION, RSB2_BUILD_CHECKSUM,
+			RSB2_BUILD_HOST, RSB2_BUILD_DATE);
+	fflush(stdout);
+}
+
+/*END*/
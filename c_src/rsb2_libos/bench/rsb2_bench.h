@@ -0,0 +1,126 @@
+/** Benchmark support - Interface.
+ * @file bench/rsb2_bench.h
+ * @author jp.tranvouez@navilab.com
+ * @defgroup rsb2_bench Benchmarks
+ * @ingroup rsb2_libos
+ * @{
+ * Helpers of the benchmark programs built and run by "make bench": an
+ * in-process server thread, echo and sink message processing functions,
+ * and the result report. Each result is one JSON object per line on
+ * stdout, with the build identification, so the results of two releases
+ * can be compared line by line.
+ */
+#ifndef RSB2_BENCH_H
+#define RSB2_BENCH_H
+
+#include "rsb2_histo.h"
+#include "rsb2_unixsock.h"
+
+#include <pthread.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** Server kinds. */
+typedef enum rsb2_Bench_kind {
+	RSB2_BENCH_SEQSERVE = 0,	/**< rsb2_unixsock_seqserve, one connection per call. */
+	RSB2_BENCH_EPOLL,			/**< rsb2_unixsock_serve, epoll engine. */
+	RSB2_BENCH_POOL,			/**< rsb2_unixsock_serve, reactor threads. */
+	RSB2_BENCH_URING,			/**< rsb2_unixsock_serve, io_uring engine. */
+	RSB2_BENCH_KINDS			/**< Number of server kinds. */
+} rsb2_Bench_kind;
+
+/** In-process server. */
+typedef struct rsb2_Bench_server {
+	rsb2_Bench_kind kind;		/**< Server kind. */
+	rsb2_Unixsock_recv *fRecv;	/**< Message processing function. */
+	bool framed;				/**< Framed messages (see opts->framed). */
+	char path[108];				/**< Unix socket path. */
+	pthread_t thread;			/**< Server thread. */
+} rsb2_Bench_server;
+
+/** Bytes received by rsb2_bench_sink(). */
+extern uint64_t rsb2_bench_received;
+
+/** Initialize a benchmark program.
+ * Tracing and event notification are silenced, so that the socket work is
+ * measured, and the operation count scale is read from the first argument.
+ * @param argc argument count
+ * @param argv arguments, argv[1] is a scale factor (default 1.0)
+ */
+void rsb2_bench_init(int argc, char **argv);
+
+/** Scale an operation count.
+ * @param ops operation count at scale 1.0
+ * @return scaled operation count, at least 1
+ */
+uint64_t rsb2_bench_ops(uint64_t ops);
+
+/** Get the name of a server kind.
+ * @param kind server kind
+ * @return name
+ */
+const char *rsb2_bench_kindName(rsb2_Bench_kind kind);
+
+/** Start a server thread and wait until it accepts connections.
+ * The I/O engine is selected for the kind, so clients use it too.
+ * @param server server, kind and fRecv set
+ * @param name benchmark name, part of the socket path
+ * @retval 0 success
+ * @retval -1 error, or kind not supported (io_uring)
+ */
+int rsb2_bench_start(rsb2_Bench_server *server, const char *name);
+
+/** Stop a server thread with a "stop" message and join it.
+ * The message is framed for a framed server.
+ * @param server server
+ */
+void rsb2_bench_stop(rsb2_Bench_server *server);
+
+/** Message processing function: echo, stop on "stop".
+ * @see rsb2_Unixsock_recv
+ */
+int rsb2_bench_echo(int sock, const char *msg, int msglen);
+
+/** Message processing function: echo as a frame, stop on "stop".
+ * @see rsb2_Unixsock_recv
+ */
+int rsb2_bench_echoFramed(int sock, const char *msg, int msglen);
+
+/** Message processing function: echo and close, stop on "stop".
+ * @see rsb2_Unixsock_recv
+ */
+int rsb2_bench_echoClose(int sock, const char *msg, int msglen);
+
+/** Message processing function: count bytes in rsb2_bench_received,
+ * stop on "stop".
+ * @see rsb2_Unixsock_recv
+ */
+int rsb2_bench_sink(int sock, const char *msg, int msglen);
+
+/** Wait until rsb2_bench_sink() has received a number of bytes.
+ * @param bytes byte count
+ * @param maxms maximum wait (ms)
+ * @retval 0 success
+ * @retval -1 timeout
+ */
+int rsb2_bench_waitReceived(uint64_t bytes, int maxms);
+
+/** Write a result line.
+ * @param bench benchmark name
+ * @param params JSON members of the parameters, without braces
+ * @param ops operation count
+ * @param bytes payload bytes transferred
+ * @param ns elapsed time (ns)
+ * @param lat latency of each operation, or NULL
+ */
+void rsb2_bench_report(const char *bench, const char *params, uint64_t ops,
+		uint64_t bytes, uint64_t ns, const rsb2_Histo *lat);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /*@} RSB2_BENCH_H */
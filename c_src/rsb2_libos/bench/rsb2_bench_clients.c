@@ -0,0 +1,109 @@
+/** Benchmark of server throughput with concurrent clients.
+ * @file bench/rsb2_bench_clients.c
+ * @author jp.tranvouez@navilab.com
+ * 1 to N client threads (N is the second argument, default 8) send 64-byte
+ * requests to an echo server with rsb2_unixsock_rpc. The sequential server
+ * gets one connection per request, the event-loop servers one pooled
+ * connection per client, with framing so that it is reused.
+ */
+#include "rsb2_bench.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+enum {
+	RSB2_BENCH_MSGSZ	= 64,			/* Request size. */
+	RSB2_BENCH_MAXCLIENTS	= 64,		/* Maximum number of clients. */
+};
+
+static rsb2_Histo g_lat;				/* Round-trip latencies. */
+
+/* Client thread. */
+typedef struct rsb2_Bench_client {
+	const char *path;					/* Unix socket path. */
+	uint64_t ops;						/* Requests to send. */
+	uint64_t errors;					/* Requests failed. */
+	pthread_t thread;					/* Client thread. */
+} rsb2_Bench_client;
+
+static void *rsb2_bench_client(void *arg)
+{
+	rsb2_Bench_client *client = arg;
+	char msg[RSB2_BENCH_MSGSZ];
+	char buf[RSB2_BENCH_MSGSZ];
+	memset(msg, 'x', sizeof(msg));
+	for (uint64_t i = 0; i < client->ops; i++) {
+		uint64_t t0 = rsb2_histo_now();
+		if (rsb2_unixsock_rpc(client->path, msg, sizeof(msg), buf,
+				sizeof(buf)) <= 0) {
+			client->errors++;
+		}
+		rsb2_histo_since(&g_lat, t0);
+	}
+	return NULL;
+}
+
+static void rsb2_bench_run(rsb2_Bench_kind kind, int nclients, uint64_t ops)
+{
+	rsb2_Bench_server server = {
+		.kind = kind,
+		.fRecv = kind == RSB2_BENCH_SEQSERVE? rsb2_bench_echoClose:
+				rsb2_bench_echoFramed,
+		.framed = kind != RSB2_BENCH_SEQSERVE,
+	};
+	if (!rsb2_bench_start(&server, "clients")) {
+		rsb2_Bench_client clients[RSB2_BENCH_MAXCLIENTS];
+		int pool = kind == RSB2_BENCH_SEQSERVE? 0: nclients;
+		rsb2_unixsock_setPoolSize(server.path, pool);
+		rsb2_unixsock_setPoolFramed(server.path, server.framed);
+		rsb2_histo_reset(&g_lat);
+		uint64_t start = rsb2_histo_now();
+		int n = 0;
+		for (; n < nclients; n++) {
+			clients[n].path = server.path;
+			clients[n].ops = ops / nclients;
+			clients[n].errors = 0;
+			if (pthread_create(&clients[n].thread, NULL, rsb2_bench_client,
+					&clients[n])) {
+				fprintf(stderr, "%s: pthread_create failed\n", server.path);
+				break;
+			}
+		}
+		uint64_t done = 0;
+		uint64_t errors = 0;
+		for (int i = 0; i < n; i++) {
+			pthread_join(clients[i].thread, NULL);
+			done += clients[i].ops;
+			errors += clients[i].errors;
+		}
+		uint64_t ns = rsb2_histo_now() - start;
+		char params[128];
+		snprintf(params, sizeof(params), "\"server\":\"%s\",\"pool\":%d,"
+				"\"clients\":%d,\"msgsize\":%d,\"errors\":%llu",
+				rsb2_bench_kindName(kind), pool, n, RSB2_BENCH_MSGSZ,
+				(unsigned long long)errors);
+		rsb2_bench_report("server_throughput", params, done,
+				2 * done * RSB2_BENCH_MSGSZ, ns, &g_lat);
+		rsb2_unixsock_setPoolSize(server.path, 0);
+		rsb2_unixsock_setPoolFramed(server.path, false);
+		rsb2_bench_stop(&server);
+	}
+}
+
+int main(int argc, char **argv)
+{
+	rsb2_bench_init(argc, argv);
+	int maxClients = argc > 2? atoi(argv[2]): 8;
+	maxClients = maxClients < 1? 1: maxClients > RSB2_BENCH_MAXCLIENTS?
+			RSB2_BENCH_MAXCLIENTS: maxClients;
+	for (rsb2_Bench_kind kind = 0; kind < RSB2_BENCH_KINDS; kind++) {
+		uint64_t ops = rsb2_bench_ops(kind == RSB2_BENCH_SEQSERVE? 5000: 20000);
+		for (int nclients = 1; nclients <= maxClients; nclients *= 2) {
+			rsb2_bench_run(kind, nclients, ops);
+		}
+	}
+	return 0;
+}
+
+/*END*/
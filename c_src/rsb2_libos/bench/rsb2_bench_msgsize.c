@@ -0,0 +1,79 @@
+/** Benchmark of stream throughput versus message size.
+ * @file bench/rsb2_bench_msgsize.c
+ * @author jp.tranvouez@navilab.com
+ * One client sends messages of 16 B to 1 MiB on a pooled connection to a
+ * sink server, for each event-loop server kind. The time runs until the
+ * server has received every byte.
+ */
+#include "rsb2_bench.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+enum {
+	RSB2_BENCH_MINSZ	= 16,			/* Smallest message size. */
+	RSB2_BENCH_MAXSZ	= 1 << 20,		/* Largest message size. */
+	RSB2_BENCH_VOLUME	= 64 << 20,		/* Bytes sent per size, at most. */
+	RSB2_BENCH_MAXOPS	= 100000,		/* Messages sent per size, at most. */
+	RSB2_BENCH_MAXMS	= 30000,		/* Maximum wait for the sink. */
+};
+
+static void rsb2_bench_run(rsb2_Bench_kind kind, const char *msg)
+{
+	rsb2_Bench_server server = {
+		.kind = kind,
+		.fRecv = rsb2_bench_sink,
+	};
+	if (!rsb2_bench_start(&server, "msgsize")) {
+		rsb2_unixsock_setPoolSize(server.path, 1);
+		for (int msgsize = RSB2_BENCH_MINSZ; msgsize <= RSB2_BENCH_MAXSZ;
+				msgsize *= 4) {
+			uint64_t ops = RSB2_BENCH_VOLUME / msgsize;
+			ops = rsb2_bench_ops(ops < RSB2_BENCH_MAXOPS? ops:
+					RSB2_BENCH_MAXOPS);
+			uint64_t errors = 0;
+			__atomic_store_n(&rsb2_bench_received, 0, __ATOMIC_RELEASE);
+			uint64_t start = rsb2_histo_now();
+			for (uint64_t i = 0; i < ops; i++) {
+				if (rsb2_unixsock_sendto(server.path, msg, msgsize) !=
+						msgsize) {
+					errors++;
+				}
+			}
+			uint64_t bytes = (ops - errors) * msgsize;
+			errors += rsb2_bench_waitReceived(bytes, RSB2_BENCH_MAXMS)? 1: 0;
+			uint64_t ns = rsb2_histo_now() - start;
+			char params[128];
+			snprintf(params, sizeof(params), "\"server\":\"%s\",\"pool\":1,"
+					"\"clients\":1,\"msgsize\":%d,\"errors\":%llu",
+					rsb2_bench_kindName(kind), msgsize,
+					(unsigned long long)errors);
+			rsb2_bench_report("msgsize_throughput", params, ops, bytes, ns,
+					NULL);
+		}
+		rsb2_unixsock_setPoolSize(server.path, 0);
+		rsb2_bench_stop(&server);
+	}
+}
+
+int main(int argc, char **argv)
+{
+	rsb2_bench_init(argc, argv);
+	int err = 1;
+	char *msg = malloc(RSB2_BENCH_MAXSZ);
+	if (!msg) {
+		fprintf(stderr, "malloc failed\n");
+	} else {
+		memset(msg, 'x', RSB2_BENCH_MAXSZ);
+		for (rsb2_Bench_kind kind = RSB2_BENCH_EPOLL; kind < RSB2_BENCH_KINDS;
+				kind++) {
+			rsb2_bench_run(kind, msg);
+		}
+		free(msg);
+		err = 0;
+	}
+	return err;
+}
+
+/*END*/
@@ -0,0 +1,73 @@
+/** Benchmark of rsb2_unixsock_rpc round-trip latency.
+ * @file bench/rsb2_bench_rpc.c
+ * @author jp.tranvouez@navilab.com
+ * One client sends 64-byte requests to an echo server, one at a time,
+ * with and without a connection pool, for each server kind. Pooled
+ * connections are only reused with framing, so the pooled runs are framed.
+ */
+#include "rsb2_bench.h"
+
+#include <stdio.h>
+#include <string.h>
+
+enum {
+	RSB2_BENCH_MSGSZ	= 64,			/* Request size. */
+	RSB2_BENCH_WARMUP	= 100,			/* Requests before measuring. */
+};
+
+static rsb2_Histo g_lat;				/* Round-trip latencies. */
+
+static void rsb2_bench_run(rsb2_Bench_kind kind, int pool, uint64_t ops)
+{
+	rsb2_Bench_server server = {
+		.kind = kind,
+		.fRecv = pool? rsb2_bench_echoFramed: rsb2_bench_echoClose,
+		.framed = pool > 0,
+	};
+	if (!rsb2_bench_start(&server, "rpc")) {
+		char msg[RSB2_BENCH_MSGSZ];
+		char buf[RSB2_BENCH_MSGSZ];
+		uint64_t errors = 0;
+		memset(msg, 'x', sizeof(msg));
+		rsb2_unixsock_setPoolSize(server.path, pool);
+		rsb2_unixsock_setPoolFramed(server.path, server.framed);
+		for (int i = 0; i < RSB2_BENCH_WARMUP; i++) {
+			rsb2_unixsock_rpc(server.path, msg, sizeof(msg), buf, sizeof(buf));
+		}
+		rsb2_histo_reset(&g_lat);
+		uint64_t start = rsb2_histo_now();
+		for (uint64_t i = 0; i < ops; i++) {
+			uint64_t t0 = rsb2_histo_now();
+			if (rsb2_unixsock_rpc(server.path, msg, sizeof(msg), buf,
+					sizeof(buf)) <= 0) {
+				errors++;
+			}
+			rsb2_histo_since(&g_lat, t0);
+		}
+		uint64_t ns = rsb2_histo_now() - start;
+		char params[128];
+		snprintf(params, sizeof(params), "\"server\":\"%s\",\"pool\":%d,"
+				"\"clients\":1,\"msgsize\":%d,\"errors\":%llu",
+				rsb2_bench_kindName(kind), pool, RSB2_BENCH_MSGSZ,
+				(unsigned long long)errors);
+		rsb2_bench_report("rpc_latency", params, ops, 2 * ops * sizeof(msg),
+				ns, &g_lat);
+		rsb2_unixsock_setPoolSize(server.path, 0);
+		rsb2_unixsock_setPoolFramed(server.path, false);
+		rsb2_bench_stop(&server);
+	}
+}
+
+int main(int argc, char **argv)
+{
+	rsb2_bench_init(argc, argv);
+	rsb2_bench_run(RSB2_BENCH_SEQSERVE, 0, rsb2_bench_ops(5000));
+	for (rsb2_Bench_kind kind = RSB2_BENCH_EPOLL; kind < RSB2_BENCH_KINDS;
+			kind++) {
+		rsb2_bench_run(kind, 0, rsb2_bench_ops(5000));
+		rsb2_bench_run(kind, 1, rsb2_bench_ops(20000));
+	}
+	return 0;
+}
+
+/*END*/
@@ -0,0 +1,63 @@
+/** Benchmark of rsb2_unixsock_sendto message rate.
+ * @file bench/rsb2_bench_sendto.c
+ * @author jp.tranvouez@navilab.com
+ * One client sends 64-byte messages to a sink server as fast as it can,
+ * with and without a connection pool, for each server kind. The time runs
+ * until the server has received every byte.
+ */
+#include "rsb2_bench.h"
+
+#include <stdio.h>
+#include <string.h>
+
+enum {
+	RSB2_BENCH_MSGSZ	= 64,			/* Message size. */
+	RSB2_BENCH_MAXMS	= 30000,		/* Maximum wait for the sink. */
+};
+
+static void rsb2_bench_run(rsb2_Bench_kind kind, int pool, uint64_t ops)
+{
+	rsb2_Bench_server server = {
+		.kind = kind,
+		.fRecv = rsb2_bench_sink,
+	};
+	if (!rsb2_bench_start(&server, "sendto")) {
+		char msg[RSB2_BENCH_MSGSZ];
+		uint64_t errors = 0;
+		memset(msg, 'x', sizeof(msg));
+		rsb2_unixsock_setPoolSize(server.path, pool);
+		__atomic_store_n(&rsb2_bench_received, 0, __ATOMIC_RELEASE);
+		uint64_t start = rsb2_histo_now();
+		for (uint64_t i = 0; i < ops; i++) {
+			if (rsb2_unixsock_sendto(server.path, msg, sizeof(msg)) !=
+					sizeof(msg)) {
+				errors++;
+			}
+		}
+		uint64_t bytes = (ops - errors) * sizeof(msg);
+		errors += rsb2_bench_waitReceived(bytes, RSB2_BENCH_MAXMS)? 1: 0;
+		uint64_t ns = rsb2_histo_now() - start;
+		char params[128];
+		snprintf(params, sizeof(params), "\"server\":\"%s\",\"pool\":%d,"
+				"\"clients\":1,\"msgsize\":%d,\"errors\":%llu",
+				rsb2_bench_kindName(kind), pool, RSB2_BENCH_MSGSZ,
+				(unsigned long long)errors);
+		rsb2_bench_report("sendto_rate", params, ops, bytes, ns, NULL);
+		rsb2_unixsock_setPoolSize(server.path, 0);
+		rsb2_bench_stop(&server);
+	}
+}
+
+int main(int argc, char **argv)
+{
+	rsb2_bench_init(argc, argv);
+	rsb2_bench_run(RSB2_BENCH_SEQSERVE, 0, rsb2_bench_ops(10000));
+	for (rsb2_Bench_kind kind = RSB2_BENCH_EPOLL; kind < RSB2_BENCH_KINDS;
+			kind++) {
+		rsb2_bench_run(kind, 0, rsb2_bench_ops(10000));
+		rsb2_bench_run(kind, 1, rsb2_bench_ops(200000));
+	}
+	return 0;
+}
+
+/*END*/
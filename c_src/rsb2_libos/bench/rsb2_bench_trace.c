@@ -0,0 +1,316 @@
+/** Microbenchmark of the trace and event notification cost.
+ * @file bench/rsb2_bench_trace.c
+ * @author jp.tranvouez@navilab.com
+ * 1 to N threads (N is the second argument, default 4) call a trace or
+ * event function in a loop; the cost per call is reported in ns of elapsed
+ * and thread CPU time and, when the kernel exposes the hardware counter,
+ * in user-space instructions.
+ * Handlers:
+ * - disabled: trace group masked out, or event rate-limited to 1 per second;
+ * - null: handler returning at once, formatting cost only;
+ * - stderr: default handler, stderr redirected to /dev/null meanwhile;
+ * - file: handler writing the default line format to a temporary file;
+ * - ring: rsb2_tracering started, RSB2_TRACE callsites only.
+ */
+#include "rsb2_bench.h"
+#include "rsb2_eventmgr.h"
+#include "rsb2_module.h"
+#include "rsb2_tracering.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <linux/perf_event.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+enum {
+	RSB2_BENCH_MAXTHREADS	= 64,		/* Maximum number of threads. */
+	RSB2_BENCH_WARMUP		= 1000,		/* Calls before measuring. */
+};
+
+/* Function measured. */
+typedef enum rsb2_Bench_op {
+	RSB2_BENCH_TRACE_ARGS = 0,			/* RSB2_TRACE_ARGS. */
+	RSB2_BENCH_MODULE_TRACE,			/* rsb2_module_trace. */
+	RSB2_BENCH_NOTIFY,					/* rsb2_eventmgr_notify. */
+	RSB2_BENCH_ERRNO,					/* rsb2_eventmgr_errno. */
+	RSB2_BENCH_OPS						/* Number of functions. */
+} rsb2_Bench_op;
+
+/* Handler configuration. */
+typedef enum rsb2_Bench_handler {
+	RSB2_BENCH_DISABLED = 0,			/* Masked out or rate-limited. */
+	RSB2_BENCH_NULL,					/* Null handler. */
+	RSB2_BENCH_STDERR,					/* Default handler. */
+	RSB2_BENCH_FILE,					/* File handler. */
+	RSB2_BENCH_RING,					/* Trace rings. */
+	RSB2_BENCH_HANDLERS					/* Number of handlers. */
+} rsb2_Bench_handler;
+
+/* Measuring thread. */
+typedef struct rsb2_Bench_thread {
+	rsb2_Bench_op op;					/* Function called. */
+	uint64_t ops;						/* Calls. */
+	uint64_t ns;						/* Elapsed time. */
+	uint64_t cpuns;						/* Thread CPU time. */
+	int64_t insns;						/* Instructions, -1 if unknown. */
+	pthread_t thread;					/* Thread. */
+} rsb2_Bench_thread;
+
+static int g_module = -1;				/* Module reference. */
+static FILE *g_file = NULL;				/* File handler output. */
+static const char *g_opNames[RSB2_BENCH_OPS] = {
+	"trace_args",
+	"module_trace",
+	"eventmgr_notify",
+	"eventmgr_errno",
+};
+static const char *g_handlerNames[RSB2_BENCH_HANDLERS] = {
+	"disabled",
+	"null",
+	"stderr",
+	"file",
+	"ring",
+};
+
+static void rsb2_bench_nullTracer(const char *func, const char *file, int line,
+		int ref, rsb2_TraceGroup group, const char *descr)
+{
+}
+
+static void rsb2_bench_nullHandler(const char *func, const char *file,
+		int line, const char *name, const char *descr)
+{
+}
+
+static void rsb2_bench_fileTracer(const char *func, const char *file, int line,
+		int ref, rsb2_TraceGroup group, const char *descr)
+{
+	char loc[256];
+	snprintf(loc, sizeof(loc), "%-16.16s %4d %s", file, line, func);
+	fprintf(g_file, "trace    %-50.50s|%s\n", loc, descr);
+}
+
+static void rsb2_bench_fileHandler(const char *func, const char *file,
+		int line, const char *name, const char *descr)
+{
+	char loc[256];
+	snprintf(loc, sizeof(loc), "%-16.16s %4d %s", file, line, func);
+	fprintf(g_file, "event    %-50.50s|%s,%s\n", loc, name, descr? descr: "");
+}
+
+/* Open a counter of the user-space instructions of the calling thread. */
+static int rsb2_bench_perfOpen(void)
+{
+	struct perf_event_attr attr;
+	memset(&attr, 0, sizeof(attr));
+	attr.type = PERF_TYPE_HARDWARE;
+	attr.size = sizeof(attr);
+	attr.config = PERF_COUNT_HW_INSTRUCTIONS;
+	attr.disabled = 1;
+	attr.exclude_kernel = 1;
+	attr.exclude_hv = 1;
+	return syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+}
+
+/* Get the CPU time of the calling thread (ns). */
+static uint64_t rsb2_bench_cpuNow(void)
+{
+	struct timespec now;
+	clock_gettime(CLOCK_THREAD_CPUTIME_ID, &now);
+	return now.tv_sec * 1000000000ull + now.tv_nsec;
+}
+
+/* Call the measured function once. */
+static void rsb2_bench_call(rsb2_Bench_op op, int i)
+{
+	const char *buf = "payload";
+	switch (op) {
+	case RSB2_BENCH_TRACE_ARGS:
+		RSB2_TRACE_ARGS("sock=%d,buf=%p,bufsz=%d", i, buf, 8192);
+		break;
+	case RSB2_BENCH_MODULE_TRACE:
+		rsb2_module_trace(g_module, __func__, __FILE__, __LINE__,
+				RSB2_TRACEGROUP_FUNC, "func_entry sock=%d,buf=%p,bufsz=%d",
+				i, buf, 8192);
+		break;
+	case RSB2_BENCH_NOTIFY:
+		rsb2_eventmgr_notify(__func__, __FILE__, __LINE__, "bench_event",
+				"sock=%d,msglen=%d", i, 64);
+		break;
+	default:
+		rsb2_eventmgr_errno(__func__, __FILE__, __LINE__, "recv", EAGAIN,
+				"sock=%d", i);
+		break;
+	}
+}
+
+static void *rsb2_bench_thread(void *arg)
+{
+	rsb2_Bench_thread *thread = arg;
+	int fd = rsb2_bench_perfOpen();
+	for (int i = 0; i < RSB2_BENCH_WARMUP; i++) {
+		rsb2_bench_call(thread->op, i);
+	}
+	if (fd >= 0) {
+		ioctl(fd, PERF_EVENT_IOC_RESET, 0);
+		ioctl(fd, PERF_EVENT_IOC_ENABLE, 0);
+	}
+	uint64_t start = rsb2_histo_now();
+	uint64_t cpuStart = rsb2_bench_cpuNow();
+	for (uint64_t i = 0; i < thread->ops; i++) {
+		rsb2_bench_call(thread->op, i);
+	}
+	thread->cpuns = rsb2_bench_cpuNow() - cpuStart;
+	thread->ns = rsb2_histo_now() - start;
+	thread->insns = -1;
+	if (fd >= 0) {
+		uint64_t count = 0;
+		ioctl(fd, PERF_EVENT_IOC_DISABLE, 0);
+		if (read(fd, &count, sizeof(count)) == sizeof(count)) {
+			thread->insns = count;
+		}
+		close(fd);
+	}
+	return NULL;
+}
+
+/* Install a handler configuration, return false if not applicable. */
+static bool rsb2_bench_setup(rsb2_Bench_op op, rsb2_Bench_handler handler)
+{
+	bool trace = op == RSB2_BENCH_TRACE_ARGS || op == RSB2_BENCH_MODULE_TRACE;
+	const char *name = op == RSB2_BENCH_NOTIFY? "bench_event": "errno_set";
+	bool ok = true;
+	if (handler == RSB2_BENCH_RING && op != RSB2_BENCH_TRACE_ARGS) {
+		/* only callsites are recorded in rings */
+		ok = false;
+	} else if (trace) {
+		rsb2_module_setTraceMask(g_module, handler == RSB2_BENCH_DISABLED? 0:
+				RSB2_TRACEGROUP_FUNC | RSB2_TRACEGROUP_DATA |
+				RSB2_TRACEGROUP_CTRL | RSB2_TRACEGROUP_APPL);
+		rsb2_module_setTracer(handler == RSB2_BENCH_STDERR? NULL:
+				handler == RSB2_BENCH_FILE? rsb2_bench_fileTracer:
+				rsb2_bench_nullTracer);
+		if (handler == RSB2_BENCH_RING && rsb2_tracering_start(0, 0)) {
+			ok = false;
+		}
+	} else {
+		rsb2_eventmgr_setLimit(name, handler == RSB2_BENCH_DISABLED? 1: 0);
+		rsb2_eventmgr_setHandler(handler == RSB2_BENCH_STDERR? NULL:
+				handler == RSB2_BENCH_FILE? rsb2_bench_fileHandler:
+				rsb2_bench_nullHandler);
+	}
+	return ok;
+}
+
+/* Restore the silent configuration of rsb2_bench_init. */
+static void rsb2_bench_teardown(rsb2_Bench_op op, rsb2_Bench_handler handler)
+{
+	if (handler == RSB2_BENCH_RING) {
+		rsb2_tracering_stop();
+	}
+	rsb2_module_setTracer(rsb2_bench_nullTracer);
+	rsb2_module_setTraceMask(g_module, 0);
+	rsb2_eventmgr_setHandler(rsb2_bench_nullHandler);
+	rsb2_eventmgr_setLimit(op == RSB2_BENCH_NOTIFY? "bench_event":
+			"errno_set", 0);
+	fflush(g_file);
+	if (ftruncate(fileno(g_file), 0)) {
+		fprintf(stderr, "ftruncate failed\n");
+	}
+	rewind(g_file);
+}
+
+static void rsb2_bench_run(rsb2_Bench_op op, rsb2_Bench_handler handler,
+		int nthreads, uint64_t ops)
+{
+	/* stderr output discarded, its cost is the formatting and write */
+	int saved = -1;
+	if (handler == RSB2_BENCH_STDERR) {
+		int null = open("/dev/null", O_WRONLY);
+		saved = dup(STDERR_FILENO);
+		dup2(null, STDERR_FILENO);
+		close(null);
+	}
+	if (rsb2_bench_setup(op, handler)) {
+		rsb2_Bench_thread threads[RSB2_BENCH_MAXTHREADS];
+		uint64_t start = rsb2_histo_now();
+		int n = 0;
+		for (; n < nthreads; n++) {
+			threads[n].op = op;
+			threads[n].ops = ops;
+			if (pthread_create(&threads[n].thread, NULL, rsb2_bench_thread,
+					&threads[n])) {
+				fprintf(stderr, "pthread_create failed\n");
+				break;
+			}
+		}
+		double nsPerCall = 0.0;
+		double cpuPerCall = 0.0;
+		double insnsPerCall = 0.0;
+		bool insns = n > 0;
+		for (int i = 0; i < n; i++) {
+			pthread_join(threads[i].thread, NULL);
+			nsPerCall += (double)threads[i].ns / ops / n;
+			cpuPerCall += (double)threads[i].cpuns / ops / n;
+			insnsPerCall += (double)threads[i].insns / ops / n;
+			insns = insns && threads[i].insns >= 0;
+		}
+		uint64_t ns = rsb2_histo_now() - start;
+		rsb2_bench_teardown(op, handler);
+		char params[256];
+		char insnsText[32] = "null";
+		if (insns) {
+			snprintf(insnsText, sizeof(insnsText), "%.1f", insnsPerCall);
+		}
+		snprintf(params, sizeof(params), "\"function\":\"%s\","
+				"\"handler\":\"%s\",\"threads\":%d,\"ns_per_call\":%.1f,"
+				"\"cpu_ns_per_call\":%.1f,\"insns_per_call\":%s",
+				g_opNames[op], g_handlerNames[handler], n, nsPerCall,
+				cpuPerCall, insnsText);
+		rsb2_bench_report("trace_cost", params, n * ops, 0, ns, NULL);
+	}
+	if (saved >= 0) {
+		dup2(saved, STDERR_FILENO);
+		close(saved);
+	}
+}
+
+int main(int argc, char **argv)
+{
+	rsb2_bench_init(argc, argv);
+	int maxThreads = argc > 2? atoi(argv[2]): 4;
+	maxThreads = maxThreads < 1? 1: maxThreads > RSB2_BENCH_MAXTHREADS?
+			RSB2_BENCH_MAXTHREADS: maxThreads;
+	int err = 1;
+	g_module = rsb2_module_ref("rsb2_bench_trace");
+	g_file = tmpfile();
+	if (g_module < 0 || !g_file) {
+		fprintf(stderr, "initialization failed\n");
+	} else {
+		rsb2_module_setTraceMask(g_module, 0);
+		for (rsb2_Bench_op op = 0; op < RSB2_BENCH_OPS; op++) {
+			for (rsb2_Bench_handler handler = 0;
+					handler < RSB2_BENCH_HANDLERS; handler++) {
+				uint64_t ops = rsb2_bench_ops(handler ==
+						RSB2_BENCH_DISABLED? 10000000: 200000);
+				for (int nthreads = 1; nthreads <= maxThreads;
+						nthreads *= 2) {
+					rsb2_bench_run(op, handler, nthreads, ops);
+				}
+			}
+		}
+		err = 0;
+	}
+	if (g_file) {
+		fclose(g_file);
+	}
+	rsb2_module_destroy(g_module);
+	return err;
+}
+
+/*END*/
@@ -0,0 +1,272 @@
+/** Module rsb2_bufpool - Implementation.
+ * @file rsb2_bufpool.c
+ * @author jp.tranvouez@navilab.com
+ */
+#include "rsb2_bufpool.h"
+#include "rsb2_metrics.h"
+#include "rsb2_module.h"
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* Header of a buffer, before its data. */
+typedef struct rsb2_Bufpool_hdr {
+	struct rsb2_Bufpool_hdr *next;		/* Next free buffer. */
+	size_t size;						/* Capacity. */
+	int cls;							/* Size class, -1 if oversize. */
+	int refs;							/* Reference count. */
+} __attribute__((aligned(16))) rsb2_Bufpool_hdr;
+
+/* Free lists of a thread. */
+typedef struct rsb2_Bufpool_cache {
+	rsb2_Bufpool_hdr *free[RSB2_BUFPOOL_CLASSES];	/* Free buffers. */
+	int count[RSB2_BUFPOOL_CLASSES];	/* Free buffers count. */
+} rsb2_Bufpool_cache;
+
+static int g_module = -1;				/* Module reference. */
+static const size_t g_sizes[RSB2_BUFPOOL_CLASSES] = {
+	RSB2_BUFPOOL_MINSZ,
+	64 * 1024,
+	RSB2_BUFPOOL_MAXSZ,
+};
+static const int g_maxFree[RSB2_BUFPOOL_CLASSES] = {
+	64,									/* 256 KiB */
+	16,									/* 1 MiB */
+	4,									/* 4 MiB */
+};
+static const int g_maxShared[RSB2_BUFPOOL_CLASSES] = {
+	256,								/* 1 MiB */
+	64,									/* 4 MiB */
+	16,									/* 16 MiB */
+};
+static pthread_mutex_t g_lock = PTHREAD_MUTEX_INITIALIZER;	/* Shared lists. */
+static rsb2_Bufpool_hdr *g_shared[RSB2_BUFPOOL_CLASSES];	/* Shared lists. */
+static int g_nshared[RSB2_BUFPOOL_CLASSES];	/* Shared lists count. */
+static rsb2_Bufpool_stats g_stats;		/* Counters. */
+static pthread_once_t g_keyOnce = PTHREAD_ONCE_INIT;	/* Key init. */
+static pthread_key_t g_key;				/* Free lists of the thread, for exit. */
+static __thread rsb2_Bufpool_cache *t_cache = NULL;	/* Free lists of the thread. */
+
+int rsb2_bufpool_begin(void)
+{
+	g_module = rsb2_module_ref("rsb2_bufpool");
+	int err = g_module < 0;
+	return err;
+}
+
+void rsb2_bufpool_end(void)
+{
+	rsb2_bufpool_trim();
+	rsb2_module_destroy(g_module);
+}
+
+static void rsb2_bufpool_free(rsb2_Bufpool_cache *cache)
+{
+	for (int cls = 0; cls < RSB2_BUFPOOL_CLASSES; cls++) {
+		while (cache->free[cls]) {
+			rsb2_Bufpool_hdr *hdr = cache->free[cls];
+			cache->free[cls] = hdr->next;
+			free(hdr);
+		}
+		cache->count[cls] = 0;
+	}
+}
+
+static void rsb2_bufpool_exit(void *arg)
+{
+	rsb2_Bufpool_cache *cache = arg;
+	rsb2_bufpool_free(cache);
+	free(cache);
+	t_cache = NULL;
+}
+
+static void rsb2_bufpool_key(void)
+{
+	pthread_key_create(&g_key, rsb2_bufpool_exit);
+}
+
+static rsb2_Bufpool_cache *rsb2_bufpool_cache(void)
+{
+	if (!t_cache) {
+		pthread_once(&g_keyOnce, rsb2_bufpool_key);
+		t_cache = calloc(1, sizeof(*t_cache));
+		if (!t_cache) {
+			/* notify 'calloc' failure */
+			RSB2_ERRNO("calloc", "size=%zu", sizeof(*t_cache));
+		} else {
+			pthread_setspecific(g_key, t_cache);
+		}
+	}
+	return t_cache;
+}
+
+static int rsb2_bufpool_class(size_t size)
+{
+	int cls = 0;
+	while (cls < RSB2_BUFPOOL_CLASSES && g_sizes[cls] < size) {
+		cls++;
+	}
+	return cls < RSB2_BUFPOOL_CLASSES? cls: -1;
+}
+
+char *rsb2_bufpool_get(size_t size, size_t *pcap)
+{
+	RSB2_TRACE_ARGS("size=%zu,pcap=%p", size, pcap);
+	int cls = rsb2_bufpool_class(size);
+	rsb2_Bufpool_hdr *hdr = NULL;
+	if (cls < 0) {
+		/* above the classes, not kept */
+		__atomic_add_fetch(&g_stats.oversize, 1, __ATOMIC_RELAXED);
+	} else if (t_cache && t_cache->free[cls]) {
+		/* reuse a free buffer of the thread */
+		hdr = t_cache->free[cls];
+		t_cache->free[cls] = hdr->next;
+		t_cache->count[cls]--;
+	} else if (__atomic_load_n(&g_nshared[cls], __ATOMIC_RELAXED)) {
+		/* reuse a buffer released by another thread */
+		pthread_mutex_lock(&g_lock);
+		hdr = g_shared[cls];
+		if (hdr) {
+			g_shared[cls] = hdr->next;
+			__atomic_store_n(&g_nshared[cls], g_nshared[cls] - 1,
+					__ATOMIC_RELAXED);
+		}
+		pthread_mutex_unlock(&g_lock);
+		if (hdr) {
+			__atomic_add_fetch(&g_stats.shared[cls], 1, __ATOMIC_RELAXED);
+		}
+	}
+	if (cls < 0) {
+		/* not counted */
+	} else if (hdr) {
+		__atomic_add_fetch(&g_stats.hits[cls], 1, __ATOMIC_RELAXED);
+		rsb2_metrics_add(RSB2_METRICS_BUF_HITS, 1);
+	} else {
+		__atomic_add_fetch(&g_stats.misses[cls], 1, __ATOMIC_RELAXED);
+		rsb2_metrics_add(RSB2_METRICS_BUF_MISSES, 1);
+	}
+	if (!hdr) {
+		size_t cap = cls < 0? size: g_sizes[cls];
+		hdr = malloc(sizeof(*hdr) + cap);
+		if (!hdr) {
+			/* notify 'malloc' failure */
+			RSB2_ERRNO("malloc", "size=%zu", sizeof(*hdr) + cap);
+		} else {
+			hdr->size = cap;
+			hdr->cls = cls;
+		}
+	}
+	char *buf = NULL;
+	if (hdr) {
+		hdr->next = NULL;
+		hdr->refs = 1;
+		buf = (char *)(hdr + 1);
+		if (pcap) {
+			*pcap = hdr->size;
+		}
+	}
+	RSB2_TRACE_EXIT_PTR(buf);
+	return buf;
+}
+
+char *rsb2_bufpool_grow(char *buf, size_t len, size_t size, size_t *pcap)
+{
+	RSB2_TRACE_ARGS("buf=%p,len=%zu,size=%zu,pcap=%p", buf, len, size, pcap);
+	RSB2_ASSERT(!buf || len <= rsb2_bufpool_capacity(buf));
+	char *grown = buf;
+	if (buf && rsb2_bufpool_capacity(buf) >= size) {
+		/* large enough */
+		if (pcap) {
+			*pcap = rsb2_bufpool_capacity(buf);
+		}
+	} else if (!(grown = rsb2_bufpool_get(size, pcap))) {
+		RSB2_ERRTRACE();
+	} else if (buf) {
+		memcpy(grown, buf, len);
+		rsb2_bufpool_put(buf);
+	}
+	RSB2_TRACE_EXIT_PTR(grown);
+	return grown;
+}
+
+void rsb2_bufpool_retain(char *buf)
+{
+	RSB2_TRACE_ARGS("buf=%p", buf);
+	RSB2_ASSERT_NOTNULL(buf);
+	rsb2_Bufpool_hdr *hdr = (rsb2_Bufpool_hdr *)buf - 1;
+	__atomic_add_fetch(&hdr->refs, 1, __ATOMIC_RELAXED);
+	RSB2_TRACE_EXIT();
+}
+
+void rsb2_bufpool_put(char *buf)
+{
+	RSB2_TRACE_ARGS("buf=%p", buf);
+	rsb2_Bufpool_hdr *hdr = buf? (rsb2_Bufpool_hdr *)buf - 1: NULL;
+	/* the last reference sees every write of the other holders */
+	if (hdr && !__atomic_sub_fetch(&hdr->refs, 1, __ATOMIC_ACQ_REL)) {
+		int cls = hdr->cls;
+		rsb2_Bufpool_cache *cache = cls < 0? NULL: rsb2_bufpool_cache();
+		bool kept = false;
+		if (cache && cache->count[cls] < g_maxFree[cls]) {
+			/* keep for the next get of the thread */
+			hdr->next = cache->free[cls];
+			cache->free[cls] = hdr;
+			cache->count[cls]++;
+			kept = true;
+		} else if (cls >= 0) {
+			/* thread lists full, share with the other threads */
+			pthread_mutex_lock(&g_lock);
+			if (g_nshared[cls] < g_maxShared[cls]) {
+				hdr->next = g_shared[cls];
+				g_shared[cls] = hdr;
+				__atomic_store_n(&g_nshared[cls], g_nshared[cls] + 1,
+						__ATOMIC_RELAXED);
+				kept = true;
+			}
+			pthread_mutex_unlock(&g_lock);
+		}
+		if (!kept) {
+			if (cls >= 0) {
+				__atomic_add_fetch(&g_stats.freed, 1, __ATOMIC_RELAXED);
+			}
+			free(hdr);
+		}
+	}
+	RSB2_TRACE_EXIT();
+}
+
+size_t rsb2_bufpool_capacity(const char *buf)
+{
+	RSB2_ASSERT_NOTNULL(buf);
+	return ((const rsb2_Bufpool_hdr *)buf - 1)->size;
+}
+
+void rsb2_bufpool_trim(void)
+{
+	RSB2_TRACE_ENTRY();
+	if (t_cache) {
+		rsb2_bufpool_free(t_cache);
+	}
+	RSB2_TRACE_EXIT();
+}
+
+void rsb2_bufpool_stats(rsb2_Bufpool_stats *stats)
+{
+	RSB2_TRACE_ARGS("stats=%p", stats);
+	RSB2_ASSERT_NOTNULL(stats);
+	for (int cls = 0; cls < RSB2_BUFPOOL_CLASSES; cls++) {
+		stats->hits[cls] = __atomic_load_n(&g_stats.hits[cls],
+				__ATOMIC_RELAXED);
+		stats->shared[cls] = __atomic_load_n(&g_stats.shared[cls],
+				__ATOMIC_RELAXED);
+		stats->misses[cls] = __atomic_load_n(&g_stats.misses[cls],
+				__ATOMIC_RELAXED);
+	}
+	stats->oversize = __atomic_load_n(&g_stats.oversize, __ATOMIC_RELAXED);
+	stats->freed = __atomic_load_n(&g_stats.freed, __ATOMIC_RELAXED);
+	RSB2_TRACE_EXIT();
+}
+
+/*END*/
@@ -0,0 +1,97 @@
+/** Module rsb2_bufpool - Interface.
+ * @file rsb2_bufpool.h
+ * @author jp.tranvouez@navilab.com
+ * @defgroup rsb2_bufpool Receive Buffer Pool
+ * @ingroup rsb2_libos
+ * @{
+ * Receive buffers in size classes of 4 KiB, 64 KiB and 1 MiB. Released
+ * buffers are kept on free lists of the releasing thread, so a server loop
+ * gets its buffers back without locking or heap allocation; past their
+ * length, the lists overflow to shared lists that other threads draw
+ * from, so buffers released by worker threads return to the server. A
+ * buffer larger than the largest class is allocated and freed each time.
+ * Buffers are reference-counted: a buffer passed to another thread is
+ * retained by the receiver and released by whichever thread is last.
+ */
+#ifndef RSB2_BUFPOOL_H
+#define RSB2_BUFPOOL_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** Number of size classes. */
+#define RSB2_BUFPOOL_CLASSES	3
+
+/** Size of the smallest class. */
+#define RSB2_BUFPOOL_MINSZ		(4 * 1024)
+
+/** Size of the largest class. */
+#define RSB2_BUFPOOL_MAXSZ		(1024 * 1024)
+
+/** Pool counters, cumulated over every thread. */
+typedef struct rsb2_Bufpool_stats {
+	uint64_t hits[RSB2_BUFPOOL_CLASSES];	/**< Buffers reused, by class. */
+	uint64_t shared[RSB2_BUFPOOL_CLASSES];	/**< Of which from shared lists. */
+	uint64_t misses[RSB2_BUFPOOL_CLASSES];	/**< Buffers allocated, by class. */
+	uint64_t oversize;						/**< Buffers above the classes. */
+	uint64_t freed;							/**< Buffers freed, all lists full. */
+} rsb2_Bufpool_stats;
+
+/** Get a buffer, with one reference.
+ * @param size minimum size
+ * @param pcap buffer capacity, at least size, or NULL
+ * @return buffer address
+ * @retval NULL allocation failure
+ */
+char *rsb2_bufpool_get(size_t size, size_t *pcap);
+
+/** Get a larger buffer holding the data of a buffer.
+ * The buffer is returned unchanged if large enough, else its first len
+ * bytes are copied into a buffer of the class of size and it is released.
+ * The buffer must have a single reference.
+ * @param buf buffer address, or NULL
+ * @param len length of the data to keep
+ * @param size minimum size
+ * @param pcap buffer capacity, at least size, or NULL
+ * @return buffer address
+ * @retval NULL allocation failure, buf is unchanged
+ */
+char *rsb2_bufpool_grow(char *buf, size_t len, size_t size, size_t *pcap);
+
+/** Add a reference to a buffer.
+ * @param buf buffer address
+ */
+void rsb2_bufpool_retain(char *buf);
+
+/** Release a reference to a buffer, from any thread.
+ * The last reference puts the buffer on the free lists of the calling
+ * thread.
+ * @param buf buffer address, or NULL
+ */
+void rsb2_bufpool_put(char *buf);
+
+/** Get the capacity of a buffer.
+ * @param buf buffer address
+ * @return buffer capacity
+ */
+size_t rsb2_bufpool_capacity(const char *buf);
+
+/** Free the buffers kept by the calling thread.
+ * Done at thread exit.
+ */
+void rsb2_bufpool_trim(void);
+
+/** Get the pool counters.
+ * @param stats counters
+ */
+void rsb2_bufpool_stats(rsb2_Bufpool_stats *stats);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /*@} RSB2_BUFPOOL_H */
@@ -0,0 +1,392 @@
+/** Module rsb2_coro - Interface.
+ * @file rsb2_coro.h
+ * @author jp.tranvouez@navilab.com
+ * @defgroup rsb2_coro Coroutine Sessions
+ * @ingroup rsb2_libos
+ * @{
+ * C++20 coroutines over the sessions of rsb2_unixsock_serve. Each
+ * connection runs a handler coroutine that awaits its messages, replies
+ * and timers in sequence, as a blocking conversation would, but suspends
+ * instead of blocking: the event loop thread serves every other
+ * connection meanwhile, so a few loop threads (opts.nthreads) carry
+ * thousands of conversations. A suspended conversation costs its
+ * coroutine frame and its queued messages, no thread.
+ *
+ * @code
+ * rsb2::Task login(rsb2::Session &s)
+ * {
+ *	auto user = co_await s.recv(5000);
+ *	if (user && co_await s.send("password?") >= 0) {
+ *		auto pass = co_await s.recv(5000);
+ *		co_await s.send(pass && check(*user, *pass)? "ok": "denied");
+ *	}
+ * }
+ * ...
+ * rsb2_Unixsock_opts opts = {};
+ * opts.framed = true;
+ * rsb2::serve<login>("/run/login.sock", opts);
+ * @endcode
+ *
+ * A message is what fRecv would get: use framing (opts.framed) for
+ * message boundaries on a stream. Replies go through rsb2_unixsock_reply
+ * and never suspend; past the high-water mark of the connection the loop
+ * stops reading its requests, so the next recv waits for the peer to read
+ * its replies. The connection is closed when the handler returns, or
+ * throws (with an error event), and the handler is destroyed at its
+ * current suspension point when the connection ends first (peer closed,
+ * idle timeout, shutdown). With opts.shmring, the replies go through the
+ * shared-memory channel, so a session receives before it sends.
+ * Sessions run on the epoll engine only, rsb2_unixsock_serve falls back
+ * to it.
+ */
+#ifndef RSB2_CORO_H
+#define RSB2_CORO_H
+
+#if !defined(__cplusplus) || __cplusplus < 202002L
+#error "rsb2_coro.h requires C++20"
+#endif
+
+#include "rsb2_eventmgr.h"
+#include "rsb2_timer.h"
+#include "rsb2_unixsock.h"
+
+#include <coroutine>
+#include <deque>
+#include <exception>
+#include <new>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <utility>
+
+namespace rsb2 {
+
+class Session;
+
+/** Handler coroutine of a session.
+ * Started at once, destroyed with its session.
+ */
+class Task {
+public:
+	/** Coroutine promise. */
+	struct promise_type {
+		Task get_return_object() noexcept
+		{
+			return Task(std::coroutine_handle<promise_type>::from_promise(*this));
+		}
+		std::suspend_never initial_suspend() noexcept { return {}; }
+		std::suspend_always final_suspend() noexcept { return {}; }
+		void return_void() noexcept {}
+		/* an exception ends the handler, and the connection */
+		void unhandled_exception() noexcept
+		{
+			exception = std::current_exception();
+		}
+
+		std::exception_ptr exception;	/* Exception thrown or none. */
+	};
+
+	Task() noexcept = default;
+	Task(Task &&other) noexcept : m_handle(std::exchange(other.m_handle, {})) {}
+	Task &operator=(Task &&other) noexcept
+	{
+		if (this != &other) {
+			if (m_handle) {
+				m_handle.destroy();
+			}
+			m_handle = std::exchange(other.m_handle, {});
+		}
+		return *this;
+	}
+	~Task()
+	{
+		if (m_handle) {
+			m_handle.destroy();
+		}
+	}
+
+	/** Tell if the handler has returned.
+	 * @retval true returned or thrown
+	 * @retval false suspended
+	 */
+	bool done() const noexcept { return !m_handle || m_handle.done(); }
+
+	/** Get the exception that ended the handler.
+	 * @return exception thrown, null if none
+	 */
+	std::exception_ptr exception() const noexcept
+	{
+		return m_handle? m_handle.promise().exception: nullptr;
+	}
+
+private:
+	explicit Task(std::coroutine_handle<promise_type> handle) noexcept :
+			m_handle(handle) {}
+
+	std::coroutine_handle<promise_type> m_handle;	/* Coroutine frame. */
+};
+
+/** Session of a connection, passed to its handler. */
+class Session {
+public:
+	/** Awaiter of the next message. */
+	class Recv {
+	public:
+		bool await_ready() const noexcept
+		{
+			return !m_session.m_inbox.empty();
+		}
+		void await_suspend(std::coroutine_handle<> handle) noexcept
+		{
+			m_session.suspend(handle, true, m_maxms);
+		}
+		std::optional<std::string> await_resume()
+		{
+			m_session.resumed();
+			std::optional<std::string> msg;
+			if (!m_session.m_inbox.empty()) {
+				msg = std::move(m_session.m_inbox.front());
+				m_session.m_inbox.pop_front();
+			}
+			return msg;
+		}
+
+	private:
+		friend class Session;
+		Recv(Session &session, int maxms) noexcept :
+				m_session(session), m_maxms(maxms) {}
+
+		Session &m_session;				/* Session. */
+		int m_maxms;					/* Timeout (ms), 0 for none. */
+	};
+
+	/** Awaiter of a delay. */
+	class Sleep {
+	public:
+		bool await_ready() const noexcept { return m_ms <= 0; }
+		void await_suspend(std::coroutine_handle<> handle) noexcept
+		{
+			m_session.suspend(handle, false, m_ms);
+		}
+		void await_resume() noexcept { m_session.resumed(); }
+
+	private:
+		friend class Session;
+		Sleep(Session &session, int ms) noexcept :
+				m_session(session), m_ms(ms) {}
+
+		Session &m_session;				/* Session. */
+		int m_ms;						/* Delay (ms). */
+	};
+
+	/** Awaiter of a reply, never suspended. */
+	class Send {
+	public:
+		bool await_ready() const noexcept { return true; }
+		void await_suspend(std::coroutine_handle<>) noexcept {}
+		int await_resume() noexcept
+		{
+			return rsb2_unixsock_reply(m_sock, m_msg.data(), (int)m_msg.size());
+		}
+
+	private:
+		friend class Session;
+		Send(int sock, std::string_view msg) noexcept :
+				m_sock(sock), m_msg(msg) {}
+
+		int m_sock;						/* Service socket. */
+		std::string_view m_msg;			/* Reply message. */
+	};
+
+	Session(const Session &) = delete;
+	Session &operator=(const Session &) = delete;
+
+	/** Get the socket of the connection.
+	 * @return service socket file descriptor
+	 */
+	int sock() const noexcept { return m_sock; }
+
+	/** Wait for the next message.
+	 * @param maxms maximum wait time (ms), 0 for no limit
+	 * @return awaiter of the message, std::nullopt on timeout
+	 */
+	[[nodiscard]] Recv recv(int maxms = 0) noexcept { return Recv(*this, maxms); }
+
+	/** Reply, see rsb2_unixsock_reply.
+	 * The message is queued or sent before the awaiter returns.
+	 * @param msg reply message
+	 * @return awaiter of the rsb2_unixsock_reply result
+	 */
+	[[nodiscard]] Send send(std::string_view msg) noexcept
+	{
+		return Send(m_sock, msg);
+	}
+
+	/** Wait for a delay, on the timer wheel of the loop.
+	 * Messages received meanwhile are kept for recv.
+	 * @param ms delay (ms)
+	 * @return awaiter of the delay
+	 */
+	[[nodiscard]] Sleep sleep(int ms) noexcept { return Sleep(*this, ms); }
+
+	/** Stop the server when the current message is processed.
+	 * Without effect from a timer.
+	 */
+	void stopServer() noexcept { m_stop = true; }
+
+	/* Session functions of rsb2_unixsock_serve. */
+	template <Task (*Handler)(Session &)>
+	static void *open(int sock) noexcept;
+	static void close(int sock, void *ctx) noexcept;
+	static int recvMsg(int sock, const char *msg, int msglen) noexcept;
+
+private:
+	/* opened by the loop of the connection, whose wheel runs the timer */
+	explicit Session(int sock) noexcept :
+			m_sock(sock), m_wheel(rsb2_unixsock_wheel())
+	{
+		rsb2_timer_init(&m_timer, wake, this);
+	}
+	~Session()
+	{
+		/* possibly from another thread, freeing the loop at shutdown */
+		if (m_wheel) {
+			rsb2_timer_cancel(m_wheel, &m_timer);
+		}
+	}
+
+	void suspend(std::coroutine_handle<> handle, bool wantMsg, int ms) noexcept
+	{
+		m_waiter = handle;
+		m_wantMsg = wantMsg;
+		if (ms > 0 && m_wheel) {
+			rsb2_timer_arm(m_wheel, &m_timer, ms, 0);
+		}
+	}
+
+	void resumed() noexcept
+	{
+		m_waiter = {};
+		m_wantMsg = false;
+		if (m_wheel) {
+			rsb2_timer_cancel(m_wheel, &m_timer);
+		}
+	}
+
+	/* the handler has returned: report an exception that ended it */
+	void finished() noexcept
+	{
+		m_closing = true;
+		std::exception_ptr exception = m_task.exception();
+		if (exception) {
+			const char *what = "unknown";
+			try {
+				std::rethrow_exception(exception);
+			} catch (const std::exception &ex) {
+				what = ex.what();
+			} catch (...) {
+			}
+			/* notify handler ended by an exception */
+			RSB2_ERROR("coro_exception", "sock=%d,what=%s", m_sock, what);
+		}
+	}
+
+	/* resume the handler, close the connection once it has returned */
+	int resume(bool fromLoop) noexcept
+	{
+		if (m_waiter) {
+			m_waiter.resume();
+		}
+		int ret = m_stop? 2: 0;
+		if (!ret && m_task.done() && !m_closing) {
+			finished();
+			if (fromLoop) {
+				ret = 1;
+			} else {
+				rsb2_unixsock_close(m_sock);
+			}
+		}
+		return ret;
+	}
+
+	static void wake(rsb2_Timer *, void *arg) noexcept
+	{
+		static_cast<Session *>(arg)->resume(false);
+	}
+
+	int m_sock;							/* Service socket. */
+	rsb2_Timer_wheel *m_wheel;			/* Wheel of the loop or NULL. */
+	bool m_wantMsg = false;				/* Suspended in recv. */
+	bool m_closing = false;				/* Handler returned. */
+	bool m_stop = false;				/* Server stop requested. */
+	std::coroutine_handle<> m_waiter;	/* Suspended handler or none. */
+	std::deque<std::string> m_inbox;	/* Messages not yet received. */
+	rsb2_Timer m_timer;					/* Timeout of recv or sleep. */
+	Task m_task;						/* Handler, destroyed first. */
+};
+
+template <Task (*Handler)(Session &)>
+void *Session::open(int sock) noexcept
+{
+	Session *session = new (std::nothrow) Session(sock);
+	if (!session) {
+		rsb2_unixsock_close(sock);
+	} else {
+		/* the handler runs until it first waits */
+		try {
+			session->m_task = Handler(*session);
+		} catch (...) {
+			/* notify coroutine frame not allocated */
+			RSB2_ERROR("coro_open", "sock=%d", sock);
+		}
+		if (session->m_task.done()) {
+			session->finished();
+			rsb2_unixsock_close(sock);
+		}
+	}
+	return session;
+}
+
+inline void Session::close(int, void *ctx) noexcept
+{
+	delete static_cast<Session *>(ctx);
+}
+
+inline int Session::recvMsg(int sock, const char *msg, int msglen) noexcept
+{
+	Session *session = static_cast<Session *>(rsb2_unixsock_context(sock));
+	int ret = 1;
+	if (session && !session->m_closing) {
+		try {
+			/* kept until the handler receives it */
+			session->m_inbox.emplace_back(msg, msglen);
+			ret = session->m_wantMsg? session->resume(true):
+					session->m_stop? 2: 0;
+		} catch (...) {
+			/* notify message lost, the conversation cannot go on */
+			RSB2_ERROR("coro_recv", "sock=%d,msglen=%d", sock, msglen);
+		}
+	}
+	return ret;
+}
+
+/** Run a Unix socket server whose connections are handler coroutines.
+ * See rsb2_unixsock_serve; the session functions of opts are replaced.
+ * @tparam Handler handler coroutine of each connection
+ * @param path filesystem path of Unix socket
+ * @param opts server options
+ * @retval 0 normal shutdown
+ * @retval -1 error detected
+ */
+template <Task (*Handler)(Session &)>
+int serve(const char *path, rsb2_Unixsock_opts opts = {})
+{
+	opts.fOpen = Session::open<Handler>;
+	opts.fClose = Session::close;
+	opts.fRecvBuf = nullptr;
+	return rsb2_unixsock_serve(path, Session::recvMsg, &opts);
+}
+
+} // namespace rsb2
+
+#endif /*@} RSB2_CORO_H */
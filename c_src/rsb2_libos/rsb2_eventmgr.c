@@ -6,10 +6,64 @@
 #include "rsb2_assert.h"
 
 #include <errno.h>
+#include <pthread.h>
+#include <sched.h>
 #include <stdarg.h>
+#include <stdbool.h>
 #include <stddef.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
+#include <time.h>
+
+enum {
+	RSB2_EVENTMGR_DESCRSZ	= 256,		/* Event arguments size. */
+	RSB2_EVENTMGR_IDLE		= 100,		/* Max dispatcher sleep (ms). */
+	RSB2_EVENTMGR_WAIT		= 10,		/* Max producer wait (ms). */
+};
+
+/* Queued event. */
+typedef struct rsb2_Event_slot {
+	uint64_t seq;						/* Sequence, for the queue. */
+	const char *func;					/* Function name. */
+	const char *file;					/* Source file name. */
+	int line;							/* Source line number. */
+	const char *name;					/* Event name. */
+	bool hasDescr;						/* Event arguments present. */
+	char descr[RSB2_EVENTMGR_DESCRSZ];	/* Event arguments. */
+} rsb2_Event_slot;
+
+/* Bounded multi-producer queue, multi-consumer so that producers can
+ * drop the oldest event; slots are sequenced as in D. Vyukov's queue. */
+static rsb2_Event_slot *g_slots = NULL;	/* Queue slots. */
+static uint64_t g_mask = 0;				/* Queue index mask. */
+static uint64_t g_head __attribute__((aligned(64))) = 0;	/* Consumer. */
+static uint64_t g_tail __attribute__((aligned(64))) = 0;	/* Producers. */
+
+static int g_async = 0;					/* Asynchronous mode started. */
+static int g_inflight = 0;				/* Producers in the queue. */
+static rsb2_Event_policy g_policy = RSB2_EVENTMGR_DROP_NEWEST;	/* Overflow. */
+static rsb2_Event_stats g_stats;		/* Counters. */
+static pthread_mutex_t g_lock = PTHREAD_MUTEX_INITIALIZER;	/* Wakeups. */
+static pthread_cond_t g_ready = PTHREAD_COND_INITIALIZER;	/* Events queued. */
+static pthread_cond_t g_room = PTHREAD_COND_INITIALIZER;	/* Slots freed. */
+static int g_sleeping = 0;				/* Dispatcher waiting for events. */
+static int g_waiters = 0;				/* Producers waiting for room. */
+static bool g_stop = false;				/* Dispatcher stop requested. */
+static pthread_t g_dispatcher;			/* Dispatcher thread. */
+static __thread bool t_dispatcher = false;	/* Dispatcher thread itself. */
+
+/* Rate limit of an event name; entries are only added, under g_lock. */
+typedef struct rsb2_Event_limit {
+	char name[32];						/* Event name. */
+	unsigned max;						/* Max events per second, 0 if none. */
+	uint64_t second;					/* Current second. */
+	unsigned count;						/* Events in the current second. */
+	uint64_t suppressed;				/* Events suppressed, not reported. */
+} rsb2_Event_limit;
+
+static rsb2_Event_limit g_limits[RSB2_EVENTMGR_MAXLIMITS];	/* Limits. */
+static int g_nlimits = 0;				/* Number of limits. */
 
 static void rsb2_eventmgr_handle(const char *func, const char *file, int line,
 		const char *name, const char *descr)
@@ -30,72 +84,403 @@ void rsb2_eventmgr_setHandler(rsb2_Event_handler *fHandler)
 	g_fHandler = fHandler? fHandler: rsb2_eventmgr_handle;
 }
 
+/* copy an event but its sequence, owned by the queue */
+static void rsb2_eventmgr_copy(rsb2_Event_slot *dst, const rsb2_Event_slot *src)
+{
+	dst->func = src->func;
+	dst->file = src->file;
+	dst->line = src->line;
+	dst->name = src->name;
+	dst->hasDescr = src->hasDescr;
+	memcpy(dst->descr, src->descr, strlen(src->descr) + 1);
+}
+
+static bool rsb2_eventmgr_push(const rsb2_Event_slot *ev)
+{
+	uint64_t pos = __atomic_load_n(&g_tail, __ATOMIC_RELAXED);
+	rsb2_Event_slot *slot = NULL;
+	while (!slot) {
+		rsb2_Event_slot *cur = &g_slots[pos & g_mask];
+		int64_t diff = (int64_t)(__atomic_load_n(&cur->seq,
+				__ATOMIC_ACQUIRE) - pos);
+		if (diff == 0 && __atomic_compare_exchange_n(&g_tail, &pos, pos + 1,
+				true, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+			slot = cur;
+		} else if (diff < 0) {
+			/* full */
+			return false;
+		} else if (diff > 0) {
+			pos = __atomic_load_n(&g_tail, __ATOMIC_RELAXED);
+		}
+	}
+	rsb2_eventmgr_copy(slot, ev);
+	__atomic_store_n(&slot->seq, pos + 1, __ATOMIC_RELEASE);
+	return true;
+}
+
+static bool rsb2_eventmgr_pop(rsb2_Event_slot *ev)
+{
+	uint64_t pos = __atomic_load_n(&g_head, __ATOMIC_RELAXED);
+	rsb2_Event_slot *slot = NULL;
+	while (!slot) {
+		rsb2_Event_slot *cur = &g_slots[pos & g_mask];
+		int64_t diff = (int64_t)(__atomic_load_n(&cur->seq,
+				__ATOMIC_ACQUIRE) - (pos + 1));
+		if (diff == 0 && __atomic_compare_exchange_n(&g_head, &pos, pos + 1,
+				true, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+			slot = cur;
+		} else if (diff < 0) {
+			/* empty */
+			return false;
+		} else if (diff > 0) {
+			pos = __atomic_load_n(&g_head, __ATOMIC_RELAXED);
+		}
+	}
+	rsb2_eventmgr_copy(ev, slot);
+	__atomic_store_n(&slot->seq, pos + g_mask + 1, __ATOMIC_RELEASE);
+	return true;
+}
+
+static void rsb2_eventmgr_deadline(struct timespec *deadline, int ms)
+{
+	clock_gettime(CLOCK_REALTIME, deadline);
+	deadline->tv_nsec += ms * 1000000L;
+	deadline->tv_sec += deadline->tv_nsec / 1000000000L;
+	deadline->tv_nsec %= 1000000000L;
+}
+
+static void rsb2_eventmgr_enqueue(const rsb2_Event_slot *ev)
+{
+	bool queued = rsb2_eventmgr_push(ev);
+	bool blocked = false;
+	while (!queued) {
+		if (g_policy == RSB2_EVENTMGR_DROP_NEWEST) {
+			__atomic_add_fetch(&g_stats.droppedNewest, 1, __ATOMIC_RELAXED);
+			return;
+		} else if (g_policy == RSB2_EVENTMGR_DROP_OLDEST) {
+			rsb2_Event_slot old;
+			if (rsb2_eventmgr_pop(&old)) {
+				__atomic_add_fetch(&g_stats.droppedOldest, 1,
+						__ATOMIC_RELAXED);
+			}
+		} else {
+			struct timespec deadline;
+			rsb2_eventmgr_deadline(&deadline, RSB2_EVENTMGR_WAIT);
+			pthread_mutex_lock(&g_lock);
+			__atomic_add_fetch(&g_waiters, 1, __ATOMIC_RELAXED);
+			pthread_cond_signal(&g_ready);
+			pthread_cond_timedwait(&g_room, &g_lock, &deadline);
+			__atomic_sub_fetch(&g_waiters, 1, __ATOMIC_RELAXED);
+			pthread_mutex_unlock(&g_lock);
+			blocked = true;
+		}
+		queued = rsb2_eventmgr_push(ev);
+	}
+	__atomic_add_fetch(&g_stats.queued, 1, __ATOMIC_RELAXED);
+	__atomic_add_fetch(&g_stats.blocked, blocked, __ATOMIC_RELAXED);
+	/* pairs with the fence of the dispatcher going to sleep */
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+	if (__atomic_load_n(&g_sleeping, __ATOMIC_RELAXED)) {
+		pthread_mutex_lock(&g_lock);
+		pthread_cond_signal(&g_ready);
+		pthread_mutex_unlock(&g_lock);
+	}
+}
+
+/* Pass an event to the handler, or queue it in asynchronous mode. */
+static void rsb2_eventmgr_dispatch(const char *func, const char *file,
+		int line, const char *name, const char *descr)
+{
+	int err = errno;
+	bool queued = false;
+	if (!t_dispatcher) {
+		__atomic_add_fetch(&g_inflight, 1, __ATOMIC_SEQ_CST);
+		if (__atomic_load_n(&g_async, __ATOMIC_SEQ_CST)) {
+			rsb2_Event_slot ev;
+			ev.func = func;
+			ev.file = file;
+			ev.line = line;
+			ev.name = name;
+			ev.hasDescr = descr != NULL;
+			snprintf(ev.descr, sizeof(ev.descr), "%s", descr? descr: "");
+			rsb2_eventmgr_enqueue(&ev);
+			queued = true;
+		}
+		__atomic_sub_fetch(&g_inflight, 1, __ATOMIC_RELEASE);
+	}
+	if (!queued) {
+		g_fHandler(func, file, line, name, descr);
+	}
+	errno = err;
+}
+
+static void *rsb2_eventmgr_dispatcher(void *arg)
+{
+	(void)arg;
+	t_dispatcher = true;
+	bool stop = false;
+	while (!stop) {
+		rsb2_Event_slot ev;
+		while (rsb2_eventmgr_pop(&ev)) {
+			g_fHandler(ev.func, ev.file, ev.line, ev.name,
+					ev.hasDescr? ev.descr: NULL);
+			__atomic_add_fetch(&g_stats.dispatched, 1, __ATOMIC_RELAXED);
+			if (__atomic_load_n(&g_waiters, __ATOMIC_RELAXED)) {
+				pthread_mutex_lock(&g_lock);
+				pthread_cond_broadcast(&g_room);
+				pthread_mutex_unlock(&g_lock);
+			}
+		}
+		pthread_mutex_lock(&g_lock);
+		__atomic_store_n(&g_sleeping, 1, __ATOMIC_RELAXED);
+		/* pairs with the fence of the producers */
+		__atomic_thread_fence(__ATOMIC_SEQ_CST);
+		if (__atomic_load_n(&g_head, __ATOMIC_RELAXED) !=
+				__atomic_load_n(&g_tail, __ATOMIC_RELAXED)) {
+			/* events queued meanwhile */
+		} else if (g_stop) {
+			stop = true;
+		} else {
+			struct timespec deadline;
+			rsb2_eventmgr_deadline(&deadline, RSB2_EVENTMGR_IDLE);
+			pthread_cond_timedwait(&g_ready, &g_lock, &deadline);
+		}
+		__atomic_store_n(&g_sleeping, 0, __ATOMIC_RELAXED);
+		pthread_mutex_unlock(&g_lock);
+	}
+	return NULL;
+}
+
+int rsb2_eventmgr_startAsync(unsigned queuesz, rsb2_Event_policy policy)
+{
+	int err = -1;
+	uint64_t size = 2;
+	queuesz = queuesz? queuesz: RSB2_EVENTMGR_QUEUESZ;
+	while (size < queuesz && size < 1u << 20) {
+		size <<= 1;
+	}
+	pthread_mutex_lock(&g_lock);
+	bool started = g_slots != NULL;
+	pthread_mutex_unlock(&g_lock);
+	rsb2_Event_slot *slots = started? NULL: malloc(size * sizeof(*slots));
+	if (started) {
+		/* notify already started */
+		RSB2_ERROR("eventmgr_started", "queuesz=%u", queuesz);
+	} else if (!slots) {
+		/* notify allocation failure */
+		RSB2_ERRNO("malloc", "queuesz=%u", queuesz);
+	} else {
+		for (uint64_t i = 0; i < size; i++) {
+			slots[i].seq = i;
+		}
+		pthread_mutex_lock(&g_lock);
+		g_slots = slots;
+		g_mask = size - 1;
+		g_head = g_tail = 0;
+		g_policy = policy;
+		g_stop = false;
+		pthread_mutex_unlock(&g_lock);
+		err = pthread_create(&g_dispatcher, NULL, rsb2_eventmgr_dispatcher,
+				NULL);
+		if (err) {
+			pthread_mutex_lock(&g_lock);
+			g_slots = NULL;
+			pthread_mutex_unlock(&g_lock);
+			free(slots);
+			/* notify 'pthread_create' failure */
+			RSB2_ERRRET("pthread_create", err, "queuesz=%u", queuesz);
+			err = -1;
+		} else {
+			__atomic_store_n(&g_async, 1, __ATOMIC_SEQ_CST);
+		}
+	}
+	return err;
+}
+
+void rsb2_eventmgr_stopAsync(void)
+{
+	if (__atomic_exchange_n(&g_async, 0, __ATOMIC_SEQ_CST)) {
+		while (__atomic_load_n(&g_inflight, __ATOMIC_ACQUIRE)) {
+			/* let the producers that saw the asynchronous mode finish */
+			sched_yield();
+		}
+		pthread_mutex_lock(&g_lock);
+		g_stop = true;
+		pthread_cond_signal(&g_ready);
+		pthread_mutex_unlock(&g_lock);
+		pthread_join(g_dispatcher, NULL);
+		pthread_mutex_lock(&g_lock);
+		free(g_slots);
+		g_slots = NULL;
+		pthread_mutex_unlock(&g_lock);
+	}
+}
+
+void rsb2_eventmgr_stats(rsb2_Event_stats *stats)
+{
+	RSB2_ASSERT_NOTNULL(stats);
+	stats->queued = __atomic_load_n(&g_stats.queued, __ATOMIC_RELAXED);
+	stats->dispatched = __atomic_load_n(&g_stats.dispatched,
+			__ATOMIC_RELAXED);
+	stats->droppedNewest = __atomic_load_n(&g_stats.droppedNewest,
+			__ATOMIC_RELAXED);
+	stats->droppedOldest = __atomic_load_n(&g_stats.droppedOldest,
+			__ATOMIC_RELAXED);
+	stats->blocked = __atomic_load_n(&g_stats.blocked, __ATOMIC_RELAXED);
+}
+
+int rsb2_eventmgr_setLimit(const char *name, unsigned maxPerSec)
+{
+	RSB2_ASSERT_NOTNULL(name);
+	int err = 0;
+	rsb2_Event_limit *limit = NULL;
+	bool tooLong = strlen(name) >= sizeof(limit->name);
+	pthread_mutex_lock(&g_lock);
+	for (int i = 0; i < g_nlimits && !limit && !tooLong; i++) {
+		if (!strcmp(g_limits[i].name, name)) {
+			limit = &g_limits[i];
+		}
+	}
+	if (tooLong) {
+		err = -1;
+	} else if (limit) {
+		__atomic_store_n(&limit->max, maxPerSec, __ATOMIC_RELAXED);
+	} else if (g_nlimits < RSB2_EVENTMGR_MAXLIMITS) {
+		limit = &g_limits[g_nlimits];
+		snprintf(limit->name, sizeof(limit->name), "%s", name);
+		limit->max = maxPerSec;
+		/* the entry is complete before it is visible */
+		__atomic_store_n(&g_nlimits, g_nlimits + 1, __ATOMIC_RELEASE);
+	} else {
+		err = -1;
+	}
+	pthread_mutex_unlock(&g_lock);
+	if (tooLong) {
+		/* notify name too long, it would never match an event */
+		RSB2_ERROR("eventmgr_limitName", "name=%s,max=%zu", name,
+				sizeof(limit->name) - 1);
+	} else if (err) {
+		/* notify too many limits */
+		RSB2_ERROR("eventmgr_limits", "name=%s,max=%d", name,
+				RSB2_EVENTMGR_MAXLIMITS);
+	}
+	return err;
+}
+
+/* Check the rate limit of an event, before formatting it. */
+static bool rsb2_eventmgr_admit(const char *func, const char *file, int line,
+		const char *name)
+{
+	int nlimits = __atomic_load_n(&g_nlimits, __ATOMIC_ACQUIRE);
+	rsb2_Event_limit *limit = NULL;
+	for (int i = 0; i < nlimits && !limit; i++) {
+		if (!strcmp(g_limits[i].name, name)) {
+			limit = &g_limits[i];
+		}
+	}
+	unsigned max = limit? __atomic_load_n(&limit->max, __ATOMIC_RELAXED): 0;
+	bool admit = true;
+	if (max) {
+		struct timespec now;
+		clock_gettime(CLOCK_MONOTONIC_COARSE, &now);
+		uint64_t second = __atomic_load_n(&limit->second, __ATOMIC_RELAXED);
+		if ((uint64_t)now.tv_sec != second && __atomic_compare_exchange_n(
+				&limit->second, &second, now.tv_sec, false,
+				__ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+			/* new second: report the events suppressed */
+			__atomic_store_n(&limit->count, 0, __ATOMIC_RELAXED);
+			uint64_t suppressed = __atomic_exchange_n(&limit->suppressed, 0,
+					__ATOMIC_RELAXED);
+			if (suppressed) {
+				char descr[RSB2_EVENTMGR_DESCRSZ];
+				snprintf(descr, sizeof(descr), "name=%s,count=%llu", name,
+						(unsigned long long)suppressed);
+				rsb2_eventmgr_dispatch(func, file, line, "event_suppressed",
+						descr);
+			}
+		}
+		if (__atomic_add_fetch(&limit->count, 1, __ATOMIC_RELAXED) > max) {
+			__atomic_add_fetch(&limit->suppressed, 1, __ATOMIC_RELAXED);
+			admit = false;
+		}
+	}
+	return admit;
+}
+
 void rsb2_eventmgr_notify(const char *func, const char *file, int line,
 		const char *name, const char *fmt, ...)
 {
-	if (fmt && *fmt) {
+	if (!rsb2_eventmgr_admit(func, file, line, name)) {
+		/* suppressed */
+	} else if (fmt && *fmt) {
 		va_list ap;
 		va_start(ap, fmt);
 		char descr[256];
 		vsnprintf(descr, sizeof(descr), fmt, ap);
 		va_end(ap);
-		g_fHandler(func, file, line, name, descr);
+		rsb2_eventmgr_dispatch(func, file, line, name, descr);
 	} else {
-		g_fHandler(func, file, line, name, NULL);
+		rsb2_eventmgr_dispatch(func, file, line, name, NULL);
 	}
 }
 
 void rsb2_eventmgr_error(const char *func, const char *file, int line,
 		const char *name, const char *fmt, ...)
 {
-	if (fmt && *fmt) {
+	if (!rsb2_eventmgr_admit(func, file, line, name)) {
+		/* suppressed */
+	} else if (fmt && *fmt) {
 		va_list ap;
 		va_start(ap, fmt);
 		char descr[256];
 		vsnprintf(descr, sizeof(descr), fmt, ap);
 		va_end(ap);
-		g_fHandler(func, file, line, name, descr);
+		rsb2_eventmgr_dispatch(func, file, line, name, descr);
 	} else {
-		g_fHandler(func, file, line, name, NULL);
+		rsb2_eventmgr_dispatch(func, file, line, name, NULL);
 	}
 }
 
 void rsb2_eventmgr_errno(const char *func, const char *file, int line,
 		const char *fcn, int err, const char *fmt, ...)
 {
-	char descr[256];
-	if (fmt && *fmt) {
-		va_list ap;
-		va_start(ap, fmt);
-		char buf[256];
-		vsnprintf(buf, sizeof(buf), fmt, ap);
-		va_end(ap);
-		snprintf(descr, sizeof(descr), "fcn=%s,errno=%d,err=%s,%s",
-				fcn, err, strerror(err), buf);
-	} else {
-		snprintf(descr, sizeof(descr), "fcn=%s,errno=%d,err=%s",
-				fcn, err, strerror(err));
+	if (rsb2_eventmgr_admit(func, file, line, "errno_set")) {
+		char descr[256];
+		if (fmt && *fmt) {
+			va_list ap;
+			va_start(ap, fmt);
+			char buf[256];
+			vsnprintf(buf, sizeof(buf), fmt, ap);
+			va_end(ap);
+			snprintf(descr, sizeof(descr), "fcn=%s,errno=%d,err=%s,%s",
+					fcn, err, strerror(err), buf);
+		} else {
+			snprintf(descr, sizeof(descr), "fcn=%s,errno=%d,err=%s",
+					fcn, err, strerror(err));
+		}
+		rsb2_eventmgr_dispatch(func, file, line, "errno_set", descr);
 	}
-	g_fHandler(func, file, line, "errno_set", descr);
 }
 
 void rsb2_eventmgr_errret(const char *func, const char *file, int line,
 		const char *fcn, int ret, const char *fmt, ...)
 {
-	char descr[256];
-	if (fmt && *fmt) {
-		va_list ap;
-		va_start(ap, fmt);
-		char buf[256] = "";
-		vsnprintf(buf, sizeof(buf), fmt, ap);
-		va_end(ap);
-		snprintf(descr, sizeof(descr), "fcn=%s,ret=%d,%s",
-				fcn, ret, buf);
-	} else {
-		snprintf(descr, sizeof(descr), "fcn=%s,ret=%d",
-				fcn, ret);
+	if (rsb2_eventmgr_admit(func, file, line, "error_return")) {
+		char descr[256];
+		if (fmt && *fmt) {
+			va_list ap;
+			va_start(ap, fmt);
+			char buf[256] = "";
+			vsnprintf(buf, sizeof(buf), fmt, ap);
+			va_end(ap);
+			snprintf(descr, sizeof(descr), "fcn=%s,ret=%d,%s",
+					fcn, ret, buf);
+		} else {
+			snprintf(descr, sizeof(descr), "fcn=%s,ret=%d",
+					fcn, ret);
+		}
+		rsb2_eventmgr_dispatch(func, file, line, "error_return", descr);
 	}
-	g_fHandler(func, file, line, "error_return", descr);
 }
 
 /*END*/
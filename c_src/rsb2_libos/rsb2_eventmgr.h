@@ -9,6 +9,7 @@
 #define RSB2_EVENTMGR_H
 
 #include <errno.h>
+#include <stdint.h>
 
 #ifdef __cplusplus
 extern "C" {
@@ -30,6 +31,64 @@ typedef void rsb2_Event_handler(const char *func, const char *file, int line,
  */
 void rsb2_eventmgr_setHandler(rsb2_Event_handler *fHandler);
 
+/** Default queue size of the asynchronous mode. */
+#define RSB2_EVENTMGR_QUEUESZ	1024
+
+/** Overflow policy of the asynchronous mode. */
+typedef enum rsb2_Event_policy {
+	RSB2_EVENTMGR_DROP_NEWEST	= 0,	/**< Drop the event notified. */
+	RSB2_EVENTMGR_DROP_OLDEST,			/**< Drop the oldest queued event. */
+	RSB2_EVENTMGR_BLOCK,				/**< Wait for room in the queue. */
+} rsb2_Event_policy;
+
+/** Counters of the asynchronous mode, from rsb2_eventmgr_stats(). */
+typedef struct rsb2_Event_stats {
+	uint64_t queued;					/**< Events queued. */
+	uint64_t dispatched;				/**< Events passed to the handler. */
+	uint64_t droppedNewest;				/**< Events dropped when notified. */
+	uint64_t droppedOldest;				/**< Queued events dropped. */
+	uint64_t blocked;					/**< Notifications that waited. */
+} rsb2_Event_stats;
+
+/** Start the asynchronous mode.
+ * Events are formatted by the notifying thread, queued, and passed to the
+ * handler by a dispatcher thread. Function, file and event names must be
+ * static strings, as with the notification macros.
+ * @param queuesz number of queued events, rounded up to a power of two,
+ * or 0 for RSB2_EVENTMGR_QUEUESZ
+ * @param policy overflow policy
+ * @retval 0 success
+ * @retval -1 error, or already started
+ */
+int rsb2_eventmgr_startAsync(unsigned queuesz, rsb2_Event_policy policy);
+
+/** Stop the asynchronous mode.
+ * Dispatch the queued events and stop the dispatcher thread; events are
+ * passed to the handler synchronously again afterwards.
+ */
+void rsb2_eventmgr_stopAsync(void);
+
+/** Get the counters of the asynchronous mode, cumulated since the first
+ * start.
+ * @param stats counters
+ */
+void rsb2_eventmgr_stats(rsb2_Event_stats *stats);
+
+/** Max number of rate-limited event names. */
+#define RSB2_EVENTMGR_MAXLIMITS	32
+
+/** Limit the rate of an event name.
+ * Past maxPerSec events in a second, the events are suppressed; the first
+ * event of a later second is preceded by an "event_suppressed" event with
+ * the count. The limit is checked before formatting the event arguments.
+ * @param name event name, "errno_set" and "error_return" for errno and
+ * error return events, 31 characters at most
+ * @param maxPerSec max events per second, 0 for no limit
+ * @retval 0 success
+ * @retval -1 error, too many event names or name too long
+ */
+int rsb2_eventmgr_setLimit(const char *name, unsigned maxPerSec);
+
 /** Notify an event.
  * @param func function name
  * @param file source file name
@@ -0,0 +1,352 @@
+/** Module rsb2_frame - Implementation.
+ * @file rsb2_frame.c
+ * @author jp.tranvouez@navilab.com
+ */
+#include "rsb2_frame.h"
+#include "rsb2_bufpool.h"
+#include "rsb2_metrics.h"
+#include "rsb2_module.h"
+#include "rsb2_socket.h"
+
+#include <errno.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <arpa/inet.h>
+
+enum {
+	RSB2_FRAME_RINGSZ			= 16384,	/* Initial ring size. */
+};
+
+static int g_module = -1;				/* Module reference. */
+
+int rsb2_frame_begin(void)
+{
+	RSB2_TRACE_ENTRY();
+	g_module = rsb2_module_ref("rsb2_frame");
+	int err = g_module < 0;
+	RSB2_TRACE_EXIT_INT(err);
+	return err;
+}
+
+void rsb2_frame_end(void)
+{
+	RSB2_TRACE_ENTRY();
+	rsb2_module_destroy(g_module);
+	RSB2_TRACE_EXIT();
+}
+
+void rsb2_frame_init(rsb2_Frame_ring *ring)
+{
+	RSB2_TRACE_ARGS("ring=%p", ring);
+	RSB2_ASSERT_NOTNULL(ring);
+	memset(ring, 0, sizeof(*ring));
+	RSB2_TRACE_EXIT();
+}
+
+void rsb2_frame_free(rsb2_Frame_ring *ring)
+{
+	RSB2_TRACE_ARGS("ring=%p", ring);
+	RSB2_ASSERT_NOTNULL(ring);
+	rsb2_bufpool_put(ring->buf);
+	free(ring->scratch);
+	memset(ring, 0, sizeof(*ring));
+	RSB2_TRACE_EXIT();
+}
+
+static void rsb2_frame_copy(const rsb2_Frame_ring *ring, unsigned off,
+		char *dst, unsigned len)
+{
+	/* copy bytes at head + off, splitting at the end of the buffer */
+	unsigned pos = (ring->head + off) & (ring->size - 1);
+	unsigned n = ring->size - pos;
+	if (n > len) {
+		n = len;
+	}
+	memcpy(dst, ring->buf + pos, n);
+	memcpy(dst + n, ring->buf, len - n);
+}
+
+static int rsb2_frame_grow(rsb2_Frame_ring *ring, unsigned need)
+{
+	RSB2_TRACE_ARGS("ring=%p,need=%u", ring, need);
+	int err = 0;
+	unsigned size = ring->size? ring->size: RSB2_FRAME_RINGSZ;
+	while (size < need) {
+		size *= 2;
+	}
+	if (size != ring->size) {
+		/* pooled buffer, its capacity is a power of two as well */
+		size_t cap = 0;
+		char *buf = rsb2_bufpool_get(size, &cap);
+		if (!buf) {
+			RSB2_ERRTRACE();
+			err = -1;
+		} else {
+			/* move buffered bytes to the start of the new buffer */
+			unsigned len = ring->tail - ring->head;
+			if (len) {
+				rsb2_frame_copy(ring, 0, buf, len);
+			}
+			rsb2_bufpool_put(ring->buf);
+			ring->buf = buf;
+			ring->size = cap;
+			ring->head = 0;
+			ring->tail = len;
+		}
+	}
+	RSB2_TRACE_EXIT_INT(err);
+	return err;
+}
+
+static int rsb2_frame_next(rsb2_Frame_ring *ring, unsigned *plen)
+{
+	RSB2_TRACE_ARGS("ring=%p,plen=%p", ring, plen);
+	int ret = 0;
+	unsigned avail = ring->tail - ring->head;
+	if (avail >= RSB2_FRAME_HDRSZ) {
+		uint32_t hdr;
+		rsb2_frame_copy(ring, 0, (char *)&hdr, sizeof(hdr));
+		unsigned len = ntohl(hdr);
+		if (len > RSB2_FRAME_MAXLEN) {
+			/* notify invalid frame */
+			RSB2_ERROR("frame_invalid", "len=%u", len);
+			ret = -1;
+		} else if (avail - RSB2_FRAME_HDRSZ >= len) {
+			/* complete frame */
+			*plen = len;
+			ret = 1;
+		} else if (rsb2_frame_grow(ring, RSB2_FRAME_HDRSZ + len)) {
+			/* incomplete frame larger than the ring */
+			RSB2_ERRTRACE();
+			ret = -1;
+		}
+	}
+	RSB2_TRACE_EXIT_INT(ret);
+	return ret;
+}
+
+static const char *rsb2_frame_payload(rsb2_Frame_ring *ring, unsigned len)
+{
+	RSB2_TRACE_ARGS("ring=%p,len=%u", ring, len);
+	const char *msg = NULL;
+	unsigned pos = (ring->head + RSB2_FRAME_HDRSZ) & (ring->size - 1);
+	if (pos + len <= ring->size) {
+		/* contiguous payload */
+		msg = ring->buf + pos;
+	} else {
+		/* payload wraps around, linearize it */
+		if (ring->scratchsz < len) {
+			char *scratch = realloc(ring->scratch, len);
+			if (!scratch) {
+				/* notify 'realloc' failure */
+				RSB2_ERRNO("realloc", "len=%u", len);
+			} else {
+				ring->scratch = scratch;
+				ring->scratchsz = len;
+			}
+		}
+		if (ring->scratchsz >= len) {
+			rsb2_frame_copy(ring, RSB2_FRAME_HDRSZ, ring->scratch, len);
+			msg = ring->scratch;
+		}
+	}
+	RSB2_TRACE_EXIT_PTR(msg);
+	return msg;
+}
+
+static int rsb2_frame_fill(int sock, rsb2_Frame_ring *ring)
+{
+	RSB2_TRACE_ARGS("sock=%d,ring=%p", sock, ring);
+	int len = -1;
+	unsigned used = ring->tail - ring->head;
+	if (!used) {
+		/* empty ring, restart at the beginning */
+		ring->head = ring->tail = 0;
+	}
+	if (rsb2_frame_grow(ring, used + 1)) {
+		RSB2_ERRTRACE();
+		errno = ENOMEM;
+	} else {
+		/* read once into the free space, in two parts if it wraps */
+		unsigned pos = ring->tail & (ring->size - 1);
+		unsigned n = ring->size - pos;
+		if (n > ring->size - used) {
+			n = ring->size - used;
+		}
+		struct iovec iov[2];
+		iov[0].iov_base = ring->buf + pos;
+		iov[0].iov_len = n;
+		iov[1].iov_base = ring->buf;
+		iov[1].iov_len = ring->size - used - n;
+		len = rsb2_socket_recvv(sock, iov, iov[1].iov_len? 2: 1);
+		if (len > 0) {
+			ring->tail += len;
+		}
+	}
+	RSB2_TRACE_EXIT_INT(len);
+	return len;
+}
+
+int rsb2_frame_recv(int sock, rsb2_Frame_ring *ring, rsb2_Frame_recv fRecv)
+{
+	RSB2_TRACE_ARGS("sock=%d,ring=%p,fRecv=%p", sock, ring, fRecv);
+	RSB2_ASSERT_NOTNULL(ring);
+	RSB2_ASSERT_NOTNULL(fRecv);
+	int ret = 1;
+	int len = rsb2_frame_fill(sock, ring);
+	int err = errno;
+	if (len > 0) {
+		/* process every complete frame in one pass */
+		ret = 0;
+		unsigned msglen = 0;
+		int next = 0;
+		while (!ret && (next = rsb2_frame_next(ring, &msglen)) > 0) {
+			const char *msg = rsb2_frame_payload(ring, msglen);
+			if (!msg) {
+				RSB2_ERRTRACE();
+				ret = 1;
+			} else {
+				ret = rsb2_metrics_handle(fRecv, sock, msg, msglen);
+				ring->head += RSB2_FRAME_HDRSZ + msglen;
+			}
+		}
+		if (next < 0) {
+			/* framing error */
+			ret = 1;
+		}
+	} else if (len < 0 && (err == EAGAIN || err == EWOULDBLOCK)) {
+		/* no data available */
+		ret = -1;
+	}
+	RSB2_TRACE_EXIT_INT(ret);
+	errno = err;
+	return ret;
+}
+
+int rsb2_frame_recvref(int sock, rsb2_Frame_ring *ring, const char **pmsg)
+{
+	RSB2_TRACE_ARGS("sock=%d,ring=%p,pmsg=%p", sock, ring, pmsg);
+	RSB2_ASSERT_NOTNULL(ring);
+	RSB2_ASSERT_NOTNULL(pmsg);
+	int msglen = -1;
+	for (;;) {
+		unsigned len = 0;
+		int next = rsb2_frame_next(ring, &len);
+		if (next > 0) {
+			*pmsg = rsb2_frame_payload(ring, len);
+			if (!*pmsg) {
+				RSB2_ERRTRACE();
+			} else {
+				msglen = len;
+			}
+			/* the bytes are not overwritten before the next fill */
+			ring->head += RSB2_FRAME_HDRSZ + len;
+			break;
+		}
+		if (next < 0) {
+			RSB2_ERRTRACE();
+			break;
+		}
+		int count = rsb2_frame_fill(sock, ring);
+		if (count < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+			/* non-blocking socket, wait for more data */
+			if (rsb2_socket_rdwait(sock, 0) < 0) {
+				RSB2_ERRTRACE();
+				break;
+			}
+		} else if (count <= 0) {
+			/* peer closed or read error */
+			RSB2_ERROR("frame_incomplete", "sock=%d,count=%d", sock, count);
+			break;
+		}
+	}
+	RSB2_TRACE_EXIT_INT(msglen);
+	return msglen;
+}
+
+int rsb2_frame_recvmsg(int sock, rsb2_Frame_ring *ring, char *buf, int bufsz)
+{
+	RSB2_TRACE_ARGS("sock=%d,ring=%p,buf=%p,bufsz=%d", sock, ring, buf, bufsz);
+	RSB2_ASSERT_NOTNULL(buf);
+	const char *msg = NULL;
+	int msglen = rsb2_frame_recvref(sock, ring, &msg);
+	if (msglen > bufsz) {
+		/* notify message truncation */
+		RSB2_ERROR("frame_too_long", "len=%d,bufsz=%d", msglen, bufsz);
+		msglen = -1;
+	} else if (msglen > 0) {
+		memcpy(buf, msg, msglen);
+	}
+	RSB2_TRACE_EXIT_INT(msglen);
+	return msglen;
+}
+
+static int rsb2_frame_sendallv(int sock, struct iovec *iov, int iovcnt)
+{
+	RSB2_TRACE_ARGS("sock=%d,iov=%p,iovcnt=%d", sock, iov, iovcnt);
+	int err = 0;
+	while (iovcnt > 0 && !err) {
+		int count = rsb2_socket_sendv(sock, iov, iovcnt);
+		if (count >= 0) {
+			/* skip what was sent, resume a short write */
+			while (iovcnt > 0 && (size_t)count >= iov->iov_len) {
+				count -= iov->iov_len;
+				iov++;
+				iovcnt--;
+			}
+			if (iovcnt > 0) {
+				iov->iov_base = (char *)iov->iov_base + count;
+				iov->iov_len -= count;
+			}
+		} else if (errno == EAGAIN || errno == EWOULDBLOCK) {
+			/* non-blocking socket, wait for buffer space */
+			if (rsb2_socket_wrwait(sock, 0) < 0) {
+				RSB2_ERRTRACE();
+				err = -1;
+			}
+		} else {
+			RSB2_ERRTRACE();
+			err = -1;
+		}
+	}
+	RSB2_TRACE_EXIT_INT(err);
+	return err;
+}
+
+int rsb2_frame_sendhdr(int sock, const char *hdr, int hdrlen,
+		const char *msg, int msglen)
+{
+	RSB2_TRACE_ARGS("sock=%d,hdr=%p,hdrlen=%d,msg=%p,msglen=%d",
+			sock, hdr, hdrlen, msg, msglen);
+	RSB2_ASSERT_NOTNEGINT(hdrlen);
+	RSB2_ASSERT_NOTNEGINT(msglen);
+	RSB2_ASSERT(msglen <= RSB2_FRAME_MAXLEN - hdrlen);
+	uint32_t len = htonl(hdrlen + msglen);
+	/* frame header, protocol header and message in a single write */
+	struct iovec iov[3];
+	int iovcnt = 0;
+	iov[iovcnt].iov_base = &len;
+	iov[iovcnt++].iov_len = RSB2_FRAME_HDRSZ;
+	if (hdrlen) {
+		iov[iovcnt].iov_base = (char *)hdr;
+		iov[iovcnt++].iov_len = hdrlen;
+	}
+	if (msglen) {
+		iov[iovcnt].iov_base = (char *)msg;
+		iov[iovcnt++].iov_len = msglen;
+	}
+	int err = rsb2_frame_sendallv(sock, iov, iovcnt);
+	RSB2_TRACE_EXIT_INT(err);
+	return err;
+}
+
+int rsb2_frame_send(int sock, const char *msg, int msglen)
+{
+	RSB2_TRACE_ARGS("sock=%d,msg=%p,msglen=%d", sock, msg, msglen);
+	int err = rsb2_frame_sendhdr(sock, NULL, 0, msg, msglen);
+	RSB2_TRACE_EXIT_INT(err);
+	return err;
+}
+
+/*END*/
@@ -0,0 +1,120 @@
+/** Module rsb2_frame - Interface.
+ * @file rsb2_frame.h
+ * @author jp.tranvouez@navilab.com
+ * @defgroup rsb2_frame Length-Prefixed Message Framing
+ * @ingroup rsb2_libos
+ * @{
+ */
+#ifndef RSB2_FRAME_H
+#define RSB2_FRAME_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** Size of a frame header (payload length, network byte order). */
+#define RSB2_FRAME_HDRSZ		4
+
+/** Maximum payload length of a frame. */
+#define RSB2_FRAME_MAXLEN		(64 * 1024 * 1024)
+
+/** Reassembly ring buffer of a stream connection.
+ * Bytes between head and tail are buffered, both are free-running
+ * counters masked by size - 1.
+ */
+typedef struct rsb2_Frame_ring {
+	char *buf;				/**< Buffer address or NULL. */
+	unsigned size;			/**< Buffer size, a power of two. */
+	unsigned head;			/**< Read counter. */
+	unsigned tail;			/**< Write counter. */
+	char *scratch;			/**< Copy of a frame wrapping around the end. */
+	unsigned scratchsz;		/**< Scratch buffer size. */
+} rsb2_Frame_ring;
+
+/** Process a complete message.
+ * Same contract as rsb2_Unixsock_recv.
+ * @param sock service socket file descriptor
+ * @param msg message address
+ * @param msglen message length
+ * @retval 0 continue
+ * @retval 1 close service socket
+ * @retval 2 stop server
+ */
+typedef int rsb2_Frame_recv(int sock, const char *msg, int msglen);
+
+/** Initialize an empty ring buffer.
+ * The buffer is allocated on first use.
+ * @param ring ring buffer
+ */
+void rsb2_frame_init(rsb2_Frame_ring *ring);
+
+/** Release the memory of a ring buffer.
+ * @param ring ring buffer
+ */
+void rsb2_frame_free(rsb2_Frame_ring *ring);
+
+/** Send a message as one frame.
+ * Short writes are resumed until the whole frame is sent.
+ * @param sock service socket file descriptor
+ * @param msg message address
+ * @param msglen message length
+ * @retval 0 success
+ * @retval -1 error
+ */
+int rsb2_frame_send(int sock, const char *msg, int msglen);
+
+/** Send a message prefixed with a protocol header as one frame.
+ * The frame payload is the header followed by the message.
+ * @param sock service socket file descriptor
+ * @param hdr header address
+ * @param hdrlen header length
+ * @param msg message address
+ * @param msglen message length
+ * @retval 0 success
+ * @retval -1 error
+ */
+int rsb2_frame_sendhdr(int sock, const char *hdr, int hdrlen,
+		const char *msg, int msglen);
+
+/** Read data from a socket and process every complete frame.
+ * A single read is issued; all frames completed by it are passed to
+ * fRecv in order, each one contiguous in memory. Processing stops at the
+ * first non-zero fRecv result.
+ * @param sock service socket file descriptor
+ * @param ring reassembly ring buffer of the connection
+ * @param fRecv message processing function
+ * @retval 0 continue
+ * @retval 1 close service socket (requested, peer closed or error)
+ * @retval 2 stop server
+ * @retval -1 no data available on a non-blocking socket (errno is EAGAIN)
+ */
+int rsb2_frame_recv(int sock, rsb2_Frame_ring *ring, rsb2_Frame_recv fRecv);
+
+/** Read one message from a socket.
+ * Blocks until a complete frame is available. Frames read beyond it
+ * stay in the ring buffer for the next call.
+ * @param sock service socket file descriptor
+ * @param ring reassembly ring buffer of the connection
+ * @param buf message buffer address
+ * @param bufsz message buffer size
+ * @return message length
+ * @retval -1 error, peer closed, or message longer than bufsz
+ */
+int rsb2_frame_recvmsg(int sock, rsb2_Frame_ring *ring, char *buf, int bufsz);
+
+/** Read one message from a socket without copying it.
+ * Blocks until a complete frame is available. The message stays valid
+ * until the next operation on the ring buffer.
+ * @param sock service socket file descriptor
+ * @param ring reassembly ring buffer of the connection
+ * @param pmsg returned message address
+ * @return message length
+ * @retval -1 error or peer closed
+ */
+int rsb2_frame_recvref(int sock, rsb2_Frame_ring *ring, const char **pmsg);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /*@} RSB2_FRAME_H */
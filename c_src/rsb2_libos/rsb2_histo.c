@@ -0,0 +1,110 @@
+/** Module rsb2_histo - Implementation.
+ * @file rsb2_histo.c
+ * @author jp.tranvouez@navilab.com
+ */
+#include "rsb2_histo.h"
+#include "rsb2_module.h"
+
+static int g_module = -1;				/* Module reference. */
+
+int rsb2_histo_begin(void)
+{
+	g_module = rsb2_module_ref("rsb2_histo");
+	int err = g_module < 0;
+	return err;
+}
+
+void rsb2_histo_end(void)
+{
+	rsb2_module_destroy(g_module);
+}
+
+/* Highest value of a bucket. */
+static uint64_t rsb2_histo_upper(unsigned bucket)
+{
+	uint64_t value = bucket;
+	if (bucket >= RSB2_HISTO_SUBBUCKETS) {
+		unsigned shift = (bucket >> RSB2_HISTO_SUBBITS) - 1;
+		uint64_t sub = RSB2_HISTO_SUBBUCKETS +
+				(bucket & (RSB2_HISTO_SUBBUCKETS - 1));
+		value = (sub << shift) + ((1ull << shift) - 1);
+	}
+	return value;
+}
+
+/* Copy the buckets, return the number of values they hold. */
+static uint64_t rsb2_histo_copy(const rsb2_Histo *histo, uint64_t *buckets)
+{
+	uint64_t count = 0;
+	for (int i = 0; i < RSB2_HISTO_BUCKETS; i++) {
+		buckets[i] = __atomic_load_n(&histo->buckets[i], __ATOMIC_RELAXED);
+		count += buckets[i];
+	}
+	return count;
+}
+
+/* Get the quantiles of a bucket copy, qs in increasing order. */
+static void rsb2_histo_quantiles(const uint64_t *buckets, uint64_t count,
+		uint64_t max, const double *qs, uint64_t *values, int nqs)
+{
+	uint64_t seen = 0;
+	int bucket = 0;
+	for (int i = 0; i < nqs; i++) {
+		/* rank of the quantile, from 1 to count */
+		uint64_t rank = qs[i] * count + 0.5;
+		rank = rank? rank: 1;
+		while (bucket < RSB2_HISTO_BUCKETS && seen + buckets[bucket] < rank) {
+			seen += buckets[bucket++];
+		}
+		uint64_t value = count? rsb2_histo_upper(bucket): 0;
+		values[i] = value < max? value: max;
+	}
+}
+
+uint64_t rsb2_histo_quantile(const rsb2_Histo *histo, double q)
+{
+	RSB2_ASSERT_NOTNULL(histo);
+	uint64_t buckets[RSB2_HISTO_BUCKETS];
+	uint64_t count = rsb2_histo_copy(histo, buckets);
+	uint64_t value = 0;
+	rsb2_histo_quantiles(buckets, count,
+			__atomic_load_n(&histo->max, __ATOMIC_RELAXED), &q, &value, 1);
+	return value;
+}
+
+void rsb2_histo_snapshot(const rsb2_Histo *histo, rsb2_Histo_snap *snap)
+{
+	RSB2_TRACE_ARGS("histo=%p,snap=%p", histo, snap);
+	RSB2_ASSERT_NOTNULL(histo);
+	RSB2_ASSERT_NOTNULL(snap);
+	static const double qs[] = { 0.5, 0.9, 0.99, 0.999 };
+	uint64_t values[sizeof(qs) / sizeof(qs[0])];
+	uint64_t buckets[RSB2_HISTO_BUCKETS];
+	/* count and sum from the same moment as the buckets, near enough */
+	uint64_t sum = __atomic_load_n(&histo->sum, __ATOMIC_RELAXED);
+	uint64_t count = rsb2_histo_copy(histo, buckets);
+	snap->count = count;
+	snap->max = __atomic_load_n(&histo->max, __ATOMIC_RELAXED);
+	snap->mean = count? sum / count: 0;
+	rsb2_histo_quantiles(buckets, count, snap->max, qs, values, 4);
+	snap->p50 = values[0];
+	snap->p90 = values[1];
+	snap->p99 = values[2];
+	snap->p999 = values[3];
+	RSB2_TRACE_EXIT();
+}
+
+void rsb2_histo_reset(rsb2_Histo *histo)
+{
+	RSB2_TRACE_ARGS("histo=%p", histo);
+	RSB2_ASSERT_NOTNULL(histo);
+	for (int i = 0; i < RSB2_HISTO_BUCKETS; i++) {
+		__atomic_store_n(&histo->buckets[i], 0, __ATOMIC_RELAXED);
+	}
+	__atomic_store_n(&histo->count, 0, __ATOMIC_RELAXED);
+	__atomic_store_n(&histo->sum, 0, __ATOMIC_RELAXED);
+	__atomic_store_n(&histo->max, 0, __ATOMIC_RELAXED);
+	RSB2_TRACE_EXIT();
+}
+
+/*END*/
@@ -0,0 +1,126 @@
+/** Module rsb2_histo - Interface.
+ * @file rsb2_histo.h
+ * @author jp.tranvouez@navilab.com
+ * @defgroup rsb2_histo Latency Histogram
+ * @ingroup rsb2_libos
+ * @{
+ * Lock-free histogram of durations with logarithmic buckets, as in HDR
+ * histograms: each power of two is split into RSB2_HISTO_SUBBUCKETS
+ * linear buckets, so a recorded value is known within 1/16 (6%) over
+ * the whole range of uint64_t. Recording is a few relaxed atomic adds.
+ */
+#ifndef RSB2_HISTO_H
+#define RSB2_HISTO_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <time.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** Log2 of the number of buckets per power of two. */
+#define RSB2_HISTO_SUBBITS		4
+
+/** Number of buckets per power of two. */
+#define RSB2_HISTO_SUBBUCKETS	(1 << RSB2_HISTO_SUBBITS)
+
+/** Number of buckets. */
+#define RSB2_HISTO_BUCKETS		((64 - RSB2_HISTO_SUBBITS + 1) * \
+								RSB2_HISTO_SUBBUCKETS)
+
+/** Histogram, zero-initialized. */
+typedef struct rsb2_Histo {
+	uint64_t count;						/**< Number of values. */
+	uint64_t sum;						/**< Sum of values. */
+	uint64_t max;						/**< Max value. */
+	uint64_t buckets[RSB2_HISTO_BUCKETS];	/**< Counts by bucket. */
+} rsb2_Histo;
+
+/** Histogram summary, from rsb2_histo_snapshot(). */
+typedef struct rsb2_Histo_snap {
+	uint64_t count;						/**< Number of values. */
+	uint64_t mean;						/**< Mean value. */
+	uint64_t p50;						/**< Median. */
+	uint64_t p90;						/**< 90th percentile. */
+	uint64_t p99;						/**< 99th percentile. */
+	uint64_t p999;						/**< 99.9th percentile. */
+	uint64_t max;						/**< Max value. */
+} rsb2_Histo_snap;
+
+/** Get the monotonic time, for durations.
+ * @return time (ns)
+ */
+static inline uint64_t rsb2_histo_now(void)
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return now.tv_sec * 1000000000ull + now.tv_nsec;
+}
+
+/** Get the bucket of a value.
+ * @param value value
+ * @return bucket index
+ */
+static inline unsigned rsb2_histo_bucket(uint64_t value)
+{
+	unsigned bucket = value;
+	if (value >= RSB2_HISTO_SUBBUCKETS) {
+		unsigned shift = 63 - __builtin_clzll(value) - RSB2_HISTO_SUBBITS;
+		bucket = (shift + 1) << RSB2_HISTO_SUBBITS |
+				((value >> shift) & (RSB2_HISTO_SUBBUCKETS - 1));
+	}
+	return bucket;
+}
+
+/** Record a value.
+ * @param histo histogram
+ * @param value value, a duration (ns)
+ */
+static inline void rsb2_histo_record(rsb2_Histo *histo, uint64_t value)
+{
+	__atomic_add_fetch(&histo->buckets[rsb2_histo_bucket(value)], 1,
+			__ATOMIC_RELAXED);
+	__atomic_add_fetch(&histo->count, 1, __ATOMIC_RELAXED);
+	__atomic_add_fetch(&histo->sum, value, __ATOMIC_RELAXED);
+	uint64_t max = __atomic_load_n(&histo->max, __ATOMIC_RELAXED);
+	while (value > max && !__atomic_compare_exchange_n(&histo->max, &max,
+			value, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+		/* max reloaded */
+	}
+}
+
+/** Record the duration since a start time.
+ * @param histo histogram
+ * @param start start time, from rsb2_histo_now()
+ */
+static inline void rsb2_histo_since(rsb2_Histo *histo, uint64_t start)
+{
+	rsb2_histo_record(histo, rsb2_histo_now() - start);
+}
+
+/** Get the value at a quantile.
+ * @param histo histogram
+ * @param q quantile, 0.0 to 1.0
+ * @return highest value of the bucket of the quantile, at most the max
+ */
+uint64_t rsb2_histo_quantile(const rsb2_Histo *histo, double q);
+
+/** Summarize a histogram while values are recorded.
+ * @param histo histogram
+ * @param snap summary
+ */
+void rsb2_histo_snapshot(const rsb2_Histo *histo, rsb2_Histo_snap *snap);
+
+/** Clear a histogram.
+ * Values recorded meanwhile may be partly kept.
+ * @param histo histogram
+ */
+void rsb2_histo_reset(rsb2_Histo *histo);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /*@} RSB2_HISTO_H */
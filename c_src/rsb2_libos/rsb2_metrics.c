@@ -0,0 +1,284 @@
+/** Module rsb2_metrics - Implementation.
+ * @file rsb2_metrics.c
+ * @author jp.tranvouez@navilab.com
+ */
+#include "rsb2_metrics.h"
+#include "rsb2_module.h"
+#include "rsb2_socket.h"
+#include "rsb2_unixsock.h"
+
+#include <errno.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+
+enum {
+	RSB2_METRICS_REPLYSZ	= 8192,		/* Stats reply size. */
+	RSB2_METRICS_RECVMS		= 1000,		/* Request timeout (ms). */
+};
+
+/* Description of a metric. */
+typedef struct rsb2_Metrics_desc {
+	const char *name;					/* Metric name. */
+	bool gauge;							/* Level, kept by reset. */
+} rsb2_Metrics_desc;
+
+static int g_module = -1;				/* Module reference. */
+static const rsb2_Metrics_desc g_metrics[RSB2_METRICS_COUNT] = {
+	{"rsb2_socket_bytes_sent", false},
+	{"rsb2_socket_bytes_recv", false},
+	{"rsb2_socket_msgs_sent", false},
+	{"rsb2_socket_msgs_recv", false},
+	{"rsb2_socket_send_errors", false},
+	{"rsb2_socket_recv_errors", false},
+	{"rsb2_socket_eintr_retries", false},
+	{"rsb2_unixsock_accepts", false},
+	{"rsb2_unixsock_connections", true},
+	{"rsb2_socket_poll_wakeups", false},
+	{"rsb2_bufpool_hits", false},
+	{"rsb2_bufpool_misses", false},
+	{"rsb2_sendq_bytes", true},
+	{"rsb2_sendq_full", false},
+};
+static const char *g_latencyNames[RSB2_METRICS_LAT_COUNT] = {
+	"rsb2_unixsock_rpc_ns",
+	"rsb2_unixsock_rpc_connect_ns",
+	"rsb2_unixsock_rpc_send_ns",
+	"rsb2_unixsock_rpc_recv_ns",
+	"rsb2_unixsock_handler_ns",
+	"rsb2_socket_rdwait_ns",
+};
+static int g_nshards = 0;				/* Shards assigned. */
+static pthread_mutex_t g_lock = PTHREAD_MUTEX_INITIALIZER;	/* Server. */
+static char *g_path = NULL;				/* Stats socket path, NULL if none. */
+static int g_lisSock = -1;				/* Stats listening socket. */
+static int g_stopFd = -1;				/* Stats server stop eventfd. */
+static pthread_t g_server;				/* Server thread. */
+
+rsb2_Metrics_shard rsb2_metrics_shards[RSB2_METRICS_SHARDS];
+__thread int rsb2_metrics_tshard = 0;
+rsb2_Histo rsb2_metrics_latencies[RSB2_METRICS_LAT_COUNT];
+
+int rsb2_metrics_begin(void)
+{
+	g_module = rsb2_module_ref("rsb2_metrics");
+	int err = g_module < 0;
+	return err;
+}
+
+void rsb2_metrics_end(void)
+{
+	rsb2_metrics_stop();
+	rsb2_module_destroy(g_module);
+}
+
+int rsb2_metrics_assign(void)
+{
+	/* round-robin over shards, in thread creation order */
+	int shard = __atomic_fetch_add(&g_nshards, 1, __ATOMIC_RELAXED) %
+			RSB2_METRICS_SHARDS;
+	rsb2_metrics_tshard = shard + 1;
+	return shard;
+}
+
+int64_t rsb2_metrics_get(rsb2_Metrics_id id)
+{
+	RSB2_ASSERT(id >= 0 && id < RSB2_METRICS_COUNT);
+	int64_t value = 0;
+	for (int i = 0; i < RSB2_METRICS_SHARDS; i++) {
+		value += __atomic_load_n(&rsb2_metrics_shards[i].values[id],
+				__ATOMIC_RELAXED);
+	}
+	return value;
+}
+
+const char *rsb2_metrics_name(rsb2_Metrics_id id)
+{
+	RSB2_ASSERT(id >= 0 && id < RSB2_METRICS_COUNT);
+	return g_metrics[id].name;
+}
+
+const char *rsb2_metrics_latencyName(rsb2_Metrics_latency id)
+{
+	RSB2_ASSERT(id >= 0 && id < RSB2_METRICS_LAT_COUNT);
+	return g_latencyNames[id];
+}
+
+void rsb2_metrics_snapshot(rsb2_Metrics_latency id, rsb2_Histo_snap *snap)
+{
+	RSB2_ASSERT(id >= 0 && id < RSB2_METRICS_LAT_COUNT);
+	rsb2_histo_snapshot(&rsb2_metrics_latencies[id], snap);
+}
+
+void rsb2_metrics_reset(void)
+{
+	RSB2_TRACE_ENTRY();
+	for (int id = 0; id < RSB2_METRICS_LAT_COUNT; id++) {
+		rsb2_histo_reset(&rsb2_metrics_latencies[id]);
+	}
+	for (int i = 0; i < RSB2_METRICS_SHARDS; i++) {
+		for (int id = 0; id < RSB2_METRICS_COUNT; id++) {
+			if (!g_metrics[id].gauge) {
+				__atomic_store_n(&rsb2_metrics_shards[i].values[id], 0,
+						__ATOMIC_RELAXED);
+			}
+		}
+	}
+	RSB2_TRACE_EXIT();
+}
+
+int rsb2_metrics_format(char *buf, int bufsz)
+{
+	RSB2_TRACE_ARGS("buf=%p,bufsz=%d", buf, bufsz);
+	RSB2_ASSERT_NOTNULL(buf);
+	RSB2_ASSERT_POSINT(bufsz);
+	int len = 0;
+	buf[0] = '\0';
+	for (int id = 0; id < RSB2_METRICS_COUNT && len < bufsz - 1; id++) {
+		int n = snprintf(buf + len, bufsz - len, "%s %lld\n", g_metrics[id].name,
+				(long long)rsb2_metrics_get(id));
+		len += n < bufsz - len? n: bufsz - len - 1;
+	}
+	for (int id = 0; id < RSB2_METRICS_LAT_COUNT && len < bufsz - 1; id++) {
+		rsb2_Histo_snap snap;
+		rsb2_histo_snapshot(&rsb2_metrics_latencies[id], &snap);
+		const char *name = g_latencyNames[id];
+		int n = snprintf(buf + len, bufsz - len,
+				"%s_count %llu\n%s_mean %llu\n%s_p50 %llu\n%s_p90 %llu\n"
+				"%s_p99 %llu\n%s_p999 %llu\n%s_max %llu\n",
+				name, (unsigned long long)snap.count,
+				name, (unsigned long long)snap.mean,
+				name, (unsigned long long)snap.p50,
+				name, (unsigned long long)snap.p90,
+				name, (unsigned long long)snap.p99,
+				name, (unsigned long long)snap.p999,
+				name, (unsigned long long)snap.max);
+		len += n < bufsz - len? n: bufsz - len - 1;
+	}
+	RSB2_TRACE_EXIT_INT(len);
+	return len;
+}
+
+/* wait for a socket to be readable, or for the server to be stopped */
+static int rsb2_metrics_wait(int sock, int maxms)
+{
+	RSB2_TRACE_ARGS("sock=%d,maxms=%d", sock, maxms);
+	struct pollfd fds[2];
+	fds[0].fd = sock;
+	fds[0].events = POLLIN;
+	fds[1].fd = g_stopFd;
+	fds[1].events = POLLIN;
+	int count = -1;
+	do {
+		count = poll(fds, 2, maxms);
+	} while (count < 0 && errno == EINTR);
+	int ret = -1;
+	if (count < 0) {
+		/* notify 'poll' failure */
+		RSB2_ERRNO("poll", "sock=%d,stopFd=%d", sock, g_stopFd);
+	} else if (fds[1].revents) {
+		/* server shutdown requested by rsb2_metrics_stop */
+		ret = 2;
+	} else {
+		ret = fds[0].revents? 0: 1;
+	}
+	RSB2_TRACE_EXIT_INT(ret);
+	return ret;
+}
+
+static void *rsb2_metrics_server(void *arg)
+{
+	RSB2_TRACE_ARGS("arg=%p", arg);
+	int ret = 0;
+	while (ret != 2 && ret >= 0) {
+		ret = rsb2_metrics_wait(g_lisSock, -1);
+		int sock = ret? -1: rsb2_unixsock_accept(g_lisSock);
+		if (sock >= 0) {
+			/* each request is answered, then the connection is closed */
+			char msg[64];
+			ret = rsb2_metrics_wait(sock, RSB2_METRICS_RECVMS);
+			if (!ret && rsb2_socket_recv(sock, msg, sizeof(msg)) > 0) {
+				char reply[RSB2_METRICS_REPLYSZ];
+				int len = rsb2_metrics_format(reply, sizeof(reply));
+				if (rsb2_socket_send(sock, reply, len) != len) {
+					RSB2_ERRTRACE();
+				}
+			}
+			rsb2_socket_close(sock);
+		}
+	}
+	if (ret < 0) {
+		RSB2_ERRTRACE();
+	}
+	RSB2_TRACE_EXIT_PTR(NULL);
+	return NULL;
+}
+
+int rsb2_metrics_serve(const char *path)
+{
+	RSB2_TRACE_ARGS("path=%s", path);
+	RSB2_ASSERT_NOTNULL(path);
+	int err = -1;
+	pthread_mutex_lock(&g_lock);
+	bool serving = g_path != NULL;
+	if (serving) {
+		/* notify already serving */
+		RSB2_ERROR("metrics_serving", "path=%s,serving=%s", path, g_path);
+	} else if (!(g_path = strdup(path))) {
+		/* notify 'strdup' failure */
+		RSB2_ERRNO("strdup", "path=%s", path);
+	} else if ((g_stopFd = eventfd(0, EFD_CLOEXEC)) < 0) {
+		/* notify 'eventfd' failure */
+		RSB2_ERRNO("eventfd", "path=%s", path);
+	} else if ((g_lisSock = rsb2_unixsock_listen(path)) < 0 ||
+			rsb2_socket_setnonblock(g_lisSock)) {
+		RSB2_ERRTRACE();
+	} else if ((err = pthread_create(&g_server, NULL, rsb2_metrics_server,
+			NULL)) != 0) {
+		/* notify 'pthread_create' failure */
+		RSB2_ERRRET("pthread_create", err, "path=%s", path);
+		err = -1;
+	}
+	if (err && !serving && g_path) {
+		/* release what this call created, not the running server */
+		if (g_lisSock >= 0) {
+			rsb2_socket_close(g_lisSock);
+			g_lisSock = -1;
+		}
+		if (g_stopFd >= 0) {
+			close(g_stopFd);
+			g_stopFd = -1;
+		}
+		free(g_path);
+		g_path = NULL;
+	}
+	pthread_mutex_unlock(&g_lock);
+	RSB2_TRACE_EXIT_INT(err);
+	return err;
+}
+
+void rsb2_metrics_stop(void)
+{
+	RSB2_TRACE_ENTRY();
+	pthread_mutex_lock(&g_lock);
+	if (g_path) {
+		/* wakes the server wherever it waits */
+		eventfd_write(g_stopFd, 1);
+		pthread_join(g_server, NULL);
+		rsb2_socket_close(g_lisSock);
+		g_lisSock = -1;
+		close(g_stopFd);
+		g_stopFd = -1;
+		free(g_path);
+		g_path = NULL;
+	}
+	pthread_mutex_unlock(&g_lock);
+	RSB2_TRACE_EXIT();
+}
+
+/*END*/
@@ -0,0 +1,170 @@
+/** Module rsb2_metrics - Interface.
+ * @file rsb2_metrics.h
+ * @author jp.tranvouez@navilab.com
+ * @defgroup rsb2_metrics Socket Metrics
+ * @ingroup rsb2_libos
+ * @{
+ * Process-wide counters and gauges of the socket modules. Updates go to
+ * a shard of atomic counters chosen per thread, so threads rarely share
+ * a cache line; queries sum the shards. Latencies are recorded in
+ * rsb2_histo histograms. The values can also be scraped from a stats Unix
+ * socket served by rsb2_unixsock.
+ */
+#ifndef RSB2_METRICS_H
+#define RSB2_METRICS_H
+
+#include "rsb2_histo.h"
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** Number of counter shards. */
+#define RSB2_METRICS_SHARDS		16
+
+/** Metrics. */
+typedef enum rsb2_Metrics_id {
+	RSB2_METRICS_BYTES_SENT = 0,	/**< Bytes sent. */
+	RSB2_METRICS_BYTES_RECV,		/**< Bytes received. */
+	RSB2_METRICS_MSGS_SENT,			/**< Messages (send calls) sent. */
+	RSB2_METRICS_MSGS_RECV,			/**< Messages (recv calls) received. */
+	RSB2_METRICS_SEND_ERRORS,		/**< Send errors, EAGAIN excluded. */
+	RSB2_METRICS_RECV_ERRORS,		/**< Receive errors, EAGAIN excluded. */
+	RSB2_METRICS_EINTR,				/**< System calls retried on EINTR. */
+	RSB2_METRICS_ACCEPTS,			/**< Connections accepted. */
+	RSB2_METRICS_CONNS,				/**< Server connections open (gauge). */
+	RSB2_METRICS_WAKEUPS,			/**< Poll, epoll and io_uring wakeups. */
+	RSB2_METRICS_BUF_HITS,			/**< Receive buffers reused (rsb2_bufpool). */
+	RSB2_METRICS_BUF_MISSES,		/**< Receive buffers allocated. */
+	RSB2_METRICS_SENDQ_BYTES,		/**< Bytes in send queues (gauge). */
+	RSB2_METRICS_SENDQ_FULL,		/**< Send queues past the high-water mark. */
+	RSB2_METRICS_COUNT				/**< Number of metrics. */
+} rsb2_Metrics_id;
+
+/** Latencies. */
+typedef enum rsb2_Metrics_latency {
+	RSB2_METRICS_LAT_RPC = 0,		/**< rsb2_unixsock_rpc call. */
+	RSB2_METRICS_LAT_CONNECT,		/**< RPC connection opened (not pooled). */
+	RSB2_METRICS_LAT_SEND,			/**< RPC request sent, epoll engine. */
+	RSB2_METRICS_LAT_RECV,			/**< RPC response received, epoll engine. */
+	RSB2_METRICS_LAT_HANDLER,		/**< Server message processing function. */
+	RSB2_METRICS_LAT_RDWAIT,		/**< rsb2_socket_rdwait wait. */
+	RSB2_METRICS_LAT_COUNT			/**< Number of latencies. */
+} rsb2_Metrics_latency;
+
+/** Latency histograms, for rsb2_metrics_since(). */
+extern rsb2_Histo rsb2_metrics_latencies[RSB2_METRICS_LAT_COUNT];
+
+/** Record a latency.
+ * @param id latency
+ * @param start start time, from rsb2_histo_now()
+ */
+static inline void rsb2_metrics_since(rsb2_Metrics_latency id, uint64_t start)
+{
+	rsb2_histo_since(&rsb2_metrics_latencies[id], start);
+}
+
+/** Call a server message processing function, recording its latency.
+ * @param fRecv message processing function
+ * @param sock service socket file descriptor
+ * @param msg incoming message address
+ * @param msglen incoming message length
+ * @return fRecv result
+ */
+static inline int rsb2_metrics_handle(int (*fRecv)(int, const char *, int),
+		int sock, const char *msg, int msglen)
+{
+	uint64_t start = rsb2_histo_now();
+	int ret = fRecv(sock, msg, msglen);
+	rsb2_metrics_since(RSB2_METRICS_LAT_HANDLER, start);
+	return ret;
+}
+
+/** Counter shard, aligned on a cache line. */
+typedef struct rsb2_Metrics_shard {
+	int64_t values[RSB2_METRICS_COUNT];	/**< Partial values. */
+} __attribute__((aligned(64))) rsb2_Metrics_shard;
+
+/** Counter shards, for rsb2_metrics_add(). */
+extern rsb2_Metrics_shard rsb2_metrics_shards[RSB2_METRICS_SHARDS];
+
+/** Shard of the current thread + 1, 0 until assigned. */
+extern __thread int rsb2_metrics_tshard;
+
+/** Assign a shard to the current thread.
+ * @return shard index
+ */
+int rsb2_metrics_assign(void);
+
+/** Add to a metric.
+ * @param id metric
+ * @param n value added, negative to decrease a gauge
+ */
+static inline void rsb2_metrics_add(rsb2_Metrics_id id, int64_t n)
+{
+	int shard = rsb2_metrics_tshard? rsb2_metrics_tshard - 1:
+			rsb2_metrics_assign();
+	__atomic_add_fetch(&rsb2_metrics_shards[shard].values[id], n,
+			__ATOMIC_RELAXED);
+}
+
+/** Get the value of a metric.
+ * @param id metric
+ * @return sum of the shards
+ */
+int64_t rsb2_metrics_get(rsb2_Metrics_id id);
+
+/** Get the name of a metric.
+ * @param id metric
+ * @return metric name
+ */
+const char *rsb2_metrics_name(rsb2_Metrics_id id);
+
+/** Get the name of a latency.
+ * @param id latency
+ * @return latency name
+ */
+const char *rsb2_metrics_latencyName(rsb2_Metrics_latency id);
+
+/** Summarize a latency histogram.
+ * @param id latency
+ * @param snap summary, in ns
+ */
+void rsb2_metrics_snapshot(rsb2_Metrics_latency id, rsb2_Histo_snap *snap);
+
+/** Reset the counters and latencies.
+ * Gauges (open connections, bytes in send queues) are kept, as they
+ * track levels that later decrements would drive negative.
+ */
+void rsb2_metrics_reset(void);
+
+/** Format every metric, one "name value" line each; latencies have one
+ * line for each field of rsb2_Histo_snap, in ns.
+ * @param buf output buffer
+ * @param bufsz output buffer size
+ * @return formatted length, truncated to bufsz - 1
+ */
+int rsb2_metrics_format(char *buf, int bufsz);
+
+/** Serve the metrics on a Unix socket, in a new thread.
+ * The socket is listening on return. Each message received is answered
+ * with rsb2_metrics_format() output, then the connection is closed; a
+ * connection without message for a second is closed unanswered.
+ * @param path filesystem path of Unix socket
+ * @retval 0 success
+ * @retval -1 error, or already serving
+ */
+int rsb2_metrics_serve(const char *path);
+
+/** Stop serving the metrics.
+ * Signals the server thread and waits for it, without connecting to it.
+ */
+void rsb2_metrics_stop(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /*@} RSB2_METRICS_H */
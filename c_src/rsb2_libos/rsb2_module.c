@@ -3,26 +3,183 @@
  * @author jp.tranvouez@navilab.com
  */
 #include "rsb2_module.h"
+#include "rsb2_tracering.h"
 
+#include <pthread.h>
 #include <stdarg.h>
+#include <stdint.h>
 #include <stdio.h>
+#include <string.h>
 
-static int g_module = 0;				/* Module reference. */
+static int g_module = -1;				/* Module reference. */
+
+#define RSB2_MODULE_MASKALL		(RSB2_TRACEGROUP_FUNC | RSB2_TRACEGROUP_DATA | \
+								RSB2_TRACEGROUP_CTRL | RSB2_TRACEGROUP_APPL)
+
+/* Module slot; refs, name and mask are written under g_lock, read
+ * without lock on the trace path. */
+typedef struct rsb2_Module_slot {
+	int refs;							/* Reference count, 0 if free. */
+	char name[RSB2_MODULE_NAMESZ];		/* Module name. */
+	rsb2_Module_tracer *fTrace;			/* Trace handler override or NULL. */
+	uint64_t traces[RSB2_MODULE_GROUPS];	/* Traces by group. */
+} rsb2_Module_slot;
+
+static pthread_mutex_t g_lock = PTHREAD_MUTEX_INITIALIZER;	/* Register. */
+static rsb2_Module_slot g_slots[RSB2_MODULE_MAX];	/* By reference. */
+static unsigned g_default = RSB2_MODULE_MASKALL;	/* Mask of new modules. */
+
+unsigned rsb2_module_traceMasks[RSB2_MODULE_MAX + 1] = {
+	[0 ... RSB2_MODULE_MAX] = RSB2_MODULE_MASKALL
+};
+
+static rsb2_Module_slot *rsb2_module_slot(int ref)
+{
+	return ref >= 0 && ref < RSB2_MODULE_MAX &&
+			__atomic_load_n(&g_slots[ref].refs, __ATOMIC_ACQUIRE) > 0?
+			&g_slots[ref]: NULL;
+}
+
+int rsb2_module_find(const char *name)
+{
+	RSB2_ASSERT_NOTNULL(name);
+	int ref = -1;
+	pthread_mutex_lock(&g_lock);
+	for (int i = 0; i < RSB2_MODULE_MAX && ref < 0; i++) {
+		if (g_slots[i].refs && !strncmp(g_slots[i].name, name,
+				RSB2_MODULE_NAMESZ - 1)) {
+			ref = i;
+		}
+	}
+	pthread_mutex_unlock(&g_lock);
+	return ref;
+}
 
 int rsb2_module_ref(const char *name)
 {
 	RSB2_TRACE_ARGS("name=%s", name);
-	int ref = 0;
+	RSB2_ASSERT_NOTNULL(name);
+	int ref = -1;
+	int free = -1;
+	pthread_mutex_lock(&g_lock);
+	for (int i = 0; i < RSB2_MODULE_MAX && ref < 0; i++) {
+		if (!g_slots[i].refs) {
+			free = free < 0? i: free;
+		} else if (!strncmp(g_slots[i].name, name, RSB2_MODULE_NAMESZ - 1)) {
+			ref = i;
+		}
+	}
+	if (ref >= 0) {
+		/* already registered */
+		__atomic_add_fetch(&g_slots[ref].refs, 1, __ATOMIC_RELAXED);
+	} else if (free < 0) {
+		/* notify too many modules */
+		RSB2_ERROR("module_full", "name=%s,max=%d", name, RSB2_MODULE_MAX);
+	} else {
+		ref = free;
+		rsb2_Module_slot *slot = &g_slots[ref];
+		snprintf(slot->name, sizeof(slot->name), "%s", name);
+		slot->fTrace = NULL;
+		for (int i = 0; i < RSB2_MODULE_GROUPS; i++) {
+			__atomic_store_n(&slot->traces[i], 0, __ATOMIC_RELAXED);
+		}
+		__atomic_store_n(&rsb2_module_traceMasks[ref + 1], g_default,
+				__ATOMIC_RELAXED);
+		/* the slot is complete before it is in use */
+		__atomic_store_n(&slot->refs, 1, __ATOMIC_RELEASE);
+	}
+	pthread_mutex_unlock(&g_lock);
 	RSB2_TRACE_EXIT_INT(ref);
 	return ref;
 }
 
 void rsb2_module_destroy(int ref)
 {
-	RSB2_TRACE_ENTRY();
+	RSB2_TRACE_ARGS("ref=%d", ref);
+	pthread_mutex_lock(&g_lock);
+	rsb2_Module_slot *slot = rsb2_module_slot(ref);
+	if (!slot) {
+		/* notify bad reference */
+		RSB2_ERROR("module_ref", "ref=%d", ref);
+	} else if (__atomic_sub_fetch(&slot->refs, 1, __ATOMIC_RELEASE) == 0) {
+		/* traces still in flight use the default handler */
+		__atomic_store_n(&slot->fTrace, NULL, __ATOMIC_RELEASE);
+	}
+	pthread_mutex_unlock(&g_lock);
 	RSB2_TRACE_EXIT();
 }
 
+void rsb2_module_setTraceMask(int ref, unsigned mask)
+{
+	RSB2_TRACE_ARGS("ref=%d,mask=%#x", ref, mask);
+	pthread_mutex_lock(&g_lock);
+	if (ref == -1) {
+		g_default = mask;
+		for (int i = 0; i <= RSB2_MODULE_MAX; i++) {
+			__atomic_store_n(&rsb2_module_traceMasks[i], mask,
+					__ATOMIC_RELAXED);
+		}
+	} else if (rsb2_module_slot(ref)) {
+		__atomic_store_n(&rsb2_module_traceMasks[ref + 1], mask,
+				__ATOMIC_RELAXED);
+	} else {
+		/* notify bad reference */
+		RSB2_ERROR("module_ref", "ref=%d", ref);
+	}
+	pthread_mutex_unlock(&g_lock);
+	RSB2_TRACE_EXIT();
+}
+
+unsigned rsb2_module_getTraceMask(int ref)
+{
+	unsigned i = (unsigned)(ref + 1) <= RSB2_MODULE_MAX? ref + 1: 0;
+	return __atomic_load_n(&rsb2_module_traceMasks[i], __ATOMIC_RELAXED);
+}
+
+int rsb2_module_setModuleTracer(int ref, rsb2_Module_tracer *fTrace)
+{
+	RSB2_TRACE_ARGS("ref=%d,fTrace=%p", ref, (void *)fTrace);
+	int err = -1;
+	pthread_mutex_lock(&g_lock);
+	rsb2_Module_slot *slot = rsb2_module_slot(ref);
+	if (!slot) {
+		/* notify bad reference */
+		RSB2_ERROR("module_ref", "ref=%d", ref);
+	} else {
+		__atomic_store_n(&slot->fTrace, fTrace, __ATOMIC_RELEASE);
+		err = 0;
+	}
+	pthread_mutex_unlock(&g_lock);
+	RSB2_TRACE_EXIT_INT(err);
+	return err;
+}
+
+int rsb2_module_stats(int ref, rsb2_Module_stats *stats)
+{
+	RSB2_TRACE_ARGS("ref=%d", ref);
+	RSB2_ASSERT_NOTNULL(stats);
+	int err = -1;
+	pthread_mutex_lock(&g_lock);
+	rsb2_Module_slot *slot = rsb2_module_slot(ref);
+	if (!slot) {
+		/* notify bad reference */
+		RSB2_ERROR("module_ref", "ref=%d", ref);
+	} else {
+		memcpy(stats->name, slot->name, sizeof(stats->name));
+		stats->refs = slot->refs;
+		stats->mask = rsb2_module_getTraceMask(ref);
+		stats->tracer = slot->fTrace != NULL;
+		for (int i = 0; i < RSB2_MODULE_GROUPS; i++) {
+			stats->traces[i] = __atomic_load_n(&slot->traces[i],
+					__ATOMIC_RELAXED);
+		}
+		err = 0;
+	}
+	pthread_mutex_unlock(&g_lock);
+	RSB2_TRACE_EXIT_INT(err);
+	return err;
+}
+
 static void rsb2_module_tracer(const char *func, const char *file, int line,
 		int ref, rsb2_TraceGroup group, const char *descr)
 {
@@ -38,15 +195,55 @@ void rsb2_module_setTracer(rsb2_Module_tracer *fTrace)
 	g_fTrace = fTrace? fTrace: rsb2_module_tracer;
 }
 
+rsb2_Module_tracer *rsb2_module_getTracer(void)
+{
+	return g_fTrace;
+}
+
+rsb2_Module_tracer *rsb2_module_tracerOf(int ref)
+{
+	rsb2_Module_tracer *fTrace = (unsigned)ref < RSB2_MODULE_MAX?
+			__atomic_load_n(&g_slots[ref].fTrace, __ATOMIC_ACQUIRE): NULL;
+	return fTrace? fTrace: g_fTrace;
+}
+
+/* Count a trace of a module. */
+static void rsb2_module_count(int ref, rsb2_TraceGroup group)
+{
+	if ((unsigned)ref < RSB2_MODULE_MAX && group) {
+		__atomic_add_fetch(&g_slots[ref].traces[__builtin_ctz(group) &
+				(RSB2_MODULE_GROUPS - 1)], 1, __ATOMIC_RELAXED);
+	}
+}
+
 void rsb2_module_trace(int ref, const char *func, const char *file, int line,
 		rsb2_TraceGroup group, const char *fmt, ...)
 {
-	va_list ap;
-	va_start(ap, fmt);
-	char descr[256];
-	vsnprintf(descr, sizeof(descr), fmt, ap);
+	if (rsb2_module_traceOn(ref, group)) {
+		va_list ap;
+		va_start(ap, fmt);
+		char descr[256];
+		vsnprintf(descr, sizeof(descr), fmt, ap);
+		va_end(ap);
+		rsb2_module_count(ref, group);
+		rsb2_module_tracerOf(ref)(func, file, line, ref, group, descr);
+	}
+}
+
+void rsb2_module_traceSite(int ref, rsb2_TraceCallsite *site, ...)
+{
+	va_list ap, aq;
+	va_start(ap, site);
+	va_copy(aq, ap);
+	rsb2_module_count(ref, site->group);
+	if (!rsb2_tracering_record(ref, site, aq)) {
+		char descr[256];
+		vsnprintf(descr, sizeof(descr), site->fmt, ap);
+		rsb2_module_tracerOf(ref)(site->func, site->file, site->line, ref,
+				site->group, descr);
+	}
+	va_end(aq);
 	va_end(ap);
-	g_fTrace(func, file, line, ref, group, descr);
 }
 
 /*END*/
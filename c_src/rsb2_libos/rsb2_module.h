@@ -16,6 +16,32 @@ extern "C" {
 #include "rsb2_eventmgr.h"	/* convenience */
 #include "rsb2_tracer.h"	/* convenience */
 
+#include <stdbool.h>
+#include <stdint.h>
+
+/** Max number of registered modules. */
+#define RSB2_MODULE_MAX			64
+
+/** Max size of a module name, null byte included. */
+#define RSB2_MODULE_NAMESZ		32
+
+/** Number of trace groups counted. */
+#define RSB2_MODULE_GROUPS		4
+
+/** Module state, from rsb2_module_stats(). */
+typedef struct rsb2_Module_stats {
+	char name[RSB2_MODULE_NAMESZ];		/**< Module name. */
+	int refs;							/**< Reference count. */
+	unsigned mask;						/**< Trace mask. */
+	bool tracer;						/**< Trace handler overridden. */
+	uint64_t traces[RSB2_MODULE_GROUPS];	/**< Traces by group bit. */
+} rsb2_Module_stats;
+
+/** Trace masks by module reference + 1, for rsb2_module_traceOn().
+ * Index 0 is used by modules without reference.
+ */
+extern unsigned rsb2_module_traceMasks[RSB2_MODULE_MAX + 1];
+
 /** Trace handler function type.
  * @param func function name
  * @param file source file name
@@ -33,18 +59,79 @@ typedef void rsb2_Module_tracer(const char *func, const char *file, int line,
  */
 void rsb2_module_setTracer(rsb2_Module_tracer *fTrace);
 
-/** Return a module reference.
- * @param name module name
- * @return module reference
- * @retval -1 error
+/** Get the current trace handler.
+ * @return trace handler function
+ */
+rsb2_Module_tracer *rsb2_module_getTracer(void);
+
+/** Get the trace handler of a module: its override, else the current
+ * trace handler.
+ * @param ref module reference
+ * @return trace handler function
+ */
+rsb2_Module_tracer *rsb2_module_tracerOf(int ref);
+
+/** Register a module, or reference it again if already registered.
+ * @param name module name, truncated to RSB2_MODULE_NAMESZ - 1
+ * @return module reference, an index below RSB2_MODULE_MAX
+ * @retval -1 error, too many modules
  */
 int rsb2_module_ref(const char *name);
 
-/** Destroy a module object.
+/** Release a module reference.
+ * The module slot is freed with its last reference.
  * @param ref module reference
  */
 void rsb2_module_destroy(int ref);
 
+/** Find a registered module.
+ * @param name module name
+ * @return module reference
+ * @retval -1 not registered
+ */
+int rsb2_module_find(const char *name);
+
+/** Set the trace handler of a module, overriding the common one.
+ * @param ref module reference
+ * @param fTrace trace handler function, or NULL for the common one
+ * @retval 0 success
+ * @retval -1 error, bad reference
+ */
+int rsb2_module_setModuleTracer(int ref, rsb2_Module_tracer *fTrace);
+
+/** Get the state and trace counters of a module.
+ * @param ref module reference
+ * @param stats module state
+ * @retval 0 success
+ * @retval -1 error, bad reference
+ */
+int rsb2_module_stats(int ref, rsb2_Module_stats *stats);
+
+/** Set the trace mask of a module.
+ * Every group is enabled by default.
+ * @param ref module reference, -1 for every module and the new ones
+ * @param mask mask of rsb2_TraceGroup values
+ */
+void rsb2_module_setTraceMask(int ref, unsigned mask);
+
+/** Get the trace mask of a module.
+ * @param ref module reference
+ * @return mask of rsb2_TraceGroup values
+ */
+unsigned rsb2_module_getTraceMask(int ref);
+
+/** Check whether a trace group is enabled for a module.
+ * @param ref module reference
+ * @param group event group
+ * @return true if enabled
+ */
+static inline bool rsb2_module_traceOn(int ref, rsb2_TraceGroup group)
+{
+	unsigned i = (unsigned)(ref + 1) <= RSB2_MODULE_MAX? ref + 1: 0;
+	return __atomic_load_n(&rsb2_module_traceMasks[i], __ATOMIC_RELAXED) &
+			group;
+}
+
 /** Notify a trace event.
  * @parem ref module reference
  * @param func function name
@@ -57,6 +144,15 @@ void rsb2_module_trace(int ref, const char *func, const char *file, int line,
 		rsb2_TraceGroup group, const char *fmt, ...)
 		__attribute__((format(printf, 6, 7)));
 
+/** Notify a trace event from a registered callsite.
+ * Records it in the trace ring of the calling thread if rsb2_tracering
+ * is started, else formats it and calls the trace handler.
+ * @param ref module reference
+ * @param site callsite
+ * @param ... argument values of the callsite format
+ */
+void rsb2_module_traceSite(int ref, rsb2_TraceCallsite *site, ...);
+
 #ifdef __cplusplus
 }
 #endif
@@ -0,0 +1,253 @@
+/** Module rsb2_rpcasync - Implementation.
+ * @file rsb2_rpcasync.c
+ * @author jp.tranvouez@navilab.com
+ */
+#include "rsb2_rpcasync.h"
+#include "rsb2_module.h"
+#include "rsb2_socket.h"
+#include "rsb2_unixsock.h"
+
+#include <errno.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+
+enum {
+	RSB2_RPCASYNC_MAXEVENTS		= 64,		/* Events per epoll_wait. */
+};
+
+/* Request in progress. */
+typedef struct rsb2_Rpcasync_call {
+	int sock;							/* Client-side socket. */
+	char *msg;							/* Request copy, then response. */
+	int msglen;							/* Request length. */
+	int sent;							/* Number of request bytes sent. */
+	int bufsz;							/* Maximum response length. */
+	bool watched;						/* Socket in the epoll set. */
+	rsb2_Rpcasync_done *fDone;			/* Completion function. */
+	void *arg;							/* Completion argument. */
+	struct rsb2_Rpcasync_call *prev;	/* Previous pending request. */
+	struct rsb2_Rpcasync_call *next;	/* Next pending request. */
+} rsb2_Rpcasync_call;
+
+struct rsb2_Rpcasync {
+	int epfd;							/* epoll instance. */
+	rsb2_Rpcasync_call *calls;			/* Pending requests. */
+	int ncalls;							/* Number of pending requests. */
+};
+
+static int g_module = -1;				/* Module reference. */
+
+int rsb2_rpcasync_begin(void)
+{
+	RSB2_TRACE_ENTRY();
+	g_module = rsb2_module_ref("rsb2_rpcasync");
+	int err = g_module < 0;
+	RSB2_TRACE_EXIT_INT(err);
+	return err;
+}
+
+void rsb2_rpcasync_end(void)
+{
+	RSB2_TRACE_ENTRY();
+	rsb2_module_destroy(g_module);
+	RSB2_TRACE_EXIT();
+}
+
+rsb2_Rpcasync *rsb2_rpcasync_create(void)
+{
+	RSB2_TRACE_ENTRY();
+	rsb2_Rpcasync *ctx = calloc(1, sizeof(*ctx));
+	if (!ctx) {
+		/* notify 'calloc' failure */
+		RSB2_ERRNO("calloc", "size=%zu", sizeof(*ctx));
+	} else {
+		ctx->epfd = epoll_create1(EPOLL_CLOEXEC);
+		if (ctx->epfd < 0) {
+			/* notify 'epoll_create1' failure */
+			RSB2_ERRNO("epoll_create1", "ctx=%p", ctx);
+			free(ctx);
+			ctx = NULL;
+		}
+	}
+	RSB2_TRACE_EXIT_PTR(ctx);
+	return ctx;
+}
+
+static void rsb2_rpcasync_complete(rsb2_Rpcasync *ctx,
+		rsb2_Rpcasync_call *call, int len)
+{
+	RSB2_TRACE_ARGS("ctx=%p,call=%p,len=%d", ctx, call, len);
+	/* unlink request before the callback, which may start new ones */
+	if (call->prev) {
+		call->prev->next = call->next;
+	} else {
+		ctx->calls = call->next;
+	}
+	if (call->next) {
+		call->next->prev = call->prev;
+	}
+	ctx->ncalls--;
+	rsb2_socket_close(call->sock);
+	if (len > 0) {
+		call->fDone(call->arg, call->msg, len, 0);
+	} else {
+		call->fDone(call->arg, NULL, 0, -1);
+	}
+	free(call->msg);
+	free(call);
+	RSB2_TRACE_EXIT();
+}
+
+void rsb2_rpcasync_destroy(rsb2_Rpcasync *ctx)
+{
+	RSB2_TRACE_ARGS("ctx=%p", ctx);
+	if (ctx) {
+		while (ctx->calls) {
+			rsb2_rpcasync_complete(ctx, ctx->calls, -1);
+		}
+		close(ctx->epfd);
+		free(ctx);
+	}
+	RSB2_TRACE_EXIT();
+}
+
+int rsb2_rpcasync_fd(const rsb2_Rpcasync *ctx)
+{
+	RSB2_ASSERT_NOTNULL(ctx);
+	return ctx->epfd;
+}
+
+int rsb2_rpcasync_pending(const rsb2_Rpcasync *ctx)
+{
+	RSB2_ASSERT_NOTNULL(ctx);
+	return ctx->ncalls;
+}
+
+static int rsb2_rpcasync_send(rsb2_Rpcasync *ctx, rsb2_Rpcasync_call *call)
+{
+	RSB2_TRACE_ARGS("ctx=%p,call=%p", ctx, call);
+	int err = 0;
+	while (call->sent < call->msglen && !err) {
+		int count = rsb2_socket_send(call->sock, call->msg + call->sent,
+				call->msglen - call->sent);
+		if (count > 0) {
+			call->sent += count;
+		} else if (count < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+			/* socket buffer full, wait for output ready */
+			break;
+		} else {
+			RSB2_ERRTRACE();
+			err = -1;
+		}
+	}
+	if (!err) {
+		/* wait for the rest of the request or for the response */
+		struct epoll_event ev;
+		ev.events = call->sent < call->msglen? EPOLLOUT: EPOLLIN;
+		ev.data.ptr = call;
+		err = epoll_ctl(ctx->epfd, call->watched? EPOLL_CTL_MOD: EPOLL_CTL_ADD,
+				call->sock, &ev);
+		if (err) {
+			/* notify 'epoll_ctl' failure */
+			RSB2_ERRNO("epoll_ctl", "sock=%d", call->sock);
+		} else {
+			call->watched = true;
+		}
+	}
+	RSB2_TRACE_EXIT_INT(err);
+	return err;
+}
+
+int rsb2_rpcasync_call(rsb2_Rpcasync *ctx, const char *path,
+		const char *msg, int msglen, int bufsz,
+		rsb2_Rpcasync_done *fDone, void *arg)
+{
+	RSB2_TRACE_ARGS("ctx=%p,path=%s,msg=%p,msglen=%d,bufsz=%d,fDone=%p,arg=%p",
+			ctx, path, msg, msglen, bufsz, fDone, arg);
+	RSB2_ASSERT_NOTNULL(ctx);
+	RSB2_ASSERT_NOTNULL(fDone);
+	RSB2_ASSERT_POSINT(msglen);
+	RSB2_ASSERT_POSINT(bufsz);
+	int err = -1;
+	rsb2_Rpcasync_call *call = calloc(1, sizeof(*call));
+	if (!call || !(call->msg = malloc(msglen > bufsz? msglen: bufsz))) {
+		/* notify allocation failure */
+		RSB2_ERRNO("malloc", "msglen=%d,bufsz=%d", msglen, bufsz);
+		free(call);
+	} else {
+		memcpy(call->msg, msg, msglen);
+		call->msglen = msglen;
+		call->bufsz = bufsz;
+		call->fDone = fDone;
+		call->arg = arg;
+		call->sock = rsb2_unixsock_connectnb(path);
+		if (call->sock < 0) {
+			RSB2_ERRTRACE();
+		} else if (rsb2_rpcasync_send(ctx, call)) {
+			RSB2_ERRTRACE();
+			rsb2_socket_close(call->sock);
+		} else {
+			/* link pending request */
+			call->next = ctx->calls;
+			if (ctx->calls) {
+				ctx->calls->prev = call;
+			}
+			ctx->calls = call;
+			ctx->ncalls++;
+			err = 0;
+		}
+		if (err) {
+			free(call->msg);
+			free(call);
+		}
+	}
+	RSB2_TRACE_EXIT_INT(err);
+	return err;
+}
+
+int rsb2_rpcasync_run(rsb2_Rpcasync *ctx, int maxms)
+{
+	RSB2_TRACE_ARGS("ctx=%p,maxms=%d", ctx, maxms);
+	RSB2_ASSERT_NOTNULL(ctx);
+	int ndone = 0;
+	struct epoll_event events[RSB2_RPCASYNC_MAXEVENTS];
+	int count = 0;
+	do {
+		count = epoll_wait(ctx->epfd, events, RSB2_RPCASYNC_MAXEVENTS, maxms);
+	} while (count < 0 && errno == EINTR);
+	if (count < 0) {
+		/* notify 'epoll_wait' failure */
+		RSB2_ERRNO("epoll_wait", "epfd=%d", ctx->epfd);
+		ndone = -1;
+	}
+	for (int i = 0; i < count; i++) {
+		rsb2_Rpcasync_call *call = events[i].data.ptr;
+		int len = 0;
+		if (events[i].events & EPOLLIN) {
+			/* response, or end of stream */
+			len = rsb2_socket_recv(call->sock, call->msg, call->bufsz);
+			if (len < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+				continue;
+			}
+		} else if (events[i].events & EPOLLOUT) {
+			/* rest of the request */
+			if (!rsb2_rpcasync_send(ctx, call)) {
+				continue;
+			}
+			len = -1;
+		} else {
+			/* socket error or hang-up before the response */
+			rsb2_socket_diag(call->sock);
+			len = -1;
+		}
+		rsb2_rpcasync_complete(ctx, call, len);
+		ndone++;
+	}
+	RSB2_TRACE_EXIT_INT(ndone);
+	return ndone;
+}
+
+/*END*/
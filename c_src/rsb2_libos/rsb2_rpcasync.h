@@ -0,0 +1,88 @@
+/** Module rsb2_rpcasync - Interface.
+ * @file rsb2_rpcasync.h
+ * @author jp.tranvouez@navilab.com
+ * @defgroup rsb2_rpcasync Asynchronous RPC Client
+ * @ingroup rsb2_libos
+ * @{
+ *
+ * Requests follow the rsb2_unixsock_rpc protocol (connect, send request,
+ * receive response, close) on non-blocking sockets, so any number of
+ * requests to any number of servers progress together in one thread.
+ * The caller owns the event loop: it calls rsb2_rpcasync_run, either
+ * blocking or when the descriptor returned by rsb2_rpcasync_fd is
+ * readable in its own poll/epoll set.
+ */
+#ifndef RSB2_RPCASYNC_H
+#define RSB2_RPCASYNC_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** Asynchronous RPC client context (opaque). */
+typedef struct rsb2_Rpcasync rsb2_Rpcasync;
+
+/** Process the completion of a request.
+ * The response is only valid during the call.
+ * @param arg caller argument
+ * @param msg response message address or NULL on error
+ * @param msglen response message length
+ * @param err 0 if a response was received, -1 on error
+ */
+typedef void rsb2_Rpcasync_done(void *arg, const char *msg, int msglen,
+		int err);
+
+/** Create a client context.
+ * @return client context
+ * @retval NULL error
+ */
+rsb2_Rpcasync *rsb2_rpcasync_create(void);
+
+/** Destroy a client context.
+ * Pending requests complete with an error.
+ * @param ctx client context
+ */
+void rsb2_rpcasync_destroy(rsb2_Rpcasync *ctx);
+
+/** Return the descriptor to watch for input in a caller's event loop.
+ * @param ctx client context
+ * @return file descriptor, readable when rsb2_rpcasync_run has work
+ */
+int rsb2_rpcasync_fd(const rsb2_Rpcasync *ctx);
+
+/** Return the number of pending requests.
+ * @param ctx client context
+ * @return number of requests not yet completed
+ */
+int rsb2_rpcasync_pending(const rsb2_Rpcasync *ctx);
+
+/** Start a request and return at once.
+ * The request is copied. fDone is called from rsb2_rpcasync_run, never
+ * from this function.
+ * @param ctx client context
+ * @param path filesystem path of Unix socket
+ * @param msg request message address
+ * @param msglen request message length
+ * @param bufsz maximum response length
+ * @param fDone completion function
+ * @param arg argument of fDone
+ * @retval 0 request started
+ * @retval -1 error, fDone will not be called
+ */
+int rsb2_rpcasync_call(rsb2_Rpcasync *ctx, const char *path,
+		const char *msg, int msglen, int bufsz,
+		rsb2_Rpcasync_done *fDone, void *arg);
+
+/** Make pending requests progress and run completion functions.
+ * @param ctx client context
+ * @param maxms maximum wait time (ms), 0 for no wait, -1 for no limit
+ * @return number of requests completed
+ * @retval -1 error
+ */
+int rsb2_rpcasync_run(rsb2_Rpcasync *ctx, int maxms);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /*@} RSB2_RPCASYNC_H */
@@ -0,0 +1,341 @@
+/** Module rsb2_rpcmux - Implementation.
+ * @file rsb2_rpcmux.c
+ * @author jp.tranvouez@navilab.com
+ */
+#include "rsb2_rpcmux.h"
+#include "rsb2_frame.h"
+#include "rsb2_module.h"
+#include "rsb2_socket.h"
+
+#include <limits.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+
+enum {
+	RSB2_RPCMUX_SENDLOCKS		= 64,		/* Server-side send lock stripes. */
+};
+
+/* Request in flight. */
+typedef struct rsb2_Rpcmux_slot {
+	uint32_t id;						/* Request ID. */
+	bool busy;							/* Request in flight. */
+	bool done;							/* Response received. */
+	char *msg;							/* Response message. */
+	int msglen;							/* Response message length. */
+} rsb2_Rpcmux_slot;
+
+struct rsb2_Rpcmux_client {
+	int sock;							/* Client-side socket. */
+	pthread_mutex_t lock;				/* Slot and reader lock. */
+	pthread_cond_t cond;				/* Slot state changed. */
+	pthread_mutex_t sendLock;			/* Serializes frames sent. */
+	rsb2_Frame_ring ring;				/* Response reassembly buffer. */
+	bool reading;						/* A waiter is reading responses. */
+	bool failed;						/* Connection failed. */
+	bool closing;						/* rsb2_rpcmux_close called. */
+	int users;							/* Threads in submit or wait. */
+	uint32_t nextId;					/* Next request ID. */
+	rsb2_Rpcmux_slot slots[RSB2_RPCMUX_MAXINFLIGHT];	/* Requests. */
+};
+
+/* Multiplexed RPC server, the argument of its unixsock server. */
+typedef struct rsb2_Rpcmux_server {
+	rsb2_Rpcmux_recv *fRecv;			/* Request handler. */
+} rsb2_Rpcmux_server;
+
+static int g_module = -1;				/* Module reference. */
+static pthread_mutex_t g_sendLocks[RSB2_RPCMUX_SENDLOCKS] = {	/* Stripes. */
+	[0 ... RSB2_RPCMUX_SENDLOCKS - 1] = PTHREAD_MUTEX_INITIALIZER
+};
+
+int rsb2_rpcmux_begin(void)
+{
+	RSB2_TRACE_ENTRY();
+	g_module = rsb2_module_ref("rsb2_rpcmux");
+	int err = g_module < 0;
+	RSB2_TRACE_EXIT_INT(err);
+	return err;
+}
+
+void rsb2_rpcmux_end(void)
+{
+	RSB2_TRACE_ENTRY();
+	rsb2_module_destroy(g_module);
+	RSB2_TRACE_EXIT();
+}
+
+rsb2_Rpcmux_client *rsb2_rpcmux_connect(const char *path)
+{
+	RSB2_TRACE_ARGS("path=%s", path);
+	rsb2_Rpcmux_client *client = calloc(1, sizeof(*client));
+	if (!client) {
+		/* notify 'calloc' failure */
+		RSB2_ERRNO("calloc", "path=%s", path);
+	} else {
+		client->sock = rsb2_unixsock_connect(path);
+		if (client->sock < 0) {
+			RSB2_ERRTRACE();
+			free(client);
+			client = NULL;
+		} else {
+			pthread_mutex_init(&client->lock, NULL);
+			pthread_cond_init(&client->cond, NULL);
+			pthread_mutex_init(&client->sendLock, NULL);
+			rsb2_frame_init(&client->ring);
+		}
+	}
+	RSB2_TRACE_EXIT_PTR(client);
+	return client;
+}
+
+void rsb2_rpcmux_close(rsb2_Rpcmux_client *client)
+{
+	RSB2_TRACE_ARGS("client=%p", client);
+	if (client) {
+		pthread_mutex_lock(&client->lock);
+		/* fail the requests in flight: the shutdown ends a blocked read or
+		 * write, the waiters return before the client is released */
+		client->failed = true;
+		client->closing = true;
+		shutdown(client->sock, SHUT_RDWR);
+		pthread_cond_broadcast(&client->cond);
+		while (client->users > 0) {
+			pthread_cond_wait(&client->cond, &client->lock);
+		}
+		pthread_mutex_unlock(&client->lock);
+		rsb2_socket_close(client->sock);
+		for (int i = 0; i < RSB2_RPCMUX_MAXINFLIGHT; i++) {
+			free(client->slots[i].msg);
+		}
+		rsb2_frame_free(&client->ring);
+		pthread_mutex_destroy(&client->sendLock);
+		pthread_cond_destroy(&client->cond);
+		pthread_mutex_destroy(&client->lock);
+		free(client);
+	}
+	RSB2_TRACE_EXIT();
+}
+
+static void rsb2_rpcmux_slotFree(rsb2_Rpcmux_client *client,
+		rsb2_Rpcmux_slot *slot)
+{
+	/* caller holds the client lock */
+	free(slot->msg);
+	slot->msg = NULL;
+	slot->msglen = 0;
+	slot->done = false;
+	slot->busy = false;
+	pthread_cond_broadcast(&client->cond);
+}
+
+static void rsb2_rpcmux_leave(rsb2_Rpcmux_client *client)
+{
+	/* caller holds the client lock, rsb2_rpcmux_close waits for the last */
+	client->users--;
+	if (client->closing && !client->users) {
+		pthread_cond_broadcast(&client->cond);
+	}
+}
+
+int rsb2_rpcmux_submit(rsb2_Rpcmux_client *client,
+		const char *msg, int msglen)
+{
+	RSB2_TRACE_ARGS("client=%p,msg=%p,msglen=%d", client, msg, msglen);
+	RSB2_ASSERT_NOTNULL(client);
+	pthread_mutex_lock(&client->lock);
+	client->users++;
+	/* IDs stay in the range of int */
+	uint32_t id = client->nextId++ & INT_MAX;
+	rsb2_Rpcmux_slot *slot = &client->slots[id % RSB2_RPCMUX_MAXINFLIGHT];
+	while (slot->busy && !client->failed) {
+		/* too many requests in flight */
+		pthread_cond_wait(&client->cond, &client->lock);
+	}
+	int ret = -1;
+	if (client->failed) {
+		RSB2_ERROR("rpc_failed", "sock=%d", client->sock);
+	} else {
+		slot->id = id;
+		slot->busy = true;
+		ret = (int)id;
+	}
+	pthread_mutex_unlock(&client->lock);
+	int err = 0;
+	if (ret >= 0) {
+		uint32_t hdr = htonl(id);
+		pthread_mutex_lock(&client->sendLock);
+		err = rsb2_frame_sendhdr(client->sock, (const char *)&hdr,
+				RSB2_RPCMUX_HDRSZ, msg, msglen);
+		pthread_mutex_unlock(&client->sendLock);
+	}
+	pthread_mutex_lock(&client->lock);
+	if (err) {
+		RSB2_ERRTRACE();
+		client->failed = true;
+		rsb2_rpcmux_slotFree(client, slot);
+		ret = -1;
+	}
+	rsb2_rpcmux_leave(client);
+	pthread_mutex_unlock(&client->lock);
+	RSB2_TRACE_EXIT_INT(ret);
+	return ret;
+}
+
+static void rsb2_rpcmux_readResponse(rsb2_Rpcmux_client *client)
+{
+	/* caller holds the client lock and is the only reader */
+	client->reading = true;
+	pthread_mutex_unlock(&client->lock);
+	const char *msg = NULL;
+	int len = rsb2_frame_recvref(client->sock, &client->ring, &msg);
+	pthread_mutex_lock(&client->lock);
+	client->reading = false;
+	if (len < RSB2_RPCMUX_HDRSZ) {
+		/* connection lost or invalid response, fail every request */
+		RSB2_ERROR("rpc_failed", "sock=%d,len=%d", client->sock, len);
+		client->failed = true;
+	} else {
+		uint32_t hdr;
+		memcpy(&hdr, msg, RSB2_RPCMUX_HDRSZ);
+		uint32_t id = ntohl(hdr);
+		rsb2_Rpcmux_slot *slot = &client->slots[id % RSB2_RPCMUX_MAXINFLIGHT];
+		int msglen = len - RSB2_RPCMUX_HDRSZ;
+		if (!slot->busy || slot->id != id || slot->done) {
+			/* notify unexpected response */
+			RSB2_ERROR("rpc_unexpected", "sock=%d,id=%u", client->sock, id);
+		} else if (!(slot->msg = malloc(msglen? msglen: 1))) {
+			/* notify 'malloc' failure */
+			RSB2_ERRNO("malloc", "msglen=%d", msglen);
+			client->failed = true;
+		} else {
+			memcpy(slot->msg, msg + RSB2_RPCMUX_HDRSZ, msglen);
+			slot->msglen = msglen;
+			slot->done = true;
+		}
+	}
+	pthread_cond_broadcast(&client->cond);
+}
+
+int rsb2_rpcmux_wait(rsb2_Rpcmux_client *client, int id,
+		char *buf, int bufsz)
+{
+	RSB2_TRACE_ARGS("client=%p,id=%d,buf=%p,bufsz=%d", client, id, buf, bufsz);
+	RSB2_ASSERT_NOTNULL(client);
+	RSB2_ASSERT_NOTNEGINT(id);
+	int len = -1;
+	pthread_mutex_lock(&client->lock);
+	client->users++;
+	rsb2_Rpcmux_slot *slot =
+			&client->slots[(uint32_t)id % RSB2_RPCMUX_MAXINFLIGHT];
+	if (!slot->busy || slot->id != (uint32_t)id) {
+		/* notify unknown request */
+		RSB2_ERROR("rpc_unknown", "id=%d", id);
+	} else {
+		for (;;) {
+			if (slot->done) {
+				/* response received */
+				if (slot->msglen > bufsz) {
+					RSB2_ERROR("rpc_too_long", "id=%d,msglen=%d,bufsz=%d",
+							id, slot->msglen, bufsz);
+				} else {
+					memcpy(buf, slot->msg, slot->msglen);
+					len = slot->msglen;
+				}
+				break;
+			}
+			if (client->failed) {
+				RSB2_ERROR("rpc_failed", "id=%d", id);
+				break;
+			}
+			if (client->reading) {
+				/* another waiter is reading, it wakes us up */
+				pthread_cond_wait(&client->cond, &client->lock);
+			} else {
+				/* read the next response, whichever request it matches */
+				rsb2_rpcmux_readResponse(client);
+			}
+		}
+		rsb2_rpcmux_slotFree(client, slot);
+	}
+	rsb2_rpcmux_leave(client);
+	pthread_mutex_unlock(&client->lock);
+	RSB2_TRACE_EXIT_INT(len);
+	return len;
+}
+
+int rsb2_rpcmux_call(rsb2_Rpcmux_client *client, const char *msg, int msglen,
+		char *buf, int bufsz)
+{
+	RSB2_TRACE_ARGS("client=%p,msg=%p,msglen=%d,buf=%p,bufsz=%d",
+			client, msg, msglen, buf, bufsz);
+	int len = -1;
+	int id = rsb2_rpcmux_submit(client, msg, msglen);
+	if (id < 0) {
+		RSB2_ERRTRACE();
+	} else {
+		len = rsb2_rpcmux_wait(client, id, buf, bufsz);
+	}
+	RSB2_TRACE_EXIT_INT(len);
+	return len;
+}
+
+int rsb2_rpcmux_reply(int sock, int id, const char *msg, int msglen)
+{
+	RSB2_TRACE_ARGS("sock=%d,id=%d,msg=%p,msglen=%d", sock, id, msg, msglen);
+	RSB2_ASSERT_NOTNEGINT(sock);
+	uint32_t hdr = htonl(id);
+	pthread_mutex_t *lock = &g_sendLocks[sock % RSB2_RPCMUX_SENDLOCKS];
+	pthread_mutex_lock(lock);
+	int err = rsb2_frame_sendhdr(sock, (const char *)&hdr, RSB2_RPCMUX_HDRSZ,
+			msg, msglen);
+	pthread_mutex_unlock(lock);
+	RSB2_TRACE_EXIT_INT(err);
+	return err;
+}
+
+static int rsb2_rpcmux_dispatch(int sock, const char *msg, int msglen)
+{
+	RSB2_TRACE_ARGS("sock=%d,msg=%p,msglen=%d", sock, msg, msglen);
+	const rsb2_Rpcmux_server *server = rsb2_unixsock_arg();
+	int ret = 1;
+	uint32_t hdr = 0;
+	if (msglen >= RSB2_RPCMUX_HDRSZ) {
+		memcpy(&hdr, msg, RSB2_RPCMUX_HDRSZ);
+	}
+	if (msglen < RSB2_RPCMUX_HDRSZ || ntohl(hdr) > INT_MAX) {
+		/* notify invalid request */
+		RSB2_ERROR("rpc_invalid", "sock=%d,msglen=%d", sock, msglen);
+	} else {
+		ret = server->fRecv(sock, (int)ntohl(hdr), msg + RSB2_RPCMUX_HDRSZ,
+				msglen - RSB2_RPCMUX_HDRSZ);
+	}
+	RSB2_TRACE_EXIT_INT(ret);
+	return ret;
+}
+
+int rsb2_rpcmux_serve(const char *path, rsb2_Rpcmux_recv fRecv,
+		const rsb2_Unixsock_opts *opts)
+{
+	RSB2_TRACE_ARGS("path=%s,fRecv=%p,opts=%p", path, fRecv, opts);
+	RSB2_ASSERT_NOTNULL(fRecv);
+	rsb2_Unixsock_opts muxopts;
+	if (opts) {
+		muxopts = *opts;
+	} else {
+		memset(&muxopts, 0, sizeof(muxopts));
+	}
+	/* the handler is reached through the server, not a global */
+	rsb2_Rpcmux_server server;
+	server.fRecv = fRecv;
+	muxopts.framed = true;
+	muxopts.arg = &server;
+	int err = rsb2_unixsock_serve(path, rsb2_rpcmux_dispatch, &muxopts);
+	RSB2_TRACE_EXIT_INT(err);
+	return err;
+}
+
+/*END*/
@@ -0,0 +1,122 @@
+/** Module rsb2_rpcmux - Interface.
+ * @file rsb2_rpcmux.h
+ * @author jp.tranvouez@navilab.com
+ * @defgroup rsb2_rpcmux Multiplexed RPC over a Unix Socket
+ * @ingroup rsb2_libos
+ * @{
+ *
+ * Each request and response is a frame (see rsb2_frame) whose payload
+ * starts with a 4-byte request ID in network byte order. Many requests
+ * can be in flight on one connection; responses are matched by ID and
+ * may come back in any order.
+ */
+#ifndef RSB2_RPCMUX_H
+#define RSB2_RPCMUX_H
+
+#include "rsb2_unixsock.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** Size of the request ID header. */
+#define RSB2_RPCMUX_HDRSZ		4
+
+/** Maximum number of requests in flight on a client connection. */
+#define RSB2_RPCMUX_MAXINFLIGHT	256
+
+/** Multiplexed RPC client connection (opaque). */
+typedef struct rsb2_Rpcmux_client rsb2_Rpcmux_client;
+
+/** Process a request received by a multiplexed RPC server.
+ * The response is sent with rsb2_rpcmux_reply, either before returning
+ * or later from any thread.
+ * @param sock service socket file descriptor
+ * @param id request ID
+ * @param msg request message address
+ * @param msglen request message length
+ * @retval 0 continue
+ * @retval 1 close service socket, continue listening
+ * @retval 2 stop server
+ */
+typedef int rsb2_Rpcmux_recv(int sock, int id, const char *msg, int msglen);
+
+/** Open a multiplexed RPC client connection.
+ * @param path filesystem path of Unix socket
+ * @return client connection
+ * @retval NULL error
+ */
+rsb2_Rpcmux_client *rsb2_rpcmux_connect(const char *path);
+
+/** Close a multiplexed RPC client connection.
+ * Requests still in flight fail: the threads waiting in rsb2_rpcmux_submit
+ * or rsb2_rpcmux_wait return -1 before the connection is released. No
+ * call may start on the connection once it is closing.
+ * @param client client connection
+ */
+void rsb2_rpcmux_close(rsb2_Rpcmux_client *client);
+
+/** Send a request without waiting for its response.
+ * Blocks while RSB2_RPCMUX_MAXINFLIGHT requests are in flight.
+ * @param client client connection
+ * @param msg request message address
+ * @param msglen request message length
+ * @return request ID, to be passed to rsb2_rpcmux_wait
+ * @retval -1 error
+ */
+int rsb2_rpcmux_submit(rsb2_Rpcmux_client *client,
+		const char *msg, int msglen);
+
+/** Wait for the response to a request.
+ * Any thread may wait for any request. Responses to other requests read
+ * meanwhile are kept for their own waiters.
+ * @param client client connection
+ * @param id request ID
+ * @param buf response buffer address
+ * @param bufsz response buffer size
+ * @return length of response message
+ * @retval -1 error, or response longer than bufsz
+ */
+int rsb2_rpcmux_wait(rsb2_Rpcmux_client *client, int id,
+		char *buf, int bufsz);
+
+/** Send a request and wait for its response.
+ * @param client client connection
+ * @param msg request message address
+ * @param msglen request message length
+ * @param buf response buffer address
+ * @param bufsz response buffer size
+ * @return length of response message
+ * @retval -1 error
+ */
+int rsb2_rpcmux_call(rsb2_Rpcmux_client *client, const char *msg, int msglen,
+		char *buf, int bufsz);
+
+/** Send the response to a request.
+ * Safe to call from any thread, including concurrently on one socket.
+ * @param sock service socket file descriptor
+ * @param id request ID
+ * @param msg response message address
+ * @param msglen response message length
+ * @retval 0 success
+ * @retval -1 error
+ */
+int rsb2_rpcmux_reply(int sock, int id, const char *msg, int msglen);
+
+/** Run a multiplexed RPC server.
+ * Framing is always enabled. Several servers may run at a time, each
+ * with its own handler; opts->arg is used by the server.
+ * @param path filesystem path of Unix socket
+ * @param fRecv request processing function
+ * @param opts server options or NULL for defaults
+ * @retval 0 normal shutdown
+ * @retval -1 error detected
+ */
+int rsb2_rpcmux_serve(const char *path, rsb2_Rpcmux_recv fRecv,
+		const rsb2_Unixsock_opts *opts);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /*@} RSB2_RPCMUX_H */
@@ -0,0 +1,291 @@
+/** Module rsb2_sendq - Implementation.
+ * @file rsb2_sendq.c
+ * @author jp.tranvouez@navilab.com
+ */
+#include "rsb2_sendq.h"
+#include "rsb2_bufpool.h"
+#include "rsb2_metrics.h"
+#include "rsb2_module.h"
+#include "rsb2_socket.h"
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* Maximum number of chunks written in one call. */
+#define RSB2_SENDQ_IOVMAX		16
+
+/* Chunk of queued bytes, at the start of a pooled buffer. */
+typedef struct rsb2_Sendq_chunk {
+	struct rsb2_Sendq_chunk *next;		/* Next chunk. */
+	size_t size;						/* Data capacity. */
+	size_t head;						/* Offset of the first unsent byte. */
+	size_t tail;						/* Offset past the last queued byte. */
+} __attribute__((aligned(16))) rsb2_Sendq_chunk;
+
+/* Outbound queue. */
+struct rsb2_Sendq {
+	int sock;							/* Service socket. */
+	size_t hiwat;						/* High-water mark. */
+	size_t pending;						/* Queued bytes. */
+	bool full;							/* High-water mark reached. */
+	bool failed;						/* Write error, the queue is dead. */
+	rsb2_Sendq_chunk *first;			/* Oldest chunk or NULL. */
+	rsb2_Sendq_chunk *last;				/* Newest chunk or NULL. */
+};
+
+static int g_module = -1;				/* Module reference. */
+
+int rsb2_sendq_begin(void)
+{
+	g_module = rsb2_module_ref("rsb2_sendq");
+	int err = g_module < 0;
+	return err;
+}
+
+void rsb2_sendq_end(void)
+{
+	rsb2_module_destroy(g_module);
+}
+
+rsb2_Sendq *rsb2_sendq_create(int sock, size_t hiwat)
+{
+	RSB2_TRACE_ARGS("sock=%d,hiwat=%zu", sock, hiwat);
+	rsb2_Sendq *q = calloc(1, sizeof(*q));
+	if (!q) {
+		/* notify 'calloc' failure */
+		RSB2_ERRNO("calloc", "sock=%d", sock);
+	} else if (rsb2_socket_setnonblock(sock)) {
+		RSB2_ERRTRACE();
+		free(q);
+		q = NULL;
+	} else {
+		q->sock = sock;
+		q->hiwat = hiwat? hiwat: RSB2_SENDQ_HIWAT;
+	}
+	RSB2_TRACE_EXIT_PTR(q);
+	return q;
+}
+
+static void rsb2_sendq_account(rsb2_Sendq *q, long delta)
+{
+	q->pending += delta;
+	rsb2_metrics_add(RSB2_METRICS_SENDQ_BYTES, delta);
+	if (!q->full && q->pending >= q->hiwat) {
+		/* notify backpressure */
+		RSB2_NOTIFY("sendq_full", "sock=%d,pending=%zu", q->sock, q->pending);
+		rsb2_metrics_add(RSB2_METRICS_SENDQ_FULL, 1);
+		q->full = true;
+	} else if (q->full && q->pending <= q->hiwat / 2) {
+		/* notify end of backpressure */
+		RSB2_NOTIFY("sendq_resumed", "sock=%d,pending=%zu",
+				q->sock, q->pending);
+		q->full = false;
+	}
+}
+
+void rsb2_sendq_destroy(rsb2_Sendq *q)
+{
+	RSB2_TRACE_ARGS("q=%p", q);
+	if (q) {
+		while (q->first) {
+			rsb2_Sendq_chunk *chunk = q->first;
+			q->first = chunk->next;
+			rsb2_bufpool_put((char *)chunk);
+		}
+		rsb2_metrics_add(RSB2_METRICS_SENDQ_BYTES, -(long)q->pending);
+		free(q);
+	}
+	RSB2_TRACE_EXIT();
+}
+
+static int rsb2_sendq_append(rsb2_Sendq *q, const char *data, size_t len)
+{
+	RSB2_TRACE_ARGS("q=%p,data=%p,len=%zu", q, data, len);
+	int err = 0;
+	while (len > 0 && !err) {
+		rsb2_Sendq_chunk *chunk = q->last;
+		if (!chunk || chunk->tail == chunk->size) {
+			/* small messages share a chunk, large ones get a large chunk,
+			 * the chunk header may push the last bytes to the next one */
+			size_t size = len < RSB2_BUFPOOL_MAXSZ? len: RSB2_BUFPOOL_MAXSZ;
+			size_t cap = 0;
+			chunk = (rsb2_Sendq_chunk *)rsb2_bufpool_get(size, &cap);
+			if (!chunk) {
+				RSB2_ERRTRACE();
+				err = -1;
+				break;
+			}
+			chunk->next = NULL;
+			chunk->size = cap - sizeof(*chunk);
+			chunk->head = 0;
+			chunk->tail = 0;
+			if (q->last) {
+				q->last->next = chunk;
+			} else {
+				q->first = chunk;
+			}
+			q->last = chunk;
+		}
+		size_t count = chunk->size - chunk->tail;
+		count = count < len? count: len;
+		memcpy((char *)(chunk + 1) + chunk->tail, data, count);
+		chunk->tail += count;
+		data += count;
+		len -= count;
+		rsb2_sendq_account(q, count);
+	}
+	RSB2_TRACE_EXIT_INT(err);
+	return err;
+}
+
+int rsb2_sendq_pushv(rsb2_Sendq *q, const struct iovec *iov, int iovcnt)
+{
+	RSB2_TRACE_ARGS("q=%p,iov=%p,iovcnt=%d", q, iov, iovcnt);
+	RSB2_ASSERT_NOTNULL(q);
+	RSB2_ASSERT_NOTNULL(iov);
+	RSB2_ASSERT_POSINT(iovcnt);
+	int ret = 0;
+	size_t sent = 0;
+	if (q->failed) {
+		/* notify write on a dead connection */
+		RSB2_ERROR("sendq_failed", "sock=%d", q->sock);
+		ret = -1;
+	} else if (!q->first) {
+		/* nothing queued, write at once, queue what is left */
+		int count = rsb2_socket_sendv(q->sock, iov, iovcnt);
+		if (count >= 0) {
+			sent = count;
+		} else if (errno != EAGAIN && errno != EWOULDBLOCK) {
+			RSB2_ERRTRACE();
+			q->failed = true;
+			ret = -1;
+		}
+	}
+	for (int i = 0; i < iovcnt && !ret; i++) {
+		if (sent >= iov[i].iov_len) {
+			sent -= iov[i].iov_len;
+		} else {
+			ret = rsb2_sendq_append(q, (const char *)iov[i].iov_base + sent,
+					iov[i].iov_len - sent);
+			sent = 0;
+			if (ret) {
+				/* part of the message may be written or queued, the next
+				 * one would follow a truncated message on the stream */
+				RSB2_ERRTRACE();
+				q->failed = true;
+			}
+		}
+	}
+	if (!ret && q->full) {
+		ret = 1;
+	}
+	RSB2_TRACE_EXIT_INT(ret);
+	return ret;
+}
+
+int rsb2_sendq_push(rsb2_Sendq *q, const char *msg, int msglen)
+{
+	RSB2_TRACE_ARGS("q=%p,msg=%p,msglen=%d", q, msg, msglen);
+	RSB2_ASSERT_NOTNEGINT(msglen);
+	int ret = 0;
+	if (msglen > 0) {
+		struct iovec iov;
+		iov.iov_base = (char *)msg;
+		iov.iov_len = msglen;
+		ret = rsb2_sendq_pushv(q, &iov, 1);
+	}
+	RSB2_TRACE_EXIT_INT(ret);
+	return ret;
+}
+
+int rsb2_sendq_flush(rsb2_Sendq *q)
+{
+	RSB2_TRACE_ARGS("q=%p", q);
+	RSB2_ASSERT_NOTNULL(q);
+	int ret = q->failed? -1: 0;
+	while (!ret && q->first) {
+		/* the oldest chunks in one write */
+		struct iovec iov[RSB2_SENDQ_IOVMAX];
+		int iovcnt = 0;
+		for (rsb2_Sendq_chunk *chunk = q->first;
+				chunk && iovcnt < RSB2_SENDQ_IOVMAX; chunk = chunk->next) {
+			iov[iovcnt].iov_base = (char *)(chunk + 1) + chunk->head;
+			iov[iovcnt++].iov_len = chunk->tail - chunk->head;
+		}
+		int count = rsb2_socket_sendv(q->sock, iov, iovcnt);
+		if (count < 0) {
+			if (errno == EAGAIN || errno == EWOULDBLOCK) {
+				/* socket full */
+				ret = 1;
+			} else {
+				RSB2_ERRTRACE();
+				q->failed = true;
+				ret = -1;
+			}
+			break;
+		}
+		rsb2_sendq_account(q, -(long)count);
+		/* release the chunks written, resume a partial one */
+		while (count > 0) {
+			rsb2_Sendq_chunk *chunk = q->first;
+			size_t left = chunk->tail - chunk->head;
+			if ((size_t)count < left) {
+				chunk->head += count;
+				count = 0;
+			} else {
+				count -= left;
+				q->first = chunk->next;
+				if (!q->first) {
+					q->last = NULL;
+				}
+				rsb2_bufpool_put((char *)chunk);
+			}
+		}
+	}
+	RSB2_TRACE_EXIT_INT(ret);
+	return ret;
+}
+
+int rsb2_sendq_drain(rsb2_Sendq *q, int maxms)
+{
+	RSB2_TRACE_ARGS("q=%p,maxms=%d", q, maxms);
+	int ret = rsb2_sendq_flush(q);
+	while (ret == 1) {
+		int count = rsb2_socket_wrwait(q->sock, maxms);
+		if (count < 0) {
+			RSB2_ERRTRACE();
+			q->failed = true;
+			ret = -1;
+		} else if (count == 0) {
+			/* notify timeout */
+			RSB2_NOTIFY("sendq_timeout", "sock=%d,pending=%zu",
+					q->sock, q->pending);
+			break;
+		} else {
+			ret = rsb2_sendq_flush(q);
+		}
+	}
+	RSB2_TRACE_EXIT_INT(ret);
+	return ret;
+}
+
+size_t rsb2_sendq_pending(const rsb2_Sendq *q)
+{
+	RSB2_ASSERT_NOTNULL(q);
+	return q->pending;
+}
+
+bool rsb2_sendq_full(const rsb2_Sendq *q)
+{
+	RSB2_ASSERT_NOTNULL(q);
+	return q->full;
+}
+
+int rsb2_sendq_sock(const rsb2_Sendq *q)
+{
+	RSB2_ASSERT_NOTNULL(q);
+	return q->sock;
+}
+
+/*END*/
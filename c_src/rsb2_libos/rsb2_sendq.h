@@ -0,0 +1,117 @@
+/** Module rsb2_sendq - Interface.
+ * @file rsb2_sendq.h
+ * @author jp.tranvouez@navilab.com
+ * @defgroup rsb2_sendq Outbound Stream Queue
+ * @ingroup rsb2_libos
+ * @{
+ * Outbound byte queue of a stream socket. Messages are written at once
+ * while the socket accepts them; what a short write leaves is copied into
+ * pooled buffers (see rsb2_bufpool) and written later, when the owner sees
+ * the socket writable, from its event loop or with rsb2_socket_wrwait.
+ * No call blocks except rsb2_sendq_drain. When the queued bytes reach the
+ * high-water mark, the producer is told to stop producing until they fall
+ * back to half of it, so a slow peer costs memory up to the mark and
+ * never blocks the producing thread.
+ * A queue belongs to one thread. Message boundaries are not kept, so the
+ * queue is for SOCK_STREAM sockets only.
+ */
+#ifndef RSB2_SENDQ_H
+#define RSB2_SENDQ_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <sys/uio.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** Default high-water mark (bytes). */
+#define RSB2_SENDQ_HIWAT		(1024 * 1024)
+
+/** Outbound queue (opaque). */
+typedef struct rsb2_Sendq rsb2_Sendq;
+
+/** Create an empty queue.
+ * The socket is put in non-blocking mode.
+ * @param sock service socket file descriptor
+ * @param hiwat high-water mark (bytes), 0 for RSB2_SENDQ_HIWAT
+ * @return queue
+ * @retval NULL error
+ */
+rsb2_Sendq *rsb2_sendq_create(int sock, size_t hiwat);
+
+/** Destroy a queue, dropping the bytes not yet written.
+ * The socket is not closed.
+ * @param q queue or NULL
+ */
+void rsb2_sendq_destroy(rsb2_Sendq *q);
+
+/** Queue a message.
+ * If nothing is queued, the message is written at once and only the
+ * part the socket did not take is copied.
+ * @param q queue
+ * @param msg message address
+ * @param msglen message length
+ * @retval 0 message sent or queued
+ * @retval 1 message queued, the high-water mark is reached: stop
+ * producing until rsb2_sendq_full returns false
+ * @retval -1 error, the connection is unusable
+ */
+int rsb2_sendq_push(rsb2_Sendq *q, const char *msg, int msglen);
+
+/** Queue a message gathered from several buffers.
+ * Same as rsb2_sendq_push, the buffers are sent in order in one write.
+ * @param q queue
+ * @param iov buffers
+ * @param iovcnt number of buffers
+ * @retval 0 message sent or queued
+ * @retval 1 message queued, the high-water mark is reached
+ * @retval -1 error, the connection is unusable
+ */
+int rsb2_sendq_pushv(rsb2_Sendq *q, const struct iovec *iov, int iovcnt);
+
+/** Write queued bytes until the queue is empty or the socket is full.
+ * Called when the socket is writable.
+ * @param q queue
+ * @retval 0 queue empty
+ * @retval 1 bytes left, wait for the socket to be writable
+ * @retval -1 error, the connection is unusable
+ */
+int rsb2_sendq_flush(rsb2_Sendq *q);
+
+/** Write every queued byte, waiting for the socket with rsb2_socket_wrwait.
+ * @param q queue
+ * @param maxms maximum wait time (ms), 0 for no limit
+ * @retval 0 queue empty
+ * @retval 1 timeout, bytes left
+ * @retval -1 error, the connection is unusable
+ */
+int rsb2_sendq_drain(rsb2_Sendq *q, int maxms);
+
+/** Get the number of queued bytes.
+ * @param q queue
+ * @return bytes not yet written
+ */
+size_t rsb2_sendq_pending(const rsb2_Sendq *q);
+
+/** Tell if the producer should stop.
+ * Set when the queued bytes reach the high-water mark, cleared when they
+ * fall to half of it.
+ * @param q queue
+ * @retval true high-water mark reached
+ * @retval false below the mark
+ */
+bool rsb2_sendq_full(const rsb2_Sendq *q);
+
+/** Get the socket of a queue.
+ * @param q queue
+ * @return service socket file descriptor
+ */
+int rsb2_sendq_sock(const rsb2_Sendq *q);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /*@} RSB2_SENDQ_H */
@@ -0,0 +1,698 @@
+/** Module rsb2_shmring - Implementation.
+ * @file rsb2_shmring.c
+ * @author jp.tranvouez@navilab.com
+ */
+#include "rsb2_shmring.h"
+#include "rsb2_metrics.h"
+#include "rsb2_module.h"
+#include "rsb2_socket.h"
+#include "rsb2_unixsock.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+
+enum {
+	RSB2_SHMRING_VERSION		= 1,		/* Layout version. */
+	RSB2_SHMRING_CACHELINE		= 64,		/* Counter alignment. */
+	RSB2_SHMRING_ALIGN			= 8,		/* Record alignment. */
+	RSB2_SHMRING_MINSIZE		= 4096,		/* Min ring data size. */
+	RSB2_SHMRING_MAXSIZE		= 1 << 30,	/* Max ring data size. */
+	RSB2_SHMRING_MAXSOCKS		= 1 << 20,	/* Max size of socket table. */
+};
+
+#define RSB2_SHMRING_MAGIC		"RSBS"
+#define RSB2_SHMRING_WRAP		0xffffffffu	/* Record skipping to ring start. */
+#define RSB2_SHMRING_SEALS		(F_SEAL_SEAL | F_SEAL_SHRINK | F_SEAL_GROW)
+
+/* Shared counters of a ring, producer and consumer on their own line. */
+typedef struct rsb2_Shmring_ctl {
+	uint64_t head;						/* Consumer counter. */
+	uint32_t consIdle;					/* Consumer waits on its eventfd. */
+	uint64_t tail __attribute__((aligned(RSB2_SHMRING_CACHELINE)));	/* Producer counter. */
+	uint32_t prodIdle;					/* Producer waits on its eventfd. */
+} __attribute__((aligned(RSB2_SHMRING_CACHELINE))) rsb2_Shmring_ctl;
+
+/* Header of the shared memory, followed by the data of both rings. */
+typedef struct rsb2_Shmring_shm {
+	char magic[4];						/* RSB2_SHMRING_MAGIC. */
+	uint32_t version;					/* RSB2_SHMRING_VERSION. */
+	uint32_t size;						/* Data size of each ring. */
+	uint32_t reserved;					/* Zero. */
+	rsb2_Shmring_ctl ctl[2];			/* Client to server, server to client. */
+} rsb2_Shmring_shm;
+
+/* Negotiation message, sent with the memfd and both eventfds. */
+typedef struct rsb2_Shmring_hello {
+	char magic[4];						/* RSB2_SHMRING_MAGIC. */
+	uint32_t version;					/* RSB2_SHMRING_VERSION. */
+	uint32_t size;						/* Data size of each ring. */
+	uint32_t reserved;					/* Zero. */
+} rsb2_Shmring_hello;
+
+/* One direction of a channel, seen from one end. */
+typedef struct rsb2_Shmring_ring {
+	rsb2_Shmring_ctl *ctl;				/* Shared counters. */
+	char *data;							/* Shared data. */
+	uint32_t size;						/* Data size, a power of two. */
+	uint64_t pos;						/* Own counter, never read back. */
+	uint64_t next;						/* Consumer counter after release. */
+} rsb2_Shmring_ring;
+
+/* Reply waiting for room in the ring. */
+typedef struct rsb2_Shmring_msg {
+	struct rsb2_Shmring_msg *next;		/* Next reply or NULL. */
+	int msglen;							/* Message length. */
+	char msg[];							/* Message. */
+} rsb2_Shmring_msg;
+
+struct rsb2_Shmring_chan {
+	int sock;							/* Unix socket. */
+	bool ownSock;						/* Socket closed with the channel. */
+	int selfFd;							/* Eventfd signalled by the peer. */
+	int peerFd;							/* Eventfd waited on by the peer. */
+	void *base;							/* Shared memory mapping. */
+	size_t mapsz;						/* Mapping size. */
+	rsb2_Shmring_ring tx;				/* Ring produced by this end. */
+	rsb2_Shmring_ring rx;				/* Ring consumed by this end. */
+	rsb2_Shmring_msg *first;			/* Oldest queued reply or NULL. */
+	rsb2_Shmring_msg *last;				/* Newest queued reply or NULL. */
+	size_t backlog;						/* Length of queued replies. */
+};
+
+static int g_module = -1;				/* Module reference. */
+static pthread_once_t g_chansOnce = PTHREAD_ONCE_INIT;	/* Table init. */
+static rsb2_Shmring_chan **g_chans = NULL;	/* Accepted channels by socket. */
+static int g_nchans = 0;				/* Size of socket table. */
+
+int rsb2_shmring_begin(void)
+{
+	RSB2_TRACE_ENTRY();
+	g_module = rsb2_module_ref("rsb2_shmring");
+	int err = g_module < 0;
+	RSB2_TRACE_EXIT_INT(err);
+	return err;
+}
+
+void rsb2_shmring_end(void)
+{
+	RSB2_TRACE_ENTRY();
+	rsb2_module_destroy(g_module);
+	RSB2_TRACE_EXIT();
+}
+
+static void rsb2_shmring_chansInit(void)
+{
+	struct rlimit rl;
+	int n = RSB2_SHMRING_MAXSOCKS;
+	if (!getrlimit(RLIMIT_NOFILE, &rl) && rl.rlim_cur < (rlim_t)n) {
+		n = rl.rlim_cur;
+	}
+	g_chans = calloc(n, sizeof(*g_chans));
+	if (!g_chans) {
+		/* notify 'calloc' failure */
+		RSB2_ERRNO("calloc", "n=%d", n);
+	} else {
+		g_nchans = n;
+	}
+}
+
+static size_t rsb2_shmring_dataOff(void)
+{
+	return (sizeof(rsb2_Shmring_shm) + RSB2_SHMRING_CACHELINE - 1) &
+			~(size_t)(RSB2_SHMRING_CACHELINE - 1);
+}
+
+static size_t rsb2_shmring_mapsz(uint32_t size)
+{
+	return rsb2_shmring_dataOff() + 2 * (size_t)size;
+}
+
+static bool rsb2_shmring_sealed(int memfd)
+{
+	/* F_GET_SEALS fails on a file that is not a memfd, and -1 has every
+	 * seal bit set */
+	int seals = fcntl(memfd, F_GET_SEALS);
+	return seals >= 0 && (seals & RSB2_SHMRING_SEALS) == RSB2_SHMRING_SEALS;
+}
+
+static rsb2_Shmring_chan *rsb2_shmring_map(int sock, int memfd, uint32_t size,
+		int selfFd, int peerFd, bool client)
+{
+	RSB2_TRACE_ARGS("sock=%d,memfd=%d,size=%u,selfFd=%d,peerFd=%d,client=%d",
+			sock, memfd, size, selfFd, peerFd, client);
+	size_t mapsz = rsb2_shmring_mapsz(size);
+	rsb2_Shmring_chan *chan = calloc(1, sizeof(*chan));
+	void *base = MAP_FAILED;
+	if (!chan) {
+		/* notify 'calloc' failure */
+		RSB2_ERRNO("calloc", "sock=%d", sock);
+	} else if ((base = mmap(NULL, mapsz, PROT_READ | PROT_WRITE, MAP_SHARED,
+			memfd, 0)) == MAP_FAILED) {
+		/* notify 'mmap' failure */
+		RSB2_ERRNO("mmap", "memfd=%d,mapsz=%zu", memfd, mapsz);
+		free(chan);
+		chan = NULL;
+	} else {
+		rsb2_Shmring_shm *shm = base;
+		if (client) {
+			/* consumers start idle, the first message signals them */
+			memcpy(shm->magic, RSB2_SHMRING_MAGIC, sizeof(shm->magic));
+			shm->version = RSB2_SHMRING_VERSION;
+			shm->size = size;
+			shm->ctl[0].consIdle = 1;
+			shm->ctl[1].consIdle = 1;
+		}
+		char *data = (char *)base + rsb2_shmring_dataOff();
+		rsb2_Shmring_ring c2s = { &shm->ctl[0], data, size, 0, 0 };
+		rsb2_Shmring_ring s2c = { &shm->ctl[1], data + size, size, 0, 0 };
+		chan->sock = sock;
+		chan->ownSock = client;
+		chan->selfFd = selfFd;
+		chan->peerFd = peerFd;
+		chan->base = base;
+		chan->mapsz = mapsz;
+		chan->tx = client? c2s: s2c;
+		chan->rx = client? s2c: c2s;
+	}
+	RSB2_TRACE_EXIT_PTR(chan);
+	return chan;
+}
+
+rsb2_Shmring_chan *rsb2_shmring_connect(const char *path, size_t size)
+{
+	RSB2_TRACE_ARGS("path=%s,size=%zu", path, size);
+	RSB2_ASSERT_NOTNULL(path);
+	rsb2_Shmring_chan *chan = NULL;
+	uint32_t ringsz = RSB2_SHMRING_MINSIZE;
+	size = size? size: RSB2_SHMRING_SIZE;
+	while (ringsz < size && ringsz < RSB2_SHMRING_MAXSIZE) {
+		ringsz <<= 1;
+	}
+	size_t mapsz = rsb2_shmring_mapsz(ringsz);
+	int sock = -1;
+	int memfd = -1;
+	int selfFd = -1;
+	int peerFd = -1;
+	if (size > RSB2_SHMRING_MAXSIZE) {
+		/* notify invalid ring size */
+		RSB2_ERROR("shmring_size", "path=%s,size=%zu", path, size);
+	} else if ((sock = rsb2_unixsock_connect(path)) < 0) {
+		RSB2_ERRTRACE();
+	} else if ((memfd = memfd_create("rsb2_shmring",
+			MFD_CLOEXEC | MFD_ALLOW_SEALING)) < 0) {
+		/* notify 'memfd_create' failure */
+		RSB2_ERRNO("memfd_create", "path=%s", path);
+	} else if (ftruncate(memfd, mapsz)) {
+		/* notify 'ftruncate' failure */
+		RSB2_ERRNO("ftruncate", "memfd=%d,mapsz=%zu", memfd, mapsz);
+	} else if (fcntl(memfd, F_ADD_SEALS, RSB2_SHMRING_SEALS)) {
+		/* notify 'fcntl' failure */
+		RSB2_ERRNO("fcntl", "memfd=%d,cmd=F_ADD_SEALS", memfd);
+	} else if ((selfFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)) < 0 ||
+			(peerFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)) < 0) {
+		/* notify 'eventfd' failure */
+		RSB2_ERRNO("eventfd", "path=%s", path);
+	} else if (!(chan = rsb2_shmring_map(sock, memfd, ringsz, selfFd, peerFd,
+			true))) {
+		RSB2_ERRTRACE();
+	} else {
+		/* the server's own eventfd first */
+		rsb2_Shmring_hello hello;
+		memcpy(hello.magic, RSB2_SHMRING_MAGIC, sizeof(hello.magic));
+		hello.version = RSB2_SHMRING_VERSION;
+		hello.size = ringsz;
+		hello.reserved = 0;
+		int fds[3] = { memfd, peerFd, selfFd };
+		rsb2_Shmring_hello ack;
+		if (rsb2_socket_sendfds(sock, fds, 3, (const char *)&hello,
+				sizeof(hello)) != sizeof(hello)) {
+			RSB2_ERRTRACE();
+		} else if (rsb2_socket_recv(sock, (char *)&ack, sizeof(ack)) !=
+				sizeof(ack) || memcmp(&ack, &hello, sizeof(ack))) {
+			/* notify refused negotiation */
+			RSB2_ERROR("shmring_refused", "path=%s,sock=%d", path, sock);
+		} else {
+			sock = selfFd = peerFd = -1;
+		}
+		if (sock >= 0) {
+			munmap(chan->base, chan->mapsz);
+			free(chan);
+			chan = NULL;
+		}
+	}
+	if (memfd >= 0) {
+		/* the mappings keep the memory */
+		close(memfd);
+	}
+	if (!chan) {
+		if (selfFd >= 0) {
+			close(selfFd);
+		}
+		if (peerFd >= 0) {
+			close(peerFd);
+		}
+		if (sock >= 0) {
+			rsb2_socket_close(sock);
+		}
+	}
+	RSB2_TRACE_EXIT_PTR(chan);
+	return chan;
+}
+
+rsb2_Shmring_chan *rsb2_shmring_accept(int sock)
+{
+	RSB2_TRACE_ARGS("sock=%d", sock);
+	rsb2_Shmring_chan *chan = NULL;
+	rsb2_Shmring_hello hello;
+	int fds[RSB2_SOCKET_MAXFDS];
+	int nfds = 0;
+	pthread_once(&g_chansOnce, rsb2_shmring_chansInit);
+	int count = rsb2_socket_recvfds(sock, fds, &nfds, (char *)&hello,
+			sizeof(hello));
+	int err = errno;
+	struct stat st;
+	if (count < 0) {
+		if (err != EAGAIN && err != EWOULDBLOCK) {
+			RSB2_ERRTRACE();
+		}
+	} else if (count != sizeof(hello) || nfds != 3 ||
+			memcmp(hello.magic, RSB2_SHMRING_MAGIC, sizeof(hello.magic)) ||
+			hello.version != RSB2_SHMRING_VERSION ||
+			hello.size < RSB2_SHMRING_MINSIZE ||
+			hello.size > RSB2_SHMRING_MAXSIZE ||
+			(hello.size & (hello.size - 1))) {
+		/* notify invalid negotiation message */
+		RSB2_ERROR("shmring_invalid", "sock=%d,count=%d,nfds=%d",
+				sock, count, nfds);
+		err = EPROTO;
+	} else if (!rsb2_shmring_sealed(fds[0]) || fstat(fds[0], &st) ||
+			(size_t)st.st_size != rsb2_shmring_mapsz(hello.size)) {
+		/* the client could shrink the memory under the mapping */
+		RSB2_ERROR("shmring_unsealed", "sock=%d,memfd=%d", sock, fds[0]);
+		err = EPROTO;
+	} else if (sock >= g_nchans) {
+		/* notify socket out of table */
+		RSB2_ERROR("shmring_socket", "sock=%d,nchans=%d", sock, g_nchans);
+		err = EMFILE;
+	} else if (!(chan = rsb2_shmring_map(sock, fds[0], hello.size, fds[1],
+			fds[2], false))) {
+		RSB2_ERRTRACE();
+		err = ENOMEM;
+	} else {
+		rsb2_Shmring_shm *shm = chan->base;
+		if (memcmp(shm->magic, hello.magic, sizeof(shm->magic)) ||
+				shm->size != hello.size) {
+			/* notify invalid shared memory header */
+			RSB2_ERROR("shmring_invalid", "sock=%d,size=%u",
+					sock, shm->size);
+			err = EPROTO;
+		} else if (rsb2_socket_send(sock, (const char *)&hello,
+				sizeof(hello)) != sizeof(hello)) {
+			RSB2_ERRTRACE();
+			err = errno;
+		} else {
+			__atomic_store_n(&g_chans[sock], chan, __ATOMIC_RELEASE);
+			/* notify channel accepted */
+			RSB2_NOTIFY("shmring_accepted", "sock=%d,size=%u",
+					sock, hello.size);
+			err = 0;
+		}
+		if (err) {
+			/* the eventfds are closed below */
+			munmap(chan->base, chan->mapsz);
+			free(chan);
+			chan = NULL;
+		}
+	}
+	for (int i = 0; i < nfds; i++) {
+		/* the mapping keeps the memory, the channel the eventfds */
+		if (i == 0 || !chan) {
+			close(fds[i]);
+		}
+	}
+	RSB2_TRACE_EXIT_PTR(chan);
+	errno = err;
+	return chan;
+}
+
+void rsb2_shmring_close(rsb2_Shmring_chan *chan)
+{
+	RSB2_TRACE_ARGS("chan=%p", chan);
+	RSB2_ASSERT_NOTNULL(chan);
+	if (chan->ownSock) {
+		rsb2_socket_close(chan->sock);
+	} else {
+		__atomic_store_n(&g_chans[chan->sock], NULL, __ATOMIC_RELEASE);
+	}
+	while (chan->first) {
+		rsb2_Shmring_msg *next = chan->first->next;
+		free(chan->first);
+		chan->first = next;
+	}
+	munmap(chan->base, chan->mapsz);
+	close(chan->selfFd);
+	close(chan->peerFd);
+	free(chan);
+	RSB2_TRACE_EXIT();
+}
+
+int rsb2_shmring_sock(const rsb2_Shmring_chan *chan)
+{
+	RSB2_ASSERT_NOTNULL(chan);
+	return chan->sock;
+}
+
+int rsb2_shmring_fd(const rsb2_Shmring_chan *chan)
+{
+	RSB2_ASSERT_NOTNULL(chan);
+	return chan->selfFd;
+}
+
+static void rsb2_shmring_wake(rsb2_Shmring_chan *chan, uint32_t *idle)
+{
+	/* pairs with the fence of rsb2_shmring_idle: either the peer sees
+	 * the counter just published, or this end sees the idle flag */
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+	if (__atomic_load_n(idle, __ATOMIC_RELAXED) &&
+			__atomic_exchange_n(idle, 0, __ATOMIC_ACQ_REL)) {
+		eventfd_write(chan->peerFd, 1);
+	}
+}
+
+static void rsb2_shmring_idle(uint32_t *idle)
+{
+	__atomic_store_n(idle, 1, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+}
+
+static int rsb2_shmring_sleep(rsb2_Shmring_chan *chan)
+{
+	RSB2_TRACE_ARGS("chan=%p", chan);
+	int err = -1;
+	struct pollfd fds[2];
+	fds[0].fd = chan->selfFd;
+	fds[0].events = POLLIN;
+	fds[1].fd = chan->sock;
+	fds[1].events = POLLRDHUP;
+	int count = -1;
+	do {
+		count = poll(fds, 2, -1);
+	} while (count < 0 && errno == EINTR);
+	if (count < 0) {
+		/* notify 'poll' failure */
+		RSB2_ERRNO("poll", "selfFd=%d,sock=%d", chan->selfFd, chan->sock);
+	} else if (fds[1].revents) {
+		/* notify peer gone */
+		RSB2_ERROR("shmring_closed", "sock=%d,revents=%d",
+				chan->sock, fds[1].revents);
+	} else {
+		eventfd_t value;
+		eventfd_read(chan->selfFd, &value);
+		err = 0;
+	}
+	RSB2_TRACE_EXIT_INT(err);
+	return err;
+}
+
+static int rsb2_shmring_put(rsb2_Shmring_chan *chan, const char *msg,
+		int msglen)
+{
+	rsb2_Shmring_ring *ring = &chan->tx;
+	uint64_t head = __atomic_load_n(&ring->ctl->head, __ATOMIC_ACQUIRE);
+	uint64_t used = ring->pos - head;
+	if (used > ring->size) {
+		/* notify corrupted ring */
+		RSB2_ERROR("shmring_corrupted", "sock=%d,used=%llu",
+				chan->sock, (unsigned long long)used);
+		return -1;
+	}
+	uint32_t off = ring->pos & (ring->size - 1);
+	uint32_t need = (sizeof(uint32_t) + msglen + RSB2_SHMRING_ALIGN - 1) &
+			~(RSB2_SHMRING_ALIGN - 1);
+	/* a record never wraps, the end of the ring is skipped instead */
+	uint32_t pad = ring->size - off < need? ring->size - off: 0;
+	if (pad + need > ring->size - used) {
+		return 0;
+	}
+	if (pad) {
+		*(uint32_t *)(ring->data + off) = RSB2_SHMRING_WRAP;
+		off = 0;
+	}
+	*(uint32_t *)(ring->data + off) = msglen;
+	memcpy(ring->data + off + sizeof(uint32_t), msg, msglen);
+	ring->pos += pad + need;
+	__atomic_store_n(&ring->ctl->tail, ring->pos, __ATOMIC_RELEASE);
+	rsb2_shmring_wake(chan, &ring->ctl->consIdle);
+	return 1;
+}
+
+static int rsb2_shmring_get(rsb2_Shmring_chan *chan, const char **pmsg,
+		int *pmsglen)
+{
+	rsb2_Shmring_ring *ring = &chan->rx;
+	uint64_t tail = __atomic_load_n(&ring->ctl->tail, __ATOMIC_ACQUIRE);
+	for (;;) {
+		uint64_t avail = tail - ring->pos;
+		if (!avail) {
+			return 0;
+		}
+		uint32_t off = ring->pos & (ring->size - 1);
+		/* read once, the peer could change it after validation */
+		uint32_t len = __atomic_load_n((uint32_t *)(ring->data + off),
+				__ATOMIC_RELAXED);
+		uint64_t need = len == RSB2_SHMRING_WRAP? ring->size - off:
+				(sizeof(uint32_t) + (uint64_t)len + RSB2_SHMRING_ALIGN - 1) &
+				~(uint64_t)(RSB2_SHMRING_ALIGN - 1);
+		if (avail > ring->size || need > avail || off + need > ring->size) {
+			/* notify corrupted ring */
+			RSB2_ERROR("shmring_corrupted", "sock=%d,avail=%llu,len=%u",
+					chan->sock, (unsigned long long)avail, len);
+			return -1;
+		}
+		if (len == RSB2_SHMRING_WRAP) {
+			ring->pos += need;
+			continue;
+		}
+		*pmsg = ring->data + off + sizeof(uint32_t);
+		*pmsglen = len;
+		ring->next = ring->pos + need;
+		return 1;
+	}
+}
+
+static void rsb2_shmring_release(rsb2_Shmring_chan *chan)
+{
+	rsb2_Shmring_ring *ring = &chan->rx;
+	ring->pos = ring->next;
+	__atomic_store_n(&ring->ctl->head, ring->pos, __ATOMIC_RELEASE);
+	rsb2_shmring_wake(chan, &ring->ctl->prodIdle);
+}
+
+int rsb2_shmring_send(rsb2_Shmring_chan *chan, const char *msg, int msglen)
+{
+	RSB2_TRACE_ARGS("chan=%p,msg=%p,msglen=%d", chan, msg, msglen);
+	RSB2_ASSERT_NOTNULL(chan);
+	RSB2_ASSERT_NOTNULL(msg);
+	RSB2_ASSERT_NOTNEGINT(msglen);
+	int err = 0;
+	bool idle = false;
+	if ((uint32_t)msglen > chan->tx.size / 4) {
+		/* notify message too long */
+		RSB2_ERROR("shmring_msglen", "sock=%d,msglen=%d,size=%u",
+				chan->sock, msglen, chan->tx.size);
+		err = -1;
+	}
+	while (!err) {
+		int ret = rsb2_shmring_put(chan, msg, msglen);
+		if (ret) {
+			err = ret < 0? -1: 0;
+			break;
+		}
+		if (!idle) {
+			/* announce, then check again before sleeping */
+			rsb2_shmring_idle(&chan->tx.ctl->prodIdle);
+			idle = true;
+		} else {
+			err = rsb2_shmring_sleep(chan);
+			idle = false;
+		}
+	}
+	RSB2_TRACE_EXIT_INT(err);
+	return err;
+}
+
+static int rsb2_shmring_flush(rsb2_Shmring_chan *chan)
+{
+	RSB2_TRACE_ARGS("chan=%p", chan);
+	int err = 0;
+	bool idle = false;
+	while (chan->first) {
+		rsb2_Shmring_msg *msg = chan->first;
+		int ret = rsb2_shmring_put(chan, msg->msg, msg->msglen);
+		if (ret < 0) {
+			err = -1;
+			break;
+		} else if (ret) {
+			chan->first = msg->next;
+			if (!chan->first) {
+				chan->last = NULL;
+			}
+			chan->backlog -= msg->msglen;
+			free(msg);
+		} else if (!idle) {
+			/* announce, then check again: the release signals the eventfd */
+			rsb2_shmring_idle(&chan->tx.ctl->prodIdle);
+			idle = true;
+		} else {
+			break;
+		}
+	}
+	RSB2_TRACE_EXIT_INT(err);
+	return err;
+}
+
+static int rsb2_shmring_queue(rsb2_Shmring_chan *chan, const char *msg,
+		int msglen)
+{
+	RSB2_TRACE_ARGS("chan=%p,msg=%p,msglen=%d", chan, msg, msglen);
+	int err = -1;
+	int ret = 0;
+	rsb2_Shmring_msg *rec = NULL;
+	if ((uint32_t)msglen > chan->tx.size / 4) {
+		/* notify message too long */
+		RSB2_ERROR("shmring_msglen", "sock=%d,msglen=%d,size=%u",
+				chan->sock, msglen, chan->tx.size);
+	} else if (!chan->first &&
+			(ret = rsb2_shmring_put(chan, msg, msglen)) != 0) {
+		/* written in order, nothing queued before */
+		err = ret < 0? -1: 0;
+	} else if (!(rec = malloc(sizeof(*rec) + msglen))) {
+		/* notify 'malloc' failure */
+		RSB2_ERRNO("malloc", "sock=%d,msglen=%d", chan->sock, msglen);
+	} else {
+		rec->next = NULL;
+		rec->msglen = msglen;
+		memcpy(rec->msg, msg, msglen);
+		if (chan->last) {
+			chan->last->next = rec;
+		} else {
+			chan->first = rec;
+		}
+		chan->last = rec;
+		chan->backlog += msglen;
+		err = rsb2_shmring_flush(chan);
+	}
+	RSB2_TRACE_EXIT_INT(err);
+	return err;
+}
+
+int rsb2_shmring_recv(rsb2_Shmring_chan *chan, char *buf, int bufsz)
+{
+	RSB2_TRACE_ARGS("chan=%p,buf=%p,bufsz=%d", chan, buf, bufsz);
+	RSB2_ASSERT_NOTNULL(chan);
+	RSB2_ASSERT_NOTNULL(buf);
+	int len = -1;
+	bool idle = false;
+	for (;;) {
+		const char *msg;
+		int msglen;
+		int ret = rsb2_shmring_get(chan, &msg, &msglen);
+		if (ret > 0) {
+			if (msglen > bufsz) {
+				/* notify buffer too small, the message is dropped */
+				RSB2_ERROR("shmring_bufsz", "sock=%d,msglen=%d,bufsz=%d",
+						chan->sock, msglen, bufsz);
+			} else {
+				memcpy(buf, msg, msglen);
+				len = msglen;
+			}
+			rsb2_shmring_release(chan);
+			break;
+		}
+		if (ret < 0) {
+			break;
+		}
+		if (!idle) {
+			/* announce, then check again before sleeping */
+			rsb2_shmring_idle(&chan->rx.ctl->consIdle);
+			idle = true;
+		} else if (rsb2_shmring_sleep(chan)) {
+			RSB2_ERRTRACE();
+			break;
+		} else {
+			idle = false;
+		}
+	}
+	RSB2_TRACE_EXIT_INT(len);
+	return len;
+}
+
+int rsb2_shmring_dispatch(rsb2_Shmring_chan *chan, rsb2_Shmring_recv *fRecv)
+{
+	RSB2_TRACE_ARGS("chan=%p,fRecv=%p", chan, fRecv);
+	RSB2_ASSERT_NOTNULL(chan);
+	RSB2_ASSERT_NOTNULL(fRecv);
+	int ret = 0;
+	bool idle = false;
+	/* clear the eventfd first, a later signal is never lost */
+	eventfd_t value;
+	eventfd_read(chan->selfFd, &value);
+	if (rsb2_shmring_flush(chan)) {
+		ret = 1;
+	}
+	while (!ret) {
+		const char *msg;
+		int msglen;
+		if (chan->backlog > chan->tx.size) {
+			/* the peer reads no reply, its requests wait: the next
+			 * release signals the eventfd */
+			break;
+		}
+		int got = rsb2_shmring_get(chan, &msg, &msglen);
+		if (got > 0) {
+			/* call message processing function in place */
+			ret = rsb2_metrics_handle(fRecv, chan->sock, msg, msglen);
+			rsb2_shmring_release(chan);
+			idle = false;
+		} else if (got < 0) {
+			ret = 1;
+		} else if (!idle) {
+			/* announce, then check again before returning */
+			rsb2_shmring_idle(&chan->rx.ctl->consIdle);
+			idle = true;
+		} else {
+			break;
+		}
+	}
+	RSB2_TRACE_EXIT_INT(ret);
+	return ret;
+}
+
+int rsb2_shmring_reply(int sock, const char *msg, int msglen)
+{
+	RSB2_TRACE_ARGS("sock=%d,msg=%p,msglen=%d", sock, msg, msglen);
+	pthread_once(&g_chansOnce, rsb2_shmring_chansInit);
+	rsb2_Shmring_chan *chan = sock >= 0 && sock < g_nchans?
+			__atomic_load_n(&g_chans[sock], __ATOMIC_ACQUIRE): NULL;
+	int err = -1;
+	if (chan) {
+		/* never waits, the loop thread serves other connections */
+		err = rsb2_shmring_queue(chan, msg, msglen);
+	} else if (rsb2_socket_send(sock, msg, msglen) == msglen) {
+		err = 0;
+	}
+	RSB2_TRACE_EXIT_INT(err);
+	return err;
+}
+
+/*END*/
@@ -0,0 +1,135 @@
+/** Module rsb2_shmring - Interface.
+ * @file rsb2_shmring.h
+ * @author jp.tranvouez@navilab.com
+ * @defgroup rsb2_shmring Shared-Memory Ring Transport
+ * @ingroup rsb2_libos
+ * @{
+ * A channel is a pair of single-producer single-consumer rings, one
+ * for each direction, in a memfd shared by a client and a server on
+ * the same host. The client creates the memfd and two eventfds and
+ * passes them over a connected Unix socket; the server maps them and
+ * acknowledges. Messages then bypass the socket: a peer is only woken
+ * through its eventfd when it has announced that it is idle. The Unix
+ * socket stays open, its closure ends the channel.
+ */
+#ifndef RSB2_SHMRING_H
+#define RSB2_SHMRING_H
+
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** Default data size of each ring. */
+#define RSB2_SHMRING_SIZE		(1024 * 1024)
+
+/** Shared-memory channel. */
+typedef struct rsb2_Shmring_chan rsb2_Shmring_chan;
+
+/** Process a message received from a channel.
+ * Same contract as rsb2_Unixsock_recv; the message is only valid
+ * during the call.
+ * @param sock Unix socket file descriptor of the channel
+ * @param msg message address
+ * @param msglen message length
+ * @retval 0 continue
+ * @retval 1 close channel
+ * @retval 2 stop server
+ */
+typedef int rsb2_Shmring_recv(int sock, const char *msg, int msglen);
+
+/** Connect to a server and negotiate a channel.
+ * @param path filesystem path of Unix socket
+ * @param size data size of each ring, rounded up to a power of two,
+ * or 0 for RSB2_SHMRING_SIZE
+ * @return channel
+ * @retval NULL error
+ */
+rsb2_Shmring_chan *rsb2_shmring_connect(const char *path, size_t size);
+
+/** Accept the channel negotiated by a client.
+ * Reads the negotiation message from a connected socket, maps the
+ * rings and acknowledges. The socket stays owned by the caller.
+ * @param sock connected Unix socket file descriptor
+ * @return channel
+ * @retval NULL error, or no negotiation message yet on a non-blocking
+ * socket (errno is EAGAIN)
+ */
+rsb2_Shmring_chan *rsb2_shmring_accept(int sock);
+
+/** Close a channel.
+ * Unmaps the rings and closes the eventfds, and the socket of a
+ * client-side channel.
+ * @param chan channel
+ */
+void rsb2_shmring_close(rsb2_Shmring_chan *chan);
+
+/** Get the Unix socket of a channel.
+ * @param chan channel
+ * @return Unix socket file descriptor
+ */
+int rsb2_shmring_sock(const rsb2_Shmring_chan *chan);
+
+/** Get the eventfd signalled when the peer needs attention.
+ * Use it to watch a channel in an event loop, then call
+ * rsb2_shmring_dispatch().
+ * @param chan channel
+ * @return eventfd file descriptor (non-blocking)
+ */
+int rsb2_shmring_fd(const rsb2_Shmring_chan *chan);
+
+/** Send a message through a channel.
+ * Waits for room if the ring is full.
+ * @param chan channel
+ * @param msg message address
+ * @param msglen message length, at most a quarter of the ring size
+ * @retval 0 success
+ * @retval -1 error, or peer closed the socket
+ */
+int rsb2_shmring_send(rsb2_Shmring_chan *chan, const char *msg, int msglen);
+
+/** Receive a message from a channel.
+ * Waits for a message if the ring is empty.
+ * @param chan channel
+ * @param buf buffer address
+ * @param bufsz buffer size
+ * @return message length
+ * @retval -1 error, message larger than buffer, or peer closed the
+ * socket
+ */
+int rsb2_shmring_recv(rsb2_Shmring_chan *chan, char *buf, int bufsz);
+
+/** Pass every pending message to a processing function.
+ * Never waits; before returning with an empty ring, the caller is
+ * announced idle so that the next message signals the eventfd.
+ * Replies queued by rsb2_shmring_reply are written first; while more
+ * than a ring of them waits, the messages are left in the ring until
+ * the peer reads its replies, which signals the eventfd again.
+ * @param chan channel
+ * @param fRecv message processing function
+ * @retval 0 ring drained
+ * @retval 1 close channel (requested or corrupted ring)
+ * @retval 2 stop server
+ */
+int rsb2_shmring_dispatch(rsb2_Shmring_chan *chan, rsb2_Shmring_recv *fRecv);
+
+/** Reply to the peer of a server-side socket.
+ * Sends through the channel accepted on the socket, or directly on
+ * the socket if it has none, so that handlers serve both transports.
+ * Never waits for room in the ring: the reply is queued on the channel
+ * and written by the next rsb2_shmring_dispatch(), from the thread that
+ * dispatches the channel.
+ * @param sock Unix socket file descriptor
+ * @param msg message address
+ * @param msglen message length
+ * @retval 0 success
+ * @retval -1 error
+ */
+int rsb2_shmring_reply(int sock, const char *msg, int msglen);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /*@} RSB2_SHMRING_H */
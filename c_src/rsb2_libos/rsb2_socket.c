@@ -3,10 +3,15 @@
  * @author jp.tranvouez@navilab.com
  */
 #include "rsb2_socket.h"
+#include "rsb2_metrics.h"
 #include "rsb2_module.h"
 
+#include <errno.h>
+#include <stdbool.h>
 #include <stdio.h>
+#include <fcntl.h>
 #include <poll.h>
+#include <string.h>
 #include <unistd.h>
 #include <sys/socket.h>
 
@@ -42,6 +47,25 @@ void rsb2_socket_close(int sock)
 	RSB2_TRACE_EXIT();
 }
 
+int rsb2_socket_setnonblock(int sock)
+{
+	RSB2_TRACE_ARGS("sock=%d", sock);
+	int err = -1;
+	int flags = fcntl(sock, F_GETFL);
+	if (flags < 0) {
+		/* notify 'fcntl' failure */
+		RSB2_ERRNO("fcntl", "sock=%d,cmd=F_GETFL", sock);
+	} else {
+		err = fcntl(sock, F_SETFL, flags | O_NONBLOCK);
+		if (err) {
+			/* notify 'fcntl' failure */
+			RSB2_ERRNO("fcntl", "sock=%d,cmd=F_SETFL", sock);
+		}
+	}
+	RSB2_TRACE_EXIT_INT(err);
+	return err;
+}
+
 int rsb2_socket_diag(int sock)
 {
 	RSB2_TRACE_ARGS("sock=%d", sock);
@@ -61,15 +85,34 @@ int rsb2_socket_diag(int sock)
 	return err;
 }
 
+/* Update the metrics of a send or receive system call. */
+static void rsb2_socket_metrics(bool send, int count, int err, int msgs,
+		int64_t bytes, int retries)
+{
+	if (count >= 0) {
+		rsb2_metrics_add(send? RSB2_METRICS_MSGS_SENT:
+				RSB2_METRICS_MSGS_RECV, msgs);
+		rsb2_metrics_add(send? RSB2_METRICS_BYTES_SENT:
+				RSB2_METRICS_BYTES_RECV, bytes);
+	} else if (err != EAGAIN && err != EWOULDBLOCK) {
+		rsb2_metrics_add(send? RSB2_METRICS_SEND_ERRORS:
+				RSB2_METRICS_RECV_ERRORS, 1);
+	}
+	if (retries) {
+		rsb2_metrics_add(RSB2_METRICS_EINTR, retries);
+	}
+}
+
 static int rsb2_socket_iowait(int sock, int maxms, int events)
 {
 	RSB2_TRACE_ARGS("sock=%d,maxms=%d,events=%d", sock, maxms, events);
 	int count = 0;
 	struct pollfd fdset;
 	fdset.fd = sock;
-	fdset.events = POLLIN;
+	fdset.events = events;
 	RSB2_NOTIFY("thread_iowait", "sock=%d", sock);
 	count = poll(&fdset, 1, maxms? maxms: -1);
+	rsb2_metrics_add(RSB2_METRICS_WAKEUPS, 1);
 	RSB2_NOTIFY("thread_running", "sock=%d,count=%d", sock, count);
 	if (count < 0) {
 		/* notify 'poll' error */
@@ -86,7 +129,9 @@ static int rsb2_socket_iowait(int sock, int maxms, int events)
 int rsb2_socket_rdwait(int sock, int maxms)
 {
 	RSB2_TRACE_ARGS("sock=%d,maxms=%d", sock, maxms);
+	uint64_t start = rsb2_histo_now();
 	int count = rsb2_socket_iowait(sock, maxms, POLLIN);
+	rsb2_metrics_since(RSB2_METRICS_LAT_RDWAIT, start);
 	RSB2_TRACE_EXIT_INT(count);
 	return count;
 }
@@ -105,14 +150,43 @@ int rsb2_socket_recv(int sock, char *buf, int bufsz)
 	RSB2_ASSERT_NOTNULL(buf);
 	RSB2_ASSERT_POSINT(bufsz);
 	int count = -1;
+	int retries = -1;
 	do {
+		retries++;
 		count = recv(sock, buf, bufsz, 0);
 	} while (count < 0 && errno == EINTR);
-	if (count < 0) {
+	int err = errno;
+	rsb2_socket_metrics(false, count, err, count > 0, count, retries);
+	if (count < 0 && err != EAGAIN && err != EWOULDBLOCK) {
 		/* notify 'recv' error */
 		RSB2_ERRNO("recv", "sock=%d", sock);
 	}
 	RSB2_TRACE_EXIT_INT(count);
+	errno = err;
+	return count;
+}
+
+int rsb2_socket_recvrec(int sock, char *buf, int bufsz)
+{
+	RSB2_TRACE_ARGS("sock=%d,buf=%p,bufsz=%d", sock, buf, bufsz);
+	RSB2_ASSERT_NOTNULL(buf);
+	RSB2_ASSERT_POSINT(bufsz);
+	int count = -1;
+	int retries = -1;
+	do {
+		retries++;
+		/* MSG_TRUNC returns the length of the record, not of the copy */
+		count = recv(sock, buf, bufsz, MSG_TRUNC);
+	} while (count < 0 && errno == EINTR);
+	int err = errno;
+	rsb2_socket_metrics(false, count, err, count > 0,
+			count < bufsz? count: bufsz, retries);
+	if (count < 0 && err != EAGAIN && err != EWOULDBLOCK) {
+		/* notify 'recv' error */
+		RSB2_ERRNO("recv", "sock=%d", sock);
+	}
+	RSB2_TRACE_EXIT_INT(count);
+	errno = err;
 	return count;
 }
 
@@ -120,16 +194,256 @@ int rsb2_socket_send(int sock, const char *msg, int msglen)
 {
 	RSB2_TRACE_ARGS("sock=%d,msg=%p,msglen=%d", sock, msg, msglen);
 	int count = -1;
+	int retries = -1;
+	int err = errno;
 	if (sock >= 0 && msglen > 0) {
 		do {
-			count = write(sock, msg, msglen);
+			retries++;
+			/* no SIGPIPE when the peer is gone, report EPIPE instead */
+			count = send(sock, msg, msglen, MSG_NOSIGNAL);
 		} while (count < 0 && errno == EINTR);
-		if (count < 0) {
-			/* notify 'write' error */
-			RSB2_ERRNO("write", "sock=%d", sock);
+		err = errno;
+		rsb2_socket_metrics(true, count, err, 1, count, retries);
+		if (count < 0 && err != EAGAIN && err != EWOULDBLOCK) {
+			/* notify 'send' error */
+			RSB2_ERRNO("send", "sock=%d", sock);
+		}
+	}
+	RSB2_TRACE_EXIT_INT(count);
+	errno = err;
+	return count;
+}
+
+int rsb2_socket_recvv(int sock, const struct iovec *iov, int iovcnt)
+{
+	RSB2_TRACE_ARGS("sock=%d,iov=%p,iovcnt=%d", sock, iov, iovcnt);
+	RSB2_ASSERT_NOTNULL(iov);
+	RSB2_ASSERT_POSINT(iovcnt);
+	struct msghdr hdr;
+	memset(&hdr, 0, sizeof(hdr));
+	hdr.msg_iov = (struct iovec *)iov;
+	hdr.msg_iovlen = iovcnt;
+	int count = -1;
+	int retries = -1;
+	do {
+		retries++;
+		count = recvmsg(sock, &hdr, 0);
+	} while (count < 0 && errno == EINTR);
+	int err = errno;
+	rsb2_socket_metrics(false, count, err, count > 0, count, retries);
+	if (count < 0 && err != EAGAIN && err != EWOULDBLOCK) {
+		/* notify 'recvmsg' error */
+		RSB2_ERRNO("recvmsg", "sock=%d", sock);
+	}
+	RSB2_TRACE_EXIT_INT(count);
+	errno = err;
+	return count;
+}
+
+int rsb2_socket_sendv(int sock, const struct iovec *iov, int iovcnt)
+{
+	RSB2_TRACE_ARGS("sock=%d,iov=%p,iovcnt=%d", sock, iov, iovcnt);
+	RSB2_ASSERT_NOTNULL(iov);
+	RSB2_ASSERT_POSINT(iovcnt);
+	struct msghdr hdr;
+	memset(&hdr, 0, sizeof(hdr));
+	hdr.msg_iov = (struct iovec *)iov;
+	hdr.msg_iovlen = iovcnt;
+	int count = -1;
+	int retries = -1;
+	do {
+		retries++;
+		/* no SIGPIPE when the peer is gone, report EPIPE instead */
+		count = sendmsg(sock, &hdr, MSG_NOSIGNAL);
+	} while (count < 0 && errno == EINTR);
+	int err = errno;
+	rsb2_socket_metrics(true, count, err, 1, count, retries);
+	if (count < 0 && err != EAGAIN && err != EWOULDBLOCK) {
+		/* notify 'sendmsg' error */
+		RSB2_ERRNO("sendmsg", "sock=%d", sock);
+	}
+	RSB2_TRACE_EXIT_INT(count);
+	errno = err;
+	return count;
+}
+
+int rsb2_socket_sendfds(int sock, const int *fds, int nfds,
+		const char *msg, int msglen)
+{
+	RSB2_TRACE_ARGS("sock=%d,fds=%p,nfds=%d,msg=%p,msglen=%d",
+			sock, fds, nfds, msg, msglen);
+	RSB2_ASSERT_NOTNULL(fds);
+	RSB2_ASSERT(nfds > 0 && nfds <= RSB2_SOCKET_MAXFDS);
+	RSB2_ASSERT_NOTNULL(msg);
+	RSB2_ASSERT_POSINT(msglen);
+	struct iovec iov;
+	iov.iov_base = (char *)msg;
+	iov.iov_len = msglen;
+	union {
+		struct cmsghdr align;
+		char buf[CMSG_SPACE(RSB2_SOCKET_MAXFDS * sizeof(int))];
+	} ctl;
+	memset(&ctl, 0, sizeof(ctl));
+	struct msghdr hdr;
+	memset(&hdr, 0, sizeof(hdr));
+	hdr.msg_iov = &iov;
+	hdr.msg_iovlen = 1;
+	hdr.msg_control = ctl.buf;
+	hdr.msg_controllen = CMSG_SPACE(nfds * sizeof(int));
+	struct cmsghdr *cmsg = CMSG_FIRSTHDR(&hdr);
+	cmsg->cmsg_level = SOL_SOCKET;
+	cmsg->cmsg_type = SCM_RIGHTS;
+	cmsg->cmsg_len = CMSG_LEN(nfds * sizeof(int));
+	memcpy(CMSG_DATA(cmsg), fds, nfds * sizeof(int));
+	int count = -1;
+	int retries = -1;
+	do {
+		retries++;
+		count = sendmsg(sock, &hdr, MSG_NOSIGNAL);
+	} while (count < 0 && errno == EINTR);
+	int err = errno;
+	rsb2_socket_metrics(true, count, err, 1, count, retries);
+	if (count < 0) {
+		/* notify 'sendmsg' error */
+		RSB2_ERRNO("sendmsg", "sock=%d,nfds=%d", sock, nfds);
+	}
+	RSB2_TRACE_EXIT_INT(count);
+	errno = err;
+	return count;
+}
+
+int rsb2_socket_recvfds(int sock, int *fds, int *pnfds, char *buf, int bufsz)
+{
+	RSB2_TRACE_ARGS("sock=%d,fds=%p,pnfds=%p,buf=%p,bufsz=%d",
+			sock, fds, pnfds, buf, bufsz);
+	RSB2_ASSERT_NOTNULL(fds);
+	RSB2_ASSERT_NOTNULL(pnfds);
+	RSB2_ASSERT_NOTNULL(buf);
+	RSB2_ASSERT_POSINT(bufsz);
+	struct iovec iov;
+	iov.iov_base = buf;
+	iov.iov_len = bufsz;
+	union {
+		struct cmsghdr align;
+		char buf[CMSG_SPACE(RSB2_SOCKET_MAXFDS * sizeof(int))];
+	} ctl;
+	struct msghdr hdr;
+	memset(&hdr, 0, sizeof(hdr));
+	hdr.msg_iov = &iov;
+	hdr.msg_iovlen = 1;
+	hdr.msg_control = ctl.buf;
+	hdr.msg_controllen = sizeof(ctl.buf);
+	*pnfds = 0;
+	int count = -1;
+	int retries = -1;
+	do {
+		retries++;
+		count = recvmsg(sock, &hdr, MSG_CMSG_CLOEXEC);
+	} while (count < 0 && errno == EINTR);
+	int err = errno;
+	rsb2_socket_metrics(false, count, err, count > 0, count, retries);
+	if (count < 0) {
+		if (err != EAGAIN && err != EWOULDBLOCK) {
+			/* notify 'recvmsg' error */
+			RSB2_ERRNO("recvmsg", "sock=%d", sock);
 		}
+	} else {
+		for (struct cmsghdr *cmsg = CMSG_FIRSTHDR(&hdr); cmsg;
+				cmsg = CMSG_NXTHDR(&hdr, cmsg)) {
+			if (cmsg->cmsg_level == SOL_SOCKET &&
+					cmsg->cmsg_type == SCM_RIGHTS) {
+				int n = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+				memcpy(fds + *pnfds, CMSG_DATA(cmsg), n * sizeof(int));
+				*pnfds += n;
+			}
+		}
+		if (hdr.msg_flags & MSG_CTRUNC) {
+			/* notify truncated control data */
+			RSB2_ERROR("fd_truncated", "sock=%d", sock);
+		}
+	}
+	RSB2_TRACE_EXIT_INT(count);
+	errno = err;
+	return count;
+}
+
+int rsb2_socket_sendfd(int sock, int fd, const char *msg, int msglen)
+{
+	RSB2_TRACE_ARGS("sock=%d,fd=%d,msg=%p,msglen=%d", sock, fd, msg, msglen);
+	int count = rsb2_socket_sendfds(sock, &fd, 1, msg, msglen);
+	RSB2_TRACE_EXIT_INT(count);
+	return count;
+}
+
+int rsb2_socket_recvfd(int sock, int *pfd, char *buf, int bufsz)
+{
+	RSB2_TRACE_ARGS("sock=%d,pfd=%p,buf=%p,bufsz=%d", sock, pfd, buf, bufsz);
+	RSB2_ASSERT_NOTNULL(pfd);
+	int fds[RSB2_SOCKET_MAXFDS];
+	int nfds = 0;
+	int count = rsb2_socket_recvfds(sock, fds, &nfds, buf, bufsz);
+	int err = errno;
+	*pfd = nfds? fds[0]: -1;
+	for (int i = 1; i < nfds; i++) {
+		/* unexpected extra descriptors */
+		close(fds[i]);
+	}
+	RSB2_TRACE_EXIT_INT(count);
+	errno = err;
+	return count;
+}
+
+/* Sum the lengths of the messages of a batch. */
+static int64_t rsb2_socket_batchBytes(const struct mmsghdr *msgs, int count)
+{
+	int64_t bytes = 0;
+	for (int i = 0; i < count; i++) {
+		bytes += msgs[i].msg_len;
+	}
+	return bytes;
+}
+
+int rsb2_socket_recvbatch(int sock, struct mmsghdr *msgs, int vlen)
+{
+	RSB2_TRACE_ARGS("sock=%d,msgs=%p,vlen=%d", sock, msgs, vlen);
+	RSB2_ASSERT_NOTNULL(msgs);
+	RSB2_ASSERT_POSINT(vlen);
+	int count = -1;
+	int retries = -1;
+	do {
+		retries++;
+		count = recvmmsg(sock, msgs, vlen, MSG_WAITFORONE, NULL);
+	} while (count < 0 && errno == EINTR);
+	int err = errno;
+	rsb2_socket_metrics(false, count, err, count, rsb2_socket_batchBytes(msgs, count), retries);
+	if (count < 0 && err != EAGAIN && err != EWOULDBLOCK) {
+		/* notify 'recvmmsg' error */
+		RSB2_ERRNO("recvmmsg", "sock=%d", sock);
+	}
+	RSB2_TRACE_EXIT_INT(count);
+	errno = err;
+	return count;
+}
+
+int rsb2_socket_sendbatch(int sock, struct mmsghdr *msgs, int vlen)
+{
+	RSB2_TRACE_ARGS("sock=%d,msgs=%p,vlen=%d", sock, msgs, vlen);
+	RSB2_ASSERT_NOTNULL(msgs);
+	RSB2_ASSERT_POSINT(vlen);
+	int count = -1;
+	int retries = -1;
+	do {
+		retries++;
+		count = sendmmsg(sock, msgs, vlen, MSG_NOSIGNAL);
+	} while (count < 0 && errno == EINTR);
+	int err = errno;
+	rsb2_socket_metrics(true, count, err, count, rsb2_socket_batchBytes(msgs, count), retries);
+	if (count < 0 && err != EAGAIN && err != EWOULDBLOCK) {
+		/* notify 'sendmmsg' error */
+		RSB2_ERRNO("sendmmsg", "sock=%d", sock);
 	}
 	RSB2_TRACE_EXIT_INT(count);
+	errno = err;
 	return count;
 }
 
@@ -8,6 +8,9 @@
 #ifndef RSB2_SOCKET_H
 #define RSB2_SOCKET_H
 
+#include <sys/socket.h>
+#include <sys/uio.h>
+
 #ifdef __cplusplus
 extern "C" {
 #endif
@@ -17,6 +20,13 @@ extern "C" {
  */
 void rsb2_socket_close(int sock);
 
+/** Put a socket in non-blocking mode.
+ * @param sock socket file descriptor
+ * @retval 0 success
+ * @retval -1 error
+ */
+int rsb2_socket_setnonblock(int sock);
+
 /** Diagnose a socket.
  * @param sock socket file descriptor
  * @retval 0 no error was detected on the socket
@@ -47,19 +57,126 @@ int rsb2_socket_wrwait(int sock, int maxms);
  * @param buf buffer address
  * @param bufsz buffer size
  * @return number of bytes read
- * @retval -1 error
+ * @retval -1 error, or no data available on a non-blocking socket
+ * (errno is EAGAIN)
  */
 int rsb2_socket_recv(int sock, char *buf, int bufsz);
 
+/** Read one record from a SOCK_SEQPACKET or SOCK_DGRAM socket.
+ * @param sock service socket file descriptor
+ * @param buf buffer address
+ * @param bufsz buffer size
+ * @return record length, greater than bufsz if the record was truncated
+ * to the buffer (the rest of it is lost)
+ * @retval -1 error, or no data available on a non-blocking socket
+ * (errno is EAGAIN)
+ */
+int rsb2_socket_recvrec(int sock, char *buf, int bufsz);
+
 /** Write data to a service socket.
  * @param sock service socket file descriptor
  * @param msg data address
  * @param msglen data length
  * @return number of bytes written
- * @retval -1 error
+ * @retval -1 error, or no buffer space on a non-blocking socket
+ * (errno is EAGAIN)
  */
 int rsb2_socket_send(int sock, const char *msg, int msglen);
 
+/** Read data from a service socket into several buffers.
+ * @param sock service socket file descriptor
+ * @param iov buffers, filled in order
+ * @param iovcnt number of buffers
+ * @return number of bytes read
+ * @retval -1 error, or no data available on a non-blocking socket
+ * (errno is EAGAIN)
+ */
+int rsb2_socket_recvv(int sock, const struct iovec *iov, int iovcnt);
+
+/** Write data from several buffers to a service socket in one call.
+ * @param sock service socket file descriptor
+ * @param iov buffers, sent in order
+ * @param iovcnt number of buffers
+ * @return number of bytes written
+ * @retval -1 error, or no buffer space on a non-blocking socket
+ * (errno is EAGAIN)
+ */
+int rsb2_socket_sendv(int sock, const struct iovec *iov, int iovcnt);
+
+/** Maximum number of file descriptors passed in one message. */
+#define RSB2_SOCKET_MAXFDS		8
+
+/** Write data and file descriptors to a Unix socket.
+ * The descriptors are passed with SCM_RIGHTS; the receiver gets
+ * duplicates of them.
+ * @param sock Unix socket file descriptor
+ * @param fds file descriptors to pass
+ * @param nfds number of file descriptors, at most RSB2_SOCKET_MAXFDS
+ * @param msg data address
+ * @param msglen data length, at least one byte
+ * @return number of bytes written
+ * @retval -1 error
+ */
+int rsb2_socket_sendfds(int sock, const int *fds, int nfds,
+		const char *msg, int msglen);
+
+/** Read data and file descriptors from a Unix socket.
+ * @param sock Unix socket file descriptor
+ * @param fds returned file descriptors (close-on-exec), room for
+ * RSB2_SOCKET_MAXFDS
+ * @param pnfds returned number of file descriptors
+ * @param buf buffer address
+ * @param bufsz buffer size
+ * @return number of bytes read
+ * @retval -1 error, or no data available on a non-blocking socket
+ * (errno is EAGAIN)
+ */
+int rsb2_socket_recvfds(int sock, int *fds, int *pnfds, char *buf, int bufsz);
+
+/** Write data and a file descriptor to a Unix socket.
+ * The descriptor is passed with SCM_RIGHTS; the receiver gets a
+ * duplicate of it.
+ * @param sock Unix socket file descriptor
+ * @param fd file descriptor to pass
+ * @param msg data address
+ * @param msglen data length, at least one byte
+ * @return number of bytes written
+ * @retval -1 error
+ */
+int rsb2_socket_sendfd(int sock, int fd, const char *msg, int msglen);
+
+/** Read data and a file descriptor from a Unix socket.
+ * @param sock Unix socket file descriptor
+ * @param pfd returned file descriptor (close-on-exec), -1 if none
+ * @param buf buffer address
+ * @param bufsz buffer size
+ * @return number of bytes read
+ * @retval -1 error
+ */
+int rsb2_socket_recvfd(int sock, int *pfd, char *buf, int bufsz);
+
+/** Read several messages from a datagram or seqpacket socket in one call.
+ * Waits for the first message only, then takes those already queued.
+ * The length of each message is returned in msgs[i].msg_len.
+ * @param sock socket file descriptor
+ * @param msgs message headers
+ * @param vlen number of message headers
+ * @return number of messages read
+ * @retval -1 error, or no message available on a non-blocking socket
+ * (errno is EAGAIN)
+ */
+int rsb2_socket_recvbatch(int sock, struct mmsghdr *msgs, int vlen);
+
+/** Write several messages to a datagram or seqpacket socket in one call.
+ * @param sock socket file descriptor
+ * @param msgs message headers
+ * @param vlen number of message headers
+ * @return number of messages written
+ * @retval -1 error, or no buffer space on a non-blocking socket
+ * (errno is EAGAIN)
+ */
+int rsb2_socket_sendbatch(int sock, struct mmsghdr *msgs, int vlen);
+
 #ifdef __cplusplus
 }
 #endif
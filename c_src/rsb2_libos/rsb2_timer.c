@@ -0,0 +1,237 @@
+/** Module rsb2_timer - Implementation.
+ * @file rsb2_timer.c
+ * @author jp.tranvouez@navilab.com
+ */
+#include "rsb2_timer.h"
+#include "rsb2_module.h"
+
+#include <limits.h>
+#include <stddef.h>
+#include <time.h>
+
+/* Span of a slot of a level (ms). */
+#define RSB2_TIMER_SPAN(level)	(1ull << (RSB2_TIMER_SLOTBITS * (level)))
+
+/* Span of the wheel (ms), later timers wait in the last level. */
+#define RSB2_TIMER_RANGE		RSB2_TIMER_SPAN(RSB2_TIMER_LEVELS)
+
+static int g_module = -1;				/* Module reference. */
+
+int rsb2_timer_begin(void)
+{
+	g_module = rsb2_module_ref("rsb2_timer");
+	int err = g_module < 0;
+	return err;
+}
+
+void rsb2_timer_end(void)
+{
+	rsb2_module_destroy(g_module);
+}
+
+uint64_t rsb2_timer_now(void)
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return now.tv_sec * 1000ull + now.tv_nsec / 1000000;
+}
+
+void rsb2_timer_wheelInit(rsb2_Timer_wheel *wheel, uint64_t now)
+{
+	RSB2_TRACE_ARGS("wheel=%p,now=%llu", wheel, (unsigned long long)now);
+	RSB2_ASSERT_NOTNULL(wheel);
+	for (int i = 0; i < RSB2_TIMER_LEVELS * RSB2_TIMER_SLOTS; i++) {
+		wheel->slots[i] = NULL;
+	}
+	for (int level = 0; level < RSB2_TIMER_LEVELS; level++) {
+		wheel->busy[level] = 0;
+	}
+	wheel->now = now;
+	wheel->count = 0;
+	RSB2_TRACE_EXIT();
+}
+
+void rsb2_timer_init(rsb2_Timer *timer, rsb2_Timer_fn *fn, void *arg)
+{
+	RSB2_ASSERT_NOTNULL(timer);
+	timer->next = NULL;
+	timer->pprev = NULL;
+	timer->slot = -1;
+	timer->expiry = 0;
+	timer->period = 0;
+	timer->fn = fn;
+	timer->arg = arg;
+}
+
+static void rsb2_timer_link(rsb2_Timer **phead, rsb2_Timer *timer)
+{
+	timer->next = *phead;
+	if (timer->next) {
+		timer->next->pprev = &timer->next;
+	}
+	timer->pprev = phead;
+	*phead = timer;
+}
+
+static void rsb2_timer_unlink(rsb2_Timer_wheel *wheel, rsb2_Timer *timer)
+{
+	*timer->pprev = timer->next;
+	if (timer->next) {
+		timer->next->pprev = timer->pprev;
+	}
+	if (timer->slot >= 0 && !wheel->slots[timer->slot]) {
+		/* last timer of the slot */
+		wheel->busy[timer->slot / RSB2_TIMER_SLOTS] &=
+				~(1ull << (timer->slot % RSB2_TIMER_SLOTS));
+	}
+	timer->next = NULL;
+	timer->pprev = NULL;
+	timer->slot = -1;
+	wheel->count--;
+}
+
+static void rsb2_timer_insert(rsb2_Timer_wheel *wheel, rsb2_Timer *timer)
+{
+	/* the level whose slots are just fine enough for the delay, so the
+	 * slot is reached after now and before the expiry */
+	uint64_t expiry = timer->expiry;
+	if (expiry - wheel->now >= RSB2_TIMER_RANGE) {
+		/* beyond the wheel, moved again when its slot is reached */
+		expiry = wheel->now + RSB2_TIMER_RANGE - 1;
+	}
+	int level = 0;
+	while (level < RSB2_TIMER_LEVELS - 1 &&
+			expiry - wheel->now >= RSB2_TIMER_SPAN(level + 1)) {
+		level++;
+	}
+	int index = (expiry >> (RSB2_TIMER_SLOTBITS * level)) %
+			RSB2_TIMER_SLOTS;
+	timer->slot = level * RSB2_TIMER_SLOTS + index;
+	rsb2_timer_link(&wheel->slots[timer->slot], timer);
+	wheel->busy[level] |= 1ull << index;
+	wheel->count++;
+}
+
+void rsb2_timer_arm(rsb2_Timer_wheel *wheel, rsb2_Timer *timer,
+		uint64_t delay, uint64_t period)
+{
+	RSB2_TRACE_ARGS("wheel=%p,timer=%p,delay=%llu,period=%llu", wheel, timer,
+			(unsigned long long)delay, (unsigned long long)period);
+	RSB2_ASSERT_NOTNULL(wheel);
+	RSB2_ASSERT_NOTNULL(timer);
+	if (timer->pprev) {
+		rsb2_timer_unlink(wheel, timer);
+	}
+	/* the slot of the wheel time is past */
+	timer->expiry = wheel->now + (delay? delay: 1);
+	timer->period = period;
+	rsb2_timer_insert(wheel, timer);
+	RSB2_TRACE_EXIT();
+}
+
+void rsb2_timer_cancel(rsb2_Timer_wheel *wheel, rsb2_Timer *timer)
+{
+	RSB2_TRACE_ARGS("wheel=%p,timer=%p", wheel, timer);
+	RSB2_ASSERT_NOTNULL(wheel);
+	RSB2_ASSERT_NOTNULL(timer);
+	if (timer->pprev) {
+		rsb2_timer_unlink(wheel, timer);
+	}
+	RSB2_TRACE_EXIT();
+}
+
+bool rsb2_timer_armed(const rsb2_Timer *timer)
+{
+	RSB2_ASSERT_NOTNULL(timer);
+	return timer->pprev != NULL;
+}
+
+static uint64_t rsb2_timer_next(const rsb2_Timer_wheel *wheel)
+{
+	/* the first busy slot after the current one of each level, a slot of
+	 * level 0 expires, a slot above is moved down when it starts */
+	uint64_t next = UINT64_MAX;
+	for (int level = 0; level < RSB2_TIMER_LEVELS; level++) {
+		uint64_t busy = wheel->busy[level];
+		if (busy) {
+			uint64_t cur = wheel->now >> (RSB2_TIMER_SLOTBITS * level);
+			unsigned shift = (cur + 1) % RSB2_TIMER_SLOTS;
+			uint64_t rotated = shift? busy >> shift |
+					busy << (RSB2_TIMER_SLOTS - shift): busy;
+			uint64_t start = (cur + 1 + __builtin_ctzll(rotated)) <<
+					(RSB2_TIMER_SLOTBITS * level);
+			next = start < next? start: next;
+		}
+	}
+	return next;
+}
+
+int rsb2_timer_timeout(const rsb2_Timer_wheel *wheel)
+{
+	RSB2_ASSERT_NOTNULL(wheel);
+	int timeout = -1;
+	if (wheel->count) {
+		uint64_t wait = rsb2_timer_next(wheel) - wheel->now;
+		timeout = wait < INT_MAX? (int)wait: INT_MAX;
+	}
+	return timeout;
+}
+
+static int rsb2_timer_tick(rsb2_Timer_wheel *wheel)
+{
+	int count = 0;
+	/* move the timers of the slots starting now down, highest first */
+	for (int level = RSB2_TIMER_LEVELS - 1; level > 0; level--) {
+		if (wheel->now % RSB2_TIMER_SPAN(level) == 0) {
+			int slot = level * RSB2_TIMER_SLOTS +
+					(wheel->now >> (RSB2_TIMER_SLOTBITS * level)) %
+					RSB2_TIMER_SLOTS;
+			while (wheel->slots[slot]) {
+				rsb2_Timer *timer = wheel->slots[slot];
+				rsb2_timer_unlink(wheel, timer);
+				rsb2_timer_insert(wheel, timer);
+			}
+		}
+	}
+	/* the expiring timers leave the wheel first, so that their functions
+	 * may arm timers in the same slot or cancel any of them */
+	rsb2_Timer *expiring = NULL;
+	int slot = wheel->now % RSB2_TIMER_SLOTS;
+	while (wheel->slots[slot]) {
+		rsb2_Timer *timer = wheel->slots[slot];
+		rsb2_timer_unlink(wheel, timer);
+		rsb2_timer_link(&expiring, timer);
+		wheel->count++;
+	}
+	while (expiring) {
+		rsb2_Timer *timer = expiring;
+		rsb2_timer_unlink(wheel, timer);
+		if (timer->period) {
+			timer->expiry = wheel->now + timer->period;
+			rsb2_timer_insert(wheel, timer);
+		}
+		timer->fn(timer, timer->arg);
+		count++;
+	}
+	return count;
+}
+
+int rsb2_timer_expire(rsb2_Timer_wheel *wheel, uint64_t now)
+{
+	RSB2_TRACE_ARGS("wheel=%p,now=%llu", wheel, (unsigned long long)now);
+	RSB2_ASSERT_NOTNULL(wheel);
+	int count = 0;
+	/* jump from one slot with work to the next */
+	uint64_t next;
+	while (wheel->count && (next = rsb2_timer_next(wheel)) <= now) {
+		wheel->now = next;
+		count += rsb2_timer_tick(wheel);
+	}
+	if (now > wheel->now) {
+		wheel->now = now;
+	}
+	RSB2_TRACE_EXIT_INT(count);
+	return count;
+}
+
+/*END*/
@@ -0,0 +1,127 @@
+/** Module rsb2_timer - Interface.
+ * @file rsb2_timer.h
+ * @author jp.tranvouez@navilab.com
+ * @defgroup rsb2_timer Hierarchical Timer Wheel
+ * @ingroup rsb2_libos
+ * @{
+ * Timers with a 1 ms resolution on a wheel of RSB2_TIMER_LEVELS levels of
+ * RSB2_TIMER_SLOTS slots, each level 64 times coarser than the one below.
+ * Arming and cancelling a timer link and unlink it in one slot; a timer is
+ * moved down a level each time the wheel reaches its slot, and runs from
+ * the lowest level on time. Timers are embedded in the caller's objects,
+ * so the wheel allocates nothing. The owner of a wheel, usually an event
+ * loop, waits at most rsb2_timer_timeout and calls rsb2_timer_expire with
+ * the time of each wakeup: no system call is made per timer.
+ * A wheel belongs to one thread.
+ */
+#ifndef RSB2_TIMER_H
+#define RSB2_TIMER_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** Number of levels. */
+#define RSB2_TIMER_LEVELS		4
+
+/** Number of slots per level, log2. */
+#define RSB2_TIMER_SLOTBITS		6
+
+/** Number of slots per level. */
+#define RSB2_TIMER_SLOTS		(1 << RSB2_TIMER_SLOTBITS)
+
+struct rsb2_Timer;
+
+/** Process an expired timer.
+ * The timer is already re-armed if periodic; the function may cancel,
+ * re-arm or release it, and arm or cancel other timers.
+ * @param timer expired timer
+ * @param arg argument given to rsb2_timer_init
+ */
+typedef void rsb2_Timer_fn(struct rsb2_Timer *timer, void *arg);
+
+/** Timer. */
+typedef struct rsb2_Timer {
+	struct rsb2_Timer *next;	/**< Next timer of the slot. */
+	struct rsb2_Timer **pprev;	/**< Link to the timer, NULL if not armed. */
+	int slot;					/**< Slot index in the wheel, -1 if expiring. */
+	uint64_t expiry;			/**< Expiry time (ms). */
+	uint64_t period;			/**< Period (ms), 0 for a one-shot timer. */
+	rsb2_Timer_fn *fn;			/**< Expiry function. */
+	void *arg;					/**< Argument of fn. */
+} rsb2_Timer;
+
+/** Timer wheel. */
+typedef struct rsb2_Timer_wheel {
+	rsb2_Timer *slots[RSB2_TIMER_LEVELS * RSB2_TIMER_SLOTS];	/**< Timers. */
+	uint64_t busy[RSB2_TIMER_LEVELS];	/**< Non-empty slots, a bit each. */
+	uint64_t now;				/**< Wheel time (ms). */
+	int count;					/**< Number of armed timers. */
+} rsb2_Timer_wheel;
+
+/** Get the monotonic time of timers.
+ * @return time (ms)
+ */
+uint64_t rsb2_timer_now(void);
+
+/** Initialize an empty wheel.
+ * @param wheel timer wheel
+ * @param now current time (ms), from rsb2_timer_now()
+ */
+void rsb2_timer_wheelInit(rsb2_Timer_wheel *wheel, uint64_t now);
+
+/** Initialize a timer, not armed.
+ * @param timer timer
+ * @param fn expiry function
+ * @param arg argument of fn
+ */
+void rsb2_timer_init(rsb2_Timer *timer, rsb2_Timer_fn *fn, void *arg);
+
+/** Arm a timer, or re-arm it if armed.
+ * The delay counts from the wheel time, the time of the last
+ * rsb2_timer_expire call.
+ * @param wheel timer wheel
+ * @param timer timer
+ * @param delay delay before expiry (ms), 0 for the next tick
+ * @param period period after the first expiry (ms), 0 for none
+ */
+void rsb2_timer_arm(rsb2_Timer_wheel *wheel, rsb2_Timer *timer,
+		uint64_t delay, uint64_t period);
+
+/** Cancel a timer.
+ * Nothing is done if the timer is not armed.
+ * @param wheel timer wheel
+ * @param timer timer
+ */
+void rsb2_timer_cancel(rsb2_Timer_wheel *wheel, rsb2_Timer *timer);
+
+/** Tell if a timer is armed.
+ * @param timer timer
+ * @retval true armed
+ * @retval false not armed
+ */
+bool rsb2_timer_armed(const rsb2_Timer *timer);
+
+/** Get the wait time before the wheel has work.
+ * The work may be moving timers down a level only.
+ * @param wheel timer wheel
+ * @return wait time (ms) from the wheel time
+ * @retval -1 no timer armed
+ */
+int rsb2_timer_timeout(const rsb2_Timer_wheel *wheel);
+
+/** Advance the wheel time and run the expired timers.
+ * @param wheel timer wheel
+ * @param now current time (ms), from rsb2_timer_now()
+ * @return number of timers run
+ */
+int rsb2_timer_expire(rsb2_Timer_wheel *wheel, uint64_t now);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /*@} RSB2_TIMER_H */
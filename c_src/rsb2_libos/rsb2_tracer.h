@@ -22,90 +22,151 @@ typedef enum rsb2_TraceGroup {
 	RSB2_TRACEGROUP_APPL		= 8,	/**< Application trace. */
 } rsb2_TraceGroup;
 
+/** Trace groups compiled in, a mask of rsb2_TraceGroup values.
+ * Traces of other groups are removed at compile time: release builds
+ * (NDEBUG) drop the function call and return traces by default.
+ */
+#ifndef RSB2_TRACE_GROUPS
+#ifdef NDEBUG
+#define RSB2_TRACE_GROUPS		0xe		/* DATA, CTRL, APPL */
+#else
+#define RSB2_TRACE_GROUPS		0xf		/* FUNC, DATA, CTRL, APPL */
+#endif
+#endif
+
+/** Trace callsite, a static object per RSB2_TRACE expansion.
+ * Its metadata is registered on first use and recorded traces only
+ * refer to it by ID.
+ */
+typedef struct rsb2_TraceCallsite {
+	const char *func;				/**< Function name. */
+	const char *file;				/**< Source file name. */
+	int line;						/**< Source line number. */
+	rsb2_TraceGroup group;			/**< Event group. */
+	const char *fmt;				/**< Message format. */
+	int id;							/**< Callsite ID, 0 until registered. */
+} rsb2_TraceCallsite;
+
+/** Check trace arguments against their format, never called. */
+static inline void rsb2_tracer_check(const char *fmt, ...)
+		__attribute__((format(printf, 1, 2)));
+static inline void rsb2_tracer_check(const char *fmt, ...)
+{
+	(void)fmt;
+}
+
 /** Notify a trace event.
+ * Arguments are only evaluated if the group is compiled in and enabled
+ * in the trace mask of the module.
  * @param trace event group
  * @param fmt message format, followed by variables
  */
 #define RSB2_TRACE(group, fmt, ...) \
-		rsb2_module_trace(g_module, __func__, __FILE__, __LINE__, \
-				group, fmt, ##__VA_ARGS__)
+		do { \
+			if (((RSB2_TRACE_GROUPS) & (group)) && \
+					rsb2_module_traceOn(g_module, group)) { \
+				static rsb2_TraceCallsite rsb2_callsite_ = { \
+						__func__, __FILE__, __LINE__, group, fmt, 0 }; \
+				if (0) { \
+					rsb2_tracer_check(fmt, ##__VA_ARGS__); \
+				} \
+				rsb2_module_traceSite(g_module, &rsb2_callsite_, \
+						##__VA_ARGS__); \
+			} \
+		} while (0)
+
+/** Notify a function trace event, removed if not compiled in.
+ * @param fmt message format, followed by variables
+ */
+#if (RSB2_TRACE_GROUPS) & 1
+#define RSB2_TRACE_FUNC(fmt, ...) \
+		RSB2_TRACE(RSB2_TRACEGROUP_FUNC, fmt, ##__VA_ARGS__)
+#else
+#define RSB2_TRACE_FUNC(fmt, ...) \
+		do { \
+			if (0) { \
+				rsb2_tracer_check(fmt, ##__VA_ARGS__); \
+				(void)g_module; \
+			} \
+		} while (0)
+#endif
 
 /** Trace a function call.
  * @param fcn called function name
  */
 #define RSB2_TRACE_CALL(fcn) \
-		RSB2_TRACE(RSB2_TRACEGROUP_FUNC, \
+		RSB2_TRACE_FUNC( \
 				"func_call %s", fcn)
 
 /** Trace return from a function call.
  * @param fcn called function name
  */
 #define RSB2_TRACE_RETURN(fcn) \
-		RSB2_TRACE(RSB2_TRACEGROUP_FUNC, \
+		RSB2_TRACE_FUNC( \
 				"func_return %s", fcn)
 
 /** Trace entry in the current function. */
 #define RSB2_TRACE_ENTRY() \
-		RSB2_TRACE(RSB2_TRACEGROUP_FUNC, \
+		RSB2_TRACE_FUNC( \
 				"func_entry")
 
 /** Trace entry in the current function. */
 #define RSB2_TRACE_ARGS(fmt, ...) \
-		RSB2_TRACE(RSB2_TRACEGROUP_FUNC, \
+		RSB2_TRACE_FUNC( \
 				"func_entry " fmt, ##__VA_ARGS__)
 
 /** Trace exit from the current function.*/
 #define RSB2_TRACE_EXIT() \
-		RSB2_TRACE(RSB2_TRACEGROUP_FUNC, \
+		RSB2_TRACE_FUNC( \
 				"func_exit")
 
 /** Trace exit from the current function, returning a boolean.
  * @param b returned value
  */
 #define RSB2_TRACE_EXIT_BOOL(b) \
-		RSB2_TRACE(RSB2_TRACEGROUP_FUNC, \
+		RSB2_TRACE_FUNC( \
 				"func_exit ret=%s", (b)? "true": "false")
 
 /** Trace exit from the current function, returning an integer.
  * @param i returned value
  */
 #define RSB2_TRACE_EXIT_INT(i) \
-		RSB2_TRACE(RSB2_TRACEGROUP_FUNC, \
+		RSB2_TRACE_FUNC( \
 				"func_exit ret=%d", i)
 
 /** Trace exit from the current function, returning a long.
  * @param l returned value
  */
 #define RSB2_TRACE_EXIT_LONG(l) \
-		RSB2_TRACE(RSB2_TRACEGROUP_FUNC, \
+		RSB2_TRACE_FUNC( \
 				"func_exit ret=%ld", l)
 
 /** Trace exit from the current function, returning a size.
  * @param n returned value
  */
 #define RSB2_TRACE_EXIT_SIZE(n) \
-		RSB2_TRACE(RSB2_TRACEGROUP_FUNC, \
+		RSB2_TRACE_FUNC( \
 				"func_exit ret=%zu", n)
 
 /** Trace exit from the current function, returning a double.
  * @param d returned value
  */
 #define RSB2_TRACE_EXIT_DBL(d) \
-		RSB2_TRACE(RSB2_TRACEGROUP_FUNC, \
+		RSB2_TRACE_FUNC( \
 				"func_exit ret=%f", d)
 
 /** Trace exit from the current function, returning a pointer.
  * @param p returned value
  */
 #define RSB2_TRACE_EXIT_PTR(p) \
-		RSB2_TRACE(RSB2_TRACEGROUP_FUNC, \
+		RSB2_TRACE_FUNC( \
 				"func_exit ret=%p", p)
 
 /** Trace exit from the current function, returning a string.
  * @param s returned value
  */
 #define RSB2_TRACE_EXIT_STR(s) \
-		RSB2_TRACE(RSB2_TRACEGROUP_FUNC, \
+		RSB2_TRACE_FUNC( \
 				"func_exit ret='%s'", s)
 
 #ifdef __cplusplus
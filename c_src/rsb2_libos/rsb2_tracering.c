@@ -0,0 +1,486 @@
+/** Module rsb2_tracering - Implementation.
+ * @file rsb2_tracering.c
+ * @author jp.tranvouez@navilab.com
+ * No RSB2_TRACE in this module: it records them.
+ */
+#include "rsb2_tracering.h"
+#include "rsb2_eventmgr.h"
+#include "rsb2_module.h"
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+enum {
+	RSB2_TRACERING_CACHELINE	= 64,		/* Counter alignment. */
+	RSB2_TRACERING_MINSIZE		= 4096,		/* Min ring size. */
+	RSB2_TRACERING_MAXSITES		= 8192,		/* Max number of callsites. */
+	RSB2_TRACERING_MAXARGS		= 16,		/* Max arguments of a callsite. */
+	RSB2_TRACERING_MAXSTR		= 120,		/* Max slot of a string argument. */
+	RSB2_TRACERING_DESCRSZ		= 256,		/* Formatted trace size. */
+};
+
+#define RSB2_TRACERING_WRAP		0xffffffffu	/* Record skipping to ring start. */
+
+/* Argument types, from the conversions of a callsite format. */
+typedef enum rsb2_Tracering_arg {
+	RSB2_TRACERING_INT,					/* int and shorter. */
+	RSB2_TRACERING_LONG,				/* long. */
+	RSB2_TRACERING_LLONG,				/* long long, intmax_t. */
+	RSB2_TRACERING_SIZE,				/* size_t. */
+	RSB2_TRACERING_DOUBLE,				/* double. */
+	RSB2_TRACERING_PTR,					/* Pointer. */
+	RSB2_TRACERING_STR,					/* String, copied. */
+} rsb2_Tracering_arg;
+
+/* Registered callsite. */
+typedef struct rsb2_Tracering_site {
+	const rsb2_TraceCallsite *site;		/* Callsite metadata. */
+	bool direct;						/* Format not supported. */
+	int nargs;							/* Number of arguments. */
+	unsigned char types[RSB2_TRACERING_MAXARGS];	/* Argument types. */
+} rsb2_Tracering_site;
+
+/* Header of a record, followed by 8-byte argument slots; a string slot
+ * holds its length, its bytes and a null byte. */
+typedef struct rsb2_Tracering_rec {
+	uint32_t size;						/* Record size, a multiple of 8. */
+	uint32_t id;						/* Callsite ID. */
+	uint64_t ts;						/* Monotonic timestamp (ns). */
+	int32_t ref;						/* Module reference. */
+	uint32_t reserved;					/* Zero. */
+} rsb2_Tracering_rec;
+
+/* Largest record. */
+#define RSB2_TRACERING_MAXREC	(sizeof(rsb2_Tracering_rec) + \
+								RSB2_TRACERING_MAXARGS * RSB2_TRACERING_MAXSTR)
+
+/* Trace ring of a thread, single producer and single consumer. */
+typedef struct rsb2_Tracering_buf {
+	uint64_t head __attribute__((aligned(RSB2_TRACERING_CACHELINE)));	/* Consumer counter. */
+	uint64_t tail __attribute__((aligned(RSB2_TRACERING_CACHELINE)));	/* Producer counter. */
+	uint64_t dropped;					/* Records dropped, ring full. */
+	char *data;							/* Ring data. */
+	uint32_t size;						/* Ring size, a power of two. */
+	int dead;							/* Thread exited. */
+	struct rsb2_Tracering_buf *next;	/* Next ring. */
+} rsb2_Tracering_buf;
+
+static int g_module = -1;				/* Module reference. */
+static int g_enabled = 0;				/* Recording started. */
+static unsigned g_bufsz = RSB2_TRACERING_BUFSZ;	/* Size of new rings. */
+static int g_period = RSB2_TRACERING_PERIOD;	/* Drainer period (ms). */
+static pthread_mutex_t g_siteLock = PTHREAD_MUTEX_INITIALIZER;	/* Sites. */
+static rsb2_Tracering_site g_sites[RSB2_TRACERING_MAXSITES];	/* By ID. */
+static int g_nsites = 0;				/* Last callsite ID. */
+static pthread_mutex_t g_bufsLock = PTHREAD_MUTEX_INITIALIZER;	/* Rings. */
+static rsb2_Tracering_buf *g_bufs = NULL;	/* Rings of all threads. */
+static uint64_t g_droppedFreed = 0;		/* Dropped by freed rings. */
+static pthread_once_t g_keyOnce = PTHREAD_ONCE_INIT;	/* Key init. */
+static pthread_key_t g_key;				/* Ring of the thread, for exit. */
+static __thread rsb2_Tracering_buf *t_buf = NULL;	/* Ring of the thread. */
+static pthread_mutex_t g_drainLock = PTHREAD_MUTEX_INITIALIZER;	/* Drainer. */
+static pthread_cond_t g_drainCond = PTHREAD_COND_INITIALIZER;	/* Stop. */
+static bool g_stop = false;				/* Drainer stop requested. */
+static pthread_t g_drainer;				/* Drainer thread. */
+
+int rsb2_tracering_begin(void)
+{
+	g_module = rsb2_module_ref("rsb2_tracering");
+	return g_module < 0;
+}
+
+void rsb2_tracering_end(void)
+{
+	rsb2_tracering_stop();
+	rsb2_module_destroy(g_module);
+}
+
+static void rsb2_tracering_parse(rsb2_Tracering_site *ts,
+		const rsb2_TraceCallsite *site)
+{
+	ts->site = site;
+	ts->direct = false;
+	ts->nargs = 0;
+	for (const char *p = site->fmt; *p && !ts->direct; p++) {
+		if (*p != '%') {
+			continue;
+		}
+		if (*++p == '%') {
+			continue;
+		}
+		/* flags, width and precision */
+		p += strspn(p, "-+ #0123456789.");
+		int longs = 0;
+		bool size = false;
+		for (; strchr("hlzjtL", *p) && *p; p++) {
+			longs += *p == 'l'? 1: *p == 'j' || *p == 'L'? 2: 0;
+			size = size || *p == 'z' || *p == 't';
+			ts->direct = ts->direct || *p == 'L';
+		}
+		int type = -1;
+		if (strchr("diouxXc", *p) && *p) {
+			type = size? RSB2_TRACERING_SIZE: longs == 0? RSB2_TRACERING_INT:
+					longs == 1? RSB2_TRACERING_LONG: RSB2_TRACERING_LLONG;
+		} else if (strchr("eEfFgGaA", *p) && *p) {
+			type = RSB2_TRACERING_DOUBLE;
+		} else if (*p == 's' && !longs) {
+			type = RSB2_TRACERING_STR;
+		} else if (*p == 'p') {
+			type = RSB2_TRACERING_PTR;
+		}
+		if (type < 0 || ts->nargs == RSB2_TRACERING_MAXARGS) {
+			/* '*', '%n', wide strings: formatted by the caller */
+			ts->direct = true;
+		} else {
+			ts->types[ts->nargs++] = type;
+		}
+		if (!*p) {
+			break;
+		}
+	}
+}
+
+static int rsb2_tracering_register(rsb2_TraceCallsite *site)
+{
+	pthread_mutex_lock(&g_siteLock);
+	int id = site->id;
+	if (!id && g_nsites + 1 < RSB2_TRACERING_MAXSITES) {
+		id = ++g_nsites;
+		rsb2_tracering_parse(&g_sites[id], site);
+		/* the site is complete before its ID is visible */
+		__atomic_store_n(&site->id, id, __ATOMIC_RELEASE);
+	}
+	pthread_mutex_unlock(&g_siteLock);
+	return id;
+}
+
+static void rsb2_tracering_exit(void *arg)
+{
+	rsb2_Tracering_buf *buf = arg;
+	/* a trace from a later destructor of the thread gets a new ring, not
+	 * this one, which the drainer frees once empty */
+	t_buf = NULL;
+	__atomic_store_n(&buf->dead, 1, __ATOMIC_RELEASE);
+}
+
+static void rsb2_tracering_key(void)
+{
+	pthread_key_create(&g_key, rsb2_tracering_exit);
+}
+
+static rsb2_Tracering_buf *rsb2_tracering_bufNew(void)
+{
+	pthread_once(&g_keyOnce, rsb2_tracering_key);
+	rsb2_Tracering_buf *buf = NULL;
+	if (posix_memalign((void **)&buf, RSB2_TRACERING_CACHELINE,
+			sizeof(*buf))) {
+		buf = NULL;
+	} else {
+		memset(buf, 0, sizeof(*buf));
+		buf->size = __atomic_load_n(&g_bufsz, __ATOMIC_RELAXED);
+		buf->data = malloc(buf->size);
+		if (!buf->data) {
+			free(buf);
+			buf = NULL;
+		}
+	}
+	if (!buf) {
+		/* notify allocation failure */
+		RSB2_ERRNO("malloc", "size=%u", g_bufsz);
+	} else {
+		pthread_setspecific(g_key, buf);
+		pthread_mutex_lock(&g_bufsLock);
+		buf->next = g_bufs;
+		g_bufs = buf;
+		pthread_mutex_unlock(&g_bufsLock);
+		t_buf = buf;
+	}
+	return buf;
+}
+
+static void rsb2_tracering_put(rsb2_Tracering_buf *buf, const void *rec,
+		uint32_t size)
+{
+	uint64_t head = __atomic_load_n(&buf->head, __ATOMIC_ACQUIRE);
+	uint32_t off = buf->tail & (buf->size - 1);
+	/* a record never wraps, the end of the ring is skipped instead */
+	uint32_t pad = buf->size - off < size? buf->size - off: 0;
+	if (pad + size > buf->size - (buf->tail - head)) {
+		__atomic_store_n(&buf->dropped, buf->dropped + 1, __ATOMIC_RELAXED);
+		return;
+	}
+	if (pad) {
+		*(uint32_t *)(buf->data + off) = RSB2_TRACERING_WRAP;
+		off = 0;
+	}
+	memcpy(buf->data + off, rec, size);
+	__atomic_store_n(&buf->tail, buf->tail + pad + size, __ATOMIC_RELEASE);
+}
+
+bool rsb2_tracering_record(int ref, rsb2_TraceCallsite *site, va_list ap)
+{
+	if (!__atomic_load_n(&g_enabled, __ATOMIC_RELAXED)) {
+		return false;
+	}
+	int id = __atomic_load_n(&site->id, __ATOMIC_ACQUIRE);
+	if (!id && !(id = rsb2_tracering_register(site))) {
+		return false;
+	}
+	const rsb2_Tracering_site *ts = &g_sites[id];
+	rsb2_Tracering_buf *buf = t_buf? t_buf: rsb2_tracering_bufNew();
+	if (ts->direct || !buf) {
+		return false;
+	}
+	/* build the record on the stack, then copy it in one piece */
+	uint64_t stage[RSB2_TRACERING_MAXREC / sizeof(uint64_t)];
+	rsb2_Tracering_rec *rec = (rsb2_Tracering_rec *)stage;
+	char *p = (char *)(rec + 1);
+	for (int i = 0; i < ts->nargs; i++) {
+		union {
+			int64_t i;
+			uint64_t u;
+			double d;
+		} v;
+		switch (ts->types[i]) {
+		case RSB2_TRACERING_INT:
+			v.i = va_arg(ap, int);
+			break;
+		case RSB2_TRACERING_LONG:
+			v.i = va_arg(ap, long);
+			break;
+		case RSB2_TRACERING_LLONG:
+			v.i = va_arg(ap, long long);
+			break;
+		case RSB2_TRACERING_SIZE:
+			v.u = va_arg(ap, size_t);
+			break;
+		case RSB2_TRACERING_DOUBLE:
+			v.d = va_arg(ap, double);
+			break;
+		case RSB2_TRACERING_PTR:
+			v.u = (uintptr_t)va_arg(ap, void *);
+			break;
+		default: {
+			const char *s = va_arg(ap, const char *);
+			s = s? s: "(null)";
+			uint32_t n = strnlen(s, RSB2_TRACERING_MAXSTR - 5);
+			memcpy(p, &n, sizeof(n));
+			memcpy(p + sizeof(n), s, n);
+			p[sizeof(n) + n] = '\0';
+			p += (sizeof(n) + n + 1 + 7) & ~(size_t)7;
+			continue;
+		}
+		}
+		memcpy(p, &v, sizeof(v));
+		p += sizeof(v);
+	}
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	rec->size = p - (char *)stage;
+	rec->id = id;
+	rec->ts = now.tv_sec * 1000000000ull + now.tv_nsec;
+	rec->ref = ref;
+	rec->reserved = 0;
+	rsb2_tracering_put(buf, rec, rec->size);
+	return true;
+}
+
+static const rsb2_Tracering_rec *rsb2_tracering_peek(rsb2_Tracering_buf *buf)
+{
+	uint64_t tail = __atomic_load_n(&buf->tail, __ATOMIC_ACQUIRE);
+	while (buf->head != tail) {
+		uint32_t off = buf->head & (buf->size - 1);
+		const rsb2_Tracering_rec *rec =
+				(const rsb2_Tracering_rec *)(buf->data + off);
+		if (rec->size != RSB2_TRACERING_WRAP) {
+			return rec;
+		}
+		__atomic_store_n(&buf->head, buf->head + buf->size - off,
+				__ATOMIC_RELEASE);
+	}
+	return NULL;
+}
+
+static void rsb2_tracering_format(const rsb2_Tracering_rec *rec,
+		char *descr, size_t descrsz)
+{
+	const rsb2_Tracering_site *ts = &g_sites[rec->id];
+	const char *arg = (const char *)(rec + 1);
+	size_t len = 0;
+	int i = 0;
+	for (const char *p = ts->site->fmt; *p && len + 1 < descrsz; p++) {
+		if (*p != '%' || p[1] == '%') {
+			/* literal, '%%' included */
+			descr[len++] = *p;
+			p += *p == '%';
+			continue;
+		}
+		char spec[32];
+		size_t speclen = strcspn(p + 1, "diouxXceEfFgGaAsp") + 2;
+		if (speclen >= sizeof(spec) || i == ts->nargs) {
+			break;
+		}
+		memcpy(spec, p, speclen);
+		spec[speclen] = '\0';
+		p += speclen - 1;
+		union {
+			int64_t i;
+			uint64_t u;
+			double d;
+		} v;
+		memcpy(&v, arg, sizeof(v));
+		char *out = descr + len;
+		size_t outsz = descrsz - len;
+		size_t slot = sizeof(v);
+		int n = 0;
+		switch (ts->types[i++]) {
+		case RSB2_TRACERING_INT:
+			n = snprintf(out, outsz, spec, (int)v.i);
+			break;
+		case RSB2_TRACERING_LONG:
+			n = snprintf(out, outsz, spec, (long)v.i);
+			break;
+		case RSB2_TRACERING_LLONG:
+			n = snprintf(out, outsz, spec, (long long)v.i);
+			break;
+		case RSB2_TRACERING_SIZE:
+			n = snprintf(out, outsz, spec, (size_t)v.u);
+			break;
+		case RSB2_TRACERING_DOUBLE:
+			n = snprintf(out, outsz, spec, v.d);
+			break;
+		case RSB2_TRACERING_PTR:
+			n = snprintf(out, outsz, spec, (void *)(uintptr_t)v.u);
+			break;
+		default: {
+			uint32_t slen;
+			memcpy(&slen, arg, sizeof(slen));
+			n = snprintf(out, outsz, spec, arg + sizeof(slen));
+			slot = (sizeof(slen) + slen + 1 + 7) & ~(size_t)7;
+			break;
+		}
+		}
+		arg += slot;
+		len += n > 0? ((size_t)n < outsz? (size_t)n: outsz - 1): 0;
+	}
+	descr[len] = '\0';
+}
+
+void rsb2_tracering_flush(void)
+{
+	pthread_mutex_lock(&g_bufsLock);
+	for (;;) {
+		/* merge the rings by timestamp */
+		rsb2_Tracering_buf *best = NULL;
+		const rsb2_Tracering_rec *bestRec = NULL;
+		for (rsb2_Tracering_buf *buf = g_bufs; buf; buf = buf->next) {
+			const rsb2_Tracering_rec *rec = rsb2_tracering_peek(buf);
+			if (rec && (!bestRec || rec->ts < bestRec->ts)) {
+				best = buf;
+				bestRec = rec;
+			}
+		}
+		if (!best) {
+			break;
+		}
+		const rsb2_TraceCallsite *site = g_sites[bestRec->id].site;
+		char descr[RSB2_TRACERING_DESCRSZ];
+		rsb2_tracering_format(bestRec, descr, sizeof(descr));
+		rsb2_module_tracerOf(bestRec->ref)(site->func, site->file, site->line,
+				bestRec->ref, site->group, descr);
+		__atomic_store_n(&best->head, best->head + bestRec->size,
+				__ATOMIC_RELEASE);
+	}
+	for (rsb2_Tracering_buf **pbuf = &g_bufs; *pbuf;) {
+		/* free the drained rings of exited threads */
+		rsb2_Tracering_buf *buf = *pbuf;
+		if (__atomic_load_n(&buf->dead, __ATOMIC_ACQUIRE) &&
+				!rsb2_tracering_peek(buf)) {
+			*pbuf = buf->next;
+			g_droppedFreed += __atomic_load_n(&buf->dropped, __ATOMIC_RELAXED);
+			free(buf->data);
+			free(buf);
+		} else {
+			pbuf = &buf->next;
+		}
+	}
+	pthread_mutex_unlock(&g_bufsLock);
+}
+
+static void *rsb2_tracering_drainer(void *arg)
+{
+	(void)arg;
+	pthread_mutex_lock(&g_drainLock);
+	while (!g_stop) {
+		struct timespec deadline;
+		clock_gettime(CLOCK_REALTIME, &deadline);
+		deadline.tv_nsec += g_period % 1000 * 1000000L;
+		deadline.tv_sec += g_period / 1000 + deadline.tv_nsec / 1000000000L;
+		deadline.tv_nsec %= 1000000000L;
+		pthread_cond_timedwait(&g_drainCond, &g_drainLock, &deadline);
+		pthread_mutex_unlock(&g_drainLock);
+		rsb2_tracering_flush();
+		pthread_mutex_lock(&g_drainLock);
+	}
+	pthread_mutex_unlock(&g_drainLock);
+	return NULL;
+}
+
+int rsb2_tracering_start(unsigned bufsz, int periodms)
+{
+	int err = -1;
+	unsigned size = RSB2_TRACERING_MINSIZE;
+	bufsz = bufsz? bufsz: RSB2_TRACERING_BUFSZ;
+	while (size < bufsz && size < 1u << 30) {
+		size <<= 1;
+	}
+	pthread_mutex_lock(&g_drainLock);
+	if (__atomic_load_n(&g_enabled, __ATOMIC_RELAXED)) {
+		/* notify already started */
+		RSB2_ERROR("tracering_started", "bufsz=%u", bufsz);
+	} else {
+		g_bufsz = size;
+		g_period = periodms > 0? periodms: RSB2_TRACERING_PERIOD;
+		g_stop = false;
+		err = pthread_create(&g_drainer, NULL, rsb2_tracering_drainer, NULL);
+		if (err) {
+			/* notify 'pthread_create' failure */
+			RSB2_ERRRET("pthread_create", err, "bufsz=%u", bufsz);
+			err = -1;
+		} else {
+			__atomic_store_n(&g_enabled, 1, __ATOMIC_RELEASE);
+		}
+	}
+	pthread_mutex_unlock(&g_drainLock);
+	return err;
+}
+
+void rsb2_tracering_stop(void)
+{
+	pthread_mutex_lock(&g_drainLock);
+	bool started = __atomic_exchange_n(&g_enabled, 0, __ATOMIC_ACQ_REL);
+	g_stop = true;
+	pthread_cond_signal(&g_drainCond);
+	pthread_mutex_unlock(&g_drainLock);
+	if (started) {
+		pthread_join(g_drainer, NULL);
+		rsb2_tracering_flush();
+	}
+}
+
+uint64_t rsb2_tracering_dropped(void)
+{
+	pthread_mutex_lock(&g_bufsLock);
+	uint64_t dropped = g_droppedFreed;
+	for (rsb2_Tracering_buf *buf = g_bufs; buf; buf = buf->next) {
+		dropped += __atomic_load_n(&buf->dropped, __ATOMIC_RELAXED);
+	}
+	pthread_mutex_unlock(&g_bufsLock);
+	return dropped;
+}
+
+/*END*/
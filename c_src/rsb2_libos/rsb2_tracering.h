@@ -0,0 +1,71 @@
+/** Module rsb2_tracering - Interface.
+ * @file rsb2_tracering.h
+ * @author jp.tranvouez@navilab.com
+ * @defgroup rsb2_tracering Binary Trace Ring
+ * @ingroup rsb2_libcore
+ * @{
+ * Deferred trace backend. Each thread records its traces into its own
+ * lock-free ring as compact binary records: timestamp, callsite ID,
+ * module reference and raw argument values (strings are copied). A
+ * drainer thread merges the rings by timestamp, formats the records and
+ * passes them to the trace handler of rsb2_module. A full ring drops
+ * records rather than blocking the thread.
+ */
+#ifndef RSB2_TRACERING_H
+#define RSB2_TRACERING_H
+
+#include "rsb2_tracer.h"
+
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** Default ring size of a thread. */
+#define RSB2_TRACERING_BUFSZ		(256 * 1024)
+
+/** Default period of the drainer thread (ms). */
+#define RSB2_TRACERING_PERIOD		10
+
+/** Start recording traces in per-thread rings.
+ * @param bufsz ring size of each thread, rounded up to a power of two,
+ * or 0 for RSB2_TRACERING_BUFSZ
+ * @param periodms drainer period, or 0 for RSB2_TRACERING_PERIOD
+ * @retval 0 success
+ * @retval -1 error, or already started
+ */
+int rsb2_tracering_start(unsigned bufsz, int periodms);
+
+/** Stop recording, drain every ring and stop the drainer thread.
+ * Traces are formatted synchronously again afterwards.
+ */
+void rsb2_tracering_stop(void);
+
+/** Format and output every record available now.
+ * Callable from any thread while started.
+ */
+void rsb2_tracering_flush(void);
+
+/** Record a trace event in the ring of the calling thread.
+ * @param ref module reference
+ * @param site callsite
+ * @param ap argument values of the callsite format
+ * @retval true recorded, or dropped because the ring is full
+ * @retval false not started, or callsite format not supported (width
+ * or precision from arguments, long double): format it synchronously
+ */
+bool rsb2_tracering_record(int ref, rsb2_TraceCallsite *site, va_list ap);
+
+/** Get the number of records dropped because a ring was full.
+ * @return number of dropped records since start
+ */
+uint64_t rsb2_tracering_dropped(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /*@} RSB2_TRACERING_H */
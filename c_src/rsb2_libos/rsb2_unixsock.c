@@ -3,25 +3,200 @@
  * @author jp.tranvouez@navilab.com
  */
 #include "rsb2_unixsock.h"
+#include "rsb2_bufpool.h"
+#include "rsb2_frame.h"
+#include "rsb2_metrics.h"
 #include "rsb2_module.h"
+#include "rsb2_sendq.h"
+#include "rsb2_shmring.h"
 #include "rsb2_socket.h"
+#include "rsb2_timer.h"
+#include "rsb2_uring.h"
 
 #include <assert.h>
+#include <errno.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <fcntl.h>
 #include <poll.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdint.h>
 #include <string.h>
 #include <unistd.h>
+#include <arpa/inet.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
 #include <sys/socket.h>
 #include <sys/stat.h>
 #include <sys/un.h>
 
 enum {
 	RSB2_SOCKET_BACKLOG			= 100,		/* Default backlog. */
+	RSB2_EPOLL_MAXEVENTS		= 256,		/* Events per epoll_wait. */
+	RSB2_RECV_BUFSZ				= 8192,		/* Receive buffer size. */
+	RSB2_DGRAM_BATCH			= 16,		/* Datagrams per recvmmsg. */
+	RSB2_UNIXSOCK_MAXPOOLS		= 32,		/* Max number of connection pools. */
+	RSB2_URING_ENTRIES			= 256,		/* Submission queue size. */
+	RSB2_URING_BUFS				= 256,		/* Provided receive buffers. */
+	RSB2_UNIXSOCK_MAXSOCKS		= 1 << 20,	/* Max size of owner table. */
 };
 
+/* User data of io_uring requests other than connection receives. */
+enum {
+	RSB2_URING_ACCEPT			= 1,		/* Multishot accept. */
+	RSB2_URING_STOP				= 2,		/* Poll of the stop eventfd. */
+	RSB2_URING_IGNORE			= 3,		/* Cancel or linked send. */
+	RSB2_URING_RECV				= 4,		/* RPC response receive. */
+};
+
+/* Control message of a bulk payload, sent with the memfd. */
+typedef struct rsb2_Unixsock_bulkMsg {
+	char magic[4];						/* RSB2_BULK_MAGIC. */
+	uint32_t reserved;					/* Zero. */
+	uint64_t len;						/* Payload length. */
+} rsb2_Unixsock_bulkMsg;
+
+#define RSB2_BULK_MAGIC		"RSBB"
+#define RSB2_BULK_SEALS		(F_SEAL_SEAL | F_SEAL_SHRINK | F_SEAL_GROW | \
+							F_SEAL_WRITE)
+
+/* Client-side connection pool of a Unix socket path. */
+typedef struct rsb2_Unixsock_pool {
+	char path[sizeof(((struct sockaddr_un *)0)->sun_path)];	/* Socket path. */
+	int size;							/* Max number of idle connections. */
+	int nidle;							/* Number of idle connections. */
+	int *idle;							/* Idle connected sockets. */
+	bool framed;						/* Messages are framed. */
+} rsb2_Unixsock_pool;
+
+/* Kind of event source of an epoll loop. */
+typedef enum rsb2_Unixsock_srcType {
+	RSB2_UNIXSOCK_SRC_LISTEN,			/* Listening socket. */
+	RSB2_UNIXSOCK_SRC_WAKE,				/* Handoff pipe. */
+	RSB2_UNIXSOCK_SRC_STOP,				/* Stop eventfd. */
+	RSB2_UNIXSOCK_SRC_MAIL,				/* Reply handoff eventfd. */
+	RSB2_UNIXSOCK_SRC_SOCK,				/* Service socket of a connection. */
+	RSB2_UNIXSOCK_SRC_RING,				/* Channel eventfd of a connection. */
+} rsb2_Unixsock_srcType;
+
+/* Event source of an epoll loop, the data of its registration. */
+typedef struct rsb2_Unixsock_src {
+	rsb2_Unixsock_srcType type;			/* Kind of source. */
+	struct rsb2_Unixsock_conn *conn;	/* Connection or NULL. */
+} rsb2_Unixsock_src;
+
+/* Service connection of an event-loop server. */
+typedef struct rsb2_Unixsock_conn {
+	int sock;							/* Service socket. */
+	rsb2_Frame_ring ring;				/* Reassembly buffer if framed. */
+	rsb2_Shmring_chan *chan;			/* Shared-memory channel or NULL. */
+	rsb2_Sendq *sendq;					/* Reply queue or NULL. */
+	unsigned events;					/* Watched events. */
+	bool closing;						/* Closed once the replies are written. */
+	rsb2_Timer idle;					/* Idle timeout. */
+	void *ctx;							/* Session context. */
+	unsigned gen;						/* Generation of the socket number. */
+	rsb2_Unixsock_src sockSrc;			/* Source of the service socket. */
+	rsb2_Unixsock_src ringSrc;			/* Source of the channel eventfd. */
+	struct rsb2_Unixsock_conn *prev;	/* Previous connection. */
+	struct rsb2_Unixsock_conn *next;	/* Next connection. */
+} rsb2_Unixsock_conn;
+
+/* Reply handed by another thread to the loop of its connection. */
+typedef struct rsb2_Unixsock_mail {
+	struct rsb2_Unixsock_mail *next;	/* Next reply or NULL. */
+	int sock;							/* Service socket. */
+	unsigned gen;						/* Generation of the socket number. */
+	int msglen;							/* Message length. */
+	char msg[];							/* Message. */
+} rsb2_Unixsock_mail;
+
+/* Owner of a service socket number. */
+typedef struct rsb2_Unixsock_owner {
+	struct rsb2_Unixsock_loop *loop;	/* Loop of the connection or NULL. */
+	unsigned gen;						/* Connections given the number. */
+} rsb2_Unixsock_owner;
+
+/* Event loop of an event-loop server. */
+typedef struct rsb2_Unixsock_loop {
+	int epfd;							/* epoll instance. */
+	int lis_sock;						/* Listening socket or -1. */
+	int wake_fd;						/* Handoff pipe read end or -1. */
+	int hand_fd;						/* Handoff pipe write end or -1. */
+	int stop_fd;						/* Shared stop eventfd or -1. */
+	rsb2_Unixsock_src lisSrc;			/* Source of lis_sock. */
+	rsb2_Unixsock_src wakeSrc;			/* Source of wake_fd. */
+	rsb2_Unixsock_src stopSrc;			/* Source of stop_fd. */
+	int mail_fd;						/* Reply handoff eventfd or -1. */
+	rsb2_Unixsock_src mailSrc;			/* Source of mail_fd. */
+	rsb2_Unixsock_mail *mail;			/* Replies handed off, oldest first,
+										 * under g_mailLock. */
+	rsb2_Unixsock_mail *mailLast;		/* Newest reply handed off. */
+	int cpu;							/* CPU affinity or -1. */
+	int socktype;						/* Socket type. */
+	bool framed;						/* Length-prefixed framing. */
+	bool shmring;						/* Shared-memory channels. */
+	size_t hiwat;						/* Reply queue high-water mark. */
+	int idle_ms;						/* Idle timeout (ms) or 0. */
+	rsb2_Timer_wheel wheel;				/* Timers. */
+	struct mmsghdr *batch;				/* Datagram batch or NULL. */
+	rsb2_Unixsock_recv *fRecv;			/* Message processing function. */
+	rsb2_Unixsock_recvBuf *fRecvBuf;	/* Zero-copy function or NULL. */
+	rsb2_Unixsock_open *fOpen;			/* Session open function or NULL. */
+	rsb2_Unixsock_close *fClose;		/* Session close function or NULL. */
+	void *arg;							/* Server argument. */
+	rsb2_Unixsock_conn *conns;			/* Open connections. */
+	rsb2_Unixsock_conn **byfd;			/* Open connections by socket. */
+	int nbyfd;							/* Size of byfd. */
+	rsb2_Unixsock_conn *zombies;		/* Closed connections, freed after the
+										 * events of the current batch. */
+	int nconns;							/* Number of open connections. */
+	struct rsb2_Unixsock_loop *reactors;	/* Reactor loops or NULL. */
+	int nreactors;						/* Number of reactor loops. */
+	int next;							/* Next reactor for handoff. */
+	pthread_t thread;					/* Reactor thread. */
+} rsb2_Unixsock_loop;
+
+/* Event loop of the io_uring engine. */
+typedef struct rsb2_Unixsock_uloop {
+	rsb2_Uring ring;					/* io_uring instance. */
+	rsb2_Uring_bufs bufs;				/* Receive buffers. */
+	int lis_sock;						/* Shared listening socket. */
+	int stop_fd;						/* Shared stop eventfd. */
+	int cpu;							/* CPU affinity or -1. */
+	bool stop;							/* Server shutdown requested. */
+	rsb2_Unixsock_recv *fRecv;			/* Message processing function. */
+	rsb2_Unixsock_recvBuf *fRecvBuf;	/* Zero-copy function or NULL. */
+	void *arg;							/* Server argument. */
+	rsb2_Unixsock_conn *conns;			/* Open connections. */
+	int nconns;							/* Number of open connections. */
+	rsb2_Unixsock_conn *zombies;		/* Closed connections, freed on the
+										 * last completion of their receive. */
+	pthread_t thread;					/* Loop thread. */
+} rsb2_Unixsock_uloop;
+
 static int g_module = -1;						/* Module reference. */
 static int g_backlog = RSB2_SOCKET_BACKLOG;		/* Default backlog. */
+static pthread_mutex_t g_poolLock = PTHREAD_MUTEX_INITIALIZER;	/* Pool lock. */
+static rsb2_Unixsock_pool g_pools[RSB2_UNIXSOCK_MAXPOOLS];	/* Pools. */
+static int g_npools = 0;						/* Number of pools. */
+static pthread_once_t g_dgramOnce = PTHREAD_ONCE_INIT;	/* Datagram init. */
+static int g_dgramSock = -1;					/* Datagram client socket. */
+static int g_engine = RSB2_UNIXSOCK_EPOLL;		/* I/O engine. */
+static pthread_once_t g_rpcRingOnce = PTHREAD_ONCE_INIT;	/* RPC ring init. */
+static pthread_key_t g_rpcRingKey;				/* Per-thread RPC ring. */
+static __thread rsb2_Unixsock_recvBuf *t_fRecvBuf = NULL;	/* Zero-copy
+												 * function of the loop. */
+static __thread rsb2_Unixsock_loop *t_loop = NULL;	/* Loop of the thread. */
+static __thread void *t_arg = NULL;		/* Server argument of the loop. */
+static pthread_once_t g_ownersOnce = PTHREAD_ONCE_INIT;	/* Table init. */
+static pthread_mutex_t g_mailLock = PTHREAD_MUTEX_INITIALIZER;	/* Owners
+												 * and reply handoffs. */
+static rsb2_Unixsock_owner *g_owners = NULL;	/* Owners by service socket. */
+static int g_nowners = 0;						/* Size of owner table. */
 
 int rsb2_unixsock_begin(void)
 {
@@ -35,26 +210,35 @@ int rsb2_unixsock_begin(void)
 void rsb2_unixsock_end(void)
 {
 	RSB2_TRACE_ENTRY();
+	rsb2_unixsock_closePools();
 	rsb2_module_destroy(g_module);
 	RSB2_TRACE_EXIT();
 }
 
-int rsb2_unixsock_open(void)
+int rsb2_unixsock_openType(int type)
 {
-	RSB2_TRACE_ENTRY();
-	/* create Unix datagram socket */
-	int sock = socket(PF_UNIX, SOCK_STREAM, 0);
+	RSB2_TRACE_ARGS("type=%d", type);
+	/* create Unix socket */
+	int sock = socket(PF_UNIX, type, 0);
 	if (sock < 0) {
 		/* notify 'socket' failure */
-		RSB2_ERRNO("socket", "sock=%d", sock);
+		RSB2_ERRNO("socket", "type=%d", type);
 	} else {
 		/* notify socket opened */
-		RSB2_NOTIFY("socket_opened", "sock=%d", sock);
+		RSB2_NOTIFY("socket_opened", "sock=%d,type=%d", sock, type);
 	}
 	RSB2_TRACE_EXIT_INT(sock);
 	return sock;
 }
 
+int rsb2_unixsock_open(void)
+{
+	RSB2_TRACE_ENTRY();
+	int sock = rsb2_unixsock_openType(SOCK_STREAM);
+	RSB2_TRACE_EXIT_INT(sock);
+	return sock;
+}
+
 void rsb2_unixsock_unlink(const char *path)
 {
 	RSB2_TRACE_ARGS("path=%s", path);
@@ -75,21 +259,32 @@ void rsb2_unixsock_unlink(const char *path)
 	RSB2_TRACE_EXIT();
 }
 
-int rsb2_unixsock_connect(const char *path)
+static socklen_t rsb2_unixsock_addr(const char *path,
+		struct sockaddr_un *sockaddr)
 {
-	RSB2_TRACE_ARGS("path=%s", path);
+	sockaddr->sun_family = AF_UNIX;
+	strncpy(sockaddr->sun_path, path, sizeof(sockaddr->sun_path));
+	return strnlen(path, sizeof(sockaddr->sun_path)) +
+			sizeof(sockaddr->sun_family) + 1;
+}
+
+static int rsb2_unixsock_connectsock(const char *path, int type,
+		bool nonblock)
+{
+	RSB2_TRACE_ARGS("path=%s,type=%d,nonblock=%d", path, type, nonblock);
 	RSB2_ASSERT_NOTNULL(path);
-	/* create Unix datagram socket */
-	int sock = rsb2_unixsock_open();
+	/* create Unix socket */
+	int sock = rsb2_unixsock_openType(type);
 	if (sock < 0) {
 		RSB2_ERRTRACE();
+	} else if (nonblock && rsb2_socket_setnonblock(sock)) {
+		RSB2_ERRTRACE();
+		rsb2_socket_close(sock);
+		sock = -1;
 	} else {
 		/* connect socket to inode */
 		struct sockaddr_un sockaddr;
-		sockaddr.sun_family = AF_UNIX;
-		strncpy(sockaddr.sun_path, path, sizeof(sockaddr.sun_path));
-		socklen_t addrlen = strnlen(path, sizeof(sockaddr.sun_path)) +
-				sizeof(sockaddr.sun_family) + 1;
+		socklen_t addrlen = rsb2_unixsock_addr(path, &sockaddr);
 		int err = connect(sock, (struct sockaddr *)&sockaddr, addrlen);
 		if (err) {
 			/* handle 'connect' failure */
@@ -105,46 +300,81 @@ int rsb2_unixsock_connect(const char *path)
 	return sock;
 }
 
-int rsb2_unixsock_listen(const char *path)
+int rsb2_unixsock_connectType(const char *path, int type)
+{
+	RSB2_TRACE_ARGS("path=%s,type=%d", path, type);
+	int sock = rsb2_unixsock_connectsock(path, type, false);
+	RSB2_TRACE_EXIT_INT(sock);
+	return sock;
+}
+
+int rsb2_unixsock_connect(const char *path)
+{
+	RSB2_TRACE_ARGS("path=%s", path);
+	int sock = rsb2_unixsock_connectsock(path, SOCK_STREAM, false);
+	RSB2_TRACE_EXIT_INT(sock);
+	return sock;
+}
+
+int rsb2_unixsock_connectnb(const char *path)
 {
 	RSB2_TRACE_ARGS("path=%s", path);
+	int sock = rsb2_unixsock_connectsock(path, SOCK_STREAM, true);
+	RSB2_TRACE_EXIT_INT(sock);
+	return sock;
+}
+
+int rsb2_unixsock_listenType(const char *path, int type)
+{
+	RSB2_TRACE_ARGS("path=%s,type=%d", path, type);
 	RSB2_ASSERT_NOTNULL(path);
-	/* create Unix datagram socket */
-	int sock = rsb2_unixsock_open();
+	/* create Unix socket */
+	int sock = rsb2_unixsock_openType(type);
 	if (sock < 0) {
 		RSB2_ERRTRACE();
 	} else {
 		/* remove Unix socket if it exists */
 		rsb2_unixsock_unlink(path);
-	    /* bind socket to inode */
+		/* bind socket to inode */
 		struct sockaddr_un sockaddr;
-		sockaddr.sun_family = AF_UNIX;
-		strncpy(sockaddr.sun_path, path, sizeof(sockaddr.sun_path));
-		socklen_t addrlen = strnlen(path, sizeof(sockaddr.sun_path)) +
-				sizeof(sockaddr.sun_family) + 1;
+		socklen_t addrlen = rsb2_unixsock_addr(path, &sockaddr);
 		int err = bind(sock, (struct sockaddr *)&sockaddr, addrlen);
 		if (err) {
 			/* notify 'bind' failure */
 			RSB2_ERRNO("bind", "path=%s,sock=%d", path, sock);
-			sock = -1;
 		} else {
 			/* notify socket bound to inode */
 			RSB2_NOTIFY("socket_bound", "path=%s,sock=%d", path, sock);
-		    /* start listening */
-		    err = listen(sock, g_backlog);
-			if (err) {
-				/* handle 'listen' failure */
-				RSB2_ERRNO("listen", "path=%s,sock=%d", path, sock);
-			} else {
-				/* notify socket listening */
-				RSB2_NOTIFY("socket_listening", "path=%s,sock=%d", path, sock);
+			if (type != SOCK_DGRAM) {
+				/* start listening */
+				err = listen(sock, g_backlog);
+				if (err) {
+					/* handle 'listen' failure */
+					RSB2_ERRNO("listen", "path=%s,sock=%d", path, sock);
+				} else {
+					/* notify socket listening */
+					RSB2_NOTIFY("socket_listening", "path=%s,sock=%d",
+							path, sock);
+				}
 			}
 		}
+		if (err) {
+			rsb2_socket_close(sock);
+			sock = -1;
+		}
 	}
 	RSB2_TRACE_EXIT_INT(sock);
 	return sock;
 }
 
+int rsb2_unixsock_listen(const char *path)
+{
+	RSB2_TRACE_ARGS("path=%s", path);
+	int sock = rsb2_unixsock_listenType(path, SOCK_STREAM);
+	RSB2_TRACE_EXIT_INT(sock);
+	return sock;
+}
+
 int rsb2_unixsock_accept(int lis_sock)
 {
 	RSB2_TRACE_ARGS("lis_sock=%d", lis_sock);
@@ -160,115 +390,2239 @@ int rsb2_unixsock_accept(int lis_sock)
 			/* notify server-side socket connected */
 			RSB2_NOTIFY("socket_connected", "lis_sock=%d,sock=%d",
 					lis_sock, sock);
+			rsb2_metrics_add(RSB2_METRICS_ACCEPTS, 1);
 		}
 	}
 	RSB2_TRACE_EXIT_INT(sock);
 	return sock;
 }
 
-int rsb2_unixsock_sendto(const char *path, const char *msg, int msglen)
+static void rsb2_unixsock_dgramOpen(void)
+{
+	/* shared unbound datagram socket, sendto on it is thread-safe */
+	g_dgramSock = rsb2_unixsock_openType(SOCK_DGRAM | SOCK_CLOEXEC);
+}
+
+int rsb2_unixsock_senddgram(const char *path, const char *msg, int msglen)
 {
 	RSB2_TRACE_ARGS("path=%s,msg=%p,msglen=%d", path, msg, msglen);
 	RSB2_ASSERT_NOTNULL(path);
+	int count = -1;
+	pthread_once(&g_dgramOnce, rsb2_unixsock_dgramOpen);
+	if (g_dgramSock < 0) {
+		RSB2_ERRTRACE();
+	} else {
+		struct sockaddr_un sockaddr;
+		socklen_t addrlen = rsb2_unixsock_addr(path, &sockaddr);
+		do {
+			count = sendto(g_dgramSock, msg, msglen, MSG_NOSIGNAL,
+					(struct sockaddr *)&sockaddr, addrlen);
+		} while (count < 0 && errno == EINTR);
+		if (count < 0) {
+			/* notify 'sendto' failure */
+			RSB2_ERRNO("sendto", "path=%s,msglen=%d", path, msglen);
+		}
+	}
+	RSB2_TRACE_EXIT_INT(count);
+	return count;
+}
+
+void rsb2_unixsock_bulkFree(rsb2_Unixsock_bulk *bulk)
+{
+	RSB2_TRACE_ARGS("bulk=%p", bulk);
+	RSB2_ASSERT_NOTNULL(bulk);
+	if (bulk->data) {
+		munmap(bulk->data, bulk->len);
+	}
+	if (bulk->fd >= 0) {
+		close(bulk->fd);
+	}
+	bulk->data = NULL;
+	bulk->len = 0;
+	bulk->fd = -1;
+	bulk->writable = false;
+	RSB2_TRACE_EXIT();
+}
+
+static int rsb2_unixsock_bulkCreate(rsb2_Unixsock_bulk *bulk, size_t len)
+{
+	RSB2_TRACE_ARGS("bulk=%p,len=%zu", bulk, len);
 	int err = -1;
-	int sock = rsb2_unixsock_connect(path);
-	if (sock < 0) {
-		RSB2_ERROR("connect_failed", "path=%s", path);
+	bulk->data = NULL;
+	bulk->len = len;
+	bulk->writable = false;
+	bulk->fd = memfd_create("rsb2_bulk", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+	if (bulk->fd < 0) {
+		/* notify 'memfd_create' failure */
+		RSB2_ERRNO("memfd_create", "len=%zu", len);
+	} else if (ftruncate(bulk->fd, len)) {
+		/* notify 'ftruncate' failure */
+		RSB2_ERRNO("ftruncate", "fd=%d,len=%zu", bulk->fd, len);
+		rsb2_unixsock_bulkFree(bulk);
 	} else {
-		err = rsb2_socket_send(sock, msg, msglen);
-		rsb2_socket_close(sock);
+		err = 0;
 	}
 	RSB2_TRACE_EXIT_INT(err);
 	return err;
 }
 
-int rsb2_unixsock_rpc(const char *path, const char *msg, int msglen,
-		char *buf, int bufsz)
+int rsb2_unixsock_bulkAlloc(rsb2_Unixsock_bulk *bulk, size_t len)
 {
-	RSB2_TRACE_ARGS("path=%s,msg=%p,msglen=%d,buf=%p,bufsz=%d",
-			path, msg, msglen, buf, bufsz);
-	RSB2_ASSERT_NOTNULL(path);
-	RSB2_ASSERT_NOTNULL(buf);
-	RSB2_ASSERT_POSINT(bufsz);
-	int len = -1;
-	int sock = rsb2_unixsock_connect(path);
-	if (sock < 0) {
+	RSB2_TRACE_ARGS("bulk=%p,len=%zu", bulk, len);
+	RSB2_ASSERT_NOTNULL(bulk);
+	RSB2_ASSERT_NOTZERO(len);
+	int err = rsb2_unixsock_bulkCreate(bulk, len);
+	if (err) {
 		RSB2_ERRTRACE();
 	} else {
-		int err = rsb2_socket_send(sock, msg, msglen);
-		if (err) {
+		void *data = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_SHARED,
+				bulk->fd, 0);
+		if (data == MAP_FAILED) {
+			/* notify 'mmap' failure */
+			RSB2_ERRNO("mmap", "fd=%d,len=%zu", bulk->fd, len);
+			rsb2_unixsock_bulkFree(bulk);
+			err = -1;
+		} else {
+			bulk->data = data;
+			bulk->writable = true;
+		}
+	}
+	RSB2_TRACE_EXIT_INT(err);
+	return err;
+}
+
+static int rsb2_unixsock_bulkSeal(int sock, rsb2_Unixsock_bulk *bulk)
+{
+	RSB2_TRACE_ARGS("sock=%d,bulk=%p", sock, bulk);
+	int err = -1;
+	if (bulk->data) {
+		/* sealing for writes requires no writable mapping */
+		munmap(bulk->data, bulk->len);
+		bulk->data = NULL;
+	}
+	if (fcntl(bulk->fd, F_ADD_SEALS, RSB2_BULK_SEALS)) {
+		/* notify 'fcntl' failure */
+		RSB2_ERRNO("fcntl", "fd=%d,cmd=F_ADD_SEALS", bulk->fd);
+	} else {
+		rsb2_Unixsock_bulkMsg msg;
+		memcpy(msg.magic, RSB2_BULK_MAGIC, sizeof(msg.magic));
+		msg.reserved = 0;
+		msg.len = bulk->len;
+		int count = rsb2_socket_sendfd(sock, bulk->fd, (const char *)&msg,
+				sizeof(msg));
+		if (count != sizeof(msg)) {
 			RSB2_ERRTRACE();
 		} else {
-			len = rsb2_socket_recv(sock, buf, bufsz);
+			err = 0;
 		}
-		rsb2_socket_close(sock);
 	}
-	RSB2_TRACE_EXIT_INT(len);
-	return len;
+	/* the peer holds its own reference to the memfd */
+	rsb2_unixsock_bulkFree(bulk);
+	RSB2_TRACE_EXIT_INT(err);
+	return err;
 }
 
-int rsb2_unixsock_seqserve(const char *path, rsb2_Unixsock_recv fRecv,
-		int accept_tmo, int recv_tmo)
+int rsb2_unixsock_bulkSend(int sock, rsb2_Unixsock_bulk *bulk)
 {
-	RSB2_TRACE_ARGS("path=%s,fRecv=%p,accept_tmo=%d,recv_tmo=%d",
-			path, fRecv, accept_tmo, recv_tmo);
+	RSB2_TRACE_ARGS("sock=%d,bulk=%p", sock, bulk);
+	RSB2_ASSERT_NOTNULL(bulk);
+	RSB2_ASSERT(bulk->writable);
+	int err = rsb2_unixsock_bulkSeal(sock, bulk);
+	RSB2_TRACE_EXIT_INT(err);
+	return err;
+}
+
+int rsb2_unixsock_bulkSendCopy(int sock, const char *data, size_t len)
+{
+	RSB2_TRACE_ARGS("sock=%d,data=%p,len=%zu", sock, data, len);
+	RSB2_ASSERT_NOTNULL(data);
+	RSB2_ASSERT_NOTZERO(len);
+	rsb2_Unixsock_bulk bulk;
+	int err = rsb2_unixsock_bulkCreate(&bulk, len);
+	size_t done = 0;
+	while (!err && done < len) {
+		/* copy by the kernel, no mapping needed */
+		ssize_t count = pwrite(bulk.fd, data + done, len - done, done);
+		if (count > 0) {
+			done += count;
+		} else if (count < 0 && errno == EINTR) {
+			continue;
+		} else {
+			/* notify 'pwrite' failure */
+			RSB2_ERRNO("pwrite", "fd=%d,len=%zu", bulk.fd, len);
+			rsb2_unixsock_bulkFree(&bulk);
+			err = -1;
+		}
+	}
+	if (!err) {
+		err = rsb2_unixsock_bulkSeal(sock, &bulk);
+	}
+	RSB2_TRACE_EXIT_INT(err);
+	return err;
+}
+
+static bool rsb2_unixsock_bulkSealed(int fd)
+{
+	/* F_GET_SEALS fails on a file that is not a memfd, and -1 has every
+	 * seal bit set */
+	int seals = fcntl(fd, F_GET_SEALS);
+	return seals >= 0 && (seals & RSB2_BULK_SEALS) == RSB2_BULK_SEALS;
+}
+
+int rsb2_unixsock_bulkRecv(int sock, rsb2_Unixsock_bulk *bulk)
+{
+	RSB2_TRACE_ARGS("sock=%d,bulk=%p", sock, bulk);
+	RSB2_ASSERT_NOTNULL(bulk);
 	int err = -1;
-	int ret = 0;
-	int lis_sock = rsb2_unixsock_listen(path);
-	if (lis_sock >= 0) {
-		while (!ret) {
-			/* wait for incoming connection */
-			if (accept_tmo) {
-				/* wait for incoming connection */
-				ret = rsb2_socket_rdwait(lis_sock, accept_tmo);
-				if (ret) {
-					RSB2_ERRTRACE();
-				}
-			}
-			int sock = rsb2_unixsock_accept(lis_sock);
-			if (sock < 0) {
-				RSB2_ERROR("rsb2_unixsock_accept", "lis_sock=%d", lis_sock);
-			} else {
-				while (!ret) {
-					/* process incoming message */
-					if (recv_tmo) {
-						/* wait for incoming connection */
-						ret = rsb2_socket_rdwait(lis_sock, recv_tmo);
-						if (ret) {
-							RSB2_ERRTRACE();
-						}
-					}
-					if (!ret) {
-						/* receive incoming message */
-						char buf[8192];
-						int len = rsb2_socket_recv(sock, buf, sizeof(buf));
-						if (len > 0) {
-							/* call message processing function */
-							ret = fRecv(sock, buf, len);
-						} else if (len < 0) {
-							/* read error */
-							RSB2_ERRTRACE();
-							ret = 3;
-						} else {
-							/* no bytes read */
-						}
-					}
-				}
-				if (ret == 1) {
-					/* service socket close requested */
-					ret = 0;
-				}
-				/* close service socket */
-				rsb2_socket_close(sock);
+	rsb2_Unixsock_bulkMsg msg;
+	bulk->data = NULL;
+	bulk->len = 0;
+	bulk->writable = false;
+	int count = rsb2_socket_recvfd(sock, &bulk->fd, (char *)&msg,
+			sizeof(msg));
+	struct stat st;
+	if (count != sizeof(msg) || bulk->fd < 0 ||
+			memcmp(msg.magic, RSB2_BULK_MAGIC, sizeof(msg.magic))) {
+		/* notify invalid bulk message */
+		RSB2_ERROR("bulk_invalid", "sock=%d,count=%d,fd=%d",
+				sock, count, bulk->fd);
+	} else if (!rsb2_unixsock_bulkSealed(bulk->fd)) {
+		/* the sender could still change or shrink the payload */
+		RSB2_ERROR("bulk_unsealed", "sock=%d,fd=%d", sock, bulk->fd);
+	} else if (fstat(bulk->fd, &st) || (uint64_t)st.st_size != msg.len) {
+		/* notify size mismatch */
+		RSB2_ERROR("bulk_size", "sock=%d,fd=%d,len=%llu",
+				sock, bulk->fd, (unsigned long long)msg.len);
+	} else {
+		void *data = mmap(NULL, msg.len, PROT_READ, MAP_SHARED, bulk->fd, 0);
+		if (data == MAP_FAILED) {
+			/* notify 'mmap' failure */
+			RSB2_ERRNO("mmap", "fd=%d,len=%llu",
+					bulk->fd, (unsigned long long)msg.len);
+		} else {
+			/* the mapping keeps the memory, the fd is no longer needed */
+			close(bulk->fd);
+			bulk->fd = -1;
+			bulk->data = data;
+			bulk->len = msg.len;
+			err = 0;
+		}
+	}
+	if (err) {
+		rsb2_unixsock_bulkFree(bulk);
+	}
+	RSB2_TRACE_EXIT_INT(err);
+	return err;
+}
+
+static rsb2_Unixsock_pool *rsb2_unixsock_poolFind(const char *path)
+{
+	/* caller holds the pool lock */
+	rsb2_Unixsock_pool *pool = NULL;
+	for (int i = 0; i < g_npools && !pool; i++) {
+		if (!strncmp(g_pools[i].path, path, sizeof(g_pools[i].path))) {
+			pool = &g_pools[i];
+		}
+	}
+	return pool;
+}
+
+static rsb2_Unixsock_pool *rsb2_unixsock_poolAdd(const char *path)
+{
+	/* caller holds the pool lock */
+	rsb2_Unixsock_pool *pool = rsb2_unixsock_poolFind(path);
+	if (!pool && g_npools < RSB2_UNIXSOCK_MAXPOOLS) {
+		pool = &g_pools[g_npools++];
+		memset(pool, 0, sizeof(*pool));
+		strncpy(pool->path, path, sizeof(pool->path) - 1);
+	}
+	if (!pool) {
+		/* notify pool table full */
+		RSB2_ERROR("pool_table_full", "path=%s", path);
+	}
+	return pool;
+}
+
+int rsb2_unixsock_setPoolSize(const char *path, int size)
+{
+	RSB2_TRACE_ARGS("path=%s,size=%d", path, size);
+	RSB2_ASSERT_NOTNULL(path);
+	RSB2_ASSERT_NOTNEGINT(size);
+	int err = 0;
+	int *idle = size? calloc(size, sizeof(*idle)): NULL;
+	if (size && !idle) {
+		/* notify 'calloc' failure */
+		RSB2_ERRNO("calloc", "path=%s,size=%d", path, size);
+		err = -1;
+	} else {
+		pthread_mutex_lock(&g_poolLock);
+		rsb2_Unixsock_pool *pool = rsb2_unixsock_poolAdd(path);
+		if (!pool) {
+			err = -1;
+		} else {
+			/* keep idle connections that still fit */
+			while (pool->nidle > size) {
+				rsb2_socket_close(pool->idle[--pool->nidle]);
 			}
-			if (ret == 2) {
-				/* server shutdown requested */
-				err = 0;
+			if (pool->nidle) {
+				memcpy(idle, pool->idle, pool->nidle * sizeof(*idle));
 			}
+			free(pool->idle);
+			pool->idle = idle;
+			pool->size = size;
+			idle = NULL;
+			RSB2_NOTIFY("pool_resized", "path=%s,size=%d", path, size);
 		}
-		/* close listening socket */
-		rsb2_socket_close(lis_sock);
+		pthread_mutex_unlock(&g_poolLock);
+		free(idle);
+	}
+	RSB2_TRACE_EXIT_INT(err);
+	return err;
+}
+
+int rsb2_unixsock_setPoolFramed(const char *path, bool framed)
+{
+	RSB2_TRACE_ARGS("path=%s,framed=%d", path, framed);
+	RSB2_ASSERT_NOTNULL(path);
+	int err = 0;
+	pthread_mutex_lock(&g_poolLock);
+	rsb2_Unixsock_pool *pool = rsb2_unixsock_poolAdd(path);
+	if (!pool) {
+		err = -1;
+	} else if (pool->framed != framed) {
+		/* the idle connections were used with the other protocol */
+		while (pool->nidle) {
+			rsb2_socket_close(pool->idle[--pool->nidle]);
+		}
+		pool->framed = framed;
+	}
+	pthread_mutex_unlock(&g_poolLock);
+	RSB2_TRACE_EXIT_INT(err);
+	return err;
+}
+
+void rsb2_unixsock_closePools(void)
+{
+	RSB2_TRACE_ENTRY();
+	pthread_mutex_lock(&g_poolLock);
+	for (int i = 0; i < g_npools; i++) {
+		while (g_pools[i].nidle) {
+			rsb2_socket_close(g_pools[i].idle[--g_pools[i].nidle]);
+		}
+	}
+	pthread_mutex_unlock(&g_poolLock);
+	RSB2_TRACE_EXIT();
+}
+
+static bool rsb2_unixsock_pending(int sock)
+{
+	/* rsb2_socket_rdwait has no zero timeout, 0 waits without limit */
+	struct pollfd fdset;
+	fdset.fd = sock;
+	fdset.events = POLLIN;
+	return poll(&fdset, 1, 0) == 1;
+}
+
+static bool rsb2_unixsock_poolFramed(const char *path)
+{
+	pthread_mutex_lock(&g_poolLock);
+	rsb2_Unixsock_pool *pool = rsb2_unixsock_poolFind(path);
+	bool framed = pool && pool->framed;
+	pthread_mutex_unlock(&g_poolLock);
+	return framed;
+}
+
+static int rsb2_unixsock_poolGet(const char *path, bool *reused)
+{
+	RSB2_TRACE_ARGS("path=%s,reused=%p", path, reused);
+	int sock = -1;
+	bool idle = true;
+	while (sock < 0 && idle) {
+		pthread_mutex_lock(&g_poolLock);
+		rsb2_Unixsock_pool *pool = rsb2_unixsock_poolFind(path);
+		idle = pool && pool->nidle;
+		if (idle) {
+			sock = pool->idle[--pool->nidle];
+		}
+		pthread_mutex_unlock(&g_poolLock);
+		if (sock >= 0 &&
+				(rsb2_unixsock_pending(sock) || rsb2_socket_diag(sock))) {
+			/* an idle connection has nothing to read, unless the peer
+			 * closed it or sent bytes no request asked for */
+			RSB2_NOTIFY("pool_stale", "path=%s,sock=%d", path, sock);
+			rsb2_socket_close(sock);
+			sock = -1;
+		}
+	}
+	*reused = sock >= 0;
+	if (sock < 0) {
+		/* no idle connection, open a new one */
+		uint64_t start = rsb2_histo_now();
+		sock = rsb2_unixsock_connect(path);
+		rsb2_metrics_since(RSB2_METRICS_LAT_CONNECT, start);
+	}
+	RSB2_TRACE_EXIT_INT(sock);
+	return sock;
+}
+
+static void rsb2_unixsock_poolPut(const char *path, int sock, bool reusable)
+{
+	RSB2_TRACE_ARGS("path=%s,sock=%d,reusable=%d", path, sock, reusable);
+	if (reusable) {
+		pthread_mutex_lock(&g_poolLock);
+		rsb2_Unixsock_pool *pool = rsb2_unixsock_poolFind(path);
+		if (pool && pool->nidle < pool->size) {
+			pool->idle[pool->nidle++] = sock;
+			sock = -1;
+		}
+		pthread_mutex_unlock(&g_poolLock);
 	}
+	if (sock >= 0) {
+		rsb2_socket_close(sock);
+	}
+	RSB2_TRACE_EXIT();
+}
+
+static int rsb2_unixsock_poolSend(const char *path, const char *msg,
+		int msglen, bool framed, int *psock)
+{
+	RSB2_TRACE_ARGS("path=%s,msg=%p,msglen=%d,framed=%d,psock=%p",
+			path, msg, msglen, framed, psock);
+	int count = -1;
+	bool reused = true;
+	*psock = -1;
+	while (count < 0 && reused) {
+		int sock = rsb2_unixsock_poolGet(path, &reused);
+		if (sock < 0) {
+			RSB2_ERROR("connect_failed", "path=%s", path);
+			break;
+		}
+		uint64_t start = rsb2_histo_now();
+		if (framed) {
+			count = rsb2_frame_send(sock, msg, msglen)? -1: msglen;
+		} else {
+			count = rsb2_socket_send(sock, msg, msglen);
+		}
+		rsb2_metrics_since(RSB2_METRICS_LAT_SEND, start);
+		if (count == msglen) {
+			*psock = sock;
+		} else {
+			/* a dead pooled connection is replaced by a new one */
+			int err = errno;
+			rsb2_socket_diag(sock);
+			rsb2_unixsock_poolPut(path, sock, false);
+			if (reused && count < 0 && (err == EPIPE || err == ECONNRESET)) {
+				RSB2_NOTIFY("pool_reconnect", "path=%s,sock=%d", path, sock);
+			} else {
+				count = -1;
+				reused = false;
+			}
+		}
+	}
+	RSB2_TRACE_EXIT_INT(count);
+	return count;
+}
+
+int rsb2_unixsock_sendto(const char *path, const char *msg, int msglen)
+{
+	RSB2_TRACE_ARGS("path=%s,msg=%p,msglen=%d", path, msg, msglen);
+	RSB2_ASSERT_NOTNULL(path);
+	int sock = -1;
+	int err = rsb2_unixsock_poolSend(path, msg, msglen,
+			rsb2_unixsock_poolFramed(path), &sock);
+	if (sock >= 0) {
+		rsb2_unixsock_poolPut(path, sock, true);
+	}
+	RSB2_TRACE_EXIT_INT(err);
+	return err;
+}
+
+int rsb2_unixsock_setEngine(rsb2_Unixsock_engine engine)
+{
+	RSB2_TRACE_ARGS("engine=%d", engine);
+	int err = 0;
+	if (engine == RSB2_UNIXSOCK_URING && !rsb2_uring_supported()) {
+		/* notify fallback to the current engine */
+		RSB2_ERROR("uring_unsupported", "engine=%d", g_engine);
+		err = -1;
+	} else {
+		__atomic_store_n(&g_engine, engine, __ATOMIC_RELAXED);
+	}
+	RSB2_TRACE_EXIT_INT(err);
+	return err;
+}
+
+rsb2_Unixsock_engine rsb2_unixsock_getEngine(void)
+{
+	return __atomic_load_n(&g_engine, __ATOMIC_RELAXED);
+}
+
+static void rsb2_unixsock_rpcRingFree(void *arg)
+{
+	rsb2_uring_free(arg);
+	free(arg);
+}
+
+static void rsb2_unixsock_rpcRingKey(void)
+{
+	pthread_key_create(&g_rpcRingKey, rsb2_unixsock_rpcRingFree);
+}
+
+static rsb2_Uring *rsb2_unixsock_rpcRing(void)
+{
+	RSB2_TRACE_ENTRY();
+	pthread_once(&g_rpcRingOnce, rsb2_unixsock_rpcRingKey);
+	rsb2_Uring *ring = pthread_getspecific(g_rpcRingKey);
+	if (!ring) {
+		/* one small ring per calling thread, released at thread exit */
+		ring = malloc(sizeof(*ring));
+		if (!ring) {
+			/* notify 'malloc' failure */
+			RSB2_ERRNO("malloc", "size=%zu", sizeof(*ring));
+		} else if (rsb2_uring_init(ring, 4)) {
+			RSB2_ERRTRACE();
+			free(ring);
+			ring = NULL;
+		} else {
+			pthread_setspecific(g_rpcRingKey, ring);
+		}
+	}
+	RSB2_TRACE_EXIT_PTR(ring);
+	return ring;
+}
+
+static int rsb2_unixsock_uringReap(rsb2_Uring *ring, int sock, int queued,
+		bool failed, int msglen, int *psent, int *precvd)
+{
+	RSB2_TRACE_ARGS("ring=%p,sock=%d,queued=%d,failed=%d,msglen=%d",
+			ring, sock, queued, failed, msglen);
+	int err = 0;
+	bool shut = false;
+	/* the buffers of the caller are in use until every entry completes */
+	while (queued > 0) {
+		struct io_uring_cqe *cqe = rsb2_uring_peek(ring);
+		if (cqe) {
+			if (cqe->user_data == RSB2_URING_RECV) {
+				*precvd = cqe->res;
+			} else {
+				*psent = cqe->res;
+				failed = failed || cqe->res != msglen;
+			}
+			rsb2_uring_seen(ring);
+			queued--;
+		} else if (failed && !shut) {
+			/* the entries in flight complete on a shut down socket */
+			shutdown(sock, SHUT_RDWR);
+			shut = true;
+		} else if (rsb2_uring_submit(ring, 1) < 0) {
+			if (shut) {
+				RSB2_ERRTRACE();
+				err = -1;
+				break;
+			}
+			failed = true;
+		}
+	}
+	RSB2_TRACE_EXIT_INT(err);
+	return err;
+}
+
+static int rsb2_unixsock_uringRpc(rsb2_Uring *ring, const char *path,
+		const char *msg, int msglen, char *buf, int bufsz)
+{
+	RSB2_TRACE_ARGS("ring=%p,path=%s,msg=%p,msglen=%d,buf=%p,bufsz=%d",
+			ring, path, msg, msglen, buf, bufsz);
+	int len = -1;
+	bool reused = true;
+	while (len < 0 && reused) {
+		int sock = rsb2_unixsock_poolGet(path, &reused);
+		if (sock < 0) {
+			RSB2_ERROR("connect_failed", "path=%s", path);
+			break;
+		}
+		/* send and receive in one system call, the receive is
+		 * cancelled if the send fails */
+		int queued = 0;
+		bool failed = true;
+		struct io_uring_sqe *send = rsb2_uring_sqe(ring);
+		struct io_uring_sqe *recv = send? rsb2_uring_sqe(ring): NULL;
+		if (!send) {
+			RSB2_ERRTRACE();
+		} else if (!recv) {
+			RSB2_ERRTRACE();
+			/* the send entry is queued already, it completes as a no-op */
+			send->opcode = IORING_OP_NOP;
+			send->user_data = RSB2_URING_IGNORE;
+			queued = 1;
+		} else {
+			send->opcode = IORING_OP_SEND;
+			send->fd = sock;
+			send->addr = (unsigned long)msg;
+			send->len = msglen;
+			send->msg_flags = MSG_NOSIGNAL;
+			send->flags = IOSQE_IO_LINK;
+			send->user_data = RSB2_URING_IGNORE;
+			recv->opcode = IORING_OP_RECV;
+			recv->fd = sock;
+			recv->addr = (unsigned long)buf;
+			recv->len = bufsz;
+			recv->user_data = RSB2_URING_RECV;
+			queued = 2;
+			failed = rsb2_uring_submit(ring, 2) < 0;
+		}
+		int sent = -ECANCELED;
+		int recvd = -ECANCELED;
+		if (rsb2_unixsock_uringReap(ring, sock, queued, failed, msglen,
+				&sent, &recvd)) {
+			/* entries may still refer to the buffers, drop the ring */
+			RSB2_ERROR("uring_rpc_lost", "path=%s,sock=%d", path, sock);
+			pthread_setspecific(g_rpcRingKey, NULL);
+			rsb2_unixsock_rpcRingFree(ring);
+			rsb2_unixsock_poolPut(path, sock, false);
+			break;
+		}
+		if (queued == 2) {
+			rsb2_metrics_add(sent >= 0? RSB2_METRICS_MSGS_SENT:
+					RSB2_METRICS_SEND_ERRORS, 1);
+			rsb2_metrics_add(RSB2_METRICS_BYTES_SENT, sent > 0? sent: 0);
+		}
+		if (recvd != -ECANCELED) {
+			rsb2_metrics_add(recvd >= 0? RSB2_METRICS_MSGS_RECV:
+					RSB2_METRICS_RECV_ERRORS, 1);
+			rsb2_metrics_add(RSB2_METRICS_BYTES_RECV, recvd > 0? recvd: 0);
+		}
+		if (sent == msglen && recvd > 0) {
+			/* the stream may have split the reply, never reused */
+			len = recvd;
+			rsb2_unixsock_poolPut(path, sock, false);
+			break;
+		}
+		rsb2_unixsock_poolPut(path, sock, false);
+		if (queued < 2) {
+			/* notify submission queue failure, no retry */
+			RSB2_ERROR("uring_rpc", "path=%s,queued=%d", path, queued);
+			reused = false;
+		} else if (reused && (sent == -EPIPE || sent == -ECONNRESET)) {
+			/* a dead pooled connection is replaced by a new one */
+			RSB2_NOTIFY("pool_reconnect", "path=%s,sock=%d", path, sock);
+		} else {
+			/* notify failed call */
+			RSB2_ERROR("uring_rpc", "path=%s,sent=%d,recvd=%d",
+					path, sent, recvd);
+			reused = false;
+		}
+	}
+	RSB2_TRACE_EXIT_INT(len);
+	return len;
+}
+
+int rsb2_unixsock_rpc(const char *path, const char *msg, int msglen,
+		char *buf, int bufsz)
+{
+	RSB2_TRACE_ARGS("path=%s,msg=%p,msglen=%d,buf=%p,bufsz=%d",
+			path, msg, msglen, buf, bufsz);
+	RSB2_ASSERT_NOTNULL(path);
+	RSB2_ASSERT_NOTNULL(buf);
+	RSB2_ASSERT_POSINT(bufsz);
+	uint64_t start = rsb2_histo_now();
+	int len = -1;
+	int sock = -1;
+	bool framed = rsb2_unixsock_poolFramed(path);
+	rsb2_Uring *ring = !framed &&
+			rsb2_unixsock_getEngine() == RSB2_UNIXSOCK_URING?
+			rsb2_unixsock_rpcRing(): NULL;
+	if (ring) {
+		len = rsb2_unixsock_uringRpc(ring, path, msg, msglen, buf, bufsz);
+	} else {
+		rsb2_unixsock_poolSend(path, msg, msglen, framed, &sock);
+		if (sock < 0) {
+			RSB2_ERRTRACE();
+		} else if (framed) {
+			/* the whole reply frame is read, the connection is reused
+			 * unless the server sent more */
+			rsb2_Frame_ring fring;
+			rsb2_frame_init(&fring);
+			uint64_t sent = rsb2_histo_now();
+			len = rsb2_frame_recvmsg(sock, &fring, buf, bufsz);
+			rsb2_metrics_since(RSB2_METRICS_LAT_RECV, sent);
+			rsb2_unixsock_poolPut(path, sock, len >= 0 &&
+					fring.head == fring.tail && !rsb2_unixsock_pending(sock));
+			rsb2_frame_free(&fring);
+		} else {
+			/* the stream may have split the reply, its tail would be read
+			 * by the next request as its own reply: never reused */
+			uint64_t sent = rsb2_histo_now();
+			len = rsb2_socket_recv(sock, buf, bufsz);
+			rsb2_metrics_since(RSB2_METRICS_LAT_RECV, sent);
+			rsb2_unixsock_poolPut(path, sock, false);
+		}
+	}
+	rsb2_metrics_since(RSB2_METRICS_LAT_RPC, start);
+	RSB2_TRACE_EXIT_INT(len);
+	return len;
+}
+
+static int rsb2_unixsock_recvMsg(int sock, char **pbuf, size_t *pcap,
+		bool stream, bool blocking)
+{
+	RSB2_TRACE_ARGS("sock=%d,pbuf=%p,pcap=%p,stream=%d,blocking=%d",
+			sock, pbuf, pcap, stream, blocking);
+	size_t space = *pcap;
+	int len = stream? rsb2_socket_recv(sock, *pbuf, space):
+			rsb2_socket_recvrec(sock, *pbuf, space);
+	if (len > 0 && (size_t)len > space) {
+		/* notify record longer than the buffer, the rest of it is lost */
+		RSB2_ERROR("record_truncated", "sock=%d,len=%d,bufsz=%zu",
+				sock, len, space);
+		errno = EMSGSIZE;
+		len = -1;
+	}
+	int n = len;
+	/* a filled stream buffer grows to the next size class while data is
+	 * pending, so a message sent in one write reaches fRecv in one call */
+	while (stream && n > 0 && (size_t)n == space &&
+			(size_t)len < RSB2_BUFPOOL_MAXSZ &&
+			(!blocking || rsb2_unixsock_pending(sock))) {
+		char *buf = rsb2_bufpool_grow(*pbuf, len, len + 1, pcap);
+		if (!buf) {
+			RSB2_ERRTRACE();
+			break;
+		}
+		*pbuf = buf;
+		space = *pcap - len;
+		n = rsb2_socket_recv(sock, buf + len, space);
+		if (n > 0) {
+			len += n;
+		}
+		/* else EAGAIN, end of file or error, seen again by the next call */
+	}
+	RSB2_TRACE_EXIT_INT(len);
+	return len;
+}
+
+int rsb2_unixsock_seqserve(const char *path, rsb2_Unixsock_recv fRecv,
+		int accept_tmo, int recv_tmo)
+{
+	RSB2_TRACE_ARGS("path=%s,fRecv=%p,accept_tmo=%d,recv_tmo=%d",
+			path, fRecv, accept_tmo, recv_tmo);
+	int err = -1;
+	int ret = 0;
+	int lis_sock = rsb2_unixsock_listen(path);
+	if (lis_sock >= 0) {
+		while (!ret) {
+			/* wait for incoming connection */
+			if (accept_tmo) {
+				/* wait for incoming connection */
+				ret = rsb2_socket_rdwait(lis_sock, accept_tmo);
+				if (ret) {
+					RSB2_ERRTRACE();
+				}
+			}
+			int sock = rsb2_unixsock_accept(lis_sock);
+			size_t cap = 0;
+			char *buf = NULL;
+			if (sock < 0) {
+				RSB2_ERROR("rsb2_unixsock_accept", "lis_sock=%d", lis_sock);
+			} else if (!(buf = rsb2_bufpool_get(RSB2_BUFPOOL_MINSZ, &cap))) {
+				/* no receive buffer */
+				RSB2_ERRTRACE();
+				rsb2_socket_close(sock);
+			} else {
+				rsb2_metrics_add(RSB2_METRICS_CONNS, 1);
+				while (!ret) {
+					/* process incoming message */
+					if (recv_tmo) {
+						/* wait for incoming connection */
+						ret = rsb2_socket_rdwait(lis_sock, recv_tmo);
+						if (ret) {
+							RSB2_ERRTRACE();
+						}
+					}
+					if (!ret) {
+						/* receive incoming message */
+						int len = rsb2_unixsock_recvMsg(sock, &buf, &cap, true,
+								true);
+						if (len > 0) {
+							/* call message processing function */
+							ret = rsb2_metrics_handle(fRecv, sock, buf, len);
+						} else if (len < 0) {
+							/* read error */
+							RSB2_ERRTRACE();
+							ret = 3;
+						} else {
+							/* connection closed by peer */
+							ret = 1;
+						}
+					}
+				}
+				if (ret == 1) {
+					/* service socket close requested */
+					ret = 0;
+				}
+				/* close service socket */
+				rsb2_socket_close(sock);
+				rsb2_bufpool_put(buf);
+				rsb2_metrics_add(RSB2_METRICS_CONNS, -1);
+			}
+			if (ret == 2) {
+				/* server shutdown requested */
+				err = 0;
+			}
+		}
+		/* close listening socket */
+		rsb2_socket_close(lis_sock);
+	}
+	RSB2_TRACE_EXIT_INT(err);
+	return err;
+}
+
+static void rsb2_unixsock_ownersInit(void)
+{
+	struct rlimit rl;
+	int n = RSB2_UNIXSOCK_MAXSOCKS;
+	if (!getrlimit(RLIMIT_NOFILE, &rl) && rl.rlim_cur < (rlim_t)n) {
+		n = rl.rlim_cur;
+	}
+	g_owners = calloc(n, sizeof(*g_owners));
+	if (!g_owners) {
+		/* notify 'calloc' failure */
+		RSB2_ERRNO("calloc", "n=%d", n);
+	} else {
+		g_nowners = n;
+	}
+}
+
+/* record the loop of a service socket, NULL when it is closed, and
+ * return the generation of a new connection */
+static unsigned rsb2_unixsock_own(int sock, rsb2_Unixsock_loop *loop)
+{
+	unsigned gen = 0;
+	pthread_once(&g_ownersOnce, rsb2_unixsock_ownersInit);
+	pthread_mutex_lock(&g_mailLock);
+	if (sock < g_nowners) {
+		g_owners[sock].loop = loop;
+		g_owners[sock].gen += loop? 1: 0;
+		gen = g_owners[sock].gen;
+	}
+	pthread_mutex_unlock(&g_mailLock);
+	return gen;
+}
+
+static void rsb2_unixsock_connClose(rsb2_Unixsock_loop *loop,
+		rsb2_Unixsock_conn *conn)
+{
+	RSB2_TRACE_ARGS("loop=%p,conn=%p", loop, conn);
+	/* unlink connection */
+	if (conn->prev) {
+		conn->prev->next = conn->next;
+	} else {
+		loop->conns = conn->next;
+	}
+	if (conn->next) {
+		conn->next->prev = conn->prev;
+	}
+	loop->nconns--;
+	rsb2_metrics_add(RSB2_METRICS_CONNS, -1);
+	loop->byfd[conn->sock] = NULL;
+	if (conn->sock != loop->lis_sock) {
+		/* no more replies handed off to the loop */
+		rsb2_unixsock_own(conn->sock, NULL);
+	}
+	if (loop->fClose && conn->sock != loop->lis_sock) {
+		/* end the session while the socket is open */
+		loop->fClose(conn->sock, conn->ctx);
+		conn->ctx = NULL;
+	}
+	if (conn->chan) {
+		/* the peer shares the eventfd, closing it would not unwatch it */
+		epoll_ctl(loop->epfd, EPOLL_CTL_DEL, rsb2_shmring_fd(conn->chan), NULL);
+		rsb2_shmring_close(conn->chan);
+		conn->chan = NULL;
+	}
+	rsb2_timer_cancel(&loop->wheel, &conn->idle);
+	/* replies not yet written are dropped */
+	rsb2_sendq_destroy(conn->sendq);
+	conn->sendq = NULL;
+	/* closing the socket removes it from the epoll set */
+	rsb2_socket_close(conn->sock);
+	conn->sock = -1;
+	rsb2_frame_free(&conn->ring);
+	/* pending events of the batch may still refer to the connection */
+	conn->next = loop->zombies;
+	loop->zombies = conn;
+	RSB2_TRACE_EXIT();
+}
+
+static void rsb2_unixsock_connIdle(rsb2_Timer *timer, void *arg)
+{
+	rsb2_Unixsock_conn *conn = arg;
+	RSB2_TRACE_ARGS("timer=%p,conn=%p", timer, conn);
+	/* notify idle connection closed */
+	RSB2_NOTIFY("socket_idle", "sock=%d", conn->sock);
+	rsb2_unixsock_connClose(t_loop, conn);
+	RSB2_TRACE_EXIT();
+}
+
+static int rsb2_unixsock_connAdd(rsb2_Unixsock_loop *loop, int sock)
+{
+	RSB2_TRACE_ARGS("loop=%p,sock=%d", loop, sock);
+	int err = -1;
+	rsb2_Unixsock_conn *conn = NULL;
+	if (sock >= loop->nbyfd) {
+		/* descriptors are reused lowest first, the table stays small */
+		int nbyfd = loop->nbyfd? loop->nbyfd: 64;
+		while (nbyfd <= sock) {
+			nbyfd *= 2;
+		}
+		rsb2_Unixsock_conn **byfd = realloc(loop->byfd,
+				nbyfd * sizeof(*byfd));
+		if (!byfd) {
+			/* notify 'realloc' failure */
+			RSB2_ERRNO("realloc", "sock=%d,nbyfd=%d", sock, nbyfd);
+		} else {
+			memset(byfd + loop->nbyfd, 0,
+					(nbyfd - loop->nbyfd) * sizeof(*byfd));
+			loop->byfd = byfd;
+			loop->nbyfd = nbyfd;
+		}
+	}
+	if (sock >= loop->nbyfd) {
+		RSB2_ERRTRACE();
+	} else if (!(conn = calloc(1, sizeof(*conn)))) {
+		/* notify 'calloc' failure */
+		RSB2_ERRNO("calloc", "sock=%d", sock);
+	} else {
+		conn->sock = sock;
+		conn->sockSrc.type = RSB2_UNIXSOCK_SRC_SOCK;
+		conn->sockSrc.conn = conn;
+		conn->ringSrc.type = RSB2_UNIXSOCK_SRC_RING;
+		conn->ringSrc.conn = conn;
+		conn->events = EPOLLIN | EPOLLRDHUP | EPOLLET;
+		rsb2_frame_init(&conn->ring);
+		rsb2_timer_init(&conn->idle, rsb2_unixsock_connIdle, conn);
+		struct epoll_event ev;
+		ev.events = conn->events;
+		ev.data.ptr = &conn->sockSrc;
+		err = epoll_ctl(loop->epfd, EPOLL_CTL_ADD, sock, &ev);
+		if (err) {
+			/* notify 'epoll_ctl' failure */
+			RSB2_ERRNO("epoll_ctl", "sock=%d", sock);
+			free(conn);
+		} else {
+			/* link connection */
+			conn->next = loop->conns;
+			if (loop->conns) {
+				loop->conns->prev = conn;
+			}
+			loop->conns = conn;
+			loop->nconns++;
+			loop->byfd[sock] = conn;
+			rsb2_metrics_add(RSB2_METRICS_CONNS, 1);
+			if (sock != loop->lis_sock) {
+				/* replies from other threads go through the loop */
+				conn->gen = rsb2_unixsock_own(sock, loop);
+			}
+			if (loop->idle_ms && sock != loop->lis_sock) {
+				/* not the socket of a datagram server */
+				rsb2_timer_arm(&loop->wheel, &conn->idle, loop->idle_ms, 0);
+			}
+			if (loop->fOpen && sock != loop->lis_sock) {
+				/* the session may reply or close at once */
+				conn->ctx = loop->fOpen(sock);
+			}
+		}
+	}
+	RSB2_TRACE_EXIT_INT(err);
+	return err;
+}
+
+static int rsb2_unixsock_handoff(rsb2_Unixsock_loop *loop, int sock)
+{
+	RSB2_TRACE_ARGS("loop=%p,sock=%d", loop, sock);
+	int err = -1;
+	/* round-robin over reactors, skipping those with a full pipe */
+	for (int i = 0; i < loop->nreactors && err; i++) {
+		rsb2_Unixsock_loop *reactor = &loop->reactors[loop->next];
+		loop->next = (loop->next + 1) % loop->nreactors;
+		int count = -1;
+		do {
+			count = write(reactor->hand_fd, &sock, sizeof(sock));
+		} while (count < 0 && errno == EINTR);
+		if (count == sizeof(sock)) {
+			err = 0;
+		} else if (errno != EAGAIN) {
+			/* notify 'write' failure */
+			RSB2_ERRNO("write", "hand_fd=%d,sock=%d", reactor->hand_fd, sock);
+		}
+	}
+	RSB2_TRACE_EXIT_INT(err);
+	return err;
+}
+
+static int rsb2_unixsock_acceptAll(rsb2_Unixsock_loop *loop)
+{
+	RSB2_TRACE_ARGS("loop=%p", loop);
+	int count = 0;
+	for (;;) {
+		int sock = accept4(loop->lis_sock, NULL, NULL,
+				SOCK_NONBLOCK | SOCK_CLOEXEC);
+		if (sock < 0) {
+			if (errno == EINTR || errno == ECONNABORTED) {
+				rsb2_metrics_add(RSB2_METRICS_EINTR, errno == EINTR);
+				continue;
+			}
+			if (errno != EAGAIN && errno != EWOULDBLOCK) {
+				/* notify 'accept4' failure */
+				RSB2_ERRNO("accept4", "lis_sock=%d", loop->lis_sock);
+			}
+			break;
+		}
+		/* notify server-side socket connected */
+		RSB2_NOTIFY("socket_connected", "lis_sock=%d,sock=%d",
+				loop->lis_sock, sock);
+		rsb2_metrics_add(RSB2_METRICS_ACCEPTS, 1);
+		int err = loop->nreactors?
+				rsb2_unixsock_handoff(loop, sock):
+				rsb2_unixsock_connAdd(loop, sock);
+		if (err) {
+			RSB2_ERRTRACE();
+			rsb2_socket_close(sock);
+		} else {
+			count++;
+		}
+	}
+	RSB2_TRACE_EXIT_INT(count);
+	return count;
+}
+
+static int rsb2_unixsock_adoptAll(rsb2_Unixsock_loop *loop)
+{
+	RSB2_TRACE_ARGS("loop=%p", loop);
+	int count = 0;
+	for (;;) {
+		int socks[64];
+		int len = read(loop->wake_fd, socks, sizeof(socks));
+		if (len < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			if (errno != EAGAIN) {
+				/* notify 'read' failure */
+				RSB2_ERRNO("read", "wake_fd=%d", loop->wake_fd);
+			}
+			break;
+		}
+		if (len == 0) {
+			break;
+		}
+		/* writes of a single fd are atomic, reads never split an fd */
+		for (int i = 0; i < len / (int)sizeof(int); i++) {
+			if (rsb2_unixsock_connAdd(loop, socks[i])) {
+				RSB2_ERRTRACE();
+				rsb2_socket_close(socks[i]);
+			} else {
+				count++;
+			}
+		}
+	}
+	RSB2_TRACE_EXIT_INT(count);
+	return count;
+}
+
+static int rsb2_unixsock_loopWatch(rsb2_Unixsock_loop *loop, int fd,
+		rsb2_Unixsock_src *src, unsigned events)
+{
+	RSB2_TRACE_ARGS("loop=%p,fd=%d,src=%p,events=%u", loop, fd, src, events);
+	struct epoll_event ev;
+	ev.events = events;
+	ev.data.ptr = src;
+	int err = epoll_ctl(loop->epfd, EPOLL_CTL_ADD, fd, &ev);
+	if (err) {
+		/* notify 'epoll_ctl' failure */
+		RSB2_ERRNO("epoll_ctl", "epfd=%d,fd=%d", loop->epfd, fd);
+	}
+	RSB2_TRACE_EXIT_INT(err);
+	return err;
+}
+
+static void rsb2_unixsock_connFree(rsb2_Unixsock_loop *loop)
+{
+	RSB2_TRACE_ARGS("loop=%p", loop);
+	while (loop->zombies) {
+		rsb2_Unixsock_conn *conn = loop->zombies;
+		loop->zombies = conn->next;
+		free(conn);
+	}
+	RSB2_TRACE_EXIT();
+}
+
+static int rsb2_unixsock_recvCopy(int sock, const char *msg, int msglen)
+{
+	RSB2_TRACE_ARGS("sock=%d,msg=%p,msglen=%d", sock, msg, msglen);
+	int ret = 0;
+	/* the message is in a frame ring, a shared-memory ring or a batch
+	 * buffer reused by the next read, the handler gets its own buffer */
+	char *buf = rsb2_bufpool_get(msglen, NULL);
+	if (!buf) {
+		RSB2_ERRTRACE();
+		ret = 1;
+	} else {
+		memcpy(buf, msg, msglen);
+		ret = t_fRecvBuf(sock, buf, msglen);
+		rsb2_bufpool_put(buf);
+	}
+	RSB2_TRACE_EXIT_INT(ret);
+	return ret;
+}
+
+static int rsb2_unixsock_connShm(rsb2_Unixsock_loop *loop,
+		rsb2_Unixsock_conn *conn)
+{
+	RSB2_TRACE_ARGS("loop=%p,conn=%p", loop, conn);
+	int ret = 0;
+	if (!conn->chan) {
+		/* the negotiation message comes first */
+		conn->chan = rsb2_shmring_accept(conn->sock);
+		if (!conn->chan) {
+			ret = errno != EAGAIN && errno != EWOULDBLOCK;
+		} else if (rsb2_unixsock_loopWatch(loop, rsb2_shmring_fd(conn->chan),
+				&conn->ringSrc, EPOLLIN | EPOLLET)) {
+			RSB2_ERRTRACE();
+			ret = 1;
+		} else {
+			/* messages sent before the eventfd was watched */
+			ret = rsb2_shmring_dispatch(conn->chan, loop->fRecv);
+		}
+	} else {
+		/* nothing follows the negotiation on the socket */
+		char buf[64];
+		int len = rsb2_socket_recv(conn->sock, buf, sizeof(buf));
+		if (len >= 0 || (errno != EAGAIN && errno != EWOULDBLOCK)) {
+			/* peer closed, deliver what it sent before */
+			ret = rsb2_shmring_dispatch(conn->chan, loop->fRecv);
+			ret = ret == 2? 2: 1;
+		}
+	}
+	RSB2_TRACE_EXIT_INT(ret);
+	return ret;
+}
+
+static int rsb2_unixsock_connRead(rsb2_Unixsock_loop *loop,
+		rsb2_Unixsock_conn *conn)
+{
+	RSB2_TRACE_ARGS("loop=%p,conn=%p", loop, conn);
+	int ret = 0;
+	if (loop->shmring) {
+		ret = rsb2_unixsock_connShm(loop, conn);
+	}
+	while (!ret && !conn->closing && loop->framed) {
+		/* drain socket, passing each complete frame to fRecv */
+		ret = rsb2_frame_recv(conn->sock, &conn->ring, loop->fRecv);
+		if (ret < 0) {
+			/* socket drained */
+			ret = 0;
+			break;
+		}
+	}
+	while (!ret && loop->batch) {
+		/* drain datagram socket, a batch of datagrams per call */
+		int count = rsb2_socket_recvbatch(conn->sock, loop->batch,
+				RSB2_DGRAM_BATCH);
+		if (count < 0) {
+			if (errno != EAGAIN && errno != EWOULDBLOCK) {
+				/* read error, the socket stays open */
+				RSB2_ERRTRACE();
+			}
+			break;
+		}
+		for (int i = 0; i < count && ret != 2; i++) {
+			/* no connection to close, only a stop request is honoured */
+			struct mmsghdr *msg = &loop->batch[i];
+			if (msg->msg_hdr.msg_flags & MSG_TRUNC) {
+				/* notify datagram longer than the buffer, dropped */
+				RSB2_ERROR("record_truncated", "sock=%d,bufsz=%d",
+						conn->sock, RSB2_RECV_BUFSZ);
+				continue;
+			}
+			ret = rsb2_metrics_handle(loop->fRecv, conn->sock,
+					msg->msg_hdr.msg_iov->iov_base, msg->msg_len);
+			ret = ret == 2? 2: 0;
+		}
+	}
+	size_t cap = 0;
+	char *buf = NULL;
+	while (!ret && !conn->closing && !loop->framed && !loop->batch &&
+			!loop->shmring) {
+		/* drain socket, edge-triggered events are not repeated */
+		/* a SOCK_SEQPACKET record longer than the buffer is an error */
+		bool stream = loop->socktype == SOCK_STREAM;
+		if (!buf && !(buf = rsb2_bufpool_get(stream? RSB2_BUFPOOL_MINSZ:
+				RSB2_RECV_BUFSZ, &cap))) {
+			/* no receive buffer, data would be left unread */
+			RSB2_ERRTRACE();
+			ret = 1;
+			break;
+		}
+		int len = rsb2_unixsock_recvMsg(conn->sock, &buf, &cap, stream,
+				false);
+		if (len > 0 && loop->fRecvBuf) {
+			/* pass the receive buffer, the handler may keep it */
+			uint64_t start = rsb2_histo_now();
+			ret = loop->fRecvBuf(conn->sock, buf, len);
+			rsb2_metrics_since(RSB2_METRICS_LAT_HANDLER, start);
+			rsb2_bufpool_put(buf);
+			buf = NULL;
+		} else if (len > 0) {
+			/* call message processing function */
+			ret = rsb2_metrics_handle(loop->fRecv, conn->sock, buf, len);
+		} else if (len == 0) {
+			/* peer closed connection */
+			ret = 1;
+		} else if (errno == EAGAIN || errno == EWOULDBLOCK) {
+			/* socket drained */
+			break;
+		} else {
+			/* read error */
+			RSB2_ERRTRACE();
+			ret = 1;
+		}
+	}
+	rsb2_bufpool_put(buf);
+	RSB2_TRACE_EXIT_INT(ret);
+	return ret;
+}
+
+static int rsb2_unixsock_connWrite(rsb2_Unixsock_loop *loop,
+		rsb2_Unixsock_conn *conn)
+{
+	RSB2_TRACE_ARGS("loop=%p,conn=%p", loop, conn);
+	int ret = 0;
+	int left = conn->sendq? rsb2_sendq_flush(conn->sendq): 0;
+	if (left < 0) {
+		/* queued replies cannot be written */
+		RSB2_ERRTRACE();
+		ret = 1;
+	} else if (!left && conn->closing) {
+		/* last reply written, close requested */
+		ret = 1;
+	}
+	RSB2_TRACE_EXIT_INT(ret);
+	return ret;
+}
+
+static int rsb2_unixsock_connArm(rsb2_Unixsock_loop *loop,
+		rsb2_Unixsock_conn *conn)
+{
+	RSB2_TRACE_ARGS("loop=%p,conn=%p", loop, conn);
+	int err = 0;
+	/* no reads past the high-water mark or once closing, so the replies
+	 * of a peer that does not read them stop its requests */
+	unsigned events = EPOLLRDHUP | EPOLLET;
+	if (!conn->closing && !(conn->sendq && rsb2_sendq_full(conn->sendq))) {
+		events |= EPOLLIN;
+	}
+	if (conn->closing || (conn->sendq && rsb2_sendq_pending(conn->sendq))) {
+		/* writable at once when closing with nothing left, the close
+		 * then happens in the loop */
+		events |= EPOLLOUT;
+	}
+	if (events != conn->events) {
+		/* a modification reports the input already pending */
+		struct epoll_event ev;
+		ev.events = events;
+		ev.data.ptr = &conn->sockSrc;
+		err = epoll_ctl(loop->epfd, EPOLL_CTL_MOD, conn->sock, &ev);
+		if (err) {
+			/* notify 'epoll_ctl' failure */
+			RSB2_ERRNO("epoll_ctl", "sock=%d", conn->sock);
+		} else {
+			conn->events = events;
+		}
+	}
+	RSB2_TRACE_EXIT_INT(err);
+	return err;
+}
+
+static int rsb2_unixsock_sendAll(int sock, const char *msg, int msglen)
+{
+	RSB2_TRACE_ARGS("sock=%d,msg=%p,msglen=%d", sock, msg, msglen);
+	int err = 0;
+	int sent = 0;
+	while (sent < msglen && !err) {
+		int count = rsb2_socket_send(sock, msg + sent, msglen - sent);
+		if (count >= 0) {
+			/* resume a short write */
+			sent += count;
+		} else if (errno == EAGAIN || errno == EWOULDBLOCK) {
+			/* non-blocking socket, wait for buffer space */
+			if (rsb2_socket_wrwait(sock, 0) < 0) {
+				RSB2_ERRTRACE();
+				err = -1;
+			}
+		} else {
+			RSB2_ERRTRACE();
+			err = -1;
+		}
+	}
+	RSB2_TRACE_EXIT_INT(err);
+	return err;
+}
+
+static rsb2_Unixsock_conn *rsb2_unixsock_find(int sock)
+{
+	/* the socket of a datagram server is no connection */
+	return t_loop && sock >= 0 && sock < t_loop->nbyfd &&
+			sock != t_loop->lis_sock? t_loop->byfd[sock]: NULL;
+}
+
+rsb2_Timer_wheel *rsb2_unixsock_wheel(void)
+{
+	return t_loop? &t_loop->wheel: NULL;
+}
+
+/* hand a reply to the loop of its connection, when it is another loop */
+static int rsb2_unixsock_mailPost(int sock, unsigned gen, const char *msg,
+		int msglen)
+{
+	RSB2_TRACE_ARGS("sock=%d,gen=%u,msg=%p,msglen=%d", sock, gen, msg, msglen);
+	int ret = 0;
+	rsb2_Unixsock_mail *mail = NULL;
+	pthread_once(&g_ownersOnce, rsb2_unixsock_ownersInit);
+	pthread_mutex_lock(&g_mailLock);
+	rsb2_Unixsock_loop *loop = sock >= 0 && sock < g_nowners?
+			g_owners[sock].loop: NULL;
+	if (!loop || loop == t_loop) {
+		/* no connection of another loop */
+	} else if (gen && g_owners[sock].gen != gen) {
+		/* notify reply dropped, the socket is another connection's */
+		RSB2_ERROR("reply_dropped", "sock=%d,gen=%u,msglen=%d",
+				sock, gen, msglen);
+		ret = -1;
+	} else if (!(mail = malloc(sizeof(*mail) + msglen))) {
+		/* notify 'malloc' failure */
+		RSB2_ERRNO("malloc", "sock=%d,msglen=%d", sock, msglen);
+		ret = -1;
+	} else {
+		mail->next = NULL;
+		mail->sock = sock;
+		mail->gen = g_owners[sock].gen;
+		mail->msglen = msglen;
+		memcpy(mail->msg, msg, msglen);
+		if (loop->mailLast) {
+			loop->mailLast->next = mail;
+		} else {
+			loop->mail = mail;
+		}
+		loop->mailLast = mail;
+		/* under the lock, the loop cannot be freed meanwhile */
+		eventfd_write(loop->mail_fd, 1);
+		ret = 1;
+	}
+	pthread_mutex_unlock(&g_mailLock);
+	RSB2_TRACE_EXIT_INT(ret);
+	return ret;
+}
+
+static int rsb2_unixsock_replyGen(int sock, unsigned gen, const char *msg,
+		int msglen);
+
+static void rsb2_unixsock_mailDrain(rsb2_Unixsock_loop *loop)
+{
+	RSB2_TRACE_ARGS("loop=%p", loop);
+	eventfd_t value;
+	eventfd_read(loop->mail_fd, &value);
+	pthread_mutex_lock(&g_mailLock);
+	rsb2_Unixsock_mail *mail = loop->mail;
+	loop->mail = loop->mailLast = NULL;
+	pthread_mutex_unlock(&g_mailLock);
+	while (mail) {
+		rsb2_Unixsock_mail *next = mail->next;
+		/* dropped if the connection closed meanwhile, even if a new one
+		 * got its socket number */
+		if (rsb2_unixsock_replyGen(mail->sock, mail->gen, mail->msg,
+				mail->msglen) < 0) {
+			RSB2_ERRTRACE();
+		}
+		free(mail);
+		mail = next;
+	}
+	RSB2_TRACE_EXIT();
+}
+
+/* reply to a connection of the given generation, or any if 0 */
+static int rsb2_unixsock_replyGen(int sock, unsigned gen, const char *msg,
+		int msglen)
+{
+	RSB2_TRACE_ARGS("sock=%d,gen=%u,msg=%p,msglen=%d", sock, gen, msg, msglen);
+	RSB2_ASSERT_NOTNEGINT(msglen);
+	int ret = -1;
+	rsb2_Unixsock_conn *conn = rsb2_unixsock_find(sock);
+	int posted = conn? 0: rsb2_unixsock_mailPost(sock, gen, msg, msglen);
+	if (posted) {
+		/* connection of another loop, replied from its thread */
+		ret = posted < 0? -1: 0;
+	} else if (gen && (!conn || conn->gen != gen)) {
+		/* notify reply dropped, the connection is closed */
+		RSB2_ERROR("reply_dropped", "sock=%d,gen=%u,msglen=%d",
+				sock, gen, msglen);
+	} else if (conn && t_loop->shmring && !conn->chan) {
+		/* notify reply before the channel, the client reads the ack */
+		RSB2_ERROR("unixsock_shmring", "sock=%d,msglen=%d", sock, msglen);
+	} else if (conn && t_loop->shmring) {
+		/* through the ring, the client never reads the socket */
+		ret = rsb2_shmring_reply(sock, msg, msglen);
+	} else if (!conn || t_loop->socktype != SOCK_STREAM) {
+		/* not a stream connection of an event loop */
+		ret = rsb2_unixsock_sendAll(sock, msg, msglen);
+	} else if (!conn->sendq &&
+			!(conn->sendq = rsb2_sendq_create(sock, t_loop->hiwat))) {
+		RSB2_ERRTRACE();
+	} else if (t_loop->framed) {
+		/* frame header and message in one write */
+		RSB2_ASSERT(msglen <= RSB2_FRAME_MAXLEN);
+		uint32_t len = htonl(msglen);
+		struct iovec iov[2];
+		iov[0].iov_base = &len;
+		iov[0].iov_len = RSB2_FRAME_HDRSZ;
+		iov[1].iov_base = (char *)msg;
+		iov[1].iov_len = msglen;
+		ret = rsb2_sendq_pushv(conn->sendq, iov, 2);
+	} else {
+		ret = rsb2_sendq_push(conn->sendq, msg, msglen);
+	}
+	if (conn && conn->sendq && ret >= 0 && rsb2_unixsock_connArm(t_loop, conn)) {
+		/* from a timer, no event of the connection would arm it */
+		RSB2_ERRTRACE();
+		ret = -1;
+	}
+	RSB2_TRACE_EXIT_INT(ret);
+	return ret;
+}
+
+int rsb2_unixsock_reply(int sock, const char *msg, int msglen)
+{
+	return rsb2_unixsock_replyGen(sock, 0, msg, msglen);
+}
+
+uint64_t rsb2_unixsock_connId(int sock)
+{
+	rsb2_Unixsock_conn *conn = rsb2_unixsock_find(sock);
+	return conn && conn->gen? (uint64_t)conn->gen << 32 | (uint32_t)sock: 0;
+}
+
+int rsb2_unixsock_replyTo(uint64_t id, const char *msg, int msglen)
+{
+	RSB2_TRACE_ARGS("id=%#llx,msg=%p,msglen=%d",
+			(unsigned long long)id, msg, msglen);
+	int ret = -1;
+	if (!(id >> 32)) {
+		/* notify no connection identifier */
+		RSB2_ERROR("unixsock_replyTo", "id=%#llx,msglen=%d",
+				(unsigned long long)id, msglen);
+	} else {
+		ret = rsb2_unixsock_replyGen((int)(uint32_t)id,
+				(unsigned)(id >> 32), msg, msglen);
+	}
+	RSB2_TRACE_EXIT_INT(ret);
+	return ret;
+}
+
+void *rsb2_unixsock_context(int sock)
+{
+	rsb2_Unixsock_conn *conn = rsb2_unixsock_find(sock);
+	return conn? conn->ctx: NULL;
+}
+
+int rsb2_unixsock_close(int sock)
+{
+	RSB2_TRACE_ARGS("sock=%d", sock);
+	int err = -1;
+	rsb2_Unixsock_conn *conn = rsb2_unixsock_find(sock);
+	if (!conn) {
+		/* notify not a connection of the calling loop */
+		RSB2_ERROR("unixsock_close", "sock=%d", sock);
+	} else {
+		/* closed by the loop once the replies are written */
+		conn->closing = true;
+		err = rsb2_unixsock_connArm(t_loop, conn);
+	}
+	RSB2_TRACE_EXIT_INT(err);
+	return err;
+}
+
+void *rsb2_unixsock_arg(void)
+{
+	return t_arg;
+}
+
+static int rsb2_unixsock_loopInit(rsb2_Unixsock_loop *loop,
+		rsb2_Unixsock_recv *fRecv, const rsb2_Unixsock_opts *opts,
+		int stop_fd)
+{
+	RSB2_TRACE_ARGS("loop=%p,fRecv=%p,opts=%p,stop_fd=%d",
+			loop, fRecv, opts, stop_fd);
+	int err = -1;
+	memset(loop, 0, sizeof(*loop));
+	loop->lis_sock = -1;
+	loop->wake_fd = -1;
+	loop->hand_fd = -1;
+	loop->stop_fd = stop_fd;
+	loop->lisSrc.type = RSB2_UNIXSOCK_SRC_LISTEN;
+	loop->wakeSrc.type = RSB2_UNIXSOCK_SRC_WAKE;
+	loop->stopSrc.type = RSB2_UNIXSOCK_SRC_STOP;
+	loop->mail_fd = -1;
+	loop->mailSrc.type = RSB2_UNIXSOCK_SRC_MAIL;
+	loop->cpu = -1;
+	loop->socktype = opts->socktype? opts->socktype: SOCK_STREAM;
+	/* other socket types preserve message boundaries */
+	loop->shmring = opts->shmring && loop->socktype != SOCK_DGRAM;
+	loop->framed = opts->framed && loop->socktype == SOCK_STREAM &&
+			!loop->shmring;
+	loop->fRecv = fRecv;
+	loop->fRecvBuf = opts->fRecvBuf;
+	loop->fOpen = opts->fOpen;
+	loop->fClose = opts->fClose;
+	loop->arg = opts->arg;
+	loop->hiwat = opts->hiwat;
+	loop->idle_ms = opts->idle_ms;
+	rsb2_timer_wheelInit(&loop->wheel, rsb2_timer_now());
+	loop->epfd = epoll_create1(EPOLL_CLOEXEC);
+	if (loop->epfd < 0) {
+		/* notify 'epoll_create1' failure */
+		RSB2_ERRNO("epoll_create1", "loop=%p", loop);
+	} else if ((loop->mail_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)) < 0) {
+		/* notify 'eventfd' failure */
+		RSB2_ERRNO("eventfd", "loop=%p", loop);
+	} else if (rsb2_unixsock_loopWatch(loop, loop->mail_fd, &loop->mailSrc,
+			EPOLLIN)) {
+		RSB2_ERRTRACE();
+	} else if (stop_fd < 0) {
+		err = 0;
+	} else {
+		/* level-triggered and never read, so it wakes every loop */
+		err = rsb2_unixsock_loopWatch(loop, stop_fd, &loop->stopSrc, EPOLLIN);
+	}
+	RSB2_TRACE_EXIT_INT(err);
+	return err;
+}
+
+static void rsb2_unixsock_loopFree(rsb2_Unixsock_loop *loop)
+{
+	RSB2_TRACE_ARGS("loop=%p", loop);
+	/* close service sockets */
+	while (loop->conns) {
+		rsb2_unixsock_connClose(loop, loop->conns);
+	}
+	rsb2_unixsock_connFree(loop);
+	if (loop->wake_fd >= 0) {
+		/* close connections handed off but not adopted */
+		int sock;
+		while (read(loop->wake_fd, &sock, sizeof(sock)) == sizeof(sock)) {
+			rsb2_socket_close(sock);
+		}
+		close(loop->wake_fd);
+	}
+	if (loop->hand_fd >= 0) {
+		close(loop->hand_fd);
+	}
+	/* the connections are closed, no reply is handed off any more */
+	while (loop->mail) {
+		rsb2_Unixsock_mail *next = loop->mail->next;
+		free(loop->mail);
+		loop->mail = next;
+	}
+	if (loop->mail_fd >= 0) {
+		close(loop->mail_fd);
+	}
+	if (loop->epfd >= 0) {
+		close(loop->epfd);
+	}
+	free(loop->batch);
+	free(loop->byfd);
+	RSB2_TRACE_EXIT();
+}
+
+static int rsb2_unixsock_loopRun(rsb2_Unixsock_loop *loop)
+{
+	RSB2_TRACE_ARGS("loop=%p", loop);
+	int err = 0;
+	int stop = 0;
+	t_fRecvBuf = loop->fRecvBuf;
+	t_loop = loop;
+	t_arg = loop->arg;
+	while (!stop && !err) {
+		struct epoll_event events[RSB2_EPOLL_MAXEVENTS];
+		int count = epoll_wait(loop->epfd, events, RSB2_EPOLL_MAXEVENTS,
+				rsb2_timer_timeout(&loop->wheel));
+		rsb2_metrics_add(RSB2_METRICS_WAKEUPS, 1);
+		/* timers due first, the events then arm from the current time */
+		rsb2_timer_expire(&loop->wheel, rsb2_timer_now());
+		if (count < 0) {
+			rsb2_metrics_add(RSB2_METRICS_EINTR, errno == EINTR);
+			if (errno != EINTR) {
+				/* notify 'epoll_wait' failure */
+				RSB2_ERRNO("epoll_wait", "epfd=%d", loop->epfd);
+				err = -1;
+			}
+			continue;
+		}
+		for (int i = 0; i < count && !stop; i++) {
+			const rsb2_Unixsock_src *src = events[i].data.ptr;
+			if (src->type == RSB2_UNIXSOCK_SRC_LISTEN) {
+				/* incoming connections */
+				rsb2_unixsock_acceptAll(loop);
+				continue;
+			}
+			if (src->type == RSB2_UNIXSOCK_SRC_WAKE) {
+				/* connections handed off by the listener */
+				rsb2_unixsock_adoptAll(loop);
+				continue;
+			}
+			if (src->type == RSB2_UNIXSOCK_SRC_STOP) {
+				/* shutdown requested by another loop */
+				stop = 1;
+				continue;
+			}
+			if (src->type == RSB2_UNIXSOCK_SRC_MAIL) {
+				/* replies handed off by other threads */
+				rsb2_unixsock_mailDrain(loop);
+				continue;
+			}
+			bool ring = src->type == RSB2_UNIXSOCK_SRC_RING;
+			rsb2_Unixsock_conn *conn = src->conn;
+			int ret = 0;
+			if (conn->sock < 0) {
+				/* closed by an earlier event of the batch */
+				continue;
+			}
+			if (ring) {
+				ret = rsb2_shmring_dispatch(conn->chan, loop->fRecv);
+			} else if (conn->closing) {
+				/* write the replies left, then close */
+				ret = rsb2_unixsock_connWrite(loop, conn);
+			} else if (conn->sendq && (events[i].events & EPOLLOUT) &&
+					rsb2_unixsock_connWrite(loop, conn)) {
+				ret = 1;
+			} else if (events[i].events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP)) {
+				ret = rsb2_unixsock_connRead(loop, conn);
+			} else if (events[i].events & EPOLLERR) {
+				rsb2_socket_diag(conn->sock);
+				ret = 1;
+			}
+			if (ret == 1 && !conn->closing && conn->sendq &&
+					rsb2_sendq_pending(conn->sendq)) {
+				/* close once the replies are written */
+				conn->closing = true;
+				ret = rsb2_unixsock_connWrite(loop, conn);
+			}
+			if (!ret && (conn->sendq || conn->closing) &&
+					rsb2_unixsock_connArm(loop, conn)) {
+				RSB2_ERRTRACE();
+				ret = 1;
+			}
+			if (!ret && rsb2_timer_armed(&conn->idle)) {
+				/* traffic, the idle timeout restarts */
+				rsb2_timer_arm(&loop->wheel, &conn->idle, loop->idle_ms, 0);
+			}
+			if (ret == 2) {
+				/* server shutdown requested */
+				stop = 1;
+			} else if (ret) {
+				/* service socket close requested */
+				rsb2_unixsock_connClose(loop, conn);
+			}
+		}
+		rsb2_unixsock_connFree(loop);
+	}
+	if (loop->stop_fd >= 0) {
+		/* wake up the other loops */
+		eventfd_write(loop->stop_fd, 1);
+	}
+	RSB2_TRACE_EXIT_INT(err);
+	return err;
+}
+
+static int rsb2_unixsock_batchInit(rsb2_Unixsock_loop *loop)
+{
+	RSB2_TRACE_ARGS("loop=%p", loop);
+	int err = -1;
+	/* message headers, then iovecs, then buffers, in one block */
+	size_t hdrsz = RSB2_DGRAM_BATCH * sizeof(struct mmsghdr);
+	size_t iovsz = RSB2_DGRAM_BATCH * sizeof(struct iovec);
+	char *block = calloc(1, hdrsz + iovsz + RSB2_DGRAM_BATCH * RSB2_RECV_BUFSZ);
+	if (!block) {
+		/* notify 'calloc' failure */
+		RSB2_ERRNO("calloc", "loop=%p", loop);
+	} else {
+		loop->batch = (struct mmsghdr *)block;
+		struct iovec *iov = (struct iovec *)(block + hdrsz);
+		char *buf = block + hdrsz + iovsz;
+		for (int i = 0; i < RSB2_DGRAM_BATCH; i++) {
+			iov[i].iov_base = buf + i * RSB2_RECV_BUFSZ;
+			iov[i].iov_len = RSB2_RECV_BUFSZ;
+			loop->batch[i].msg_hdr.msg_iov = &iov[i];
+			loop->batch[i].msg_hdr.msg_iovlen = 1;
+		}
+		err = 0;
+	}
+	RSB2_TRACE_EXIT_INT(err);
+	return err;
+}
+
+static int rsb2_unixsock_loopListen(rsb2_Unixsock_loop *loop,
+		const char *path)
+{
+	RSB2_TRACE_ARGS("loop=%p,path=%s", loop, path);
+	int err = -1;
+	loop->lis_sock = rsb2_unixsock_listenType(path, loop->socktype);
+	if (loop->lis_sock < 0) {
+		RSB2_ERRTRACE();
+	} else if (rsb2_socket_setnonblock(loop->lis_sock)) {
+		RSB2_ERRTRACE();
+	} else if (loop->socktype != SOCK_DGRAM) {
+		err = rsb2_unixsock_loopWatch(loop, loop->lis_sock,
+				&loop->lisSrc, EPOLLIN | EPOLLET);
+	} else if (rsb2_unixsock_batchInit(loop)) {
+		RSB2_ERRTRACE();
+	} else {
+		/* the bound datagram socket is served like a connection */
+		err = rsb2_unixsock_connAdd(loop, loop->lis_sock);
+		if (!err) {
+			loop->lis_sock = -1;
+		}
+	}
+	RSB2_TRACE_EXIT_INT(err);
+	return err;
+}
+
+static int rsb2_unixsock_loopServe(const char *path,
+		rsb2_Unixsock_recv fRecv, const rsb2_Unixsock_opts *opts)
+{
+	RSB2_TRACE_ARGS("path=%s,fRecv=%p,opts=%p", path, fRecv, opts);
+	int err = -1;
+	rsb2_Unixsock_loop loop;
+	if (rsb2_unixsock_loopInit(&loop, fRecv, opts, -1)) {
+		RSB2_ERRTRACE();
+	} else if (rsb2_unixsock_loopListen(&loop, path)) {
+		RSB2_ERRTRACE();
+	} else {
+		err = rsb2_unixsock_loopRun(&loop);
+	}
+	if (loop.lis_sock >= 0) {
+		/* close listening socket */
+		rsb2_socket_close(loop.lis_sock);
+	}
+	rsb2_unixsock_loopFree(&loop);
+	RSB2_TRACE_EXIT_INT(err);
+	return err;
+}
+
+static void rsb2_unixsock_pin(int cpu)
+{
+	RSB2_TRACE_ARGS("cpu=%d", cpu);
+	if (cpu >= 0) {
+		/* pin reactor thread */
+		cpu_set_t cpuset;
+		CPU_ZERO(&cpuset);
+		CPU_SET(cpu, &cpuset);
+		int ret = pthread_setaffinity_np(pthread_self(), sizeof(cpuset),
+				&cpuset);
+		if (ret) {
+			/* notify 'pthread_setaffinity_np' failure */
+			RSB2_ERRRET("pthread_setaffinity_np", ret, "cpu=%d", cpu);
+		}
+	}
+	RSB2_TRACE_EXIT();
+}
+
+static void *rsb2_unixsock_reactor(void *arg)
+{
+	rsb2_Unixsock_loop *loop = arg;
+	RSB2_TRACE_ARGS("loop=%p", loop);
+	rsb2_unixsock_pin(loop->cpu);
+	RSB2_NOTIFY("reactor_started", "loop=%p,cpu=%d", loop, loop->cpu);
+	rsb2_unixsock_loopRun(loop);
+	RSB2_NOTIFY("reactor_stopped", "loop=%p,nconns=%d", loop, loop->nconns);
+	RSB2_TRACE_EXIT_PTR(NULL);
+	return NULL;
+}
+
+static int rsb2_unixsock_reactorInit(rsb2_Unixsock_loop *reactor,
+		rsb2_Unixsock_recv *fRecv, const rsb2_Unixsock_opts *opts,
+		int stop_fd, int cpu)
+{
+	RSB2_TRACE_ARGS("reactor=%p,fRecv=%p,opts=%p,stop_fd=%d,cpu=%d",
+			reactor, fRecv, opts, stop_fd, cpu);
+	int err = rsb2_unixsock_loopInit(reactor, fRecv, opts, stop_fd);
+	if (err) {
+		RSB2_ERRTRACE();
+	} else {
+		reactor->cpu = cpu;
+		int fds[2];
+		err = pipe2(fds, O_NONBLOCK | O_CLOEXEC);
+		if (err) {
+			/* notify 'pipe2' failure */
+			RSB2_ERRNO("pipe2", "reactor=%p", reactor);
+		} else {
+			reactor->wake_fd = fds[0];
+			reactor->hand_fd = fds[1];
+			err = rsb2_unixsock_loopWatch(reactor, reactor->wake_fd,
+					&reactor->wakeSrc, EPOLLIN | EPOLLET);
+		}
+	}
+	RSB2_TRACE_EXIT_INT(err);
+	return err;
+}
+
+static int rsb2_unixsock_poolServe(const char *path,
+		rsb2_Unixsock_recv fRecv, const rsb2_Unixsock_opts *opts)
+{
+	RSB2_TRACE_ARGS("path=%s,fRecv=%p,opts=%p", path, fRecv, opts);
+	int nthreads = opts->nthreads;
+	int err = -1;
+	int nstarted = 0;
+	rsb2_Unixsock_loop listener;
+	rsb2_Unixsock_loop *reactors = calloc(nthreads, sizeof(*reactors));
+	int stop_fd = eventfd(0, EFD_CLOEXEC);
+	if (!reactors) {
+		/* notify 'calloc' failure */
+		RSB2_ERRNO("calloc", "nthreads=%d", nthreads);
+	} else if (stop_fd < 0) {
+		/* notify 'eventfd' failure */
+		RSB2_ERRNO("eventfd", "path=%s", path);
+	} else if (rsb2_unixsock_loopInit(&listener, fRecv, opts, stop_fd)) {
+		RSB2_ERRTRACE();
+		rsb2_unixsock_loopFree(&listener);
+	} else {
+		listener.reactors = reactors;
+		err = 0;
+		for (int i = 0; i < nthreads && !err; i++) {
+			err = rsb2_unixsock_reactorInit(&reactors[i], fRecv, opts,
+					stop_fd, opts->cpus? opts->cpus[i]: -1);
+			if (!err) {
+				err = pthread_create(&reactors[i].thread, NULL,
+						rsb2_unixsock_reactor, &reactors[i]);
+				if (err) {
+					/* notify 'pthread_create' failure */
+					RSB2_ERRRET("pthread_create", err, "i=%d", i);
+					err = -1;
+				}
+			}
+			if (err) {
+				rsb2_unixsock_loopFree(&reactors[i]);
+			} else {
+				nstarted++;
+			}
+		}
+		if (!err) {
+			listener.nreactors = nstarted;
+			err = rsb2_unixsock_loopListen(&listener, path);
+		}
+		if (!err) {
+			/* accept connections until a reactor stops the server */
+			err = rsb2_unixsock_loopRun(&listener);
+		} else {
+			/* stop started reactors */
+			eventfd_write(stop_fd, 1);
+		}
+		for (int i = 0; i < nstarted; i++) {
+			pthread_join(reactors[i].thread, NULL);
+			rsb2_unixsock_loopFree(&reactors[i]);
+		}
+		if (listener.lis_sock >= 0) {
+			/* close listening socket */
+			rsb2_socket_close(listener.lis_sock);
+		}
+		rsb2_unixsock_loopFree(&listener);
+	}
+	if (stop_fd >= 0) {
+		close(stop_fd);
+	}
+	free(reactors);
+	RSB2_TRACE_EXIT_INT(err);
+	return err;
+}
+
+static int rsb2_unixsock_uringArm(rsb2_Unixsock_uloop *loop, int op,
+		int fd, uint64_t data)
+{
+	RSB2_TRACE_ARGS("loop=%p,op=%d,fd=%d", loop, op, fd);
+	int err = -1;
+	struct io_uring_sqe *sqe = rsb2_uring_sqe(&loop->ring);
+	if (!sqe) {
+		RSB2_ERRTRACE();
+	} else {
+		sqe->opcode = op;
+		sqe->fd = fd;
+		sqe->user_data = data;
+		if (op == IORING_OP_ACCEPT) {
+			sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+			sqe->accept_flags = SOCK_CLOEXEC;
+		} else if (op == IORING_OP_RECV) {
+			/* each completion takes a buffer from the group */
+			sqe->ioprio = IORING_RECV_MULTISHOT;
+			sqe->flags = IOSQE_BUFFER_SELECT;
+			sqe->buf_group = loop->bufs.bgid;
+		} else if (op == IORING_OP_POLL_ADD) {
+			sqe->poll32_events = POLLIN;
+		} else if (op == IORING_OP_ASYNC_CANCEL) {
+			sqe->fd = -1;
+			sqe->addr = data;
+			sqe->user_data = RSB2_URING_IGNORE;
+		}
+		err = 0;
+	}
+	RSB2_TRACE_EXIT_INT(err);
+	return err;
+}
+
+static void rsb2_unixsock_uringLink(rsb2_Unixsock_conn **plist,
+		rsb2_Unixsock_conn *conn)
+{
+	conn->prev = NULL;
+	conn->next = *plist;
+	if (*plist) {
+		(*plist)->prev = conn;
+	}
+	*plist = conn;
+}
+
+static void rsb2_unixsock_uringUnlink(rsb2_Unixsock_conn **plist,
+		rsb2_Unixsock_conn *conn)
+{
+	if (conn->prev) {
+		conn->prev->next = conn->next;
+	} else {
+		*plist = conn->next;
+	}
+	if (conn->next) {
+		conn->next->prev = conn->prev;
+	}
+}
+
+static void rsb2_unixsock_uringAccept(rsb2_Unixsock_uloop *loop, int res)
+{
+	RSB2_TRACE_ARGS("loop=%p,res=%d", loop, res);
+	rsb2_Unixsock_conn *conn = NULL;
+	if (res < 0) {
+		/* notify 'accept' failure */
+		RSB2_ERROR("uring_accept", "lis_sock=%d,errno=%d", loop->lis_sock, -res);
+	} else if (!(conn = calloc(1, sizeof(*conn)))) {
+		/* notify 'calloc' failure */
+		RSB2_ERRNO("calloc", "sock=%d", res);
+		rsb2_socket_close(res);
+	} else {
+		/* notify server-side socket connected */
+		RSB2_NOTIFY("socket_connected", "lis_sock=%d,sock=%d",
+				loop->lis_sock, res);
+		rsb2_metrics_add(RSB2_METRICS_ACCEPTS, 1);
+		rsb2_metrics_add(RSB2_METRICS_CONNS, 1);
+		conn->sock = res;
+		rsb2_unixsock_uringLink(&loop->conns, conn);
+		loop->nconns++;
+		if (rsb2_unixsock_uringArm(loop, IORING_OP_RECV, conn->sock,
+				(uintptr_t)conn)) {
+			RSB2_ERRTRACE();
+		}
+	}
+	RSB2_TRACE_EXIT();
+}
+
+static void rsb2_unixsock_uringClose(rsb2_Unixsock_uloop *loop,
+		rsb2_Unixsock_conn *conn, bool armed)
+{
+	RSB2_TRACE_ARGS("loop=%p,conn=%p,armed=%d", loop, conn, armed);
+	rsb2_unixsock_uringUnlink(&loop->conns, conn);
+	loop->nconns--;
+	rsb2_metrics_add(RSB2_METRICS_CONNS, -1);
+	rsb2_socket_close(conn->sock);
+	conn->sock = -1;
+	if (armed) {
+		/* the request holds the socket, freed on its last completion */
+		rsb2_unixsock_uringLink(&loop->zombies, conn);
+		rsb2_unixsock_uringArm(loop, IORING_OP_ASYNC_CANCEL, -1,
+				(uintptr_t)conn);
+	} else {
+		free(conn);
+	}
+	RSB2_TRACE_EXIT();
+}
+
+static void rsb2_unixsock_uringRecv(rsb2_Unixsock_uloop *loop,
+		rsb2_Unixsock_conn *conn, int res, unsigned flags)
+{
+	RSB2_TRACE_ARGS("loop=%p,conn=%p,res=%d,flags=%u", loop, conn, res, flags);
+	bool armed = flags & IORING_CQE_F_MORE;
+	int ret = 0;
+	if (conn->sock < 0) {
+		/* closed, waiting for the last completion */
+		ret = -1;
+	} else if (res > 0 && (flags & IORING_CQE_F_BUFFER)) {
+		/* call message processing function */
+		unsigned bid = flags >> IORING_CQE_BUFFER_SHIFT;
+		rsb2_metrics_add(RSB2_METRICS_MSGS_RECV, 1);
+		rsb2_metrics_add(RSB2_METRICS_BYTES_RECV, res);
+		ret = rsb2_metrics_handle(loop->fRecv, conn->sock,
+				rsb2_uring_bufsGet(&loop->bufs, bid), res);
+	} else if (res == 0) {
+		/* peer closed connection */
+		ret = 1;
+	} else if (res == -ENOBUFS) {
+		/* every buffer in use, receive again once they are back */
+		RSB2_NOTIFY("uring_nobufs", "sock=%d", conn->sock);
+	} else {
+		/* read error */
+		RSB2_ERROR("uring_recv", "sock=%d,errno=%d", conn->sock, -res);
+		rsb2_metrics_add(RSB2_METRICS_RECV_ERRORS, 1);
+		ret = 1;
+	}
+	if (flags & IORING_CQE_F_BUFFER) {
+		rsb2_uring_bufsPut(&loop->bufs, flags >> IORING_CQE_BUFFER_SHIFT);
+	}
+	if (ret < 0) {
+		if (!armed) {
+			rsb2_unixsock_uringUnlink(&loop->zombies, conn);
+			free(conn);
+		}
+	} else if (ret == 2) {
+		/* server shutdown requested, wake up the other loops */
+		loop->stop = true;
+		eventfd_write(loop->stop_fd, 1);
+	} else if (ret == 1) {
+		/* service socket close requested */
+		rsb2_unixsock_uringClose(loop, conn, armed);
+	} else if (!armed) {
+		/* the multishot receive ended, submit it again */
+		rsb2_unixsock_uringArm(loop, IORING_OP_RECV, conn->sock,
+				(uintptr_t)conn);
+	}
+	RSB2_TRACE_EXIT();
+}
+
+static int rsb2_unixsock_uringRun(rsb2_Unixsock_uloop *loop)
+{
+	RSB2_TRACE_ARGS("loop=%p", loop);
+	int err = 0;
+	t_fRecvBuf = loop->fRecvBuf;
+	t_arg = loop->arg;
+	while (!loop->stop && !err) {
+		/* submit new requests and wait, in one system call */
+		if (rsb2_uring_submit(&loop->ring, 1) < 0) {
+			RSB2_ERRTRACE();
+			err = -1;
+		}
+		rsb2_metrics_add(RSB2_METRICS_WAKEUPS, 1);
+		struct io_uring_cqe *cqe;
+		while (!loop->stop && (cqe = rsb2_uring_peek(&loop->ring))) {
+			uint64_t data = cqe->user_data;
+			int res = cqe->res;
+			unsigned flags = cqe->flags;
+			rsb2_uring_seen(&loop->ring);
+			if (data == RSB2_URING_ACCEPT) {
+				rsb2_unixsock_uringAccept(loop, res);
+				if (!(flags & IORING_CQE_F_MORE)) {
+					rsb2_unixsock_uringArm(loop, IORING_OP_ACCEPT,
+							loop->lis_sock, RSB2_URING_ACCEPT);
+				}
+			} else if (data == RSB2_URING_STOP) {
+				/* shutdown requested by another loop */
+				loop->stop = true;
+			} else if (data != RSB2_URING_IGNORE) {
+				rsb2_unixsock_uringRecv(loop,
+						(rsb2_Unixsock_conn *)(uintptr_t)data, res, flags);
+			}
+		}
+	}
+	RSB2_TRACE_EXIT_INT(err);
+	return err;
+}
+
+static void rsb2_unixsock_uloopFree(rsb2_Unixsock_uloop *loop)
+{
+	RSB2_TRACE_ARGS("loop=%p", loop);
+	rsb2_uring_bufsFree(&loop->ring, &loop->bufs);
+	/* closing the ring cancels the requests of the connections */
+	rsb2_uring_free(&loop->ring);
+	while (loop->conns) {
+		rsb2_Unixsock_conn *conn = loop->conns;
+		loop->conns = conn->next;
+		rsb2_metrics_add(RSB2_METRICS_CONNS, -1);
+		rsb2_socket_close(conn->sock);
+		free(conn);
+	}
+	while (loop->zombies) {
+		rsb2_Unixsock_conn *conn = loop->zombies;
+		loop->zombies = conn->next;
+		free(conn);
+	}
+	RSB2_TRACE_EXIT();
+}
+
+static int rsb2_unixsock_uloopInit(rsb2_Unixsock_uloop *loop,
+		rsb2_Unixsock_recv *fRecv, const rsb2_Unixsock_opts *opts,
+		int lis_sock, int stop_fd, int cpu)
+{
+	RSB2_TRACE_ARGS("loop=%p,fRecv=%p,opts=%p,lis_sock=%d,stop_fd=%d,"
+			"cpu=%d", loop, fRecv, opts, lis_sock, stop_fd, cpu);
+	int err = -1;
+	memset(loop, 0, sizeof(*loop));
+	loop->lis_sock = lis_sock;
+	loop->stop_fd = stop_fd;
+	loop->cpu = cpu;
+	loop->fRecv = fRecv;
+	loop->fRecvBuf = opts->fRecvBuf;
+	loop->arg = opts->arg;
+	if (rsb2_uring_init(&loop->ring, RSB2_URING_ENTRIES)) {
+		RSB2_ERRTRACE();
+	} else if (rsb2_uring_bufsInit(&loop->ring, &loop->bufs, 0,
+			RSB2_URING_BUFS, RSB2_RECV_BUFSZ)) {
+		RSB2_ERRTRACE();
+	} else if (rsb2_unixsock_uringArm(loop, IORING_OP_ACCEPT, lis_sock,
+			RSB2_URING_ACCEPT) ||
+			rsb2_unixsock_uringArm(loop, IORING_OP_POLL_ADD, stop_fd,
+			RSB2_URING_STOP)) {
+		RSB2_ERRTRACE();
+	} else {
+		err = 0;
+	}
+	RSB2_TRACE_EXIT_INT(err);
+	return err;
+}
+
+static void *rsb2_unixsock_uringReactor(void *arg)
+{
+	rsb2_Unixsock_uloop *loop = arg;
+	RSB2_TRACE_ARGS("loop=%p", loop);
+	rsb2_unixsock_pin(loop->cpu);
+	RSB2_NOTIFY("reactor_started", "loop=%p,cpu=%d", loop, loop->cpu);
+	if (rsb2_unixsock_uringRun(loop)) {
+		/* stop the other loops */
+		eventfd_write(loop->stop_fd, 1);
+	}
+	RSB2_NOTIFY("reactor_stopped", "loop=%p,nconns=%d", loop, loop->nconns);
+	RSB2_TRACE_EXIT_PTR(NULL);
+	return NULL;
+}
+
+static int rsb2_unixsock_uringServe(const char *path,
+		rsb2_Unixsock_recv fRecv, const rsb2_Unixsock_opts *opts)
+{
+	RSB2_TRACE_ARGS("path=%s,fRecv=%p,opts=%p", path, fRecv, opts);
+	/* every loop has its own multishot accept on the listening socket */
+	int nloops = opts->nthreads > 0? opts->nthreads: 1;
+	int err = -1;
+	int nstarted = 0;
+	int lis_sock = -1;
+	rsb2_Unixsock_uloop *loops = calloc(nloops, sizeof(*loops));
+	int stop_fd = eventfd(0, EFD_CLOEXEC);
+	if (!loops) {
+		/* notify 'calloc' failure */
+		RSB2_ERRNO("calloc", "nloops=%d", nloops);
+	} else if (stop_fd < 0) {
+		/* notify 'eventfd' failure */
+		RSB2_ERRNO("eventfd", "path=%s", path);
+	} else if ((lis_sock = rsb2_unixsock_listenType(path,
+			opts->socktype? opts->socktype: SOCK_STREAM)) < 0) {
+		RSB2_ERRTRACE();
+	} else if (!opts->nthreads) {
+		/* single loop in the current thread */
+		err = rsb2_unixsock_uloopInit(&loops[0], fRecv, opts, lis_sock,
+				stop_fd, -1);
+		if (!err) {
+			err = rsb2_unixsock_uringRun(&loops[0]);
+		}
+		rsb2_unixsock_uloopFree(&loops[0]);
+	} else {
+		err = 0;
+		for (int i = 0; i < nloops && !err; i++) {
+			err = rsb2_unixsock_uloopInit(&loops[i], fRecv, opts,
+					lis_sock, stop_fd, opts->cpus? opts->cpus[i]: -1);
+			if (!err) {
+				err = pthread_create(&loops[i].thread, NULL,
+						rsb2_unixsock_uringReactor, &loops[i]);
+				if (err) {
+					/* notify 'pthread_create' failure */
+					RSB2_ERRRET("pthread_create", err, "i=%d", i);
+					err = -1;
+				}
+			}
+			if (err) {
+				rsb2_unixsock_uloopFree(&loops[i]);
+				/* stop started loops */
+				eventfd_write(stop_fd, 1);
+			} else {
+				nstarted++;
+			}
+		}
+		for (int i = 0; i < nstarted; i++) {
+			pthread_join(loops[i].thread, NULL);
+			rsb2_unixsock_uloopFree(&loops[i]);
+		}
+	}
+	if (lis_sock >= 0) {
+		/* close listening socket */
+		rsb2_socket_close(lis_sock);
+	}
+	if (stop_fd >= 0) {
+		close(stop_fd);
+	}
+	free(loops);
+	RSB2_TRACE_EXIT_INT(err);
+	return err;
+}
+
+int rsb2_unixsock_serve(const char *path, rsb2_Unixsock_recv fRecv,
+		const rsb2_Unixsock_opts *opts)
+{
+	RSB2_TRACE_ARGS("path=%s,fRecv=%p,opts=%p", path, fRecv, opts);
+	RSB2_ASSERT(fRecv || (opts && opts->fRecvBuf));
+	rsb2_Unixsock_opts defaults;
+	if (!opts) {
+		memset(&defaults, 0, sizeof(defaults));
+		opts = &defaults;
+	}
+	if (opts->fRecvBuf) {
+		/* paths without a pooled receive buffer copy into one */
+		fRecv = rsb2_unixsock_recvCopy;
+	}
+	bool uring = rsb2_unixsock_getEngine() == RSB2_UNIXSOCK_URING;
+	/* a multishot receive does not tell a truncated record */
+	if (uring && (opts->framed || opts->shmring ||
+			opts->socktype == SOCK_DGRAM ||
+			opts->socktype == SOCK_SEQPACKET || opts->idle_ms ||
+			opts->fOpen || opts->fClose)) {
+		/* notify fallback to epoll */
+		RSB2_NOTIFY("uring_fallback", "path=%s", path);
+		uring = false;
+	}
+	/* a datagram socket has no connections to hand off */
+	int err = uring? rsb2_unixsock_uringServe(path, fRecv, opts):
+			opts->nthreads > 0 && opts->socktype != SOCK_DGRAM?
+			rsb2_unixsock_poolServe(path, fRecv, opts):
+			rsb2_unixsock_loopServe(path, fRecv, opts);
+	RSB2_TRACE_EXIT_INT(err);
+	return err;
+}
+
+int rsb2_unixsock_epollserve(const char *path, rsb2_Unixsock_recv fRecv)
+{
+	RSB2_TRACE_ARGS("path=%s,fRecv=%p", path, fRecv);
+	int err = rsb2_unixsock_serve(path, fRecv, NULL);
+	RSB2_TRACE_EXIT_INT(err);
+	return err;
+}
+
+int rsb2_unixsock_poolserve(const char *path, rsb2_Unixsock_recv fRecv,
+		int nthreads, const int *cpus)
+{
+	RSB2_TRACE_ARGS("path=%s,fRecv=%p,nthreads=%d,cpus=%p",
+			path, fRecv, nthreads, cpus);
+	RSB2_ASSERT_POSINT(nthreads);
+	rsb2_Unixsock_opts opts;
+	memset(&opts, 0, sizeof(opts));
+	opts.nthreads = nthreads;
+	opts.cpus = cpus;
+	int err = rsb2_unixsock_serve(path, fRecv, &opts);
 	RSB2_TRACE_EXIT_INT(err);
 	return err;
 }
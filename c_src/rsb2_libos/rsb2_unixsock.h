@@ -1,45 +1,84 @@
 /** Module rsb2_unixsock - Interface.
  * @file rsb2_unixsock.h
  * @author jp.tranvouez@navilab.com
- * @defgroup rsb2_unixsock Unix Stream Socket API Wrapper
+ * @defgroup rsb2_unixsock Unix Socket API Wrapper
  * @ingroup rsb2_libos
  * @{
  */
 #ifndef RSB2_UNIXSOCK_H
 #define RSB2_UNIXSOCK_H
 
+#include "rsb2_timer.h"
+
 #include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/socket.h>
 
 #ifdef __cplusplus
 extern "C" {
 #endif
 
-/** Open a socket.
+/** Open a stream socket.
  * @return socket file descriptor
  * @retval -1 error
  */
 int rsb2_unixsock_open(void);
 
+/** Open a socket of a given type.
+ * @param type SOCK_STREAM, SOCK_SEQPACKET or SOCK_DGRAM
+ * @return socket file descriptor
+ * @retval -1 error
+ */
+int rsb2_unixsock_openType(int type);
+
 /** Unlink a Unix socket inode.
  * @param path filesystem path of Unix socket
  */
 void rsb2_unixsock_unlink(const char *path);
 
-/** Open a client-side socket.
+/** Open a client-side stream socket.
  * @param path filesystem path of Unix socket
  * @return socket file descriptor
  * @retval -1 error
  */
 int rsb2_unixsock_connect(const char *path);
 
-/** Open a server-side listening socket.
+/** Open a client-side socket of a given type.
+ * A SOCK_DGRAM socket is only given a default destination.
+ * @param path filesystem path of Unix socket
+ * @param type SOCK_STREAM, SOCK_SEQPACKET or SOCK_DGRAM
+ * @return socket file descriptor
+ * @retval -1 error
+ */
+int rsb2_unixsock_connectType(const char *path, int type);
+
+/** Open a non-blocking client-side socket.
+ * A Unix socket connects at once or fails (EAGAIN if the server backlog
+ * is full), only subsequent I/O is non-blocking.
+ * @param path filesystem path of Unix socket
+ * @return socket file descriptor
+ * @retval -1 error
+ */
+int rsb2_unixsock_connectnb(const char *path);
+
+/** Open a server-side listening stream socket.
  * @param path filesystem path of Unix socket
- * @param backlog max number of outstanding connection requests or zero
  * @return listening socket file descriptor
  * @retval -1 error
  */
 int rsb2_unixsock_listen(const char *path);
 
+/** Open a server-side socket of a given type.
+ * A SOCK_DGRAM socket is only bound; it receives datagrams itself and
+ * cannot be passed to rsb2_unixsock_accept.
+ * @param path filesystem path of Unix socket
+ * @param type SOCK_STREAM, SOCK_SEQPACKET or SOCK_DGRAM
+ * @return listening or bound socket file descriptor
+ * @retval -1 error
+ */
+int rsb2_unixsock_listenType(const char *path, int type);
+
 /** Open a server-side service socket.
  * Do nothing if lis_sock is negative.
  * @param lis_sock listening socket file descriptor
@@ -48,8 +87,33 @@ int rsb2_unixsock_listen(const char *path);
  */
 int rsb2_unixsock_accept(int lis_sock);
 
+/** Send a message to a Unix socket.
+ * Connect to Unix socket, send message, close socket.
+ * A pooled connection is used instead if path has a connection pool.
+ * @param path filesystem path of Unix socket
+ * @param msg message address
+ * @param msglen message length
+ * @return number of bytes sent
+ * @retval -1 error
+ */
+int rsb2_unixsock_sendto(const char *path, const char *msg, int msglen);
+
+/** Send a datagram to a Unix datagram socket.
+ * No connection is opened: one sendto on a shared unbound socket.
+ * @param path filesystem path of Unix datagram socket
+ * @param msg message address
+ * @param msglen message length
+ * @return number of bytes sent
+ * @retval -1 error
+ */
+int rsb2_unixsock_senddgram(const char *path, const char *msg, int msglen);
+
 /** Send a request to a Unix socket and get a response.
  * Connect to Unix socket, send request, get response, close socket.
+ * A pooled connection is used instead if path has a connection pool; it
+ * is only kept for the next call if path is framed (see
+ * rsb2_unixsock_setPoolFramed), since the stream may split an unframed
+ * response.
  * @param path filesystem path of Unix socket
  * @param msg request message address
  * @param msglen request message length
@@ -61,6 +125,111 @@ int rsb2_unixsock_accept(int lis_sock);
 int rsb2_unixsock_rpc(const char *path, const char *msg, int msglen,
 		char *buf, int bufsz);
 
+/** Set the connection pool size of a Unix socket path.
+ * rsb2_unixsock_rpc and rsb2_unixsock_sendto then keep up to size idle
+ * connections to path open and reuse them, so a call costs a write and a
+ * read. A connection found closed by the peer, or with unread data, is
+ * replaced transparently.
+ * The server must keep service sockets open between messages, as the
+ * event-loop servers do. Size 0, the default, disables pooling.
+ * @param path filesystem path of Unix socket
+ * @param size maximum number of idle connections
+ * @retval 0 success
+ * @retval -1 error (too many pools)
+ */
+int rsb2_unixsock_setPoolSize(const char *path, int size);
+
+/** Set the framing of the messages sent to a Unix socket path.
+ * With framing, rsb2_unixsock_rpc and rsb2_unixsock_sendto send their
+ * messages as frames (see rsb2_frame) and rsb2_unixsock_rpc reads the
+ * response frame, for a server with opts->framed: a pooled connection
+ * is then reused after a response. Framed calls use the epoll engine.
+ * The idle connections of path are closed if the framing changes.
+ * @param path filesystem path of Unix socket
+ * @param framed messages are framed
+ * @retval 0 success
+ * @retval -1 error (too many pools)
+ */
+int rsb2_unixsock_setPoolFramed(const char *path, bool framed);
+
+/** Close the idle connections of every connection pool. */
+void rsb2_unixsock_closePools(void);
+
+/** I/O engine of event-loop servers and RPC clients. */
+typedef enum rsb2_Unixsock_engine {
+	RSB2_UNIXSOCK_EPOLL = 0,	/**< epoll, one system call per operation. */
+	RSB2_UNIXSOCK_URING,		/**< io_uring, many operations per system call. */
+} rsb2_Unixsock_engine;
+
+/** Select the I/O engine used from now on.
+ * With RSB2_UNIXSOCK_URING, rsb2_unixsock_serve accepts with a multishot
+ * accept and receives with multishot receives into a provided buffer ring,
+ * and rsb2_unixsock_rpc submits the request send linked to the response
+ * receive. Servers with framing, shared-memory channels or SOCK_DGRAM
+ * keep using epoll.
+ * @param engine I/O engine
+ * @retval 0 success
+ * @retval -1 io_uring not supported by the kernel, the engine is unchanged
+ */
+int rsb2_unixsock_setEngine(rsb2_Unixsock_engine engine);
+
+/** Get the I/O engine in use.
+ * @return I/O engine
+ */
+rsb2_Unixsock_engine rsb2_unixsock_getEngine(void);
+
+/** Bulk payload, a memory-mapped memfd. */
+typedef struct rsb2_Unixsock_bulk {
+	char *data;				/**< Payload address. */
+	size_t len;				/**< Payload length. */
+	int fd;					/**< memfd or -1. */
+	bool writable;			/**< Mapped for writing by the sender. */
+} rsb2_Unixsock_bulk;
+
+/** Allocate a bulk payload to be filled in place and sent.
+ * @param bulk bulk payload
+ * @param len payload length
+ * @retval 0 success
+ * @retval -1 error
+ */
+int rsb2_unixsock_bulkAlloc(rsb2_Unixsock_bulk *bulk, size_t len);
+
+/** Send a bulk payload allocated by rsb2_unixsock_bulkAlloc.
+ * The memfd is sealed against any change, unmapped and passed to the
+ * peer with SCM_RIGHTS, along with a small control message. The payload
+ * is released whatever the result.
+ * Bulk messages need a SOCK_SEQPACKET connection, or a stream connection
+ * carrying nothing else, so the control message is read on its own.
+ * @param sock connected Unix socket
+ * @param bulk bulk payload
+ * @retval 0 success
+ * @retval -1 error
+ */
+int rsb2_unixsock_bulkSend(int sock, rsb2_Unixsock_bulk *bulk);
+
+/** Copy data into a sealed memfd and send it as a bulk payload.
+ * @param sock connected Unix socket
+ * @param data payload address
+ * @param len payload length
+ * @retval 0 success
+ * @retval -1 error
+ */
+int rsb2_unixsock_bulkSendCopy(int sock, const char *data, size_t len);
+
+/** Receive a bulk payload and map it read-only.
+ * The sender cannot change the payload once it is received.
+ * @param sock connected Unix socket
+ * @param bulk received bulk payload, to be released by rsb2_unixsock_bulkFree
+ * @retval 0 success
+ * @retval -1 error
+ */
+int rsb2_unixsock_bulkRecv(int sock, rsb2_Unixsock_bulk *bulk);
+
+/** Release a bulk payload.
+ * @param bulk bulk payload
+ */
+void rsb2_unixsock_bulkFree(rsb2_Unixsock_bulk *bulk);
+
 /** Process a message received by a Unix socket server.
  * @param sock service socket file descriptor
  * @param msg incoming message address
@@ -71,8 +240,61 @@ int rsb2_unixsock_rpc(const char *path, const char *msg, int msglen,
  */
 typedef int rsb2_Unixsock_recv(int sock, const char *msg, int msglen);
 
+/** Zero-copy message processing function.
+ * msg is a pooled buffer (see rsb2_bufpool) of which the server holds one
+ * reference for the call. To keep the message past the call, for example
+ * to queue it to a worker thread, the function retains the buffer with
+ * rsb2_bufpool_retain and releases it later, from any thread, with
+ * rsb2_bufpool_put.
+ * @param sock service socket file descriptor
+ * @param msg incoming message address, a pooled buffer
+ * @param msglen incoming message length
+ * @retval 0 continue
+ * @retval 1 close service socket, continue listening
+ * @retval 2 stop server
+ */
+typedef int rsb2_Unixsock_recvBuf(int sock, char *msg, int msglen);
+
+/** Open the session of a new connection.
+ * Called by the thread serving the connection, before its first message.
+ * The function may reply or close the connection.
+ * @param sock service socket file descriptor
+ * @return session context, see rsb2_unixsock_context
+ */
+typedef void *rsb2_Unixsock_open(int sock);
+
+/** Close the session of a connection.
+ * Called however the connection ends, including at server shutdown,
+ * before its socket is closed.
+ * @param sock service socket file descriptor
+ * @param ctx session context
+ */
+typedef void rsb2_Unixsock_close(int sock, void *ctx);
+
+/** Event-loop server options. */
+typedef struct rsb2_Unixsock_opts {
+	int nthreads;			/**< Number of reactor threads, 0 for none. */
+	const int *cpus;		/**< CPU of each reactor thread (-1 for none) or NULL. */
+	bool framed;			/**< Length-prefixed framing (see rsb2_frame). */
+	int socktype;			/**< SOCK_STREAM (or 0), SOCK_SEQPACKET or SOCK_DGRAM. */
+	bool shmring;			/**< Clients negotiate a shared-memory channel
+							 * (see rsb2_shmring), not with SOCK_DGRAM. */
+	rsb2_Unixsock_recvBuf *fRecvBuf;	/**< Zero-copy message processing
+							 * function or NULL, replaces fRecv. */
+	size_t hiwat;			/**< Reply queue high-water mark (bytes), 0 for
+							 * RSB2_SENDQ_HIWAT (see rsb2_unixsock_reply). */
+	int idle_ms;			/**< Close connections without traffic for this
+							 * time (ms), 0 for none. */
+	rsb2_Unixsock_open *fOpen;		/**< Session open function or NULL. */
+	rsb2_Unixsock_close *fClose;	/**< Session close function or NULL. */
+	void *arg;				/**< Server argument, see rsb2_unixsock_arg. */
+} rsb2_Unixsock_opts;
+
 /** Run a Unix socket server in the current thread.
- * The server processes one client connection at a time.
+ * The server processes one client connection at a time. Data is read
+ * into a pooled buffer (see rsb2_bufpool) that grows up to 1 MiB while
+ * more is pending, so a message sent in one write is usually passed to
+ * fRecv in one call; only framing guarantees it.
  * @param path filesystem path of Unix socket
  * @param fRecv message processing function
  * @param accept_tmo accept timeout (ms)
@@ -83,6 +305,148 @@ typedef int rsb2_Unixsock_recv(int sock, const char *msg, int msglen);
 int rsb2_unixsock_seqserve(const char *path, rsb2_Unixsock_recv fRecv,
 		int accept_tmo, int recv_tmo);
 
+/** Run an event-loop Unix socket server in the current thread.
+ * The server multiplexes all client connections on non-blocking sockets
+ * with edge-triggered epoll. Pending connections are accepted in batches.
+ * fRecv is called for each chunk of data read from a service socket,
+ * read into a pooled buffer grown up to 1 MiB until the socket is drained.
+ * @param path filesystem path of Unix socket
+ * @param fRecv message processing function
+ * @retval 0 normal shutdown
+ * @retval -1 error detected
+ */
+int rsb2_unixsock_epollserve(const char *path, rsb2_Unixsock_recv fRecv);
+
+/** Run a multi-threaded Unix socket server.
+ * The current thread accepts connections and hands them off round-robin
+ * to nthreads reactor threads. Each reactor runs its own event loop and
+ * owns its connections, so fRecv is never called concurrently for the
+ * same service socket. Any fRecv returning 2 stops every thread.
+ * @param path filesystem path of Unix socket
+ * @param fRecv message processing function
+ * @param nthreads number of reactor threads
+ * @param cpus CPU of each reactor thread (-1 for no affinity) or NULL
+ * @retval 0 normal shutdown
+ * @retval -1 error detected
+ */
+int rsb2_unixsock_poolserve(const char *path, rsb2_Unixsock_recv fRecv,
+		int nthreads, const int *cpus);
+
+/** Run an event-loop Unix socket server.
+ * Without reactor threads, this is rsb2_unixsock_epollserve, otherwise
+ * rsb2_unixsock_poolserve. With framing, fRecv is called once for each
+ * complete message, whatever its size and however it was split or merged
+ * by the stream; clients send messages with rsb2_frame_send.
+ * SOCK_SEQPACKET and SOCK_DGRAM preserve message boundaries without
+ * framing; each fRecv call gets one message of up to 64 KiB (SOCK_SEQPACKET)
+ * or 8 KiB (SOCK_DGRAM). A longer message is an error event: it closes a
+ * SOCK_SEQPACKET connection, a datagram is dropped. Both run on the epoll
+ * engine. A SOCK_DGRAM server has no connections:
+ * it runs in the current thread, reads datagrams in batches and ignores
+ * close requests.
+ * With opts->shmring, each client connects with rsb2_shmring_connect and
+ * its messages are read from the shared-memory ring; replies go through
+ * the ring too (see rsb2_unixsock_reply), the socket only detects the end
+ * of the client.
+ * With opts->fOpen and opts->fClose, each connection has a session with
+ * a context of its own, for conversational protocols: see rsb2_coro.h
+ * for coroutine sessions in C++. With opts->shmring, a session must not
+ * reply from fOpen, before the client has negotiated its channel.
+ * With opts->fRecvBuf, fRecv may be NULL: stream and SOCK_SEQPACKET data
+ * read by the epoll engine is passed in its receive buffer, other paths
+ * copy each message once into a pooled buffer.
+ * @param path filesystem path of Unix socket
+ * @param fRecv message processing function, or NULL with opts->fRecvBuf
+ * @param opts server options or NULL for defaults
+ * @retval 0 normal shutdown
+ * @retval -1 error detected
+ */
+int rsb2_unixsock_serve(const char *path, rsb2_Unixsock_recv fRecv,
+		const rsb2_Unixsock_opts *opts);
+
+/** Reply to a client from a message processing function.
+ * On a SOCK_STREAM connection of the calling epoll engine loop, from
+ * fRecv, a session function or a timer of the loop, the reply goes
+ * through the outbound queue of the connection (see rsb2_sendq), framed
+ * if the server is: it never blocks, and the loop writes what the socket
+ * did not take when the socket is writable. Past the high-water mark,
+ * the loop stops reading requests from the connection until half of the
+ * queue is written. A connection closed by fRecv is closed once its
+ * replies are written. From another thread, the reply to a connection
+ * of an epoll engine server is copied and handed to the loop of the
+ * connection, which queues it as above (dropped with an event if the
+ * connection closes first; use rsb2_unixsock_replyTo if it may close
+ * before the reply is sent). On a server with opts->shmring, the reply is
+ * queued on the channel of the connection by rsb2_shmring_reply, and is
+ * an error before the channel is negotiated. Any other socket is written
+ * at once, waiting for it if needed.
+ * @param sock service socket file descriptor, as passed to fRecv
+ * @param msg reply message address
+ * @param msglen reply message length
+ * @retval 0 reply sent, queued or handed to the loop
+ * @retval 1 reply queued, the high-water mark is reached
+ * @retval -1 error
+ */
+int rsb2_unixsock_reply(int sock, const char *msg, int msglen);
+
+/** Get the identifier of a connection of an epoll engine loop.
+ * Once a connection is closed, its socket number goes to the next one:
+ * a thread replying later gets the identifier from fRecv instead, which
+ * names the connection only.
+ * @param sock service socket file descriptor, as passed to fRecv
+ * @return connection identifier
+ * @retval 0 not a connection of the calling loop
+ */
+uint64_t rsb2_unixsock_connId(int sock);
+
+/** Reply to a connection by identifier, from any thread.
+ * Same as rsb2_unixsock_reply, but the reply is dropped with an event
+ * once the connection is closed, whichever connection has its socket
+ * number now.
+ * @param id connection identifier, see rsb2_unixsock_connId
+ * @param msg reply message address
+ * @param msglen reply message length
+ * @retval 0 reply queued or handed to the loop
+ * @retval 1 reply queued, the high-water mark is reached
+ * @retval -1 error, or connection closed
+ */
+int rsb2_unixsock_replyTo(uint64_t id, const char *msg, int msglen);
+
+/** Get the argument of the server calling a processing function.
+ * Lets one set of processing functions serve several servers.
+ * @return opts->arg given to rsb2_unixsock_serve
+ * @retval NULL none, or not called from a server thread
+ */
+void *rsb2_unixsock_arg(void);
+
+/** Get the timer wheel of the calling event loop.
+ * Each thread of an epoll engine server runs the timers of its wheel
+ * (see rsb2_timer) between events: message processing functions arm
+ * request deadlines and periodic tasks on it, and must cancel them
+ * before the memory holding them is released. A timer ends a connection
+ * with rsb2_unixsock_close.
+ * @return timer wheel
+ * @retval NULL not called from an epoll engine server thread
+ */
+rsb2_Timer_wheel *rsb2_unixsock_wheel(void);
+
+/** Get the session context of a connection of the calling event loop.
+ * @param sock service socket file descriptor
+ * @return context returned by opts->fOpen
+ * @retval NULL no session, or not a connection of the calling loop
+ */
+void *rsb2_unixsock_context(int sock);
+
+/** Close a connection of the calling event loop, from a message
+ * processing function or a timer.
+ * No more messages are read from the connection, it is closed by the
+ * loop once its replies are written (see rsb2_unixsock_reply).
+ * @param sock service socket file descriptor
+ * @retval 0 close requested
+ * @retval -1 not a connection of the calling loop, or error
+ */
+int rsb2_unixsock_close(int sock);
+
 #ifdef __cplusplus
 }
 #endif
@@ -0,0 +1,316 @@
+/** Module rsb2_uring - Implementation.
+ * @file rsb2_uring.c
+ * @author jp.tranvouez@navilab.com
+ */
+#include "rsb2_uring.h"
+#include "rsb2_module.h"
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+static int g_module = -1;				/* Module reference. */
+static pthread_once_t g_probeOnce = PTHREAD_ONCE_INIT;	/* Probe init. */
+static bool g_supported = false;		/* Kernel support of io_uring. */
+
+int rsb2_uring_begin(void)
+{
+	RSB2_TRACE_ENTRY();
+	g_module = rsb2_module_ref("rsb2_uring");
+	int err = g_module < 0;
+	RSB2_TRACE_EXIT_INT(err);
+	return err;
+}
+
+void rsb2_uring_end(void)
+{
+	RSB2_TRACE_ENTRY();
+	rsb2_module_destroy(g_module);
+	RSB2_TRACE_EXIT();
+}
+
+static int rsb2_uring_setup(unsigned entries, struct io_uring_params *params)
+{
+	return syscall(__NR_io_uring_setup, entries, params);
+}
+
+static int rsb2_uring_enter(int fd, unsigned tosubmit, unsigned waitnr,
+		unsigned flags)
+{
+	return syscall(__NR_io_uring_enter, fd, tosubmit, waitnr, flags, NULL, 0);
+}
+
+static int rsb2_uring_register(int fd, unsigned opcode, void *arg,
+		unsigned nargs)
+{
+	return syscall(__NR_io_uring_register, fd, opcode, arg, nargs);
+}
+
+static void rsb2_uring_probe(void)
+{
+	RSB2_TRACE_ENTRY();
+	rsb2_Uring ring;
+	enum { NOPS = IORING_OP_SEND_ZC + 1 };
+	struct io_uring_probe *probe = calloc(1, sizeof(*probe) +
+			NOPS * sizeof(struct io_uring_probe_op));
+	if (!probe) {
+		/* notify 'calloc' failure */
+		RSB2_ERRNO("calloc", "nops=%d", NOPS);
+	} else if (rsb2_uring_init(&ring, 4)) {
+		RSB2_NOTIFY("uring_unsupported", "errno=%d", errno);
+	} else {
+		/* SEND_ZC came with multishot recv (5.19 and 6.0 features) */
+		static const int ops[] = { IORING_OP_ACCEPT, IORING_OP_RECV,
+				IORING_OP_SEND, IORING_OP_POLL_ADD, IORING_OP_ASYNC_CANCEL,
+				IORING_OP_SEND_ZC };
+		rsb2_Uring_bufs bufs;
+		if (rsb2_uring_register(ring.fd, IORING_REGISTER_PROBE, probe, NOPS)) {
+			RSB2_NOTIFY("uring_unsupported", "register=PROBE,errno=%d", errno);
+		} else if (rsb2_uring_bufsInit(&ring, &bufs, 0, 2, 64)) {
+			RSB2_NOTIFY("uring_unsupported", "register=PBUF_RING");
+		} else {
+			rsb2_uring_bufsFree(&ring, &bufs);
+			g_supported = true;
+			for (unsigned i = 0; i < sizeof(ops) / sizeof(ops[0]); i++) {
+				if (ops[i] >= probe->ops_len ||
+						!(probe->ops[ops[i]].flags & IO_URING_OP_SUPPORTED)) {
+					RSB2_NOTIFY("uring_unsupported", "op=%d", ops[i]);
+					g_supported = false;
+				}
+			}
+		}
+		rsb2_uring_free(&ring);
+	}
+	free(probe);
+	RSB2_TRACE_EXIT();
+}
+
+bool rsb2_uring_supported(void)
+{
+	pthread_once(&g_probeOnce, rsb2_uring_probe);
+	return g_supported;
+}
+
+int rsb2_uring_init(rsb2_Uring *ring, unsigned entries)
+{
+	RSB2_TRACE_ARGS("ring=%p,entries=%u", ring, entries);
+	RSB2_ASSERT_NOTNULL(ring);
+	int err = -1;
+	struct io_uring_params params;
+	memset(ring, 0, sizeof(*ring));
+	memset(&params, 0, sizeof(params));
+	ring->sqMap = ring->cqMap = MAP_FAILED;
+	ring->sqes = MAP_FAILED;
+	ring->fd = rsb2_uring_setup(entries, &params);
+	if (ring->fd < 0) {
+		/* notify 'io_uring_setup' failure */
+		RSB2_ERRNO("io_uring_setup", "entries=%u", entries);
+	} else {
+		ring->sqMapsz = params.sq_off.array + params.sq_entries *
+				sizeof(unsigned);
+		ring->cqMapsz = params.cq_off.cqes + params.cq_entries *
+				sizeof(struct io_uring_cqe);
+		if (params.features & IORING_FEAT_SINGLE_MMAP) {
+			/* one mapping for both rings */
+			if (ring->cqMapsz > ring->sqMapsz) {
+				ring->sqMapsz = ring->cqMapsz;
+			}
+			ring->cqMapsz = 0;
+		}
+		ring->sqesMapsz = params.sq_entries * sizeof(struct io_uring_sqe);
+		ring->sqMap = mmap(NULL, ring->sqMapsz, PROT_READ | PROT_WRITE,
+				MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQ_RING);
+		if (ring->sqMap != MAP_FAILED) {
+			ring->cqMap = ring->cqMapsz? mmap(NULL, ring->cqMapsz,
+					PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+					ring->fd, IORING_OFF_CQ_RING): ring->sqMap;
+		}
+		if (ring->cqMap != MAP_FAILED) {
+			ring->sqes = mmap(NULL, ring->sqesMapsz, PROT_READ | PROT_WRITE,
+					MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQES);
+		}
+		if (ring->sqes == MAP_FAILED) {
+			/* notify 'mmap' failure */
+			RSB2_ERRNO("mmap", "fd=%d", ring->fd);
+			rsb2_uring_free(ring);
+		} else {
+			char *sq = ring->sqMap;
+			char *cq = ring->cqMap;
+			ring->sqHead = (unsigned *)(sq + params.sq_off.head);
+			ring->sqTail = (unsigned *)(sq + params.sq_off.tail);
+			ring->sqMask = *(unsigned *)(sq + params.sq_off.ring_mask);
+			ring->sqArray = (unsigned *)(sq + params.sq_off.array);
+			ring->sqPending = *ring->sqTail;
+			ring->cqHead = (unsigned *)(cq + params.cq_off.head);
+			ring->cqTail = (unsigned *)(cq + params.cq_off.tail);
+			ring->cqMask = *(unsigned *)(cq + params.cq_off.ring_mask);
+			ring->cqes = (struct io_uring_cqe *)(cq + params.cq_off.cqes);
+			err = 0;
+		}
+	}
+	RSB2_TRACE_EXIT_INT(err);
+	return err;
+}
+
+void rsb2_uring_free(rsb2_Uring *ring)
+{
+	RSB2_TRACE_ARGS("ring=%p", ring);
+	RSB2_ASSERT_NOTNULL(ring);
+	if (ring->sqes != MAP_FAILED && ring->sqes) {
+		munmap(ring->sqes, ring->sqesMapsz);
+	}
+	if (ring->cqMap != MAP_FAILED && ring->cqMap && ring->cqMapsz) {
+		munmap(ring->cqMap, ring->cqMapsz);
+	}
+	if (ring->sqMap != MAP_FAILED && ring->sqMap) {
+		munmap(ring->sqMap, ring->sqMapsz);
+	}
+	if (ring->fd >= 0) {
+		/* closing the ring cancels the requests in flight */
+		close(ring->fd);
+	}
+	memset(ring, 0, sizeof(*ring));
+	ring->fd = -1;
+	RSB2_TRACE_EXIT();
+}
+
+struct io_uring_sqe *rsb2_uring_sqe(rsb2_Uring *ring)
+{
+	unsigned head = __atomic_load_n(ring->sqHead, __ATOMIC_ACQUIRE);
+	if (ring->sqPending - head > ring->sqMask && rsb2_uring_submit(ring, 0) < 0) {
+		RSB2_ERRTRACE();
+		return NULL;
+	}
+	head = __atomic_load_n(ring->sqHead, __ATOMIC_ACQUIRE);
+	if (ring->sqPending - head > ring->sqMask) {
+		/* notify submission queue full */
+		RSB2_ERROR("uring_full", "fd=%d", ring->fd);
+		return NULL;
+	}
+	unsigned index = ring->sqPending & ring->sqMask;
+	struct io_uring_sqe *sqe = &ring->sqes[index];
+	memset(sqe, 0, sizeof(*sqe));
+	ring->sqArray[index] = index;
+	ring->sqPending++;
+	return sqe;
+}
+
+int rsb2_uring_submit(rsb2_Uring *ring, unsigned waitnr)
+{
+	RSB2_TRACE_ARGS("ring=%p,waitnr=%u", ring, waitnr);
+	/* the entries must be visible before the tail */
+	__atomic_store_n(ring->sqTail, ring->sqPending, __ATOMIC_RELEASE);
+	unsigned tosubmit = ring->sqPending -
+			__atomic_load_n(ring->sqHead, __ATOMIC_ACQUIRE);
+	int count = -1;
+	do {
+		count = rsb2_uring_enter(ring->fd, tosubmit, waitnr,
+				waitnr? IORING_ENTER_GETEVENTS: 0);
+	} while (count < 0 && errno == EINTR);
+	if (count < 0 && errno != EBUSY && errno != EAGAIN) {
+		/* notify 'io_uring_enter' failure */
+		RSB2_ERRNO("io_uring_enter", "fd=%d,tosubmit=%u", ring->fd, tosubmit);
+	} else if (count < 0) {
+		/* completion queue full, reap before submitting again */
+		count = 0;
+	}
+	RSB2_TRACE_EXIT_INT(count);
+	return count;
+}
+
+struct io_uring_cqe *rsb2_uring_peek(rsb2_Uring *ring)
+{
+	unsigned head = *ring->cqHead;
+	if (head == __atomic_load_n(ring->cqTail, __ATOMIC_ACQUIRE)) {
+		return NULL;
+	}
+	return &ring->cqes[head & ring->cqMask];
+}
+
+void rsb2_uring_seen(rsb2_Uring *ring)
+{
+	__atomic_store_n(ring->cqHead, *ring->cqHead + 1, __ATOMIC_RELEASE);
+}
+
+int rsb2_uring_bufsInit(rsb2_Uring *ring, rsb2_Uring_bufs *bufs,
+		unsigned short bgid, unsigned count, unsigned size)
+{
+	RSB2_TRACE_ARGS("ring=%p,bufs=%p,bgid=%u,count=%u,size=%u",
+			ring, bufs, bgid, count, size);
+	RSB2_ASSERT_NOTNULL(bufs);
+	RSB2_ASSERT(count && !(count & (count - 1)));
+	int err = -1;
+	memset(bufs, 0, sizeof(*bufs));
+	bufs->count = count;
+	bufs->size = size;
+	bufs->bgid = bgid;
+	/* buffer ring first, page aligned, then the buffers */
+	size_t brsz = (count * sizeof(struct io_uring_buf) + 4095) & ~(size_t)4095;
+	void *map = mmap(NULL, brsz + (size_t)count * size, PROT_READ | PROT_WRITE,
+			MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (map == MAP_FAILED) {
+		/* notify 'mmap' failure */
+		RSB2_ERRNO("mmap", "count=%u,size=%u", count, size);
+	} else {
+		struct io_uring_buf_reg reg;
+		memset(&reg, 0, sizeof(reg));
+		reg.ring_addr = (unsigned long)map;
+		reg.ring_entries = count;
+		reg.bgid = bgid;
+		if (rsb2_uring_register(ring->fd, IORING_REGISTER_PBUF_RING, &reg, 1)) {
+			/* notify 'io_uring_register' failure */
+			RSB2_ERRNO("io_uring_register", "fd=%d,bgid=%u", ring->fd, bgid);
+			munmap(map, brsz + (size_t)count * size);
+		} else {
+			bufs->br = map;
+			bufs->base = (char *)map + brsz;
+			for (unsigned bid = 0; bid < count; bid++) {
+				rsb2_uring_bufsPut(bufs, bid);
+			}
+			err = 0;
+		}
+	}
+	RSB2_TRACE_EXIT_INT(err);
+	return err;
+}
+
+void rsb2_uring_bufsFree(rsb2_Uring *ring, rsb2_Uring_bufs *bufs)
+{
+	RSB2_TRACE_ARGS("ring=%p,bufs=%p", ring, bufs);
+	RSB2_ASSERT_NOTNULL(bufs);
+	if (bufs->br) {
+		struct io_uring_buf_reg reg;
+		memset(&reg, 0, sizeof(reg));
+		reg.bgid = bufs->bgid;
+		if (ring->fd >= 0) {
+			rsb2_uring_register(ring->fd, IORING_UNREGISTER_PBUF_RING, &reg, 1);
+		}
+		size_t brsz = (bufs->count * sizeof(struct io_uring_buf) + 4095) &
+				~(size_t)4095;
+		munmap(bufs->br, brsz + (size_t)bufs->count * bufs->size);
+	}
+	memset(bufs, 0, sizeof(*bufs));
+	RSB2_TRACE_EXIT();
+}
+
+char *rsb2_uring_bufsGet(rsb2_Uring_bufs *bufs, unsigned bid)
+{
+	return bufs->base + (size_t)bid * bufs->size;
+}
+
+void rsb2_uring_bufsPut(rsb2_Uring_bufs *bufs, unsigned bid)
+{
+	struct io_uring_buf *buf = &bufs->br->bufs[bufs->tail & (bufs->count - 1)];
+	buf->addr = (unsigned long)rsb2_uring_bufsGet(bufs, bid);
+	buf->len = bufs->size;
+	buf->bid = bid;
+	bufs->tail++;
+	/* the entry must be visible before the tail */
+	__atomic_store_n(&bufs->br->tail, bufs->tail, __ATOMIC_RELEASE);
+}
+
+/*END*/
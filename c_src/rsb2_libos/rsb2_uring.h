@@ -0,0 +1,135 @@
+/** Module rsb2_uring - Interface.
+ * @file rsb2_uring.h
+ * @author jp.tranvouez@navilab.com
+ * @defgroup rsb2_uring io_uring Instance Wrapper
+ * @ingroup rsb2_libos
+ * @{
+ * Minimal io_uring support on top of the raw system calls: ring setup,
+ * submission and completion queues, and provided buffer rings. Used by
+ * the io_uring engine of rsb2_unixsock.
+ */
+#ifndef RSB2_URING_H
+#define RSB2_URING_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <linux/io_uring.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** io_uring instance. */
+typedef struct rsb2_Uring {
+	int fd;							/**< Ring file descriptor or -1. */
+	unsigned *sqHead;				/**< Submission queue head (kernel). */
+	unsigned *sqTail;				/**< Submission queue tail (shared). */
+	unsigned sqMask;				/**< Submission queue index mask. */
+	unsigned *sqArray;				/**< Submission queue index array. */
+	unsigned sqPending;				/**< Local tail, not yet published. */
+	struct io_uring_sqe *sqes;		/**< Submission queue entries. */
+	unsigned *cqHead;				/**< Completion queue head (shared). */
+	unsigned *cqTail;				/**< Completion queue tail (kernel). */
+	unsigned cqMask;				/**< Completion queue index mask. */
+	struct io_uring_cqe *cqes;		/**< Completion queue entries. */
+	void *sqMap;					/**< Submission ring mapping. */
+	size_t sqMapsz;					/**< Submission ring mapping size. */
+	void *cqMap;					/**< Completion ring mapping. */
+	size_t cqMapsz;					/**< Completion ring mapping size. */
+	size_t sqesMapsz;				/**< Entries mapping size. */
+} rsb2_Uring;
+
+/** Provided buffer ring of an io_uring instance. */
+typedef struct rsb2_Uring_bufs {
+	struct io_uring_buf_ring *br;	/**< Shared buffer ring or NULL. */
+	char *base;						/**< Buffer memory. */
+	unsigned count;					/**< Number of buffers, a power of two. */
+	unsigned size;					/**< Size of each buffer. */
+	unsigned short bgid;			/**< Buffer group ID. */
+	unsigned short tail;			/**< Local tail of the buffer ring. */
+} rsb2_Uring_bufs;
+
+/** Check whether the kernel supports the io_uring features used.
+ * Needs multishot accept and recv and provided buffer rings; the
+ * result of the first probe is cached.
+ * @return true if supported
+ */
+bool rsb2_uring_supported(void);
+
+/** Create an io_uring instance.
+ * @param ring instance
+ * @param entries submission queue size
+ * @retval 0 success
+ * @retval -1 error
+ */
+int rsb2_uring_init(rsb2_Uring *ring, unsigned entries);
+
+/** Destroy an io_uring instance, cancelling its requests.
+ * @param ring instance
+ */
+void rsb2_uring_free(rsb2_Uring *ring);
+
+/** Get a cleared submission queue entry.
+ * Submits pending entries first if the queue is full.
+ * @param ring instance
+ * @return submission queue entry
+ * @retval NULL error
+ */
+struct io_uring_sqe *rsb2_uring_sqe(rsb2_Uring *ring);
+
+/** Submit pending entries and wait for completions, in one system call.
+ * @param ring instance
+ * @param waitnr number of completions to wait for, 0 for none
+ * @return number of entries submitted
+ * @retval -1 error
+ */
+int rsb2_uring_submit(rsb2_Uring *ring, unsigned waitnr);
+
+/** Get the next completion queue entry.
+ * @param ring instance
+ * @return completion queue entry, valid until rsb2_uring_seen()
+ * @retval NULL queue empty
+ */
+struct io_uring_cqe *rsb2_uring_peek(rsb2_Uring *ring);
+
+/** Release the completion queue entry returned by rsb2_uring_peek().
+ * @param ring instance
+ */
+void rsb2_uring_seen(rsb2_Uring *ring);
+
+/** Allocate buffers and register them as a provided buffer ring.
+ * @param ring instance
+ * @param bufs buffer ring
+ * @param bgid buffer group ID
+ * @param count number of buffers, a power of two
+ * @param size size of each buffer
+ * @retval 0 success
+ * @retval -1 error
+ */
+int rsb2_uring_bufsInit(rsb2_Uring *ring, rsb2_Uring_bufs *bufs,
+		unsigned short bgid, unsigned count, unsigned size);
+
+/** Unregister and release a provided buffer ring.
+ * @param ring instance
+ * @param bufs buffer ring
+ */
+void rsb2_uring_bufsFree(rsb2_Uring *ring, rsb2_Uring_bufs *bufs);
+
+/** Get the address of a provided buffer.
+ * @param bufs buffer ring
+ * @param bid buffer ID, from the flags of a completion
+ * @return buffer address
+ */
+char *rsb2_uring_bufsGet(rsb2_Uring_bufs *bufs, unsigned bid);
+
+/** Give a buffer back to the kernel.
+ * @param bufs buffer ring
+ * @param bid buffer ID
+ */
+void rsb2_uring_bufsPut(rsb2_Uring_bufs *bufs, unsigned bid);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /*@} RSB2_URING_H */
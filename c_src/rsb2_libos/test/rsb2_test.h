@@ -0,0 +1,108 @@
+/** Unit tests - Interface.
+ * @file test/rsb2_test.h
+ * @author jp.tranvouez@navilab.com
+ * @defgroup rsb2_test Unit Tests
+ * @ingroup rsb2_libos
+ * @{
+ * Unit tests of the library, built by "make test" into one program that
+ * runs every test case and exits with a non-zero status if a check fails.
+ * A test case is a function of one module; it reports each failed check
+ * with RSB2_TEST_CHECK and returns. Socket test cases run their servers in
+ * threads of the program, on paths under /tmp. C++ tests (test/*.cpp)
+ * are built into programs of their own.
+ */
+#ifndef RSB2_TEST_H
+#define RSB2_TEST_H
+
+#include "rsb2_unixsock.h"
+
+#include <pthread.h>
+#include <stdbool.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** Check a condition, report it if false.
+ * @param cond condition
+ * @return cond
+ */
+#define RSB2_TEST_CHECK(cond) \
+	rsb2_test_check((cond), #cond, __FILE__, __LINE__)
+
+/** Test case. */
+typedef void rsb2_Test_case(void);
+
+/** In-process server. */
+typedef struct rsb2_Test_server {
+	rsb2_Unixsock_recv *fRecv;	/**< Message processing function. */
+	rsb2_Unixsock_opts opts;	/**< Server options. */
+	char path[108];				/**< Unix socket path. */
+	pthread_t thread;			/**< Server thread. */
+	int err;					/**< Result of rsb2_unixsock_serve. */
+} rsb2_Test_server;
+
+/** Silence tracing and event notification, the error paths under test
+ * notify events.
+ */
+void rsb2_test_quiet(void);
+
+/** Report a check, see RSB2_TEST_CHECK.
+ * @param cond condition
+ * @param expr condition text
+ * @param file source file name
+ * @param line source line number
+ * @return cond
+ */
+bool rsb2_test_check(bool cond, const char *expr, const char *file, int line);
+
+/** Get a socket path of the program.
+ * @param path path buffer, 108 bytes
+ * @param name test name, part of the path
+ */
+void rsb2_test_path(char *path, const char *name);
+
+/** Start a server thread and wait until it accepts connections.
+ * @param server server, fRecv and opts set
+ * @param name test name, part of the socket path
+ * @retval 0 success
+ * @retval -1 error
+ */
+int rsb2_test_start(rsb2_Test_server *server, const char *name);
+
+/** Stop a server thread with a "stop" message and join it.
+ * The message is framed for a framed server, and sent through a channel
+ * to a shared-memory server.
+ * @param server server
+ */
+void rsb2_test_stop(rsb2_Test_server *server);
+
+/** Message processing function: echo, stop on "stop".
+ * @see rsb2_Unixsock_recv
+ */
+int rsb2_test_echo(int sock, const char *msg, int msglen);
+
+/** Test cases, one per file. */
+rsb2_Test_case rsb2_test_frame;
+rsb2_Test_case rsb2_test_pool;
+rsb2_Test_case rsb2_test_rpcmux;
+rsb2_Test_case rsb2_test_rpcasync;
+rsb2_Test_case rsb2_test_bulk;
+rsb2_Test_case rsb2_test_shmring;
+rsb2_Test_case rsb2_test_uring;
+rsb2_Test_case rsb2_test_tracering;
+rsb2_Test_case rsb2_test_tracemask;
+rsb2_Test_case rsb2_test_module;
+rsb2_Test_case rsb2_test_eventmgr;
+rsb2_Test_case rsb2_test_metrics;
+rsb2_Test_case rsb2_test_histo;
+rsb2_Test_case rsb2_test_bufpool;
+rsb2_Test_case rsb2_test_recvbuf;
+rsb2_Test_case rsb2_test_sendq;
+rsb2_Test_case rsb2_test_timer;
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /*@} RSB2_TEST_H */
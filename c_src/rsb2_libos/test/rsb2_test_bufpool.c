@@ -0,0 +1,126 @@
+/** Unit tests - Receive buffer pool.
+ * @file test/rsb2_test_bufpool.c
+ * @author jp.tranvouez@navilab.com
+ */
+#include "rsb2_test.h"
+#include "rsb2_bufpool.h"
+#include "rsb2_frame.h"
+#include "rsb2_socket.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+enum {
+	RSB2_TEST_BIGLEN	= 300000,		/* Message longer than 64 KiB. */
+	RSB2_TEST_HELD		= 5,			/* 1 MiB buffers released by a thread,
+										 * more than it keeps. */
+};
+
+/* release 1 MiB buffers, the ones past the thread lists are shared */
+static void *rsb2_test_bufpoolThread(void *arg)
+{
+	(void)arg;
+	char *bufs[RSB2_TEST_HELD];
+	for (int i = 0; i < RSB2_TEST_HELD; i++) {
+		bufs[i] = rsb2_bufpool_get(RSB2_BUFPOOL_MAXSZ, NULL);
+	}
+	for (int i = 0; i < RSB2_TEST_HELD; i++) {
+		rsb2_bufpool_put(bufs[i]);
+	}
+	return NULL;
+}
+
+/* size classes, reuse by the thread and by other threads */
+static void rsb2_test_bufpoolClasses(void)
+{
+	rsb2_Bufpool_stats before;
+	rsb2_Bufpool_stats after;
+	rsb2_bufpool_trim();
+	size_t cap = 0;
+	char *buf = rsb2_bufpool_get(100, &cap);
+	RSB2_TEST_CHECK(buf && cap == RSB2_BUFPOOL_MINSZ);
+	RSB2_TEST_CHECK(rsb2_bufpool_capacity(buf) == cap);
+	rsb2_bufpool_put(buf);
+	rsb2_bufpool_stats(&before);
+	RSB2_TEST_CHECK(rsb2_bufpool_get(RSB2_BUFPOOL_MINSZ, &cap) == buf);
+	rsb2_bufpool_stats(&after);
+	RSB2_TEST_CHECK(after.hits[0] == before.hits[0] + 1);
+	/* a retained buffer is not reused */
+	rsb2_bufpool_retain(buf);
+	rsb2_bufpool_put(buf);
+	char *other = rsb2_bufpool_get(100, NULL);
+	RSB2_TEST_CHECK(other && other != buf);
+	rsb2_bufpool_put(other);
+	rsb2_bufpool_put(buf);
+	/* grown across classes, the data kept */
+	buf = rsb2_bufpool_get(100, NULL);
+	memset(buf, 'g', 100);
+	buf = rsb2_bufpool_grow(buf, 100, 5000, &cap);
+	RSB2_TEST_CHECK(buf && cap == 64 * 1024 && buf[0] == 'g' && buf[99] == 'g');
+	RSB2_TEST_CHECK(rsb2_bufpool_grow(buf, 100, 6000, &cap) == buf);
+	buf = rsb2_bufpool_grow(buf, 100, RSB2_BUFPOOL_MAXSZ, &cap);
+	RSB2_TEST_CHECK(buf && cap == RSB2_BUFPOOL_MAXSZ && buf[99] == 'g');
+	rsb2_bufpool_put(buf);
+	/* above the classes: allocated each time */
+	rsb2_bufpool_stats(&before);
+	buf = rsb2_bufpool_get(RSB2_BUFPOOL_MAXSZ + 1, &cap);
+	RSB2_TEST_CHECK(buf && cap == RSB2_BUFPOOL_MAXSZ + 1);
+	rsb2_bufpool_put(buf);
+	rsb2_bufpool_stats(&after);
+	RSB2_TEST_CHECK(after.oversize == before.oversize + 1);
+	/* released by an exited thread, reused by this one */
+	rsb2_bufpool_trim();
+	pthread_t thread;
+	if (RSB2_TEST_CHECK(!pthread_create(&thread, NULL,
+			rsb2_test_bufpoolThread, NULL))) {
+		pthread_join(thread, NULL);
+		rsb2_bufpool_stats(&before);
+		buf = rsb2_bufpool_get(RSB2_BUFPOOL_MAXSZ, NULL);
+		rsb2_bufpool_stats(&after);
+		RSB2_TEST_CHECK(after.shared[2] == before.shared[2] + 1);
+		rsb2_bufpool_put(buf);
+	}
+	rsb2_bufpool_trim();
+}
+
+/* a message longer than 64 KiB is received whole */
+static void rsb2_test_bufpoolBig(void)
+{
+	rsb2_Test_server server = {
+		.fRecv = rsb2_test_echo,
+		.opts = { .framed = true },
+	};
+	char *msg = malloc(RSB2_TEST_BIGLEN);
+	char *reply = malloc(RSB2_TEST_BIGLEN);
+	if (RSB2_TEST_CHECK(msg && reply) &&
+			RSB2_TEST_CHECK(!rsb2_test_start(&server, "bufpool"))) {
+		int sock = rsb2_unixsock_connect(server.path);
+		if (RSB2_TEST_CHECK(sock >= 0)) {
+			rsb2_Frame_ring ring;
+			rsb2_frame_init(&ring);
+			for (int i = 0; i < 3; i++) {
+				for (int j = 0; j < RSB2_TEST_BIGLEN; j++) {
+					msg[j] = (char)(i + j * 7);
+				}
+				RSB2_TEST_CHECK(!rsb2_frame_send(sock, msg, RSB2_TEST_BIGLEN));
+				RSB2_TEST_CHECK(rsb2_frame_recvmsg(sock, &ring, reply,
+						RSB2_TEST_BIGLEN) == RSB2_TEST_BIGLEN &&
+						!memcmp(reply, msg, RSB2_TEST_BIGLEN));
+			}
+			rsb2_frame_free(&ring);
+			rsb2_socket_close(sock);
+		}
+		rsb2_test_stop(&server);
+		RSB2_TEST_CHECK(!server.err);
+	}
+	free(msg);
+	free(reply);
+}
+
+void rsb2_test_bufpool(void)
+{
+	rsb2_test_bufpoolClasses();
+	rsb2_test_bufpoolBig();
+}
+
+/*END*/
@@ -0,0 +1,110 @@
+/** Unit tests - Bulk transfer.
+ * @file test/rsb2_test_bulk.c
+ * @author jp.tranvouez@navilab.com
+ */
+#include "rsb2_test.h"
+#include "rsb2_socket.h"
+
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+enum {
+	RSB2_TEST_BULKLEN	= 1 << 20,		/* Length of the payload sent. */
+};
+
+/* Control message of a bulk payload, as rsb2_unixsock_bulkSend sends it. */
+typedef struct rsb2_Test_bulkMsg {
+	char magic[4];						/* "RSBB". */
+	uint32_t reserved;					/* Zero. */
+	uint64_t len;						/* Payload length. */
+} rsb2_Test_bulkMsg;
+
+/* receive a file as a bulk payload: 0 accepted, -1 rejected */
+static int rsb2_test_bulkFile(int fd, uint64_t len)
+{
+	int err = -1;
+	int sv[2];
+	if (RSB2_TEST_CHECK(!socketpair(AF_UNIX, SOCK_SEQPACKET, 0, sv))) {
+		rsb2_Test_bulkMsg msg = { { 'R', 'S', 'B', 'B' }, 0, len };
+		RSB2_TEST_CHECK(rsb2_socket_sendfd(sv[0], fd, (const char *)&msg,
+				sizeof(msg)) == sizeof(msg));
+		rsb2_Unixsock_bulk bulk;
+		err = rsb2_unixsock_bulkRecv(sv[1], &bulk);
+		if (!err) {
+			RSB2_TEST_CHECK(bulk.len == len && !memcmp(bulk.data, "hello", 5));
+			rsb2_unixsock_bulkFree(&bulk);
+		}
+		close(sv[0]);
+		close(sv[1]);
+	}
+	return err;
+}
+
+/* payloads filled in place and copied arrive whole, read-only */
+static void rsb2_test_bulkSend(void)
+{
+	int sv[2];
+	if (RSB2_TEST_CHECK(!socketpair(AF_UNIX, SOCK_SEQPACKET, 0, sv))) {
+		rsb2_Unixsock_bulk bulk;
+		if (RSB2_TEST_CHECK(!rsb2_unixsock_bulkAlloc(&bulk,
+				RSB2_TEST_BULKLEN))) {
+			for (size_t i = 0; i < bulk.len; i++) {
+				bulk.data[i] = (char)(i * 7);
+			}
+			RSB2_TEST_CHECK(!rsb2_unixsock_bulkSend(sv[0], &bulk));
+		}
+		RSB2_TEST_CHECK(!rsb2_unixsock_bulkSendCopy(sv[0], "hello", 5));
+		rsb2_Unixsock_bulk got;
+		if (RSB2_TEST_CHECK(!rsb2_unixsock_bulkRecv(sv[1], &got))) {
+			bool same = got.len == RSB2_TEST_BULKLEN;
+			for (size_t i = 0; same && i < got.len; i++) {
+				same = got.data[i] == (char)(i * 7);
+			}
+			RSB2_TEST_CHECK(same);
+			RSB2_TEST_CHECK(!got.writable);
+			/* sealed: the receiver sees what was sent, for good */
+			RSB2_TEST_CHECK(got.fd < 0 || write(got.fd, "x", 1) == -1);
+			rsb2_unixsock_bulkFree(&got);
+		}
+		if (RSB2_TEST_CHECK(!rsb2_unixsock_bulkRecv(sv[1], &got))) {
+			RSB2_TEST_CHECK(got.len == 5 && !memcmp(got.data, "hello", 5));
+			rsb2_unixsock_bulkFree(&got);
+		}
+		close(sv[0]);
+		close(sv[1]);
+	}
+}
+
+void rsb2_test_bulk(void)
+{
+	rsb2_test_bulkSend();
+	/* payloads sealed against writes and resizing, or rejected */
+	FILE *file = tmpfile();
+	if (RSB2_TEST_CHECK(file != NULL)) {
+		fwrite("hello", 1, 5, file);
+		fflush(file);
+		RSB2_TEST_CHECK(rsb2_test_bulkFile(fileno(file), 5) == -1);
+		fclose(file);
+	}
+	int memfd = memfd_create("rsb2_test", MFD_ALLOW_SEALING);
+	if (RSB2_TEST_CHECK(memfd >= 0)) {
+		RSB2_TEST_CHECK(write(memfd, "hello", 5) == 5);
+		RSB2_TEST_CHECK(rsb2_test_bulkFile(memfd, 5) == -1);
+		/* shrinking sealed only: the mapping could still grow away */
+		RSB2_TEST_CHECK(!fcntl(memfd, F_ADD_SEALS, F_SEAL_SHRINK));
+		RSB2_TEST_CHECK(rsb2_test_bulkFile(memfd, 5) == -1);
+		/* a payload longer than the file */
+		RSB2_TEST_CHECK(!fcntl(memfd, F_ADD_SEALS,
+				F_SEAL_SEAL | F_SEAL_GROW | F_SEAL_WRITE));
+		RSB2_TEST_CHECK(rsb2_test_bulkFile(memfd, 4096) == -1);
+		RSB2_TEST_CHECK(rsb2_test_bulkFile(memfd, 5) == 0);
+		close(memfd);
+	}
+}
+
+/*END*/
@@ -0,0 +1,201 @@
+/** Unit tests - Coroutine sessions.
+ * @file test/rsb2_test_coro.cpp
+ * @author jp.tranvouez@navilab.com
+ * A program of its own, as rsb2_coro.h requires C++20.
+ */
+#include "rsb2_coro.h"
+#include "rsb2_frame.h"
+#include "rsb2_module.h"
+#include "rsb2_socket.h"
+
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <stdexcept>
+#include <string>
+
+enum {
+	RSB2_TEST_WAITMS	= 50,			/* Receive timeout of "wait". */
+	RSB2_TEST_SLEEPMS	= 300,			/* Delay of "sleep". */
+};
+
+/** Check a condition, report it if false. */
+#define RSB2_TEST_CHECK(cond) \
+	rsb2_test_check((cond), #cond, __FILE__, __LINE__)
+
+static int g_failures = 0;				/* Failed checks. */
+static char g_path[108];				/* Server socket path. */
+static int g_err = -1;					/* Result of the server. */
+
+static bool rsb2_test_check(bool cond, const char *expr, const char *file,
+		int line)
+{
+	if (!cond) {
+		__atomic_add_fetch(&g_failures, 1, __ATOMIC_RELAXED);
+		fprintf(stderr, "%s:%d: check failed: %s\n", file, line, expr);
+	}
+	return cond;
+}
+
+static void rsb2_test_nullTracer(const char *, const char *, int, int,
+		rsb2_TraceGroup, const char *)
+{
+}
+
+static void rsb2_test_nullHandler(const char *, const char *, int,
+		const char *, const char *)
+{
+}
+
+static uint64_t rsb2_test_ms(void)
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return now.tv_sec * 1000ull + now.tv_nsec / 1000000;
+}
+
+/* echo, with a conversation for some requests */
+static rsb2::Task rsb2_test_coroHandler(rsb2::Session &s)
+{
+	for (;;) {
+		auto msg = co_await s.recv();
+		if (!msg || *msg == "bye") {
+			co_return;
+		} else if (*msg == "stop") {
+			s.stopServer();
+			co_return;
+		} else if (*msg == "throw") {
+			throw std::runtime_error("rsb2_test_coro");
+		} else if (*msg == "wait") {
+			/* nothing comes: the next recv times out; no std::string
+			 * temporary in a co_await operand, GCC 12 destroys it twice */
+			auto next = co_await s.recv(RSB2_TEST_WAITMS);
+			co_await s.send(next? std::string_view(*next): "timeout");
+		} else if (*msg == "sleep") {
+			/* requests received meanwhile wait for the next recv */
+			co_await s.sleep(RSB2_TEST_SLEEPMS);
+			co_await s.send("slept");
+		} else {
+			co_await s.send(*msg);
+		}
+	}
+}
+
+static void *rsb2_test_coroServer(void *)
+{
+	rsb2_Unixsock_opts opts = {};
+	opts.framed = true;
+	g_err = rsb2::serve<rsb2_test_coroHandler>(g_path, opts);
+	return NULL;
+}
+
+/* A client connection. */
+struct rsb2_Test_client {
+	int sock;							/* Client socket. */
+	rsb2_Frame_ring ring;				/* Reassembly ring. */
+};
+
+static bool rsb2_test_coroOpen(rsb2_Test_client *client)
+{
+	rsb2_frame_init(&client->ring);
+	client->sock = rsb2_unixsock_connect(g_path);
+	return client->sock >= 0;
+}
+
+static void rsb2_test_coroClose(rsb2_Test_client *client)
+{
+	rsb2_socket_close(client->sock);
+	rsb2_frame_free(&client->ring);
+}
+
+static bool rsb2_test_coroSend(rsb2_Test_client *client, const char *msg)
+{
+	return !rsb2_frame_send(client->sock, msg, strlen(msg));
+}
+
+/* receive a reply, empty if the connection is closed */
+static std::string rsb2_test_coroRecv(rsb2_Test_client *client)
+{
+	char buf[64];
+	int n = rsb2_frame_recvmsg(client->sock, &client->ring, buf, sizeof(buf));
+	return n >= 0? std::string(buf, n): std::string();
+}
+
+static void rsb2_test_coroSessions(void)
+{
+	rsb2_Test_client a;
+	rsb2_Test_client b;
+	if (RSB2_TEST_CHECK(rsb2_test_coroOpen(&a)) &&
+			RSB2_TEST_CHECK(rsb2_test_coroOpen(&b))) {
+		RSB2_TEST_CHECK(rsb2_test_coroSend(&a, "abc"));
+		RSB2_TEST_CHECK(rsb2_test_coroRecv(&a) == "abc");
+		/* receive timeout */
+		uint64_t start = rsb2_test_ms();
+		RSB2_TEST_CHECK(rsb2_test_coroSend(&a, "wait"));
+		RSB2_TEST_CHECK(rsb2_test_coroRecv(&a) == "timeout");
+		RSB2_TEST_CHECK(rsb2_test_ms() - start >= RSB2_TEST_WAITMS - 1);
+		/* a sleeping session keeps its requests, the others are served */
+		start = rsb2_test_ms();
+		RSB2_TEST_CHECK(rsb2_test_coroSend(&a, "sleep"));
+		RSB2_TEST_CHECK(rsb2_test_coroSend(&a, "def"));
+		RSB2_TEST_CHECK(rsb2_test_coroSend(&b, "ghi"));
+		RSB2_TEST_CHECK(rsb2_test_coroRecv(&b) == "ghi");
+		RSB2_TEST_CHECK(rsb2_test_ms() - start < RSB2_TEST_SLEEPMS);
+		RSB2_TEST_CHECK(rsb2_test_coroRecv(&a) == "slept");
+		RSB2_TEST_CHECK(rsb2_test_ms() - start >= RSB2_TEST_SLEEPMS - 1);
+		RSB2_TEST_CHECK(rsb2_test_coroRecv(&a) == "def");
+		/* a handler that throws or returns closes its connection only */
+		RSB2_TEST_CHECK(rsb2_test_coroSend(&a, "throw"));
+		RSB2_TEST_CHECK(rsb2_test_coroRecv(&a).empty());
+		RSB2_TEST_CHECK(rsb2_test_coroSend(&b, "bye"));
+		RSB2_TEST_CHECK(rsb2_test_coroRecv(&b).empty());
+	}
+	rsb2_test_coroClose(&a);
+	rsb2_test_coroClose(&b);
+	/* new connections still served */
+	if (RSB2_TEST_CHECK(rsb2_test_coroOpen(&a))) {
+		RSB2_TEST_CHECK(rsb2_test_coroSend(&a, "jkl"));
+		RSB2_TEST_CHECK(rsb2_test_coroRecv(&a) == "jkl");
+	}
+	rsb2_test_coroClose(&a);
+}
+
+int main(void)
+{
+	rsb2_module_setTracer(rsb2_test_nullTracer);
+	rsb2_module_setTraceMask(-1, 0);
+	rsb2_eventmgr_setHandler(rsb2_test_nullHandler);
+	snprintf(g_path, sizeof(g_path), "/tmp/rsb2_test_coro.%d", (int)getpid());
+	pthread_t server;
+	if (RSB2_TEST_CHECK(!pthread_create(&server, NULL, rsb2_test_coroServer,
+			NULL))) {
+		/* probe until listening */
+		int sock = -1;
+		for (int i = 0; sock < 0 && i < 200; i++) {
+			sock = rsb2_unixsock_connect(g_path);
+			if (sock < 0) {
+				usleep(5000);
+			}
+		}
+		if (RSB2_TEST_CHECK(sock >= 0)) {
+			rsb2_socket_close(sock);
+			rsb2_test_coroSessions();
+			rsb2_Test_client client;
+			if (RSB2_TEST_CHECK(rsb2_test_coroOpen(&client))) {
+				RSB2_TEST_CHECK(rsb2_test_coroSend(&client, "stop"));
+			}
+			rsb2_test_coroClose(&client);
+		} else {
+			pthread_cancel(server);
+		}
+		pthread_join(server, NULL);
+		RSB2_TEST_CHECK(!g_err);
+		rsb2_unixsock_unlink(g_path);
+	}
+	printf("coro       %s\n", g_failures? "FAILED": "ok");
+	return g_failures? 1: 0;
+}
+
+/*END*/
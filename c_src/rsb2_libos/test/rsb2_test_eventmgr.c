@@ -0,0 +1,114 @@
+/** Unit tests - Asynchronous event queue overflow.
+ * @file test/rsb2_test_eventmgr.c
+ * @author jp.tranvouez@navilab.com
+ */
+#include "rsb2_test.h"
+#include "rsb2_eventmgr.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+enum {
+	RSB2_TEST_QUEUESZ	= 16,			/* Queue size. */
+	RSB2_TEST_EVENTS	= 100,			/* Events notified past the held one. */
+};
+
+static bool g_held = false;				/* Handler holding the first event. */
+static bool g_release = false;			/* Handler released. */
+static bool g_produced = false;			/* Producer thread done. */
+static int g_first = -1;				/* Index of the first event handled. */
+static int g_count = 0;					/* Events handled. */
+static int g_gaps = 0;					/* Events handled out of sequence. */
+
+/* hold the dispatcher on the first event, so that the queue fills */
+static void rsb2_test_eventmgrHandler(const char *func, const char *file,
+		int line, const char *name, const char *descr)
+{
+	int index = -1;
+	if (!strcmp(name, "test_hold")) {
+		__atomic_store_n(&g_held, true, __ATOMIC_RELEASE);
+		while (!__atomic_load_n(&g_release, __ATOMIC_ACQUIRE)) {
+			usleep(1000);
+		}
+	} else if (sscanf(descr, "i=%d", &index) == 1) {
+		if (g_first < 0) {
+			g_first = index;
+		} else if (index != g_first + g_count) {
+			g_gaps++;
+		}
+		g_count++;
+	}
+}
+
+static void *rsb2_test_eventmgrProducer(void *arg)
+{
+	(void)arg;
+	for (int i = 0; i < RSB2_TEST_EVENTS; i++) {
+		RSB2_NOTIFY("test_event", "i=%d", i);
+	}
+	__atomic_store_n(&g_produced, true, __ATOMIC_RELEASE);
+	return NULL;
+}
+
+static void rsb2_test_eventmgrPolicy(rsb2_Event_policy policy,
+		rsb2_Event_stats *delta)
+{
+	g_held = g_release = g_produced = false;
+	g_first = -1;
+	g_count = g_gaps = 0;
+	rsb2_Event_stats before;
+	rsb2_eventmgr_stats(&before);
+	pthread_t thread;
+	if (RSB2_TEST_CHECK(!rsb2_eventmgr_startAsync(RSB2_TEST_QUEUESZ, policy))) {
+		RSB2_NOTIFY("test_hold", "policy=%d", policy);
+		while (!__atomic_load_n(&g_held, __ATOMIC_ACQUIRE)) {
+			usleep(1000);
+		}
+		if (RSB2_TEST_CHECK(!pthread_create(&thread, NULL,
+				rsb2_test_eventmgrProducer, NULL))) {
+			/* the producer blocks on the full queue, or drops and ends */
+			usleep(50000);
+			RSB2_TEST_CHECK(__atomic_load_n(&g_produced, __ATOMIC_ACQUIRE) ==
+					(policy != RSB2_EVENTMGR_BLOCK));
+			__atomic_store_n(&g_release, true, __ATOMIC_RELEASE);
+			pthread_join(thread, NULL);
+		}
+		__atomic_store_n(&g_release, true, __ATOMIC_RELEASE);
+		rsb2_eventmgr_stopAsync();
+	}
+	rsb2_eventmgr_stats(delta);
+	delta->queued -= before.queued;
+	delta->dispatched -= before.dispatched;
+	delta->droppedNewest -= before.droppedNewest;
+	delta->droppedOldest -= before.droppedOldest;
+	delta->blocked -= before.blocked;
+}
+
+void rsb2_test_eventmgr(void)
+{
+	rsb2_eventmgr_setHandler(rsb2_test_eventmgrHandler);
+	rsb2_Event_stats delta;
+	/* the first events are kept */
+	rsb2_test_eventmgrPolicy(RSB2_EVENTMGR_DROP_NEWEST, &delta);
+	RSB2_TEST_CHECK(g_count == RSB2_TEST_QUEUESZ && g_first == 0 && !g_gaps);
+	RSB2_TEST_CHECK(delta.droppedNewest == RSB2_TEST_EVENTS - RSB2_TEST_QUEUESZ);
+	RSB2_TEST_CHECK(!delta.droppedOldest && !delta.blocked);
+	RSB2_TEST_CHECK(delta.dispatched == delta.queued);
+	/* the last events are kept */
+	rsb2_test_eventmgrPolicy(RSB2_EVENTMGR_DROP_OLDEST, &delta);
+	RSB2_TEST_CHECK(g_count == RSB2_TEST_QUEUESZ && !g_gaps);
+	RSB2_TEST_CHECK(g_first == RSB2_TEST_EVENTS - RSB2_TEST_QUEUESZ);
+	RSB2_TEST_CHECK(delta.droppedOldest == RSB2_TEST_EVENTS - RSB2_TEST_QUEUESZ);
+	RSB2_TEST_CHECK(!delta.droppedNewest && !delta.blocked);
+	RSB2_TEST_CHECK(delta.dispatched == delta.queued - delta.droppedOldest);
+	/* every event is kept, in order */
+	rsb2_test_eventmgrPolicy(RSB2_EVENTMGR_BLOCK, &delta);
+	RSB2_TEST_CHECK(g_count == RSB2_TEST_EVENTS && g_first == 0 && !g_gaps);
+	RSB2_TEST_CHECK(!delta.droppedNewest && !delta.droppedOldest);
+	RSB2_TEST_CHECK(delta.blocked > 0);
+	RSB2_TEST_CHECK(delta.dispatched == RSB2_TEST_EVENTS + 1);
+	rsb2_test_quiet();
+}
+
+/*END*/
@@ -0,0 +1,107 @@
+/** Unit tests - Frame reassembly.
+ * @file test/rsb2_test_frame.c
+ * @author jp.tranvouez@navilab.com
+ */
+#include "rsb2_test.h"
+#include "rsb2_frame.h"
+#include "rsb2_socket.h"
+
+#include <arpa/inet.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+enum {
+	RSB2_TEST_FRAMES	= 200,			/* Frames of the stream. */
+	RSB2_TEST_BIGLEN	= 100000,		/* Payload length of the big frame. */
+};
+
+static int g_nextFrame = 0;				/* Expected frame index. */
+
+/* payload length of a frame, the last one larger than the initial ring */
+static int rsb2_test_frameLen(int index)
+{
+	return index == RSB2_TEST_FRAMES - 1? RSB2_TEST_BIGLEN: 1 + index * 37 % 500;
+}
+
+static char rsb2_test_frameByte(int index, int pos)
+{
+	return (char)(index * 31 + pos);
+}
+
+static int rsb2_test_frameRecv(int sock, const char *msg, int msglen)
+{
+	int index = g_nextFrame++;
+	bool ok = RSB2_TEST_CHECK(msglen == rsb2_test_frameLen(index));
+	for (int i = 0; ok && i < msglen; i++) {
+		ok = RSB2_TEST_CHECK(msg[i] == rsb2_test_frameByte(index, i));
+	}
+	return ok? 0: 1;
+}
+
+/* frames written in pieces of a given size, read as each piece arrives */
+static void rsb2_test_frameSplit(const char *stream, size_t len, size_t piece)
+{
+	int sv[2];
+	if (RSB2_TEST_CHECK(!socketpair(AF_UNIX, SOCK_STREAM, 0, sv))) {
+		rsb2_socket_setnonblock(sv[1]);
+		rsb2_Frame_ring ring;
+		rsb2_frame_init(&ring);
+		g_nextFrame = 0;
+		int ret = 0;
+		for (size_t pos = 0; pos < len && ret <= 0; pos += piece) {
+			size_t n = len - pos < piece? len - pos: piece;
+			if (!RSB2_TEST_CHECK(write(sv[0], stream + pos, n) == (ssize_t)n)) {
+				ret = 1;
+			}
+			/* a piece may complete no frame, one, or several */
+			while (ret <= 0 && (ret = rsb2_frame_recv(sv[1], &ring,
+					rsb2_test_frameRecv)) == 0) {
+			}
+		}
+		RSB2_TEST_CHECK(ret == -1);
+		RSB2_TEST_CHECK(g_nextFrame == RSB2_TEST_FRAMES);
+		/* the peer closes in the middle of a frame */
+		uint32_t hdr = htonl(10);
+		RSB2_TEST_CHECK(write(sv[0], &hdr, sizeof(hdr)) == sizeof(hdr));
+		RSB2_TEST_CHECK(write(sv[0], "abc", 3) == 3);
+		close(sv[0]);
+		while ((ret = rsb2_frame_recv(sv[1], &ring, rsb2_test_frameRecv)) == 0) {
+		}
+		RSB2_TEST_CHECK(ret == 1);
+		RSB2_TEST_CHECK(g_nextFrame == RSB2_TEST_FRAMES);
+		rsb2_frame_free(&ring);
+		close(sv[1]);
+	}
+}
+
+void rsb2_test_frame(void)
+{
+	size_t len = 0;
+	for (int i = 0; i < RSB2_TEST_FRAMES; i++) {
+		len += RSB2_FRAME_HDRSZ + rsb2_test_frameLen(i);
+	}
+	char *stream = malloc(len);
+	if (RSB2_TEST_CHECK(stream != NULL)) {
+		char *p = stream;
+		for (int i = 0; i < RSB2_TEST_FRAMES; i++) {
+			int msglen = rsb2_test_frameLen(i);
+			uint32_t hdr = htonl(msglen);
+			memcpy(p, &hdr, sizeof(hdr));
+			p += sizeof(hdr);
+			for (int j = 0; j < msglen; j++) {
+				*p++ = rsb2_test_frameByte(i, j);
+			}
+		}
+		/* headers split byte by byte, then across payloads and frames */
+		rsb2_test_frameSplit(stream, len, 1);
+		rsb2_test_frameSplit(stream, len, 3);
+		rsb2_test_frameSplit(stream, len, 7);
+		rsb2_test_frameSplit(stream, len, 1000);
+		free(stream);
+	}
+}
+
+/*END*/
@@ -0,0 +1,126 @@
+/** Unit tests - Latency histograms.
+ * @file test/rsb2_test_histo.c
+ * @author jp.tranvouez@navilab.com
+ */
+#include "rsb2_test.h"
+#include "rsb2_histo.h"
+#include "rsb2_metrics.h"
+
+#include <string.h>
+
+enum {
+	RSB2_TEST_VALUES	= 1000,			/* Values recorded, 1 to 1000. */
+	RSB2_TEST_THREADS	= 4,			/* Recording threads. */
+	RSB2_TEST_RECORDS	= 10000,		/* Records of each thread. */
+};
+
+static rsb2_Histo g_histo;				/* Histogram shared by the threads. */
+
+static void *rsb2_test_histoThread(void *arg)
+{
+	(void)arg;
+	for (int i = 0; i < RSB2_TEST_RECORDS; i++) {
+		rsb2_histo_record(&g_histo, i);
+	}
+	return NULL;
+}
+
+/* a quantile is the top of its bucket: above the value, by 1/16 at most */
+static bool rsb2_test_histoNear(uint64_t got, uint64_t value)
+{
+	return got >= value && got <= value + value / RSB2_HISTO_SUBBUCKETS;
+}
+
+/* buckets keep the order of the values */
+static void rsb2_test_histoBuckets(void)
+{
+	bool ordered = true;
+	for (uint64_t v = 0; v < 100000; v++) {
+		ordered = ordered && rsb2_histo_bucket(v) <= rsb2_histo_bucket(v + 1);
+	}
+	RSB2_TEST_CHECK(ordered);
+	RSB2_TEST_CHECK(rsb2_histo_bucket(UINT64_MAX) < RSB2_HISTO_BUCKETS);
+	for (uint64_t v = 0; v < RSB2_HISTO_SUBBUCKETS; v++) {
+		RSB2_TEST_CHECK(rsb2_histo_bucket(v) == v);
+	}
+}
+
+static void rsb2_test_histoQuantiles(void)
+{
+	memset(&g_histo, 0, sizeof(g_histo));
+	rsb2_Histo_snap snap;
+	rsb2_histo_snapshot(&g_histo, &snap);
+	RSB2_TEST_CHECK(!snap.count && !snap.mean && !snap.p50 && !snap.max);
+	for (int v = 1; v <= RSB2_TEST_VALUES; v++) {
+		rsb2_histo_record(&g_histo, v);
+	}
+	rsb2_histo_snapshot(&g_histo, &snap);
+	RSB2_TEST_CHECK(snap.count == RSB2_TEST_VALUES);
+	RSB2_TEST_CHECK(snap.mean == 500 && snap.max == RSB2_TEST_VALUES);
+	RSB2_TEST_CHECK(rsb2_test_histoNear(snap.p50, 500));
+	RSB2_TEST_CHECK(rsb2_test_histoNear(snap.p90, 900));
+	RSB2_TEST_CHECK(rsb2_test_histoNear(snap.p99, 990));
+	/* at most the max */
+	RSB2_TEST_CHECK(snap.p999 == RSB2_TEST_VALUES);
+	RSB2_TEST_CHECK(rsb2_histo_quantile(&g_histo, 1.0) == RSB2_TEST_VALUES);
+	RSB2_TEST_CHECK(rsb2_histo_quantile(&g_histo, 0.0) == 1);
+	rsb2_histo_reset(&g_histo);
+	rsb2_histo_snapshot(&g_histo, &snap);
+	RSB2_TEST_CHECK(!snap.count && !snap.mean && !snap.p999 && !snap.max);
+}
+
+/* records from several threads, none lost */
+static void rsb2_test_histoThreads(void)
+{
+	pthread_t threads[RSB2_TEST_THREADS];
+	int n = 0;
+	for (; n < RSB2_TEST_THREADS; n++) {
+		if (!RSB2_TEST_CHECK(!pthread_create(&threads[n], NULL,
+				rsb2_test_histoThread, NULL))) {
+			break;
+		}
+	}
+	int started = n;
+	while (n-- > 0) {
+		pthread_join(threads[n], NULL);
+	}
+	rsb2_Histo_snap snap;
+	rsb2_histo_snapshot(&g_histo, &snap);
+	RSB2_TEST_CHECK(snap.count == (uint64_t)started * RSB2_TEST_RECORDS);
+	RSB2_TEST_CHECK(snap.max == RSB2_TEST_RECORDS - 1);
+	rsb2_histo_reset(&g_histo);
+}
+
+/* an RPC records its phases, the server its handler */
+static void rsb2_test_histoRpc(void)
+{
+	rsb2_Test_server server = { .fRecv = rsb2_test_echo };
+	if (RSB2_TEST_CHECK(!rsb2_test_start(&server, "histo"))) {
+		rsb2_metrics_reset();
+		char buf[8];
+		RSB2_TEST_CHECK(rsb2_unixsock_rpc(server.path, "abc", 3,
+				buf, sizeof(buf)) == 3);
+		rsb2_Histo_snap rpc;
+		rsb2_Histo_snap connect;
+		rsb2_Histo_snap handler;
+		rsb2_metrics_snapshot(RSB2_METRICS_LAT_RPC, &rpc);
+		rsb2_metrics_snapshot(RSB2_METRICS_LAT_CONNECT, &connect);
+		rsb2_metrics_snapshot(RSB2_METRICS_LAT_HANDLER, &handler);
+		RSB2_TEST_CHECK(rpc.count == 1 && connect.count == 1);
+		RSB2_TEST_CHECK(rpc.max >= connect.max && rpc.max > 0);
+		/* the handler may still be running after the reply */
+		RSB2_TEST_CHECK(handler.count <= 1);
+		rsb2_test_stop(&server);
+		RSB2_TEST_CHECK(!server.err);
+	}
+}
+
+void rsb2_test_histo(void)
+{
+	rsb2_test_histoBuckets();
+	rsb2_test_histoQuantiles();
+	rsb2_test_histoThreads();
+	rsb2_test_histoRpc();
+}
+
+/*END*/
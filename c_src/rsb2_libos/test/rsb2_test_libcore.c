@@ -0,0 +1,155 @@
+/** Unit tests - Main program.
+ * @file test/rsb2_test_libcore.c
+ * @author jp.tranvouez@navilab.com
+ */
+#include "rsb2_test.h"
+#include "rsb2_eventmgr.h"
+#include "rsb2_frame.h"
+#include "rsb2_module.h"
+#include "rsb2_shmring.h"
+#include "rsb2_socket.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+/* Test case of the table. */
+typedef struct rsb2_Test_entry {
+	const char *name;					/* Test case name. */
+	rsb2_Test_case *fCase;				/* Test case function. */
+} rsb2_Test_entry;
+
+static const rsb2_Test_entry g_cases[] = {
+	{ "frame", rsb2_test_frame },
+	{ "pool", rsb2_test_pool },
+	{ "rpcmux", rsb2_test_rpcmux },
+	{ "rpcasync", rsb2_test_rpcasync },
+	{ "bulk", rsb2_test_bulk },
+	{ "shmring", rsb2_test_shmring },
+	{ "uring", rsb2_test_uring },
+	{ "tracering", rsb2_test_tracering },
+	{ "tracemask", rsb2_test_tracemask },
+	{ "module", rsb2_test_module },
+	{ "eventmgr", rsb2_test_eventmgr },
+	{ "metrics", rsb2_test_metrics },
+	{ "histo", rsb2_test_histo },
+	{ "bufpool", rsb2_test_bufpool },
+	{ "recvbuf", rsb2_test_recvbuf },
+	{ "sendq", rsb2_test_sendq },
+	{ "timer", rsb2_test_timer },
+};
+
+static int g_failures = 0;				/* Failed checks. */
+
+static void rsb2_test_nullTracer(const char *func, const char *file, int line,
+		int ref, rsb2_TraceGroup group, const char *descr)
+{
+}
+
+static void rsb2_test_nullHandler(const char *func, const char *file,
+		int line, const char *name, const char *descr)
+{
+}
+
+void rsb2_test_quiet(void)
+{
+	rsb2_module_setTracer(rsb2_test_nullTracer);
+	rsb2_module_setTraceMask(-1, 0);
+	rsb2_eventmgr_setHandler(rsb2_test_nullHandler);
+}
+
+bool rsb2_test_check(bool cond, const char *expr, const char *file, int line)
+{
+	if (!cond) {
+		__atomic_add_fetch(&g_failures, 1, __ATOMIC_RELAXED);
+		fprintf(stderr, "%s:%d: check failed: %s\n", file, line, expr);
+	}
+	return cond;
+}
+
+void rsb2_test_path(char *path, const char *name)
+{
+	snprintf(path, 108, "/tmp/rsb2_test_%s.%d", name, (int)getpid());
+}
+
+static void *rsb2_test_server(void *arg)
+{
+	rsb2_Test_server *server = arg;
+	server->err = rsb2_unixsock_serve(server->path, server->fRecv,
+			&server->opts);
+	return NULL;
+}
+
+int rsb2_test_start(rsb2_Test_server *server, const char *name)
+{
+	int err = -1;
+	rsb2_test_path(server->path, name);
+	if (pthread_create(&server->thread, NULL, rsb2_test_server, server)) {
+		fprintf(stderr, "%s: pthread_create failed\n", server->path);
+	} else {
+		/* probe until listening, the probe connection is closed at once */
+		for (int i = 0; err && i < 200; i++) {
+			int sock = rsb2_unixsock_connect(server->path);
+			if (sock >= 0) {
+				rsb2_socket_close(sock);
+				err = 0;
+			} else {
+				usleep(5000);
+			}
+		}
+		if (err) {
+			fprintf(stderr, "%s: server not listening\n", server->path);
+			pthread_cancel(server->thread);
+			pthread_join(server->thread, NULL);
+		}
+	}
+	return err;
+}
+
+void rsb2_test_stop(rsb2_Test_server *server)
+{
+	rsb2_Shmring_chan *chan = server->opts.shmring?
+			rsb2_shmring_connect(server->path, 0): NULL;
+	int sock = server->opts.shmring? -1: rsb2_unixsock_connect(server->path);
+	if (chan) {
+		rsb2_shmring_send(chan, "stop", 4);
+		rsb2_shmring_close(chan);
+	} else if (sock >= 0 && server->opts.framed) {
+		rsb2_frame_send(sock, "stop", 4);
+		rsb2_socket_close(sock);
+	} else if (sock >= 0) {
+		rsb2_socket_send(sock, "stop", 4);
+		rsb2_socket_close(sock);
+	}
+	pthread_join(server->thread, NULL);
+	rsb2_unixsock_unlink(server->path);
+}
+
+int rsb2_test_echo(int sock, const char *msg, int msglen)
+{
+	int ret = 0;
+	if (msglen == 4 && !memcmp(msg, "stop", 4)) {
+		ret = 2;
+	} else if (rsb2_unixsock_reply(sock, msg, msglen)) {
+		ret = 1;
+	}
+	return ret;
+}
+
+int main(int argc, char **argv)
+{
+	rsb2_test_quiet();
+	int failed = 0;
+	for (size_t i = 0; i < sizeof(g_cases) / sizeof(g_cases[0]); i++) {
+		int before = g_failures;
+		g_cases[i].fCase();
+		bool ok = g_failures == before;
+		failed += !ok;
+		printf("%-10s %s\n", g_cases[i].name, ok? "ok": "FAILED");
+	}
+	rsb2_unixsock_closePools();
+	printf("%d test cases failed\n", failed);
+	return failed? 1: 0;
+}
+
+/*END*/
@@ -0,0 +1,98 @@
+/** Unit tests - Socket metrics.
+ * @file test/rsb2_test_metrics.c
+ * @author jp.tranvouez@navilab.com
+ */
+#include "rsb2_test.h"
+#include "rsb2_metrics.h"
+#include "rsb2_socket.h"
+
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+enum {
+	RSB2_TEST_REPLYSZ	= 16384,		/* Stats reply buffer size. */
+};
+
+/* scrape the stats socket: reply length, -1 if no server */
+static int rsb2_test_metricsScrape(const char *path, char *buf, int bufsz)
+{
+	int len = -1;
+	int sock = rsb2_unixsock_connect(path);
+	if (sock >= 0) {
+		len = 0;
+		int n = rsb2_socket_send(sock, "stats", 5) == 5? 1: -1;
+		while (n > 0 && len < bufsz - 1) {
+			n = rsb2_socket_recv(sock, buf + len, bufsz - 1 - len);
+			len += n > 0? n: 0;
+		}
+		buf[len] = '\0';
+		rsb2_socket_close(sock);
+	}
+	return len;
+}
+
+/* counters follow the socket calls */
+static void rsb2_test_metricsCount(void)
+{
+	int sv[2];
+	if (RSB2_TEST_CHECK(!socketpair(AF_UNIX, SOCK_STREAM, 0, sv))) {
+		int64_t sent = rsb2_metrics_get(RSB2_METRICS_BYTES_SENT);
+		int64_t msgs = rsb2_metrics_get(RSB2_METRICS_MSGS_SENT);
+		int64_t recv = rsb2_metrics_get(RSB2_METRICS_BYTES_RECV);
+		RSB2_TEST_CHECK(rsb2_socket_send(sv[0], "hello", 5) == 5);
+		char buf[8];
+		RSB2_TEST_CHECK(rsb2_socket_recv(sv[1], buf, sizeof(buf)) == 5);
+		RSB2_TEST_CHECK(rsb2_metrics_get(RSB2_METRICS_BYTES_SENT) == sent + 5);
+		RSB2_TEST_CHECK(rsb2_metrics_get(RSB2_METRICS_MSGS_SENT) == msgs + 1);
+		RSB2_TEST_CHECK(rsb2_metrics_get(RSB2_METRICS_BYTES_RECV) == recv + 5);
+		/* counters reset, gauges kept */
+		int64_t conns = rsb2_metrics_get(RSB2_METRICS_CONNS);
+		rsb2_metrics_reset();
+		RSB2_TEST_CHECK(rsb2_metrics_get(RSB2_METRICS_BYTES_SENT) == 0);
+		RSB2_TEST_CHECK(rsb2_metrics_get(RSB2_METRICS_CONNS) == conns);
+		close(sv[0]);
+		close(sv[1]);
+	}
+}
+
+void rsb2_test_metrics(void)
+{
+	rsb2_test_metricsCount();
+	char buf[RSB2_TEST_REPLYSZ];
+	int len = rsb2_metrics_format(buf, sizeof(buf));
+	RSB2_TEST_CHECK(len > 0 && len == (int)strlen(buf) &&
+			strstr(buf, "rsb2_socket_bytes_sent ") &&
+			strstr(buf, "rsb2_unixsock_rpc_ns_p99 "));
+	/* truncated to the buffer */
+	RSB2_TEST_CHECK(rsb2_metrics_format(buf, 10) == 9 && strlen(buf) == 9);
+	char path[108];
+	char other[108];
+	rsb2_test_path(path, "metrics");
+	rsb2_test_path(other, "metrics2");
+	if (RSB2_TEST_CHECK(!rsb2_metrics_serve(path))) {
+		/* one server at a time, the first one is kept */
+		RSB2_TEST_CHECK(rsb2_metrics_serve(other) == -1);
+		RSB2_TEST_CHECK(rsb2_test_metricsScrape(other, buf, sizeof(buf)) == -1);
+		for (int i = 0; i < 2; i++) {
+			len = rsb2_test_metricsScrape(path, buf, sizeof(buf));
+			RSB2_TEST_CHECK(len > 0 && strstr(buf, "rsb2_unixsock_accepts "));
+		}
+		/* a connection without request is not answered */
+		int sock = rsb2_unixsock_connect(path);
+		if (RSB2_TEST_CHECK(sock >= 0)) {
+			RSB2_TEST_CHECK(rsb2_socket_rdwait(sock, 100) == 0);
+			rsb2_socket_close(sock);
+		}
+		rsb2_metrics_stop();
+		RSB2_TEST_CHECK(rsb2_test_metricsScrape(path, buf, sizeof(buf)) == -1);
+		/* served again once stopped */
+		if (RSB2_TEST_CHECK(!rsb2_metrics_serve(path))) {
+			RSB2_TEST_CHECK(rsb2_test_metricsScrape(path, buf, sizeof(buf)) > 0);
+			rsb2_metrics_stop();
+		}
+		rsb2_unixsock_unlink(path);
+	}
+}
+
+/*END*/
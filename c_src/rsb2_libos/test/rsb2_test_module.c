@@ -0,0 +1,117 @@
+/** Unit tests - Module registry.
+ * @file test/rsb2_test_module.c
+ * @author jp.tranvouez@navilab.com
+ */
+#include "rsb2_test.h"
+#include "rsb2_module.h"
+
+#include <stdio.h>
+#include <string.h>
+
+enum {
+	RSB2_TEST_THREADS	= 4,			/* Registering threads. */
+	RSB2_TEST_ROUNDS	= 1000,			/* Registrations of each thread. */
+};
+
+static void rsb2_test_moduleTracer(const char *func, const char *file,
+		int line, int ref, rsb2_TraceGroup group, const char *descr)
+{
+	(void)func;
+	(void)file;
+	(void)line;
+	(void)ref;
+	(void)group;
+	(void)descr;
+}
+
+/* a shared module and a module of the thread, registered and released */
+static void *rsb2_test_moduleThread(void *arg)
+{
+	char name[RSB2_MODULE_NAMESZ];
+	snprintf(name, sizeof(name), "rsb2_test_module%d", (int)(long)arg);
+	for (int i = 0; i < RSB2_TEST_ROUNDS; i++) {
+		int shared = rsb2_module_ref("rsb2_test_shared");
+		int own = rsb2_module_ref(name);
+		RSB2_TEST_CHECK(shared >= 0 && own >= 0 && own != shared);
+		RSB2_TEST_CHECK(rsb2_module_find(name) == own);
+		rsb2_module_destroy(own);
+		rsb2_module_destroy(shared);
+	}
+	return NULL;
+}
+
+/* registered until no slot is left */
+static void rsb2_test_moduleFull(void)
+{
+	int refs[RSB2_MODULE_MAX + 1];
+	int n = 0;
+	int ref = 0;
+	for (; n <= RSB2_MODULE_MAX && ref >= 0; n++) {
+		char name[RSB2_MODULE_NAMESZ];
+		snprintf(name, sizeof(name), "rsb2_test_full%d", n);
+		ref = refs[n] = rsb2_module_ref(name);
+	}
+	RSB2_TEST_CHECK(ref == -1);
+	while (n-- > 0) {
+		if (refs[n] >= 0) {
+			rsb2_module_destroy(refs[n]);
+		}
+	}
+	RSB2_TEST_CHECK(rsb2_module_find("rsb2_test_full0") == -1);
+}
+
+void rsb2_test_module(void)
+{
+	/* one slot by name, released with its last reference */
+	int ref = rsb2_module_ref("rsb2_test_module");
+	if (RSB2_TEST_CHECK(ref >= 0)) {
+		RSB2_TEST_CHECK(rsb2_module_ref("rsb2_test_module") == ref);
+		RSB2_TEST_CHECK(rsb2_module_find("rsb2_test_module") == ref);
+		rsb2_Module_stats stats;
+		RSB2_TEST_CHECK(!rsb2_module_stats(ref, &stats) && stats.refs == 2 &&
+				!strcmp(stats.name, "rsb2_test_module") && !stats.tracer);
+		/* a module tracer overrides the common one */
+		RSB2_TEST_CHECK(rsb2_module_tracerOf(ref) == rsb2_module_getTracer());
+		RSB2_TEST_CHECK(!rsb2_module_setModuleTracer(ref,
+				rsb2_test_moduleTracer));
+		RSB2_TEST_CHECK(rsb2_module_tracerOf(ref) == rsb2_test_moduleTracer);
+		rsb2_module_destroy(ref);
+		RSB2_TEST_CHECK(rsb2_module_find("rsb2_test_module") == ref);
+		rsb2_module_destroy(ref);
+		RSB2_TEST_CHECK(rsb2_module_find("rsb2_test_module") == -1);
+		RSB2_TEST_CHECK(rsb2_module_tracerOf(ref) == rsb2_module_getTracer());
+	}
+	/* names truncated to the slot */
+	char name[2 * RSB2_MODULE_NAMESZ];
+	memset(name, 'm', sizeof(name) - 1);
+	name[sizeof(name) - 1] = '\0';
+	ref = rsb2_module_ref(name);
+	if (RSB2_TEST_CHECK(ref >= 0)) {
+		rsb2_Module_stats stats;
+		RSB2_TEST_CHECK(!rsb2_module_stats(ref, &stats) &&
+				strlen(stats.name) == RSB2_MODULE_NAMESZ - 1);
+		rsb2_module_destroy(ref);
+	}
+	/* bad references */
+	rsb2_Module_stats stats;
+	RSB2_TEST_CHECK(rsb2_module_stats(-1, &stats) == -1);
+	RSB2_TEST_CHECK(rsb2_module_stats(RSB2_MODULE_MAX, &stats) == -1);
+	RSB2_TEST_CHECK(rsb2_module_setModuleTracer(RSB2_MODULE_MAX,
+			rsb2_test_moduleTracer) == -1);
+	rsb2_test_moduleFull();
+	/* concurrent registrations */
+	pthread_t threads[RSB2_TEST_THREADS];
+	int n = 0;
+	for (; n < RSB2_TEST_THREADS; n++) {
+		if (!RSB2_TEST_CHECK(!pthread_create(&threads[n], NULL,
+				rsb2_test_moduleThread, (void *)(long)n))) {
+			break;
+		}
+	}
+	while (n-- > 0) {
+		pthread_join(threads[n], NULL);
+	}
+	RSB2_TEST_CHECK(rsb2_module_find("rsb2_test_shared") == -1);
+}
+
+/*END*/
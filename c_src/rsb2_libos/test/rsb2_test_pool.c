@@ -0,0 +1,114 @@
+/** Unit tests - RPC connection pool.
+ * @file test/rsb2_test_pool.c
+ * @author jp.tranvouez@navilab.com
+ */
+#include "rsb2_test.h"
+#include "rsb2_metrics.h"
+#include "rsb2_socket.h"
+
+#include <string.h>
+#include <unistd.h>
+
+/* echo, a reply longer than the caller's buffer for "long", a reply in
+ * two writes for "split", a reply then a close for "bye" */
+static int rsb2_test_poolRecv(int sock, const char *msg, int msglen)
+{
+	int ret = 0;
+	if (msglen == 4 && !memcmp(msg, "long", 4)) {
+		char reply[100];
+		memset(reply, 'x', sizeof(reply));
+		ret = rsb2_unixsock_reply(sock, reply, sizeof(reply))? 1: 0;
+	} else if (msglen == 5 && !memcmp(msg, "split", 5)) {
+		/* the client reads the first part alone */
+		rsb2_socket_send(sock, "sp", 2);
+		usleep(20000);
+		rsb2_socket_send(sock, "lit", 3);
+	} else if (msglen == 3 && !memcmp(msg, "bye", 3)) {
+		rsb2_unixsock_reply(sock, msg, msglen);
+		ret = 1;
+	} else {
+		ret = rsb2_test_echo(sock, msg, msglen);
+	}
+	return ret;
+}
+
+static bool rsb2_test_poolCall(const char *path, const char *msg)
+{
+	char buf[10];
+	int msglen = strlen(msg);
+	int n = rsb2_unixsock_rpc(path, msg, msglen, buf, sizeof(buf));
+	return n == msglen && !memcmp(buf, msg, msglen);
+}
+
+/* unframed replies may be split by the stream, no connection is reused */
+static void rsb2_test_poolUnframed(void)
+{
+	rsb2_Test_server server = { .fRecv = rsb2_test_poolRecv };
+	if (RSB2_TEST_CHECK(!rsb2_test_start(&server, "pool"))) {
+		RSB2_TEST_CHECK(!rsb2_unixsock_setPoolSize(server.path, 2));
+		/* the probe of rsb2_test_start is accepted by then */
+		RSB2_TEST_CHECK(rsb2_test_poolCall(server.path, "abc"));
+		int64_t accepts = rsb2_metrics_get(RSB2_METRICS_ACCEPTS);
+		RSB2_TEST_CHECK(rsb2_test_poolCall(server.path, "abc"));
+		RSB2_TEST_CHECK(rsb2_test_poolCall(server.path, "abc"));
+		RSB2_TEST_CHECK(rsb2_metrics_get(RSB2_METRICS_ACCEPTS) == accepts + 2);
+		/* the tail of a split reply is not read by the next call */
+		char buf[10];
+		RSB2_TEST_CHECK(rsb2_unixsock_rpc(server.path, "split", 5,
+				buf, sizeof(buf)) == 2 && !memcmp(buf, "sp", 2));
+		RSB2_TEST_CHECK(rsb2_test_poolCall(server.path, "def"));
+		rsb2_test_stop(&server);
+		RSB2_TEST_CHECK(!server.err);
+		rsb2_unixsock_setPoolSize(server.path, 0);
+	}
+}
+
+/* framed replies are read whole, the connection carries every call */
+static void rsb2_test_poolFramed(void)
+{
+	rsb2_Test_server server = {
+		.fRecv = rsb2_test_poolRecv,
+		.opts = { .framed = true },
+	};
+	if (RSB2_TEST_CHECK(!rsb2_test_start(&server, "pool"))) {
+		RSB2_TEST_CHECK(!rsb2_unixsock_setPoolSize(server.path, 2));
+		RSB2_TEST_CHECK(!rsb2_unixsock_setPoolFramed(server.path, true));
+		RSB2_TEST_CHECK(rsb2_test_poolCall(server.path, "abc"));
+		int64_t accepts = rsb2_metrics_get(RSB2_METRICS_ACCEPTS);
+		for (int i = 0; i < 10; i++) {
+			RSB2_TEST_CHECK(rsb2_test_poolCall(server.path, "abc"));
+		}
+		RSB2_TEST_CHECK(rsb2_metrics_get(RSB2_METRICS_ACCEPTS) == accepts);
+		/* a reply longer than the buffer is an error, not pooled */
+		char buf[10];
+		RSB2_TEST_CHECK(rsb2_unixsock_rpc(server.path, "long", 4,
+				buf, sizeof(buf)) == -1);
+		RSB2_TEST_CHECK(rsb2_test_poolCall(server.path, "def"));
+		RSB2_TEST_CHECK(rsb2_metrics_get(RSB2_METRICS_ACCEPTS) == accepts + 1);
+		/* a connection closed by the server while idle is replaced */
+		RSB2_TEST_CHECK(rsb2_test_poolCall(server.path, "bye"));
+		usleep(20000);
+		RSB2_TEST_CHECK(rsb2_test_poolCall(server.path, "ghi"));
+		RSB2_TEST_CHECK(rsb2_metrics_get(RSB2_METRICS_ACCEPTS) == accepts + 2);
+		/* the pooled connection dies with the server, then is replaced */
+		rsb2_test_stop(&server);
+		RSB2_TEST_CHECK(!rsb2_test_poolCall(server.path, "ghi"));
+		if (RSB2_TEST_CHECK(!rsb2_test_start(&server, "pool"))) {
+			RSB2_TEST_CHECK(rsb2_test_poolCall(server.path, "jkl"));
+			RSB2_TEST_CHECK(rsb2_test_poolCall(server.path, "mno"));
+			rsb2_test_stop(&server);
+		}
+		RSB2_TEST_CHECK(!server.err);
+		rsb2_unixsock_setPoolSize(server.path, 0);
+		rsb2_unixsock_setPoolFramed(server.path, false);
+	}
+}
+
+void rsb2_test_pool(void)
+{
+	rsb2_test_poolUnframed();
+	rsb2_test_poolFramed();
+	rsb2_unixsock_closePools();
+}
+
+/*END*/
@@ -0,0 +1,118 @@
+/** Unit tests - Zero-copy message processing.
+ * @file test/rsb2_test_recvbuf.c
+ * @author jp.tranvouez@navilab.com
+ */
+#include "rsb2_test.h"
+#include "rsb2_bufpool.h"
+
+#include <stdio.h>
+#include <string.h>
+
+enum {
+	RSB2_TEST_CALLS		= 50,			/* Requests handed to the worker. */
+};
+
+/* Request handed to the worker thread, its buffer retained. */
+typedef struct rsb2_Test_work {
+	uint64_t id;						/* Connection identifier. */
+	char *msg;							/* Request buffer, or NULL if none. */
+	int msglen;							/* Request length. */
+	bool stop;							/* Worker stop requested. */
+} rsb2_Test_work;
+
+static pthread_mutex_t g_lock = PTHREAD_MUTEX_INITIALIZER;	/* Work slot. */
+static pthread_cond_t g_cond = PTHREAD_COND_INITIALIZER;	/* Slot changed. */
+static rsb2_Test_work g_work;			/* Work slot. */
+static char *g_kept = NULL;				/* Buffer kept past its call. */
+
+/* hand the request to the worker, keep the one of "keep" */
+static int rsb2_test_recvbufRecv(int sock, char *msg, int msglen)
+{
+	int ret = 0;
+	if (msglen == 4 && !memcmp(msg, "stop", 4)) {
+		ret = 2;
+	} else if (msglen == 4 && !memcmp(msg, "keep", 4)) {
+		rsb2_bufpool_retain(msg);
+		g_kept = msg;
+		ret = rsb2_unixsock_reply(sock, msg, msglen)? 1: 0;
+	} else {
+		rsb2_bufpool_retain(msg);
+		pthread_mutex_lock(&g_lock);
+		while (g_work.msg) {
+			pthread_cond_wait(&g_cond, &g_lock);
+		}
+		g_work.id = rsb2_unixsock_connId(sock);
+		g_work.msg = msg;
+		g_work.msglen = msglen;
+		pthread_cond_broadcast(&g_cond);
+		pthread_mutex_unlock(&g_lock);
+	}
+	return ret;
+}
+
+/* reply to the requests handed over, then release their buffers */
+static void *rsb2_test_recvbufWorker(void *arg)
+{
+	(void)arg;
+	pthread_mutex_lock(&g_lock);
+	while (!g_work.stop) {
+		if (g_work.msg) {
+			RSB2_TEST_CHECK(g_work.id != 0);
+			RSB2_TEST_CHECK(!rsb2_unixsock_replyTo(g_work.id, g_work.msg,
+					g_work.msglen));
+			rsb2_bufpool_put(g_work.msg);
+			g_work.msg = NULL;
+			pthread_cond_broadcast(&g_cond);
+		} else {
+			pthread_cond_wait(&g_cond, &g_lock);
+		}
+	}
+	pthread_mutex_unlock(&g_lock);
+	return NULL;
+}
+
+static bool rsb2_test_recvbufCall(const char *path, const char *msg)
+{
+	char buf[32];
+	int msglen = strlen(msg);
+	int n = rsb2_unixsock_rpc(path, msg, msglen, buf, sizeof(buf));
+	return n == msglen && !memcmp(buf, msg, msglen);
+}
+
+void rsb2_test_recvbuf(void)
+{
+	rsb2_Test_server server = {
+		.opts = { .fRecvBuf = rsb2_test_recvbufRecv },
+	};
+	memset(&g_work, 0, sizeof(g_work));
+	pthread_t worker;
+	if (RSB2_TEST_CHECK(!pthread_create(&worker, NULL,
+			rsb2_test_recvbufWorker, NULL))) {
+		if (RSB2_TEST_CHECK(!rsb2_test_start(&server, "recvbuf"))) {
+			/* replied and released by the worker */
+			for (int i = 0; i < RSB2_TEST_CALLS; i++) {
+				char msg[16];
+				snprintf(msg, sizeof(msg), "work%d", i);
+				RSB2_TEST_CHECK(rsb2_test_recvbufCall(server.path, msg));
+			}
+			/* a retained buffer outlives the call and the next messages */
+			RSB2_TEST_CHECK(rsb2_test_recvbufCall(server.path, "keep"));
+			RSB2_TEST_CHECK(rsb2_test_recvbufCall(server.path, "next1"));
+			RSB2_TEST_CHECK(rsb2_test_recvbufCall(server.path, "next2"));
+			if (RSB2_TEST_CHECK(g_kept != NULL)) {
+				RSB2_TEST_CHECK(!memcmp(g_kept, "keep", 4));
+				rsb2_bufpool_put(g_kept);
+				g_kept = NULL;
+			}
+			rsb2_test_stop(&server);
+			RSB2_TEST_CHECK(!server.err);
+		}
+		pthread_mutex_lock(&g_lock);
+		g_work.stop = true;
+		pthread_cond_broadcast(&g_cond);
+		pthread_mutex_unlock(&g_lock);
+		pthread_join(worker, NULL);
+	}
+}
+
+/*END*/
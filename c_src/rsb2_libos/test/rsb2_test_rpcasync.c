@@ -0,0 +1,102 @@
+/** Unit tests - Asynchronous RPC client.
+ * @file test/rsb2_test_rpcasync.c
+ * @author jp.tranvouez@navilab.com
+ */
+#include "rsb2_test.h"
+#include "rsb2_rpcasync.h"
+
+#include <stdio.h>
+#include <string.h>
+
+enum {
+	RSB2_TEST_CALLS		= 20,			/* Requests in flight together. */
+};
+
+/* Expected completion of a request. */
+typedef struct rsb2_Test_call {
+	char msg[16];						/* Request, echoed. */
+	int msglen;							/* Request length. */
+	int done;							/* Completions. */
+	int err;							/* Result of the last completion. */
+} rsb2_Test_call;
+
+/* echo, no reply for "hold" */
+static int rsb2_test_rpcasyncRecv(int sock, const char *msg, int msglen)
+{
+	int ret = 0;
+	if (msglen != 4 || memcmp(msg, "hold", 4)) {
+		ret = rsb2_test_echo(sock, msg, msglen);
+	}
+	return ret;
+}
+
+static void rsb2_test_rpcasyncDone(void *arg, const char *msg, int msglen,
+		int err)
+{
+	rsb2_Test_call *call = arg;
+	call->done++;
+	call->err = err;
+	if (!err) {
+		RSB2_TEST_CHECK(msglen == call->msglen &&
+				!memcmp(msg, call->msg, msglen));
+	}
+}
+
+/* run until every request completes, or a second without progress */
+static void rsb2_test_rpcasyncDrain(rsb2_Rpcasync *ctx)
+{
+	int ret = 1;
+	while (rsb2_rpcasync_pending(ctx) && ret > 0) {
+		ret = rsb2_rpcasync_run(ctx, 1000);
+	}
+	RSB2_TEST_CHECK(!rsb2_rpcasync_pending(ctx));
+}
+
+void rsb2_test_rpcasync(void)
+{
+	rsb2_Test_server server = { .fRecv = rsb2_test_rpcasyncRecv };
+	rsb2_Rpcasync *ctx = rsb2_rpcasync_create();
+	if (RSB2_TEST_CHECK(ctx != NULL) &&
+			RSB2_TEST_CHECK(!rsb2_test_start(&server, "rpcasync"))) {
+		/* every request gets its own response */
+		rsb2_Test_call calls[RSB2_TEST_CALLS];
+		memset(calls, 0, sizeof(calls));
+		for (int i = 0; i < RSB2_TEST_CALLS; i++) {
+			calls[i].msglen = snprintf(calls[i].msg, sizeof(calls[i].msg),
+					"call%d", i);
+			RSB2_TEST_CHECK(!rsb2_rpcasync_call(ctx, server.path,
+					calls[i].msg, calls[i].msglen, sizeof(calls[i].msg),
+					rsb2_test_rpcasyncDone, &calls[i]));
+		}
+		RSB2_TEST_CHECK(rsb2_rpcasync_pending(ctx) == RSB2_TEST_CALLS);
+		rsb2_test_rpcasyncDrain(ctx);
+		for (int i = 0; i < RSB2_TEST_CALLS; i++) {
+			RSB2_TEST_CHECK(calls[i].done == 1 && !calls[i].err);
+		}
+		/* no server: an error now, or a failed completion */
+		rsb2_Test_call lost = { .msg = "lost", .msglen = 4 };
+		char path[108];
+		rsb2_test_path(path, "rpcasync_none");
+		if (!rsb2_rpcasync_call(ctx, path, lost.msg, lost.msglen,
+				sizeof(lost.msg), rsb2_test_rpcasyncDone, &lost)) {
+			rsb2_test_rpcasyncDrain(ctx);
+			RSB2_TEST_CHECK(lost.done == 1 && lost.err == -1);
+		}
+		/* a request still waiting completes with an error on destroy */
+		rsb2_Test_call held = { .msg = "hold", .msglen = 4 };
+		RSB2_TEST_CHECK(!rsb2_rpcasync_call(ctx, server.path, held.msg,
+				held.msglen, sizeof(held.msg), rsb2_test_rpcasyncDone, &held));
+		rsb2_rpcasync_run(ctx, 50);
+		RSB2_TEST_CHECK(!held.done);
+		rsb2_rpcasync_destroy(ctx);
+		ctx = NULL;
+		RSB2_TEST_CHECK(held.done == 1 && held.err == -1);
+		rsb2_test_stop(&server);
+		RSB2_TEST_CHECK(!server.err);
+	}
+	if (ctx) {
+		rsb2_rpcasync_destroy(ctx);
+	}
+}
+
+/*END*/
@@ -0,0 +1,124 @@
+/** Unit tests - Multiplexed RPC.
+ * @file test/rsb2_test_rpcmux.c
+ * @author jp.tranvouez@navilab.com
+ */
+#include "rsb2_test.h"
+#include "rsb2_frame.h"
+#include "rsb2_rpcmux.h"
+#include "rsb2_socket.h"
+
+#include <arpa/inet.h>
+#include <stdint.h>
+#include <string.h>
+
+enum {
+	RSB2_TEST_REQUESTS	= 3,			/* Requests answered in reverse. */
+};
+
+static char g_path[108];				/* Server socket path. */
+static int g_lisSock = -1;				/* Server listening socket. */
+
+/* one connection, whose requests are all read before any is answered,
+ * and answered last first */
+static void *rsb2_test_rpcmuxServer(void *arg)
+{
+	int sock = rsb2_unixsock_accept(g_lisSock);
+	if (RSB2_TEST_CHECK(sock >= 0)) {
+		rsb2_Frame_ring ring;
+		rsb2_frame_init(&ring);
+		char reqs[RSB2_TEST_REQUESTS][16];
+		int lens[RSB2_TEST_REQUESTS];
+		int count = 0;
+		while (count < RSB2_TEST_REQUESTS && (lens[count] =
+				rsb2_frame_recvmsg(sock, &ring, reqs[count],
+				sizeof(reqs[count]))) > RSB2_RPCMUX_HDRSZ) {
+			count++;
+		}
+		RSB2_TEST_CHECK(count == RSB2_TEST_REQUESTS);
+		while (count-- > 0) {
+			char reply[16];
+			reply[0] = 'r';
+			memcpy(reply + 1, reqs[count] + RSB2_RPCMUX_HDRSZ,
+					lens[count] - RSB2_RPCMUX_HDRSZ);
+			RSB2_TEST_CHECK(!rsb2_frame_sendhdr(sock, reqs[count],
+					RSB2_RPCMUX_HDRSZ, reply,
+					1 + lens[count] - RSB2_RPCMUX_HDRSZ));
+		}
+		/* wait for the client to close */
+		char buf[16];
+		RSB2_TEST_CHECK(rsb2_frame_recvmsg(sock, &ring, buf, sizeof(buf)) < 0);
+		rsb2_frame_free(&ring);
+		rsb2_socket_close(sock);
+	}
+	return NULL;
+}
+
+/* one connection, closed at once */
+static void *rsb2_test_rpcmuxCloser(void *arg)
+{
+	int sock = rsb2_unixsock_accept(g_lisSock);
+	if (RSB2_TEST_CHECK(sock >= 0)) {
+		rsb2_socket_close(sock);
+	}
+	return NULL;
+}
+
+/* a request that cannot be sent fails, and so do the next ones */
+static void rsb2_test_rpcmuxLost(void)
+{
+	pthread_t thread;
+	if (RSB2_TEST_CHECK(!pthread_create(&thread, NULL,
+			rsb2_test_rpcmuxCloser, NULL))) {
+		rsb2_Rpcmux_client *client = rsb2_rpcmux_connect(g_path);
+		pthread_join(thread, NULL);
+		if (RSB2_TEST_CHECK(client != NULL)) {
+			RSB2_TEST_CHECK(rsb2_rpcmux_submit(client, "a", 1) == -1);
+			RSB2_TEST_CHECK(rsb2_rpcmux_submit(client, "b", 1) == -1);
+			char buf[16];
+			RSB2_TEST_CHECK(rsb2_rpcmux_call(client, "c", 1,
+					buf, sizeof(buf)) == -1);
+			rsb2_rpcmux_close(client);
+		}
+	}
+}
+
+void rsb2_test_rpcmux(void)
+{
+	rsb2_test_path(g_path, "rpcmux");
+	g_lisSock = rsb2_unixsock_listen(g_path);
+	pthread_t thread;
+	if (RSB2_TEST_CHECK(g_lisSock >= 0) &&
+			RSB2_TEST_CHECK(!pthread_create(&thread, NULL,
+			rsb2_test_rpcmuxServer, NULL))) {
+		rsb2_Rpcmux_client *client = rsb2_rpcmux_connect(g_path);
+		if (RSB2_TEST_CHECK(client != NULL)) {
+			static const char *msgs[RSB2_TEST_REQUESTS] = { "a", "bb", "ccc" };
+			int ids[RSB2_TEST_REQUESTS];
+			for (int i = 0; i < RSB2_TEST_REQUESTS; i++) {
+				ids[i] = rsb2_rpcmux_submit(client, msgs[i], strlen(msgs[i]));
+				RSB2_TEST_CHECK(ids[i] >= 0);
+			}
+			/* the middle response arrives second, after the last one, which
+			 * is kept for its waiter; the first arrives last */
+			static const int order[RSB2_TEST_REQUESTS] = { 1, 2, 0 };
+			for (int i = 0; i < RSB2_TEST_REQUESTS; i++) {
+				int req = order[i];
+				char buf[16];
+				int n = rsb2_rpcmux_wait(client, ids[req], buf, sizeof(buf));
+				int msglen = strlen(msgs[req]);
+				RSB2_TEST_CHECK(n == 1 + msglen);
+				RSB2_TEST_CHECK(n > 0 && buf[0] == 'r' &&
+						!memcmp(buf + 1, msgs[req], msglen));
+			}
+			rsb2_rpcmux_close(client);
+		}
+		pthread_join(thread, NULL);
+		rsb2_test_rpcmuxLost();
+	}
+	if (g_lisSock >= 0) {
+		rsb2_socket_close(g_lisSock);
+		rsb2_unixsock_unlink(g_path);
+	}
+}
+
+/*END*/
@@ -0,0 +1,100 @@
+/** Unit tests - Send queue backpressure.
+ * @file test/rsb2_test_sendq.c
+ * @author jp.tranvouez@navilab.com
+ */
+#include "rsb2_test.h"
+#include "rsb2_metrics.h"
+#include "rsb2_sendq.h"
+
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+enum {
+	RSB2_TEST_HIWAT		= 64 * 1024,	/* High-water mark. */
+	RSB2_TEST_MSGLEN	= 1000,			/* Message length. */
+	RSB2_TEST_BUFSZ		= 4096,			/* Socket buffer sizes. */
+};
+
+static char rsb2_test_sendqByte(size_t pos)
+{
+	return (char)(pos * 7 + pos / RSB2_TEST_MSGLEN);
+}
+
+void rsb2_test_sendq(void)
+{
+	int sv[2];
+	if (RSB2_TEST_CHECK(!socketpair(AF_UNIX, SOCK_STREAM, 0, sv))) {
+		int bufsz = RSB2_TEST_BUFSZ;
+		setsockopt(sv[0], SOL_SOCKET, SO_SNDBUF, &bufsz, sizeof(bufsz));
+		setsockopt(sv[1], SOL_SOCKET, SO_RCVBUF, &bufsz, sizeof(bufsz));
+		int64_t gauge = rsb2_metrics_get(RSB2_METRICS_SENDQ_BYTES);
+		int64_t fulls = rsb2_metrics_get(RSB2_METRICS_SENDQ_FULL);
+		rsb2_Sendq *q = rsb2_sendq_create(sv[0], RSB2_TEST_HIWAT);
+		if (RSB2_TEST_CHECK(q != NULL)) {
+			/* the peer does not read: the queue grows to the mark */
+			size_t sent = 0;
+			int ret = 0;
+			for (int i = 0; !ret && i < 1000; i++) {
+				char msg[RSB2_TEST_MSGLEN];
+				for (int j = 0; j < RSB2_TEST_MSGLEN; j++) {
+					msg[j] = rsb2_test_sendqByte(sent + j);
+				}
+				ret = rsb2_sendq_push(q, msg, sizeof(msg));
+				sent += sizeof(msg);
+			}
+			RSB2_TEST_CHECK(ret == 1);
+			RSB2_TEST_CHECK(rsb2_sendq_full(q));
+			RSB2_TEST_CHECK(rsb2_sendq_pending(q) >= RSB2_TEST_HIWAT);
+			RSB2_TEST_CHECK(rsb2_sendq_pending(q) < RSB2_TEST_HIWAT +
+					RSB2_TEST_MSGLEN);
+			RSB2_TEST_CHECK(rsb2_metrics_get(RSB2_METRICS_SENDQ_FULL) ==
+					fulls + 1);
+			RSB2_TEST_CHECK(rsb2_metrics_get(RSB2_METRICS_SENDQ_BYTES) ==
+					gauge + (int64_t)rsb2_sendq_pending(q));
+			/* the peer reads: the producer resumes at half the mark */
+			size_t received = 0;
+			int bad = 0;
+			ret = 1;
+			while (ret == 1 && received < sent) {
+				char buf[RSB2_TEST_BUFSZ];
+				ssize_t n = recv(sv[1], buf, sizeof(buf), MSG_DONTWAIT);
+				for (ssize_t i = 0; i < n; i++) {
+					bad += buf[i] != rsb2_test_sendqByte(received + i);
+				}
+				received += n > 0? (size_t)n: 0;
+				ret = rsb2_sendq_flush(q);
+				RSB2_TEST_CHECK(rsb2_sendq_full(q) ==
+						(rsb2_sendq_pending(q) > RSB2_TEST_HIWAT / 2));
+			}
+			RSB2_TEST_CHECK(!ret && !rsb2_sendq_pending(q));
+			for (ssize_t n = 1; n > 0 && received < sent; ) {
+				char buf[RSB2_TEST_BUFSZ];
+				n = recv(sv[1], buf, sizeof(buf), 0);
+				for (ssize_t i = 0; i < n; i++) {
+					bad += buf[i] != rsb2_test_sendqByte(received + i);
+				}
+				received += n > 0? (size_t)n: 0;
+			}
+			RSB2_TEST_CHECK(received == sent && !bad);
+			RSB2_TEST_CHECK(rsb2_metrics_get(RSB2_METRICS_SENDQ_BYTES) == gauge);
+			/* the peer is gone */
+			close(sv[1]);
+			sv[1] = -1;
+			char msg[RSB2_TEST_MSGLEN] = { 0 };
+			ret = 0;
+			for (int i = 0; !ret && i < 1000; i++) {
+				ret = rsb2_sendq_push(q, msg, sizeof(msg));
+			}
+			RSB2_TEST_CHECK(ret == -1);
+			rsb2_sendq_destroy(q);
+			RSB2_TEST_CHECK(rsb2_metrics_get(RSB2_METRICS_SENDQ_BYTES) == gauge);
+		}
+		close(sv[0]);
+		if (sv[1] >= 0) {
+			close(sv[1]);
+		}
+	}
+}
+
+/*END*/
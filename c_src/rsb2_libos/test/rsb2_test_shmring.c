@@ -0,0 +1,128 @@
+/** Unit tests - Shared-memory ring transport.
+ * @file test/rsb2_test_shmring.c
+ * @author jp.tranvouez@navilab.com
+ */
+#include "rsb2_test.h"
+#include "rsb2_shmring.h"
+#include "rsb2_socket.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+enum {
+	RSB2_TEST_RINGSZ	= 4096,			/* Data size of each ring. */
+	RSB2_TEST_MSGS		= 60,			/* Requests sent before any reply is read,
+										 * more than a ring of replies. */
+	RSB2_TEST_MSGLEN	= 100,			/* Request length. */
+};
+
+/* Negotiation message, as rsb2_shmring_connect sends it. */
+typedef struct rsb2_Test_hello {
+	char magic[4];						/* "RSBS". */
+	uint32_t version;					/* 1. */
+	uint32_t size;						/* Data size of each ring. */
+	uint32_t reserved;					/* Zero. */
+} rsb2_Test_hello;
+
+static int g_openReply = 0;				/* Reply result in the open function. */
+
+/* accept a shared-memory channel on a file: 0 accepted, -1 rejected */
+static int rsb2_test_shmringFile(int fd)
+{
+	int err = -1;
+	int sv[2];
+	int fds[3] = { fd, eventfd(0, 0), eventfd(0, 0) };
+	if (RSB2_TEST_CHECK(!socketpair(AF_UNIX, SOCK_STREAM, 0, sv))) {
+		rsb2_Test_hello hello = { { 'R', 'S', 'B', 'S' }, 1, 4096, 0 };
+		RSB2_TEST_CHECK(rsb2_socket_sendfds(sv[0], fds, 3,
+				(const char *)&hello, sizeof(hello)) == sizeof(hello));
+		rsb2_Shmring_chan *chan = rsb2_shmring_accept(sv[1]);
+		if (chan) {
+			rsb2_shmring_close(chan);
+			err = 0;
+		} else {
+			RSB2_TEST_CHECK(errno == EPROTO);
+		}
+		close(sv[0]);
+		close(sv[1]);
+	}
+	close(fds[1]);
+	close(fds[2]);
+	return err;
+}
+
+/* channels on a file not sealed against resizing are rejected */
+static void rsb2_test_shmringSeals(void)
+{
+	FILE *file = tmpfile();
+	if (RSB2_TEST_CHECK(file != NULL)) {
+		RSB2_TEST_CHECK(rsb2_test_shmringFile(fileno(file)) == -1);
+		fclose(file);
+	}
+	int memfd = memfd_create("rsb2_test", MFD_ALLOW_SEALING);
+	if (RSB2_TEST_CHECK(memfd >= 0)) {
+		RSB2_TEST_CHECK(!ftruncate(memfd, 65536));
+		RSB2_TEST_CHECK(rsb2_test_shmringFile(memfd) == -1);
+		/* shrinking sealed only: the mapping could still grow away */
+		RSB2_TEST_CHECK(!fcntl(memfd, F_ADD_SEALS, F_SEAL_SHRINK));
+		RSB2_TEST_CHECK(rsb2_test_shmringFile(memfd) == -1);
+		close(memfd);
+	}
+}
+
+/* a reply before the channel would corrupt the negotiation */
+static void *rsb2_test_shmringOpen(int sock)
+{
+	g_openReply = rsb2_unixsock_reply(sock, "hi", 2);
+	return NULL;
+}
+
+/* requests and replies go through the rings, the server replies with
+ * rsb2_unixsock_reply as on any other transport */
+static void rsb2_test_shmringEcho(void)
+{
+	rsb2_Test_server server = {
+		.fRecv = rsb2_test_echo,
+		.opts = { .shmring = true, .fOpen = rsb2_test_shmringOpen },
+	};
+	if (RSB2_TEST_CHECK(!rsb2_test_start(&server, "shmring"))) {
+		rsb2_Shmring_chan *chan = rsb2_shmring_connect(server.path,
+				RSB2_TEST_RINGSZ);
+		if (RSB2_TEST_CHECK(chan != NULL)) {
+			char msg[RSB2_TEST_MSGLEN];
+			char buf[RSB2_TEST_MSGLEN];
+			for (int i = 0; i < RSB2_TEST_MSGS; i++) {
+				memset(msg, 'a' + i % 26, sizeof(msg));
+				RSB2_TEST_CHECK(!rsb2_shmring_send(chan, msg, 1 + i));
+			}
+			for (int i = 0; i < RSB2_TEST_MSGS; i++) {
+				memset(msg, 'a' + i % 26, sizeof(msg));
+				int n = rsb2_shmring_recv(chan, buf, sizeof(buf));
+				RSB2_TEST_CHECK(n == 1 + i && !memcmp(buf, msg, n));
+			}
+			/* longer than a quarter of the ring */
+			char big[RSB2_TEST_RINGSZ / 2];
+			memset(big, 'x', sizeof(big));
+			RSB2_TEST_CHECK(rsb2_shmring_send(chan, big, sizeof(big)) == -1);
+			rsb2_shmring_close(chan);
+		}
+		RSB2_TEST_CHECK(g_openReply == -1);
+		rsb2_test_stop(&server);
+		RSB2_TEST_CHECK(!server.err);
+	}
+}
+
+void rsb2_test_shmring(void)
+{
+	rsb2_test_shmringSeals();
+	rsb2_test_shmringEcho();
+}
+
+/*END*/
@@ -0,0 +1,123 @@
+/** Unit tests - Timer wheel.
+ * @file test/rsb2_test_timer.c
+ * @author jp.tranvouez@navilab.com
+ */
+#include "rsb2_test.h"
+#include "rsb2_timer.h"
+
+#include <stdint.h>
+
+enum {
+	RSB2_TEST_START		= 1000003,		/* Wheel time at start (ms). */
+};
+
+/* Delays of the one-shot timers, on the edges of every level. */
+static const uint64_t g_delays[] = {
+	0, 1, 2, 63, 64, 65, 127, 128, 4095, 4096, 4097, 100000,
+	262143, 262144, 262145, 1000000,
+};
+
+#define RSB2_TEST_TIMERS	(sizeof(g_delays) / sizeof(g_delays[0]))
+
+/* Expiries of a timer. */
+typedef struct rsb2_Test_fired {
+	rsb2_Timer timer;					/* Timer. */
+	rsb2_Timer_wheel *wheel;			/* Wheel of the timer. */
+	uint64_t at;						/* Wheel time of the last expiry. */
+	int count;							/* Number of expiries. */
+} rsb2_Test_fired;
+
+/* expiry time of a timer, a zero delay runs on the next tick */
+static uint64_t rsb2_test_timerExpiry(size_t index)
+{
+	return RSB2_TEST_START + (g_delays[index]? g_delays[index]: 1);
+}
+
+static uint64_t g_last = 0;				/* Last expiry time of a run. */
+static int g_disorders = 0;				/* Expiries before the previous one. */
+
+static void rsb2_test_timerFired(rsb2_Timer *timer, void *arg)
+{
+	rsb2_Test_fired *fired = arg;
+	fired->at = fired->wheel->now;
+	fired->count++;
+	if (fired->at < g_last) {
+		g_disorders++;
+	}
+	g_last = fired->at;
+}
+
+static void rsb2_test_timerArm(rsb2_Timer_wheel *wheel, rsb2_Test_fired *fired)
+{
+	rsb2_timer_wheelInit(wheel, RSB2_TEST_START);
+	g_last = 0;
+	g_disorders = 0;
+	for (size_t i = 0; i < RSB2_TEST_TIMERS; i++) {
+		fired[i].wheel = wheel;
+		fired[i].at = 0;
+		fired[i].count = 0;
+		rsb2_timer_init(&fired[i].timer, rsb2_test_timerFired, &fired[i]);
+		rsb2_timer_arm(wheel, &fired[i].timer, g_delays[i], 0);
+	}
+}
+
+void rsb2_test_timer(void)
+{
+	rsb2_Timer_wheel wheel;
+	rsb2_Test_fired fired[RSB2_TEST_TIMERS];
+	/* each millisecond: every timer runs on time, cascaded down the levels */
+	rsb2_test_timerArm(&wheel, fired);
+	RSB2_TEST_CHECK(wheel.count == (int)RSB2_TEST_TIMERS);
+	RSB2_TEST_CHECK(rsb2_timer_timeout(&wheel) == 1);
+	uint64_t end = RSB2_TEST_START + g_delays[RSB2_TEST_TIMERS - 1];
+	int run = 0;
+	for (uint64_t now = RSB2_TEST_START; now <= end; now++) {
+		run += rsb2_timer_expire(&wheel, now);
+	}
+	RSB2_TEST_CHECK(run == (int)RSB2_TEST_TIMERS && !wheel.count);
+	for (size_t i = 0; i < RSB2_TEST_TIMERS; i++) {
+		RSB2_TEST_CHECK(fired[i].count == 1);
+		RSB2_TEST_CHECK(fired[i].at == rsb2_test_timerExpiry(i));
+	}
+	RSB2_TEST_CHECK(!g_disorders);
+	RSB2_TEST_CHECK(rsb2_timer_timeout(&wheel) == -1);
+	/* at each wakeup: no timer runs early, nor is missed */
+	rsb2_test_timerArm(&wheel, fired);
+	int wakeups = 0;
+	for (int timeout = 0; timeout >= 0 && wakeups < 1000; wakeups++) {
+		RSB2_TEST_CHECK(timeout <= 1000000);
+		rsb2_timer_expire(&wheel, wheel.now + timeout);
+		timeout = rsb2_timer_timeout(&wheel);
+		for (size_t i = 0; i < RSB2_TEST_TIMERS; i++) {
+			RSB2_TEST_CHECK(fired[i].count ==
+					(wheel.now >= rsb2_test_timerExpiry(i)));
+		}
+	}
+	for (size_t i = 0; i < RSB2_TEST_TIMERS; i++) {
+		RSB2_TEST_CHECK(fired[i].at == rsb2_test_timerExpiry(i));
+	}
+	RSB2_TEST_CHECK(wakeups < 100);
+	/* one late wakeup: every timer runs, in expiry order */
+	rsb2_test_timerArm(&wheel, fired);
+	RSB2_TEST_CHECK(rsb2_timer_expire(&wheel, end) == (int)RSB2_TEST_TIMERS);
+	RSB2_TEST_CHECK(!g_disorders);
+	/* periodic, cancelled and re-armed timers */
+	rsb2_test_timerArm(&wheel, fired);
+	for (size_t i = 0; i < RSB2_TEST_TIMERS; i++) {
+		rsb2_timer_cancel(&wheel, &fired[i].timer);
+		RSB2_TEST_CHECK(!rsb2_timer_armed(&fired[i].timer));
+	}
+	rsb2_timer_arm(&wheel, &fired[0].timer, 10, 10);
+	rsb2_timer_arm(&wheel, &fired[1].timer, 5000, 0);
+	rsb2_timer_arm(&wheel, &fired[1].timer, 50, 0);
+	for (uint64_t now = RSB2_TEST_START; now <= RSB2_TEST_START + 100; now++) {
+		rsb2_timer_expire(&wheel, now);
+	}
+	RSB2_TEST_CHECK(fired[0].count == 10 && rsb2_timer_armed(&fired[0].timer));
+	RSB2_TEST_CHECK(fired[1].count == 1 && !rsb2_timer_armed(&fired[1].timer));
+	RSB2_TEST_CHECK(fired[1].at == RSB2_TEST_START + 50);
+	rsb2_timer_cancel(&wheel, &fired[0].timer);
+	RSB2_TEST_CHECK(!wheel.count && rsb2_timer_timeout(&wheel) == -1);
+}
+
+/*END*/
@@ -0,0 +1,84 @@
+/** Unit tests - Trace group masks.
+ * @file test/rsb2_test_tracemask.c
+ * @author jp.tranvouez@navilab.com
+ */
+#define RSB2_TRACE_GROUPS		0xe		/* DATA, CTRL, APPL, as in release */
+
+#include "rsb2_test.h"
+#include "rsb2_module.h"
+
+#include <string.h>
+
+static int g_module = -1;				/* Module reference. */
+static int g_evals = 0;					/* Trace arguments evaluated. */
+static int g_traces = 0;				/* Traces received. */
+
+static void rsb2_test_tracemaskTracer(const char *func, const char *file,
+		int line, int ref, rsb2_TraceGroup group, const char *descr)
+{
+	(void)func;
+	(void)file;
+	(void)line;
+	(void)group;
+	(void)descr;
+	g_traces += ref == g_module;
+}
+
+static int rsb2_test_tracemaskArg(void)
+{
+	return ++g_evals;
+}
+
+/* one trace of each group */
+static void rsb2_test_tracemaskAll(void)
+{
+	RSB2_TRACE_ARGS("arg=%d", rsb2_test_tracemaskArg());
+	RSB2_TRACE(RSB2_TRACEGROUP_DATA, "arg=%d", rsb2_test_tracemaskArg());
+	RSB2_TRACE(RSB2_TRACEGROUP_CTRL, "arg=%d", rsb2_test_tracemaskArg());
+	RSB2_TRACE(RSB2_TRACEGROUP_APPL, "arg=%d", rsb2_test_tracemaskArg());
+}
+
+void rsb2_test_tracemask(void)
+{
+	g_module = rsb2_module_ref("rsb2_test_tracemask");
+	if (RSB2_TEST_CHECK(g_module >= 0)) {
+		rsb2_module_setModuleTracer(g_module, rsb2_test_tracemaskTracer);
+		/* function traces compiled out, whatever the mask */
+		rsb2_module_setTraceMask(g_module, 0xf);
+		RSB2_TEST_CHECK(rsb2_module_getTraceMask(g_module) == 0xf);
+		rsb2_test_tracemaskAll();
+		RSB2_TEST_CHECK(g_evals == 3 && g_traces == 3);
+		/* groups out of the mask: arguments not evaluated */
+		rsb2_module_setTraceMask(g_module, RSB2_TRACEGROUP_CTRL);
+		rsb2_test_tracemaskAll();
+		RSB2_TEST_CHECK(g_evals == 4 && g_traces == 4);
+		rsb2_module_setTraceMask(g_module, 0);
+		rsb2_test_tracemaskAll();
+		RSB2_TEST_CHECK(g_evals == 4 && g_traces == 4);
+		/* traces counted by group */
+		rsb2_Module_stats stats;
+		if (RSB2_TEST_CHECK(!rsb2_module_stats(g_module, &stats))) {
+			RSB2_TEST_CHECK(stats.mask == 0 && stats.tracer);
+			RSB2_TEST_CHECK(stats.traces[0] == 0 && stats.traces[1] == 1 &&
+					stats.traces[2] == 2 && stats.traces[3] == 1);
+		}
+		/* the mask of every module, new ones included */
+		rsb2_module_setTraceMask(-1, RSB2_TRACEGROUP_APPL);
+		RSB2_TEST_CHECK(rsb2_module_getTraceMask(g_module) ==
+				RSB2_TRACEGROUP_APPL);
+		int ref = rsb2_module_ref("rsb2_test_tracemask2");
+		if (RSB2_TEST_CHECK(ref >= 0)) {
+			RSB2_TEST_CHECK(rsb2_module_getTraceMask(ref) ==
+					RSB2_TRACEGROUP_APPL);
+			rsb2_module_destroy(ref);
+		}
+		rsb2_test_tracemaskAll();
+		RSB2_TEST_CHECK(g_evals == 5 && g_traces == 5);
+		rsb2_module_setTraceMask(-1, 0);
+		rsb2_module_setModuleTracer(g_module, NULL);
+		rsb2_module_destroy(g_module);
+		g_module = -1;
+	}
+}
+
+/*END*/
@@ -0,0 +1,161 @@
+/** Unit tests - Trace ring.
+ * @file test/rsb2_test_tracering.c
+ * @author jp.tranvouez@navilab.com
+ */
+#include "rsb2_test.h"
+#include "rsb2_module.h"
+#include "rsb2_tracering.h"
+
+#include <stdio.h>
+#include <string.h>
+
+enum {
+	RSB2_TEST_THREADS	= 2,			/* Tracing threads. */
+	RSB2_TEST_TRACES	= 200,			/* Traces of each thread. */
+	RSB2_TEST_FLOOD		= 1000,			/* Traces into a small ring. */
+};
+
+static int g_module = -1;				/* Module reference. */
+static pthread_mutex_t g_lock = PTHREAD_MUTEX_INITIALIZER;	/* Captures. */
+static int g_count = 0;					/* Traces received. */
+static char g_last[256];				/* Last trace received. */
+static int g_next[RSB2_TEST_THREADS];	/* Next trace expected by thread. */
+static bool g_disorder = false;			/* A thread trace out of order. */
+
+/* capture the traces of the test module */
+static void rsb2_test_traceringTracer(const char *func, const char *file,
+		int line, int ref, rsb2_TraceGroup group, const char *descr)
+{
+	(void)func;
+	(void)file;
+	(void)line;
+	(void)group;
+	if (ref == g_module) {
+		pthread_mutex_lock(&g_lock);
+		int thread;
+		int seq;
+		if (sscanf(descr, "thread=%d,seq=%d", &thread, &seq) == 2 &&
+				(unsigned)thread < RSB2_TEST_THREADS) {
+			g_disorder = g_disorder || seq != g_next[thread];
+			g_next[thread] = seq + 1;
+		}
+		g_count++;
+		snprintf(g_last, sizeof(g_last), "%s", descr);
+		pthread_mutex_unlock(&g_lock);
+	}
+}
+
+static int rsb2_test_traceringCount(void)
+{
+	pthread_mutex_lock(&g_lock);
+	int count = g_count;
+	pthread_mutex_unlock(&g_lock);
+	return count;
+}
+
+/* traces numbered in the order of the thread, then the thread exits */
+static void *rsb2_test_traceringThread(void *arg)
+{
+	int thread = (int)(long)arg;
+	for (int i = 0; i < RSB2_TEST_TRACES; i++) {
+		RSB2_TRACE(RSB2_TRACEGROUP_APPL, "thread=%d,seq=%d", thread, i);
+	}
+	return NULL;
+}
+
+static void *rsb2_test_traceringFlood(void *arg)
+{
+	(void)arg;
+	for (int i = 0; i < RSB2_TEST_FLOOD; i++) {
+		RSB2_TRACE(RSB2_TRACEGROUP_APPL, "flood=%d", i);
+	}
+	return NULL;
+}
+
+static void rsb2_test_traceringRun(void *(*fThread)(void *), int n)
+{
+	pthread_t threads[RSB2_TEST_THREADS];
+	int started = 0;
+	for (; started < n; started++) {
+		if (!RSB2_TEST_CHECK(!pthread_create(&threads[started], NULL,
+				fThread, (void *)(long)started))) {
+			break;
+		}
+	}
+	while (started-- > 0) {
+		pthread_join(threads[started], NULL);
+	}
+}
+
+/* arguments are copied when traced, formatted when drained */
+static void rsb2_test_traceringFormat(void)
+{
+	char str[16] = "before";
+	void *ptr = &str;
+	RSB2_TRACE(RSB2_TRACEGROUP_APPL, "int=%d,str=%s,ptr=%p,ull=%llu",
+			-42, str, ptr, 1ull << 40);
+	strcpy(str, "after");
+	RSB2_TEST_CHECK(rsb2_test_traceringCount() == 0);
+	rsb2_tracering_flush();
+	char expected[256];
+	snprintf(expected, sizeof(expected), "int=%d,str=%s,ptr=%p,ull=%llu",
+			-42, "before", ptr, 1ull << 40);
+	RSB2_TEST_CHECK(rsb2_test_traceringCount() == 1 &&
+			!strcmp(g_last, expected));
+	/* width from an argument: formatted by the caller, at once */
+	RSB2_TRACE(RSB2_TRACEGROUP_APPL, "width=%*d", 4, 7);
+	RSB2_TEST_CHECK(rsb2_test_traceringCount() == 2 &&
+			!strcmp(g_last, "width=   7"));
+}
+
+/* a full ring drops records, counted */
+static void rsb2_test_traceringDrop(void)
+{
+	if (RSB2_TEST_CHECK(!rsb2_tracering_start(4096, 1000))) {
+		uint64_t dropped = rsb2_tracering_dropped();
+		int count = rsb2_test_traceringCount();
+		rsb2_test_traceringRun(rsb2_test_traceringFlood, 1);
+		rsb2_tracering_flush();
+		dropped = rsb2_tracering_dropped() - dropped;
+		count = rsb2_test_traceringCount() - count;
+		RSB2_TEST_CHECK(dropped > 0 && count + dropped == RSB2_TEST_FLOOD);
+		rsb2_tracering_stop();
+	}
+}
+
+void rsb2_test_tracering(void)
+{
+	g_module = rsb2_module_ref("rsb2_test_tracering");
+	if (RSB2_TEST_CHECK(g_module >= 0)) {
+		rsb2_module_setModuleTracer(g_module, rsb2_test_traceringTracer);
+		rsb2_module_setTraceMask(g_module, 0xf);
+		if (RSB2_TEST_CHECK(!rsb2_tracering_start(0, 1000))) {
+			RSB2_TEST_CHECK(rsb2_tracering_start(0, 1000) == -1);
+			rsb2_test_traceringFormat();
+			/* per-thread order kept, rings of exited threads drained */
+			int count = rsb2_test_traceringCount();
+			rsb2_test_traceringRun(rsb2_test_traceringThread,
+					RSB2_TEST_THREADS);
+			rsb2_tracering_flush();
+			RSB2_TEST_CHECK(rsb2_test_traceringCount() ==
+					count + RSB2_TEST_THREADS * RSB2_TEST_TRACES);
+			for (int i = 0; i < RSB2_TEST_THREADS; i++) {
+				RSB2_TEST_CHECK(g_next[i] == RSB2_TEST_TRACES);
+			}
+			RSB2_TEST_CHECK(!g_disorder);
+			rsb2_tracering_stop();
+		}
+		rsb2_test_traceringDrop();
+		/* stopped: traces are formatted at once again */
+		int count = rsb2_test_traceringCount();
+		RSB2_TRACE(RSB2_TRACEGROUP_APPL, "stopped=%d", 1);
+		RSB2_TEST_CHECK(rsb2_test_traceringCount() == count + 1 &&
+				!strcmp(g_last, "stopped=1"));
+		rsb2_module_setTraceMask(g_module, 0);
+		rsb2_module_setModuleTracer(g_module, NULL);
+		rsb2_module_destroy(g_module);
+		g_module = -1;
+	}
+}
+
+/*END*/
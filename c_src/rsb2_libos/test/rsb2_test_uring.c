@@ -0,0 +1,71 @@
+/** Unit tests - io_uring engine.
+ * @file test/rsb2_test_uring.c
+ * @author jp.tranvouez@navilab.com
+ */
+#include "rsb2_test.h"
+#include "rsb2_uring.h"
+
+#include <stdio.h>
+#include <string.h>
+
+enum {
+	RSB2_TEST_CLIENTS	= 4,			/* Concurrent client threads. */
+	RSB2_TEST_CALLS		= 100,			/* Calls of each client. */
+};
+
+static char g_path[108];				/* Server socket path. */
+
+/* calls with a payload of their own, checked in the response */
+static void *rsb2_test_uringClient(void *arg)
+{
+	int client = (int)(long)arg;
+	for (int i = 0; i < RSB2_TEST_CALLS; i++) {
+		char msg[32];
+		char buf[32];
+		int msglen = snprintf(msg, sizeof(msg), "client%d.%d", client, i);
+		int n = rsb2_unixsock_rpc(g_path, msg, msglen, buf, sizeof(buf));
+		RSB2_TEST_CHECK(n == msglen && !memcmp(buf, msg, msglen));
+	}
+	return NULL;
+}
+
+void rsb2_test_uring(void)
+{
+	rsb2_Test_server server = { .fRecv = rsb2_test_echo };
+	if (!rsb2_uring_supported()) {
+		/* the engine cannot be selected, epoll stays */
+		RSB2_TEST_CHECK(rsb2_unixsock_setEngine(RSB2_UNIXSOCK_URING) == -1);
+		RSB2_TEST_CHECK(rsb2_unixsock_getEngine() == RSB2_UNIXSOCK_EPOLL);
+		printf("uring      not supported by the kernel, skipped\n");
+	} else if (RSB2_TEST_CHECK(!rsb2_unixsock_setEngine(RSB2_UNIXSOCK_URING)) &&
+			RSB2_TEST_CHECK(!rsb2_test_start(&server, "uring"))) {
+		/* server and clients on io_uring, pooled or not */
+		RSB2_TEST_CHECK(rsb2_unixsock_getEngine() == RSB2_UNIXSOCK_URING);
+		memcpy(g_path, server.path, sizeof(g_path));
+		for (int pool = 0; pool <= RSB2_TEST_CLIENTS;
+				pool += RSB2_TEST_CLIENTS) {
+			RSB2_TEST_CHECK(!rsb2_unixsock_setPoolSize(g_path, pool));
+			pthread_t threads[RSB2_TEST_CLIENTS];
+			int n = 0;
+			for (; n < RSB2_TEST_CLIENTS; n++) {
+				if (!RSB2_TEST_CHECK(!pthread_create(&threads[n], NULL,
+						rsb2_test_uringClient, (void *)(long)n))) {
+					break;
+				}
+			}
+			while (n-- > 0) {
+				pthread_join(threads[n], NULL);
+			}
+		}
+		/* a response longer than the buffer is truncated */
+		char buf[4];
+		RSB2_TEST_CHECK(rsb2_unixsock_rpc(g_path, "abcdefgh", 8,
+				buf, sizeof(buf)) == sizeof(buf) && !memcmp(buf, "abcd", 4));
+		rsb2_unixsock_setPoolSize(g_path, 0);
+		rsb2_test_stop(&server);
+		RSB2_TEST_CHECK(!server.err);
+	}
+	rsb2_unixsock_setEngine(RSB2_UNIXSOCK_EPOLL);
+}
+
+/*END*/